@@ -0,0 +1,231 @@
+#include "bcdecodevk.h"
+#include "dbg.h"
+#include "tier1/utlvector.h"
+#include "vstdlib/jobthread.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+// Rows of blocks decoded per job, and the image height below which
+// decoding inline is cheaper than waking up the thread pool.
+//-----------------------------------------------------------------------------
+#define BC_BLOCK_ROWS_PER_JOB 16
+#define BC_PARALLEL_MIN_HEIGHT 256
+
+struct BCDecodeJob_t
+{
+    const unsigned char *m_pSrc;
+    unsigned char *m_pDst;
+    ImageFormat m_Format;
+    int m_nWidth;
+    int m_nHeight;
+    int m_nDstStride;
+    int m_nFirstBlockRow;
+    int m_nBlockRowCount;
+};
+
+static inline int BlockSize(ImageFormat format)
+{
+    return (format == IMAGE_FORMAT_DXT1 || format == IMAGE_FORMAT_DXT1_ONEBITALPHA) ? 8 : 16;
+}
+
+static inline void Unpack565(unsigned short c, unsigned char *pRGB)
+{
+    int r = (c >> 11) & 0x1F;
+    int g = (c >> 5) & 0x3F;
+    int b = c & 0x1F;
+    pRGB[0] = (unsigned char)((r << 3) | (r >> 2));
+    pRGB[1] = (unsigned char)((g << 2) | (g >> 4));
+    pRGB[2] = (unsigned char)((b << 3) | (b >> 2));
+}
+
+//-----------------------------------------------------------------------------
+// Color endpoints + 2 bit indices, shared by all three formats.
+// DXT3/DXT5 always use the 4 color mode.
+//-----------------------------------------------------------------------------
+static void DecodeColorBlock(const unsigned char *pBlock, unsigned char pTexels[16][4], bool bForceFourColor, bool bOneBitAlpha)
+{
+    unsigned short c0 = pBlock[0] | (pBlock[1] << 8);
+    unsigned short c1 = pBlock[2] | (pBlock[3] << 8);
+
+    unsigned char palette[4][4];
+    Unpack565(c0, palette[0]);
+    Unpack565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = 255;
+
+    if (bForceFourColor || c0 > c1)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            palette[2][i] = (unsigned char)((2 * palette[0][i] + palette[1][i]) / 3);
+            palette[3][i] = (unsigned char)((palette[0][i] + 2 * palette[1][i]) / 3);
+        }
+        palette[2][3] = palette[3][3] = 255;
+    }
+    else
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            palette[2][i] = (unsigned char)((palette[0][i] + palette[1][i]) / 2);
+            palette[3][i] = 0;
+        }
+        palette[2][3] = 255;
+        palette[3][3] = bOneBitAlpha ? 0 : 255;
+    }
+
+    unsigned int indices = pBlock[4] | (pBlock[5] << 8) | (pBlock[6] << 16) | ((unsigned int)pBlock[7] << 24);
+    for (int i = 0; i < 16; i++)
+    {
+        const unsigned char *pColor = palette[(indices >> (2 * i)) & 3];
+        pTexels[i][0] = pColor[0];
+        pTexels[i][1] = pColor[1];
+        pTexels[i][2] = pColor[2];
+        pTexels[i][3] = pColor[3];
+    }
+}
+
+// DXT3: explicit 4 bit alpha
+static void DecodeExplicitAlphaBlock(const unsigned char *pBlock, unsigned char pTexels[16][4])
+{
+    for (int i = 0; i < 8; i++)
+    {
+        pTexels[2 * i + 0][3] = (unsigned char)((pBlock[i] & 0x0F) * 17);
+        pTexels[2 * i + 1][3] = (unsigned char)((pBlock[i] >> 4) * 17);
+    }
+}
+
+// DXT5: two alpha endpoints + 3 bit indices
+static void DecodeInterpolatedAlphaBlock(const unsigned char *pBlock, unsigned char pTexels[16][4])
+{
+    int a0 = pBlock[0];
+    int a1 = pBlock[1];
+
+    unsigned char palette[8];
+    palette[0] = (unsigned char)a0;
+    palette[1] = (unsigned char)a1;
+    if (a0 > a1)
+    {
+        for (int i = 1; i < 7; i++)
+        {
+            palette[i + 1] = (unsigned char)(((7 - i) * a0 + i * a1) / 7);
+        }
+    }
+    else
+    {
+        for (int i = 1; i < 5; i++)
+        {
+            palette[i + 1] = (unsigned char)(((5 - i) * a0 + i * a1) / 5);
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    uint64 indices = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        indices |= (uint64)pBlock[2 + i] << (8 * i);
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        pTexels[i][3] = palette[(indices >> (3 * i)) & 7];
+    }
+}
+
+static void DecodeBlockRows(BCDecodeJob_t &job)
+{
+    const int nBlockSize = BlockSize(job.m_Format);
+    const int nBlocksWide = (job.m_nWidth + 3) / 4;
+    const bool bOneBitAlpha = (job.m_Format == IMAGE_FORMAT_DXT1_ONEBITALPHA);
+    const bool bFourColor = (job.m_Format == IMAGE_FORMAT_DXT3 || job.m_Format == IMAGE_FORMAT_DXT5);
+
+    unsigned char texels[16][4];
+    for (int by = job.m_nFirstBlockRow; by < job.m_nFirstBlockRow + job.m_nBlockRowCount; by++)
+    {
+        const unsigned char *pBlock = job.m_pSrc + by * nBlocksWide * nBlockSize;
+        for (int bx = 0; bx < nBlocksWide; bx++, pBlock += nBlockSize)
+        {
+            switch (job.m_Format)
+            {
+            case IMAGE_FORMAT_DXT3:
+                DecodeColorBlock(pBlock + 8, texels, bFourColor, false);
+                DecodeExplicitAlphaBlock(pBlock, texels);
+                break;
+
+            case IMAGE_FORMAT_DXT5:
+                DecodeColorBlock(pBlock + 8, texels, bFourColor, false);
+                DecodeInterpolatedAlphaBlock(pBlock, texels);
+                break;
+
+            default:
+                DecodeColorBlock(pBlock, texels, false, bOneBitAlpha);
+                break;
+            }
+
+            // Clip blocks hanging off the right and bottom edges
+            int nRows = MIN(4, job.m_nHeight - by * 4);
+            int nCols = MIN(4, job.m_nWidth - bx * 4);
+            for (int y = 0; y < nRows; y++)
+            {
+                unsigned char *pDst = job.m_pDst + (by * 4 + y) * job.m_nDstStride + bx * 16;
+                memcpy(pDst, texels[y * 4], nCols * 4);
+            }
+        }
+    }
+}
+
+bool IsBCDecodeSupported(ImageFormat srcFormat)
+{
+    switch (srcFormat)
+    {
+    case IMAGE_FORMAT_DXT1:
+    case IMAGE_FORMAT_DXT1_ONEBITALPHA:
+    case IMAGE_FORMAT_DXT3:
+    case IMAGE_FORMAT_DXT5:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool DecodeBCImage(const unsigned char *pSrc, ImageFormat srcFormat, unsigned char *pDst, int nWidth, int nHeight, int nDstStride)
+{
+    if (!IsBCDecodeSupported(srcFormat))
+    {
+        Warning("DecodeBCImage: unsupported format %s\n", ImageLoader::GetName(srcFormat));
+        return false;
+    }
+
+    if (nDstStride == 0)
+    {
+        nDstStride = nWidth * 4;
+    }
+
+    BCDecodeJob_t job;
+    job.m_pSrc = pSrc;
+    job.m_pDst = pDst;
+    job.m_Format = srcFormat;
+    job.m_nWidth = nWidth;
+    job.m_nHeight = nHeight;
+    job.m_nDstStride = nDstStride;
+    job.m_nFirstBlockRow = 0;
+    job.m_nBlockRowCount = (nHeight + 3) / 4;
+
+    if (nHeight < BC_PARALLEL_MIN_HEIGHT || !g_pThreadPool)
+    {
+        DecodeBlockRows(job);
+        return true;
+    }
+
+    CUtlVector<BCDecodeJob_t> jobs;
+    for (int nRow = 0; nRow < job.m_nBlockRowCount; nRow += BC_BLOCK_ROWS_PER_JOB)
+    {
+        int i = jobs.AddToTail(job);
+        jobs[i].m_nFirstBlockRow = nRow;
+        jobs[i].m_nBlockRowCount = MIN(BC_BLOCK_ROWS_PER_JOB, job.m_nBlockRowCount - nRow);
+    }
+
+    ParallelProcess("DecodeBCImage", jobs.Base(), jobs.Count(), &DecodeBlockRows);
+    return true;
+}
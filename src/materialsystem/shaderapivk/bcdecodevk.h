@@ -0,0 +1,22 @@
+//
+
+#ifndef BCDECODEVK_H
+#define BCDECODEVK_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "bitmap/imageformat.h"
+
+//-----------------------------------------------------------------------------
+// CPU fallback for devices without textureCompressionBC.
+// Decodes DXT1/DXT3/DXT5 (BC1/BC2/BC3) data to RGBA8888.
+// Large images are split into rows of 4x4 blocks and decoded on the thread pool.
+//-----------------------------------------------------------------------------
+bool IsBCDecodeSupported(ImageFormat srcFormat);
+
+// nDstStride is in bytes, 0 means width * 4
+bool DecodeBCImage(const unsigned char *pSrc, ImageFormat srcFormat, unsigned char *pDst, int nWidth, int nHeight, int nDstStride = 0);
+
+#endif // BCDECODEVK_H
@@ -0,0 +1,169 @@
+#include "bindlessvk.h"
+#include "shaderdevicevk.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+enum
+{
+    BINDING_TEXTURES = 0,
+    BINDING_SAMPLERS = 1,
+};
+
+CBindlessTexturesVk::CBindlessTexturesVk()
+{
+    m_DescriptorSetLayout = VK_NULL_HANDLE;
+    m_DescriptorPool = VK_NULL_HANDLE;
+    m_DescriptorSet = VK_NULL_HANDLE;
+    m_nMaxTextures = 0;
+    m_nMaxSamplers = 0;
+    m_nNextTextureSlot = BINDLESS_TEXTURE_NONE + 1;
+}
+
+CBindlessTexturesVk::~CBindlessTexturesVk() { Assert(!IsInitialized()); }
+
+void CBindlessTexturesVk::Init(uint32_t nMaxTextures, uint32_t nMaxSamplers)
+{
+    m_nMaxTextures = MIN(nMaxTextures, (uint32_t)BINDLESS_TEXTURE_MASK + 1);
+    m_nMaxSamplers = MIN(nMaxSamplers, 1u << BINDLESS_SAMPLER_BITS);
+    m_nNextTextureSlot = BINDLESS_TEXTURE_NONE + 1;
+
+    VkDescriptorSetLayoutBinding bindings[2] = {};
+    bindings[BINDING_TEXTURES].binding = BINDING_TEXTURES;
+    bindings[BINDING_TEXTURES].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[BINDING_TEXTURES].descriptorCount = m_nMaxTextures;
+    bindings[BINDING_TEXTURES].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[BINDING_SAMPLERS].binding = BINDING_SAMPLERS;
+    bindings[BINDING_SAMPLERS].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    bindings[BINDING_SAMPLERS].descriptorCount = m_nMaxSamplers;
+    bindings[BINDING_SAMPLERS].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    // Slots get written while frames using other slots are in flight, and most slots are empty
+    VkDescriptorBindingFlags bindingFlags[2];
+    bindingFlags[BINDING_TEXTURES] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+                                     VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+    bindingFlags[BINDING_SAMPLERS] = bindingFlags[BINDING_TEXTURES];
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = ARRAYSIZE(bindingFlags);
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = ARRAYSIZE(bindings);
+    layoutInfo.pBindings = bindings;
+    vkCheck(vkCreateDescriptorSetLayout(g_pShaderDevice->GetVkDevice(), &layoutInfo, g_pAllocCallbacks, &m_DescriptorSetLayout),
+            "failed to create bindless descriptor set layout");
+
+    VkDescriptorPoolSize poolSizes[2] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    poolSizes[0].descriptorCount = m_nMaxTextures;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+    poolSizes[1].descriptorCount = m_nMaxSamplers;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.poolSizeCount = ARRAYSIZE(poolSizes);
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = 1;
+    vkCheck(vkCreateDescriptorPool(g_pShaderDevice->GetVkDevice(), &poolInfo, g_pAllocCallbacks, &m_DescriptorPool),
+            "failed to create bindless descriptor pool");
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_DescriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_DescriptorSetLayout;
+    vkCheck(vkAllocateDescriptorSets(g_pShaderDevice->GetVkDevice(), &allocInfo, &m_DescriptorSet),
+            "failed to allocate bindless descriptor set");
+}
+
+void CBindlessTexturesVk::Shutdown()
+{
+    if (!IsInitialized())
+        return;
+
+    // Frees the set as well
+    vkDestroyDescriptorPool(g_pShaderDevice->GetVkDevice(), m_DescriptorPool, g_pAllocCallbacks);
+    vkDestroyDescriptorSetLayout(g_pShaderDevice->GetVkDevice(), m_DescriptorSetLayout, g_pAllocCallbacks);
+
+    m_DescriptorPool = VK_NULL_HANDLE;
+    m_DescriptorSetLayout = VK_NULL_HANDLE;
+    m_DescriptorSet = VK_NULL_HANDLE;
+    m_FreeTextureSlots.RemoveAll();
+}
+
+uint32_t CBindlessTexturesVk::AllocTextureSlot(VkImageView imageView, VkImageLayout layout)
+{
+    if (!IsInitialized())
+        return BINDLESS_TEXTURE_NONE;
+
+    uint32_t nSlot;
+    if (m_FreeTextureSlots.Count() > 0)
+    {
+        nSlot = m_FreeTextureSlots.Tail();
+        m_FreeTextureSlots.RemoveMultipleFromTail(1);
+    }
+    else if (m_nNextTextureSlot < m_nMaxTextures)
+    {
+        nSlot = m_nNextTextureSlot++;
+    }
+    else
+    {
+        Warning("CBindlessTexturesVk: out of texture slots (%u)\n", m_nMaxTextures);
+        return BINDLESS_TEXTURE_NONE;
+    }
+
+    WriteTexture(nSlot, imageView, layout);
+    return nSlot;
+}
+
+void CBindlessTexturesVk::FreeTextureSlot(uint32_t nSlot)
+{
+    if (!IsInitialized() || nSlot == BINDLESS_TEXTURE_NONE)
+        return;
+
+    // Textures free their slot through the deletion queue, so no frame in flight samples it anymore
+    Assert(nSlot < m_nNextTextureSlot);
+    m_FreeTextureSlots.AddToTail(nSlot);
+}
+
+void CBindlessTexturesVk::SetSampler(int nIndex, VkSampler sampler)
+{
+    if (!IsInitialized() || (uint32_t)nIndex >= m_nMaxSamplers)
+        return;
+
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.sampler = sampler;
+
+    VkWriteDescriptorSet descriptorWrite = {};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = m_DescriptorSet;
+    descriptorWrite.dstBinding = BINDING_SAMPLERS;
+    descriptorWrite.dstArrayElement = nIndex;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(g_pShaderDevice->GetVkDevice(), 1, &descriptorWrite, 0, nullptr);
+}
+
+void CBindlessTexturesVk::WriteTexture(uint32_t nSlot, VkImageView imageView, VkImageLayout layout)
+{
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.imageView = imageView;
+    imageInfo.imageLayout = layout;
+
+    VkWriteDescriptorSet descriptorWrite = {};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = m_DescriptorSet;
+    descriptorWrite.dstBinding = BINDING_TEXTURES;
+    descriptorWrite.dstArrayElement = nSlot;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(g_pShaderDevice->GetVkDevice(), 1, &descriptorWrite, 0, nullptr);
+}
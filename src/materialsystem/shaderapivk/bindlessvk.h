@@ -0,0 +1,91 @@
+//
+
+#ifndef BINDLESSVK_H
+#define BINDLESSVK_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "localvktypes.h"
+#include "tier1/utlvector.h"
+#include "vulkanimpl.h"
+
+//-----------------------------------------------------------------------------
+// A bound sampler stage as seen by shaders, the texture's slot in the bindless
+// image array in the low bits and the sampler cache index in the high bits.
+// See shaders/bindless.glsl.
+//-----------------------------------------------------------------------------
+enum
+{
+    BINDLESS_TEXTURE_BITS = 20,
+    BINDLESS_TEXTURE_MASK = (1 << BINDLESS_TEXTURE_BITS) - 1,
+    BINDLESS_SAMPLER_BITS = 32 - BINDLESS_TEXTURE_BITS,
+
+    // Slot 0 is never handed out, unbound stages point at it
+    BINDLESS_TEXTURE_NONE = 0,
+
+    // Per-stage descriptors kept free for the rest of the pipeline layout
+    BINDLESS_RESERVED_DESCRIPTORS = 16,
+
+    // Devices with smaller update-after-bind limits don't use bindless textures
+    BINDLESS_MIN_TEXTURES = 4096,
+    BINDLESS_MIN_SAMPLERS = 64,
+};
+
+inline uint32_t PackBindlessIndex(uint32_t nTextureSlot, uint32_t nSamplerIndex)
+{
+    Assert(nTextureSlot <= BINDLESS_TEXTURE_MASK && nSamplerIndex < (1u << BINDLESS_SAMPLER_BITS));
+    return nTextureSlot | (nSamplerIndex << BINDLESS_TEXTURE_BITS);
+}
+
+// Pushed once per draw, 64 bytes out of the guaranteed 128
+struct BindlessPushConstants_t
+{
+    uint32_t m_nTextures[MAX_SAMPLERS];
+
+    BindlessPushConstants_t() { memset(this, 0, sizeof(*this)); }
+    bool operator==(const BindlessPushConstants_t &other) const { return memcmp(this, &other, sizeof(*this)) == 0; }
+    bool operator!=(const BindlessPushConstants_t &other) const { return !(*this == other); }
+};
+
+//-----------------------------------------------------------------------------
+// One descriptor set holding every resident texture in a single update-after-bind
+// sampled image array, plus every cached sampler in a sampler array.
+// It is bound once per render pass, draws only push the indices they use.
+//-----------------------------------------------------------------------------
+class CBindlessTexturesVk
+{
+  public:
+    CBindlessTexturesVk();
+    ~CBindlessTexturesVk();
+
+    void Init(uint32_t nMaxTextures, uint32_t nMaxSamplers);
+    void Shutdown();
+
+    bool IsInitialized() const { return m_DescriptorSet != VK_NULL_HANDLE; }
+
+    // Returns BINDLESS_TEXTURE_NONE when the array is full
+    uint32_t AllocTextureSlot(VkImageView imageView, VkImageLayout layout);
+    void FreeTextureSlot(uint32_t nSlot);
+
+    // Sampler cache indices map 1:1 to array elements
+    void SetSampler(int nIndex, VkSampler sampler);
+    uint32_t GetMaxSamplers() const { return m_nMaxSamplers; }
+
+    VkDescriptorSetLayout GetDescriptorSetLayout() const { return m_DescriptorSetLayout; }
+    VkDescriptorSet GetDescriptorSet() const { return m_DescriptorSet; }
+
+  private:
+    void WriteTexture(uint32_t nSlot, VkImageView imageView, VkImageLayout layout);
+
+    VkDescriptorSetLayout m_DescriptorSetLayout;
+    VkDescriptorPool m_DescriptorPool;
+    VkDescriptorSet m_DescriptorSet;
+    uint32_t m_nMaxTextures;
+    uint32_t m_nMaxSamplers;
+    uint32_t m_nNextTextureSlot;
+    CUtlVector<uint32_t> m_FreeTextureSlots;
+};
+
+#endif // BINDLESSVK_H
@@ -0,0 +1,96 @@
+#include "deletionqueuevk.h"
+#include "shaderdevicevk.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CDeletionQueueVk::CDeletionQueueVk()
+{
+    m_nHead = 0;
+
+    // Serial 0 is never submitted
+    m_nNextSerial = 1;
+}
+
+void CDeletionQueueVk::Enqueue(DeferredDeleteType_t type, uint64_t handle)
+{
+    // Slot 0 and the start of block 0 are valid, everything else is a null handle
+    if (handle == 0 && type != DEFERRED_DELETE_BINDLESS_SLOT && type != DEFERRED_DELETE_GEOMETRY_RANGE)
+        return;
+
+    // Went away with the device
+    if (!g_pShaderDevice->GetVkDevice())
+        return;
+
+    Entry_t &entry = m_Entries[m_Entries.AddToTail()];
+    entry.m_nSerial = m_nNextSerial;
+    entry.m_Type = type;
+    entry.m_Handle = handle;
+}
+
+void CDeletionQueueVk::OnCompleted(uint64_t nSerial)
+{
+    while (m_nHead < m_Entries.Count() && m_Entries[m_nHead].m_nSerial <= nSerial)
+    {
+        Release(m_Entries[m_nHead]);
+        m_nHead++;
+    }
+
+    // Compact once the released part dominates
+    if (m_nHead > 0 && m_nHead * 2 >= m_Entries.Count())
+    {
+        m_Entries.RemoveMultipleFromHead(m_nHead);
+        m_nHead = 0;
+    }
+}
+
+void CDeletionQueueVk::Flush()
+{
+    for (int i = m_nHead; i < m_Entries.Count(); i++)
+    {
+        Release(m_Entries[i]);
+    }
+    m_Entries.RemoveAll();
+    m_nHead = 0;
+}
+
+void CDeletionQueueVk::Release(const Entry_t &entry)
+{
+    VkDevice device = g_pShaderDevice->GetVkDevice();
+    switch (entry.m_Type)
+    {
+    case DEFERRED_DELETE_SHADER_MODULE:
+        vkDestroyShaderModule(device, (VkShaderModule)entry.m_Handle, g_pAllocCallbacks);
+        break;
+    case DEFERRED_DELETE_PIPELINE:
+        vkDestroyPipeline(device, (VkPipeline)entry.m_Handle, g_pAllocCallbacks);
+        break;
+    case DEFERRED_DELETE_BUFFER:
+        vkDestroyBuffer(device, (VkBuffer)entry.m_Handle, g_pAllocCallbacks);
+        break;
+    case DEFERRED_DELETE_MEMORY:
+        vkFreeMemory(device, (VkDeviceMemory)entry.m_Handle, g_pAllocCallbacks);
+        break;
+    case DEFERRED_DELETE_IMAGE:
+        vkDestroyImage(device, (VkImage)entry.m_Handle, g_pAllocCallbacks);
+        break;
+    case DEFERRED_DELETE_IMAGE_VIEW:
+        vkDestroyImageView(device, (VkImageView)entry.m_Handle, g_pAllocCallbacks);
+        break;
+    case DEFERRED_DELETE_FRAMEBUFFER:
+        vkDestroyFramebuffer(device, (VkFramebuffer)entry.m_Handle, g_pAllocCallbacks);
+        break;
+    case DEFERRED_DELETE_DESCRIPTOR_POOL:
+        vkDestroyDescriptorPool(device, (VkDescriptorPool)entry.m_Handle, g_pAllocCallbacks);
+        break;
+    case DEFERRED_DELETE_BINDLESS_SLOT:
+        g_pShaderDevice->GetBindlessTextures().FreeTextureSlot((uint32_t)entry.m_Handle);
+        break;
+    case DEFERRED_DELETE_GEOMETRY_RANGE:
+        g_pShaderDevice->GetGeometryArena().ReleaseRange(entry.m_Handle);
+        break;
+    default:
+        Assert(0);
+        break;
+    }
+}
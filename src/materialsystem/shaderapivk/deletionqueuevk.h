@@ -0,0 +1,83 @@
+//
+
+#ifndef DELETIONQUEUEVK_H
+#define DELETIONQUEUEVK_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlvector.h"
+#include "vulkanimpl.h"
+
+//-----------------------------------------------------------------------------
+// What a deferred destroy releases
+//-----------------------------------------------------------------------------
+enum DeferredDeleteType_t
+{
+    DEFERRED_DELETE_SHADER_MODULE = 0,
+    DEFERRED_DELETE_PIPELINE,
+    DEFERRED_DELETE_BUFFER,
+    DEFERRED_DELETE_MEMORY,
+    DEFERRED_DELETE_IMAGE,
+    DEFERRED_DELETE_IMAGE_VIEW,
+    DEFERRED_DELETE_FRAMEBUFFER,
+    DEFERRED_DELETE_DESCRIPTOR_POOL,
+    DEFERRED_DELETE_BINDLESS_SLOT,  // Handle is the slot index, see CBindlessTexturesVk
+    DEFERRED_DELETE_GEOMETRY_RANGE, // Handle is the block index and offset, see CGeometryArenaVk
+};
+
+//-----------------------------------------------------------------------------
+// Holds on to destroyed objects until every frame that may still use them is done.
+// Objects are stamped with the serial of the next frame submit and released once
+// the fence of that submit has been waited on, so no destroy path needs a device wait.
+//-----------------------------------------------------------------------------
+class CDeletionQueueVk
+{
+  public:
+    CDeletionQueueVk();
+
+    // A frame is about to be submitted, returns the serial it completes
+    uint64_t OnSubmit() { return m_nNextSerial++; }
+
+    // The fence of the submit with this serial was waited on, releases everything it could have used
+    void OnCompleted(uint64_t nSerial);
+
+    // The queue went idle, releases everything queued before the last submit
+    void OnIdle() { OnCompleted(m_nNextSerial - 1); }
+
+    // Device is idle and about to be destroyed
+    void Flush();
+
+    void Enqueue(DeferredDeleteType_t type, uint64_t handle);
+
+    void DestroyShaderModule(VkShaderModule shaderModule) { Enqueue(DEFERRED_DELETE_SHADER_MODULE, (uint64_t)shaderModule); }
+    void DestroyPipeline(VkPipeline pipeline) { Enqueue(DEFERRED_DELETE_PIPELINE, (uint64_t)pipeline); }
+    void DestroyBuffer(VkBuffer buffer) { Enqueue(DEFERRED_DELETE_BUFFER, (uint64_t)buffer); }
+    void FreeMemory(VkDeviceMemory memory) { Enqueue(DEFERRED_DELETE_MEMORY, (uint64_t)memory); }
+    void DestroyImage(VkImage image) { Enqueue(DEFERRED_DELETE_IMAGE, (uint64_t)image); }
+    void DestroyImageView(VkImageView imageView) { Enqueue(DEFERRED_DELETE_IMAGE_VIEW, (uint64_t)imageView); }
+    void DestroyFramebuffer(VkFramebuffer framebuffer) { Enqueue(DEFERRED_DELETE_FRAMEBUFFER, (uint64_t)framebuffer); }
+    void DestroyDescriptorPool(VkDescriptorPool pool) { Enqueue(DEFERRED_DELETE_DESCRIPTOR_POOL, (uint64_t)pool); }
+    void FreeBindlessSlot(uint32_t nSlot) { Enqueue(DEFERRED_DELETE_BINDLESS_SLOT, nSlot); }
+    void FreeGeometryRange(uint64_t handle) { Enqueue(DEFERRED_DELETE_GEOMETRY_RANGE, handle); }
+
+    int GetPendingCount() const { return m_Entries.Count() - m_nHead; }
+
+  private:
+    struct Entry_t
+    {
+        uint64_t m_nSerial;
+        DeferredDeleteType_t m_Type;
+        uint64_t m_Handle;
+    };
+
+    void Release(const Entry_t &entry);
+
+    // Serials only grow, so entries are sorted and released from the head
+    CUtlVector<Entry_t> m_Entries;
+    int m_nHead;
+    uint64_t m_nNextSerial;
+};
+
+#endif // DELETIONQUEUEVK_H
@@ -0,0 +1,297 @@
+#include "geometryarenavk.h"
+#include "buffervkutil.h"
+#include "shaderdevicevk.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Deletion queue handles are the block index above the offset
+static const int GEOMETRY_RANGE_OFFSET_BITS = 40;
+
+CGeometryArenaVk::CGeometryArenaVk() {}
+
+CGeometryArenaVk::~CGeometryArenaVk() { Assert(m_Blocks.Count() == 0); }
+
+void CGeometryArenaVk::Shutdown()
+{
+    // The device is idle, nothing can be reading from the blocks anymore
+    VkDevice device = g_pShaderDevice->GetVkDevice();
+    for (int i = 0; i < m_Blocks.Count(); i++)
+    {
+        if (!m_Blocks[i])
+            continue;
+
+        vkDestroyBuffer(device, m_Blocks[i]->m_Buffer, g_pAllocCallbacks);
+        vkFreeMemory(device, m_Blocks[i]->m_Memory, g_pAllocCallbacks);
+        delete m_Blocks[i];
+    }
+    m_Blocks.RemoveAll();
+}
+
+bool CGeometryArenaVk::Alloc(VkDeviceSize nSize, IGeometryArenaClientVk *pClient, GeometryRangeVk_t &range)
+{
+    Assert(!range.IsValid());
+    if (nSize == 0 || nSize > GEOMETRY_ARENA_MAX_ALLOC)
+        return false;
+
+    // First fit from the front, so live ranges gather in the oldest blocks
+    for (int i = 0; i < m_Blocks.Count(); i++)
+    {
+        if (AllocFromBlock(i, nSize, pClient, range))
+            return true;
+    }
+
+    return AllocFromBlock(CreateBlock(), nSize, pClient, range);
+}
+
+bool CGeometryArenaVk::AllocFromBlock(int nBlock, VkDeviceSize nSize, IGeometryArenaClientVk *pClient, GeometryRangeVk_t &range)
+{
+    Block_t *pBlock = m_Blocks[nBlock];
+    if (!pBlock)
+        return false;
+
+    nSize = AlignValue(nSize, GEOMETRY_ARENA_ALIGNMENT);
+    for (int i = 0; i < pBlock->m_FreeRanges.Count(); i++)
+    {
+        FreeRange_t &freeRange = pBlock->m_FreeRanges[i];
+        if (freeRange.m_nSize < nSize)
+            continue;
+
+        range.m_nBlock = nBlock;
+        range.m_nOffset = freeRange.m_nOffset;
+        range.m_nSize = nSize;
+
+        freeRange.m_nOffset += nSize;
+        freeRange.m_nSize -= nSize;
+        if (freeRange.m_nSize == 0)
+        {
+            pBlock->m_FreeRanges.Remove(i);
+        }
+
+        Allocation_t allocation;
+        allocation.m_nSize = nSize;
+        allocation.m_pClient = pClient;
+        pBlock->m_Allocations.Insert(range.m_nOffset, allocation);
+        pBlock->m_nUsed += nSize;
+        return true;
+    }
+
+    return false;
+}
+
+void CGeometryArenaVk::Free(GeometryRangeVk_t &range)
+{
+    if (!range.IsValid())
+        return;
+
+    Block_t *pBlock = m_Blocks.IsValidIndex(range.m_nBlock) ? m_Blocks[range.m_nBlock] : NULL;
+    if (pBlock)
+    {
+        // Compaction leaves it alone from now on
+        CUtlMap<VkDeviceSize, Allocation_t>::IndexType_t i = pBlock->m_Allocations.Find(range.m_nOffset);
+        Assert(pBlock->m_Allocations.IsValidIndex(i));
+        if (pBlock->m_Allocations.IsValidIndex(i))
+        {
+            pBlock->m_Allocations[i].m_pClient = NULL;
+        }
+
+        g_pShaderDevice->GetDeletionQueue().FreeGeometryRange(((uint64_t)range.m_nBlock << GEOMETRY_RANGE_OFFSET_BITS) | range.m_nOffset);
+    }
+
+    range = GeometryRangeVk_t();
+}
+
+void CGeometryArenaVk::Reallocate(GeometryRangeVk_t &range)
+{
+    Block_t *pBlock = m_Blocks[range.m_nBlock];
+    CUtlMap<VkDeviceSize, Allocation_t>::IndexType_t i = pBlock->m_Allocations.Find(range.m_nOffset);
+    Assert(pBlock->m_Allocations.IsValidIndex(i));
+
+    // Keeps writing in place if there's no room, which may show up in a frame in flight
+    GeometryRangeVk_t dst;
+    if (!Alloc(range.m_nSize, pBlock->m_Allocations[i].m_pClient, dst))
+        return;
+
+    memcpy(GetMemory(dst), GetMemory(range), (size_t)range.m_nSize);
+    Free(range);
+    range = dst;
+}
+
+void CGeometryArenaVk::ReleaseRange(uint64_t handle)
+{
+    int nBlock = (int)(handle >> GEOMETRY_RANGE_OFFSET_BITS);
+    VkDeviceSize nOffset = handle & ((1ull << GEOMETRY_RANGE_OFFSET_BITS) - 1);
+    Block_t *pBlock = m_Blocks.IsValidIndex(nBlock) ? m_Blocks[nBlock] : NULL;
+    if (!pBlock)
+        return;
+
+    CUtlMap<VkDeviceSize, Allocation_t>::IndexType_t i = pBlock->m_Allocations.Find(nOffset);
+    if (!pBlock->m_Allocations.IsValidIndex(i))
+    {
+        Assert(0);
+        return;
+    }
+
+    VkDeviceSize nSize = pBlock->m_Allocations[i].m_nSize;
+    pBlock->m_Allocations.RemoveAt(i);
+    pBlock->m_nUsed -= nSize;
+
+    // Keep the free list sorted and merge with the neighbours
+    int nInsert = 0;
+    while (nInsert < pBlock->m_FreeRanges.Count() && pBlock->m_FreeRanges[nInsert].m_nOffset < nOffset)
+    {
+        nInsert++;
+    }
+
+    FreeRange_t freeRange;
+    freeRange.m_nOffset = nOffset;
+    freeRange.m_nSize = nSize;
+    pBlock->m_FreeRanges.InsertBefore(nInsert, freeRange);
+
+    if (nInsert + 1 < pBlock->m_FreeRanges.Count())
+    {
+        FreeRange_t &next = pBlock->m_FreeRanges[nInsert + 1];
+        if (nOffset + nSize == next.m_nOffset)
+        {
+            pBlock->m_FreeRanges[nInsert].m_nSize += next.m_nSize;
+            pBlock->m_FreeRanges.Remove(nInsert + 1);
+        }
+    }
+    if (nInsert > 0)
+    {
+        FreeRange_t &prev = pBlock->m_FreeRanges[nInsert - 1];
+        if (prev.m_nOffset + prev.m_nSize == nOffset)
+        {
+            prev.m_nSize += pBlock->m_FreeRanges[nInsert].m_nSize;
+            pBlock->m_FreeRanges.Remove(nInsert);
+        }
+    }
+
+    if (pBlock->m_nUsed > 0)
+        return;
+
+    // Empty blocks go away unless they are the last one
+    for (int j = 0; j < m_Blocks.Count(); j++)
+    {
+        if (j != nBlock && m_Blocks[j])
+        {
+            DestroyBlock(nBlock);
+            return;
+        }
+    }
+}
+
+VkBuffer *CGeometryArenaVk::GetVkBuffer(const GeometryRangeVk_t &range)
+{
+    Assert(range.IsValid() && m_Blocks[range.m_nBlock]);
+    return &m_Blocks[range.m_nBlock]->m_Buffer;
+}
+
+unsigned char *CGeometryArenaVk::GetMemory(const GeometryRangeVk_t &range)
+{
+    Assert(range.IsValid() && m_Blocks[range.m_nBlock]);
+    return m_Blocks[range.m_nBlock]->m_pMemory + range.m_nOffset;
+}
+
+void CGeometryArenaVk::Compact()
+{
+    // Only blocks under a quarter full are worth emptying
+    int nSource = -1;
+    int nLiveBlocks = 0;
+    for (int i = 0; i < m_Blocks.Count(); i++)
+    {
+        if (!m_Blocks[i])
+            continue;
+
+        nLiveBlocks++;
+        if (m_Blocks[i]->m_nUsed < GEOMETRY_ARENA_BLOCK_SIZE / 4 && (nSource == -1 || m_Blocks[i]->m_nUsed < m_Blocks[nSource]->m_nUsed))
+        {
+            nSource = i;
+        }
+    }
+    if (nLiveBlocks < 2 || nSource == -1)
+        return;
+
+    Block_t *pSource = m_Blocks[nSource];
+    VkDeviceSize nMoved = 0;
+    FOR_EACH_MAP_FAST(pSource->m_Allocations, i)
+    {
+        if (nMoved >= GEOMETRY_ARENA_COMPACT_BUDGET)
+            break;
+
+        Allocation_t allocation = pSource->m_Allocations[i];
+        if (!allocation.m_pClient)
+            continue;
+
+        // Never grows the arena, stops once the other blocks are full
+        GeometryRangeVk_t dst;
+        for (int j = 0; j < m_Blocks.Count() && !dst.IsValid(); j++)
+        {
+            if (j != nSource)
+            {
+                AllocFromBlock(j, allocation.m_nSize, allocation.m_pClient, dst);
+            }
+        }
+        if (!dst.IsValid())
+            break;
+
+        GeometryRangeVk_t src;
+        src.m_nBlock = nSource;
+        src.m_nOffset = pSource->m_Allocations.Key(i);
+        src.m_nSize = allocation.m_nSize;
+
+        // Draws recorded before the move still read the old bytes, they're released once those frames are done
+        memcpy(GetMemory(dst), GetMemory(src), (size_t)allocation.m_nSize);
+        allocation.m_pClient->OnGeometryRangeMoved(dst);
+        Free(src);
+
+        nMoved += allocation.m_nSize;
+    }
+}
+
+int CGeometryArenaVk::CreateBlock()
+{
+    // Draws bind the blocks, staging buffers for device local ones are still copied from
+    Block_t *pBlock = new Block_t;
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    CreateBuffer(GEOMETRY_ARENA_BLOCK_SIZE, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 pBlock->m_Buffer, pBlock->m_Memory);
+    vkCheck(vkMapMemory(g_pShaderDevice->GetVkDevice(), pBlock->m_Memory, 0, GEOMETRY_ARENA_BLOCK_SIZE, 0, (void **)&pBlock->m_pMemory),
+            "failed to map geometry arena memory!");
+    pBlock->m_nUsed = 0;
+    pBlock->m_Allocations.SetLessFunc(DefLessFunc(VkDeviceSize));
+
+    FreeRange_t freeRange;
+    freeRange.m_nOffset = 0;
+    freeRange.m_nSize = GEOMETRY_ARENA_BLOCK_SIZE;
+    pBlock->m_FreeRanges.AddToTail(freeRange);
+
+    VPROF_INCREMENT_GROUP_COUNTER("TexGroup_global_" TEXTURE_GROUP_STATIC_VERTEX_BUFFER, COUNTER_GROUP_TEXTURE_GLOBAL,
+                                  GEOMETRY_ARENA_BLOCK_SIZE);
+
+    for (int i = 0; i < m_Blocks.Count(); i++)
+    {
+        if (!m_Blocks[i])
+        {
+            m_Blocks[i] = pBlock;
+            return i;
+        }
+    }
+    return m_Blocks.AddToTail(pBlock);
+}
+
+void CGeometryArenaVk::DestroyBlock(int nBlock)
+{
+    Block_t *pBlock = m_Blocks[nBlock];
+    Assert(pBlock->m_Allocations.Count() == 0);
+
+    // Freeing the memory unmaps it
+    g_pShaderDevice->GetDeletionQueue().DestroyBuffer(pBlock->m_Buffer);
+    g_pShaderDevice->GetDeletionQueue().FreeMemory(pBlock->m_Memory);
+
+    VPROF_INCREMENT_GROUP_COUNTER("TexGroup_global_" TEXTURE_GROUP_STATIC_VERTEX_BUFFER, COUNTER_GROUP_TEXTURE_GLOBAL,
+                                  -GEOMETRY_ARENA_BLOCK_SIZE);
+
+    delete pBlock;
+    m_Blocks[nBlock] = NULL;
+}
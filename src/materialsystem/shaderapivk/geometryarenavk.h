@@ -0,0 +1,117 @@
+//
+
+#ifndef GEOMETRYARENAVK_H
+#define GEOMETRYARENAVK_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlmap.h"
+#include "tier1/utlvector.h"
+#include "vulkanimpl.h"
+
+//-----------------------------------------------------------------------------
+// Important enumerations
+//-----------------------------------------------------------------------------
+enum
+{
+    GEOMETRY_ARENA_BLOCK_SIZE = 8 * 1024 * 1024,
+
+    // Bigger buffers get their own VkBuffer
+    GEOMETRY_ARENA_MAX_ALLOC = 256 * 1024,
+
+    // Ranges start on this, enough for any vertex stride copy and 32-bit indices
+    GEOMETRY_ARENA_ALIGNMENT = 16,
+
+    // Bytes moved out of sparse blocks per frame
+    GEOMETRY_ARENA_COMPACT_BUDGET = 512 * 1024,
+};
+
+// Where an arena allocation lives, m_nBlock is -1 when there is none
+struct GeometryRangeVk_t
+{
+    int m_nBlock;
+    VkDeviceSize m_nOffset;
+    VkDeviceSize m_nSize;
+
+    GeometryRangeVk_t() : m_nBlock(-1), m_nOffset(0), m_nSize(0) {}
+    bool IsValid() const { return m_nBlock >= 0; }
+};
+
+//-----------------------------------------------------------------------------
+// Owner of an arena range, told when compaction moves its data
+//-----------------------------------------------------------------------------
+abstract_class IGeometryArenaClientVk
+{
+  public:
+    virtual void OnGeometryRangeMoved(const GeometryRangeVk_t &range) = 0;
+};
+
+//-----------------------------------------------------------------------------
+// Packs small static vertex and index buffers into a few large host visible blocks.
+// Draws bind the blocks in place, so vertices and indices share them. Freed and
+// moved ranges go through the deletion queue, are coalesced with their neighbours
+// and empty blocks are released. Each frame a little of the sparsest block is moved
+// into the others so it empties out over time.
+//-----------------------------------------------------------------------------
+class CGeometryArenaVk
+{
+  public:
+    CGeometryArenaVk();
+    ~CGeometryArenaVk();
+
+    void Shutdown();
+
+    // Returns false when nSize is over GEOMETRY_ARENA_MAX_ALLOC
+    bool Alloc(VkDeviceSize nSize, IGeometryArenaClientVk *pClient, GeometryRangeVk_t &range);
+
+    // Frames in flight may still read from it, the range is reused once they are done
+    void Free(GeometryRangeVk_t &range);
+
+    // Moves the contents to a new range before they're written again, frames in flight keep reading the old one
+    void Reallocate(GeometryRangeVk_t &range);
+
+    // Called by the deletion queue
+    void ReleaseRange(uint64_t handle);
+
+    VkBuffer *GetVkBuffer(const GeometryRangeVk_t &range);
+    unsigned char *GetMemory(const GeometryRangeVk_t &range);
+
+    // Moves up to GEOMETRY_ARENA_COMPACT_BUDGET bytes out of the sparsest block
+    void Compact();
+
+  private:
+    struct FreeRange_t
+    {
+        VkDeviceSize m_nOffset;
+        VkDeviceSize m_nSize;
+    };
+
+    struct Allocation_t
+    {
+        VkDeviceSize m_nSize;
+        IGeometryArenaClientVk *m_pClient; // NULL once freed and waiting on the deletion queue
+    };
+
+    struct Block_t
+    {
+        VkBuffer m_Buffer;
+        VkDeviceMemory m_Memory;
+        unsigned char *m_pMemory;
+        VkDeviceSize m_nUsed;
+
+        // Sorted by offset
+        CUtlVector<FreeRange_t> m_FreeRanges;
+        CUtlMap<VkDeviceSize, Allocation_t> m_Allocations;
+    };
+
+    bool AllocFromBlock(int nBlock, VkDeviceSize nSize, IGeometryArenaClientVk *pClient, GeometryRangeVk_t &range);
+    int CreateBlock();
+    void DestroyBlock(int nBlock);
+
+    // NULL slots are released blocks, indices stay stable for the ranges pointing at them
+    CUtlVector<Block_t *> m_Blocks;
+};
+
+#endif // GEOMETRYARENAVK_H
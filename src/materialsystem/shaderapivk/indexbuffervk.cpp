@@ -66,10 +66,11 @@ CIndexBufferVk::CIndexBufferVk(ShaderBufferType_t bufferType, MaterialIndexForma
     m_nIndexCount = indexCount;
     m_nFirstUnwrittenOffset = 0;
     m_bIsLocked = false;
+    m_bArenaRangeWritten = false;
     m_bIsDynamic = IsDynamicBufferType(bufferType);
     m_bFlush = false;
     m_bDestination = destination;
-    m_Indices = std::vector<uint16_t>();
+    m_Indices = std::vector<unsigned char>();
 
 #ifdef CHECK_INDICES
     m_pShadowIndices = NULL;
@@ -87,9 +88,33 @@ CIndexBufferVk::~CIndexBufferVk() { Free(); }
 //-----------------------------------------------------------------------------
 int CIndexBufferVk::IndexSize() const
 {
-    // Assert( m_IndexFormat != MATERIAL_INDEX_FORMAT_UNKNOWN );
-    // return ( m_IndexFormat == MATERIAL_INDEX_FORMAT_16BIT ) ? 2 : 4;
-    return sizeof(uint16_t);
+    Assert(m_IndexFormat != MATERIAL_INDEX_FORMAT_UNKNOWN);
+    return (m_IndexFormat == MATERIAL_INDEX_FORMAT_16BIT) ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+unsigned int CIndexBufferVk::GetIndex(int nIndex) const
+{
+    Assert((nIndex + 1) * IndexSize() <= (int)m_Indices.size());
+    if (m_IndexFormat == MATERIAL_INDEX_FORMAT_16BIT)
+        return ((const uint16_t *)m_Indices.data())[nIndex];
+
+    return ((const uint32_t *)m_Indices.data())[nIndex];
+}
+
+//-----------------------------------------------------------------------------
+// Shifts the indices down so the lowest one is 0
+//-----------------------------------------------------------------------------
+template <class T> static void RebaseIndices(T *pIndices, int nCount)
+{
+    T lowest = pIndices[0];
+    for (int i = 1; i < nCount; i++)
+    {
+        lowest = MIN(lowest, pIndices[i]);
+    }
+    for (int i = 0; i < nCount; i++)
+    {
+        pIndices[i] -= lowest;
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -97,8 +122,19 @@ int CIndexBufferVk::IndexSize() const
 //-----------------------------------------------------------------------------
 bool CIndexBufferVk::Allocate()
 {
-    Assert(!m_pIndexBuffer);
+    Assert(!m_pIndexBuffer && !m_ArenaRange.IsValid());
     m_nFirstUnwrittenOffset = 0;
+    m_bArenaRangeWritten = false;
+
+    // Bound in place by the viewport, so small static buffers can be packed together.
+    // The arena blocks are counted as a whole.
+    if (!m_bIsDynamic && !m_bDestination && g_pShaderDevice->GetGeometryArena().Alloc(m_nBufferSize, this, m_ArenaRange))
+    {
+#ifdef _DEBUG
+        ++s_nBufferCount;
+#endif
+        return true;
+    }
 
     m_pIndexBuffer = new VkBuffer();
     m_pIndexBufferMemory = new VkDeviceMemory();
@@ -131,18 +167,25 @@ bool CIndexBufferVk::Allocate()
 
 void CIndexBufferVk::Free()
 {
+    if (m_ArenaRange.IsValid())
+    {
+#ifdef _DEBUG
+        --s_nBufferCount;
+#endif
+        g_pShaderDevice->GetGeometryArena().Free(m_ArenaRange);
+    }
+
     if (m_pIndexBuffer)
     {
 #ifdef _DEBUG
         --s_nBufferCount;
 #endif
 
-        // Destroy buffer
-        vkDestroyBuffer(g_pShaderDevice->GetVkDevice(), *m_pIndexBuffer, nullptr);
+        // Frames in flight may still read from it
+        g_pShaderDevice->GetDeletionQueue().DestroyBuffer(*m_pIndexBuffer);
         m_pIndexBuffer = nullptr;
 
-        // Free memory
-        vkFreeMemory(g_pShaderDevice->GetVkDevice(), *m_pIndexBufferMemory, nullptr);
+        g_pShaderDevice->GetDeletionQueue().FreeMemory(*m_pIndexBufferMemory);
         m_pIndexBufferMemory = nullptr;
 
         if (!m_bIsDynamic)
@@ -195,7 +238,13 @@ void CIndexBufferVk::Flush()
 //-----------------------------------------------------------------------------
 // Returns the Vk buffer
 //-----------------------------------------------------------------------------
-VkBuffer *CIndexBufferVk::GetVkBuffer() { return m_pIndexBuffer; }
+VkBuffer *CIndexBufferVk::GetVkBuffer()
+{
+    if (m_ArenaRange.IsValid())
+        return g_pShaderDevice->GetGeometryArena().GetVkBuffer(m_ArenaRange);
+
+    return m_pIndexBuffer;
+}
 
 //-----------------------------------------------------------------------------
 // Used to measure how much static buffer memory is touched each frame
@@ -242,11 +291,12 @@ bool CIndexBufferVk::Lock(int nMaxIndexCount, bool bAppend, IndexDesc_t &desc)
 
     m_nFirstUnwrittenOffset = 0;
 
-    m_pIndices.resize(nMaxIndexCount);
+    m_pIndices.resize(MAX(nMaxIndexCount, 1) * IndexSize());
 
+    // Like the other APIs, m_nIndexSize counts shorts, 32-bit buffers are written through a cast
     desc.m_nFirstIndex = 0;
-    desc.m_pIndices = &m_pIndices[0];
-    desc.m_nIndexSize = 1;
+    desc.m_pIndices = (unsigned short *)m_pIndices.data();
+    desc.m_nIndexSize = IndexSize() >> 1;
 
     m_bIsLocked = true;
     return true;
@@ -260,47 +310,52 @@ void CIndexBufferVk::Unlock(int nWrittenIndexCount, IndexDesc_t &desc)
 
     if (nWrittenIndexCount > 0)
     {
-        m_Indices.resize(nWrittenIndexCount + m_nFirstUnwrittenOffset);
-
-        for (int i = 0; i < nWrittenIndexCount; i++)
-        {
-            m_Indices[i + m_nFirstUnwrittenOffset] = m_pIndices[i];
-        }
+        int nIndexCount = nWrittenIndexCount + m_nFirstUnwrittenOffset;
+        m_Indices.resize(nIndexCount * IndexSize());
+        memcpy(&m_Indices[m_nFirstUnwrittenOffset * IndexSize()], m_pIndices.data(), nWrittenIndexCount * IndexSize());
 
         // VK_FIXME: index values start from weird values
-        uint16_t lowest = std::numeric_limits<uint16_t>::max();
-        for (size_t i = 0; i < m_Indices.size(); i++)
+        if (m_IndexFormat == MATERIAL_INDEX_FORMAT_16BIT)
         {
-            if (m_Indices[i] < lowest)
-            {
-                lowest = m_Indices[i];
-            }
+            RebaseIndices((uint16_t *)m_Indices.data(), nIndexCount);
         }
-        for (size_t i = 0; i < m_Indices.size(); i++)
+        else
         {
-            m_Indices[i] -= lowest;
+            RebaseIndices((uint32_t *)m_Indices.data(), nIndexCount);
         }
 
         m_nFirstUnwrittenOffset += nWrittenIndexCount;
 
-        VkDeviceSize bufferSize = m_Indices.size() * IndexSize();
+        VkDeviceSize bufferSize = m_Indices.size();
 
         if (bufferSize > m_nBufferSize)
         {
             // VK_TODO: this gets called quite often, maybe create larger buffers to start with,
             // or increase buffer size by 2^x whenever we get here.
             Free();
-            m_nIndexCount = m_Indices.size();
+            m_nIndexCount = nIndexCount;
             m_nBufferSize = bufferSize;
             Allocate();
         }
 
         // Copy index data to the buffer
-        void *data;
-        vkCheck(vkMapMemory(g_pShaderDevice->GetVkDevice(), *m_pIndexBufferMemory, 0, bufferSize, 0, &data),
-                "failed to map index buffer memory!");
-        memcpy(data, m_Indices.data(), (size_t)bufferSize);
-        vkUnmapMemory(g_pShaderDevice->GetVkDevice(), *m_pIndexBufferMemory);
+        if (m_ArenaRange.IsValid())
+        {
+            if (m_bArenaRangeWritten)
+            {
+                g_pShaderDevice->GetGeometryArena().Reallocate(m_ArenaRange);
+            }
+            m_bArenaRangeWritten = true;
+            memcpy(g_pShaderDevice->GetGeometryArena().GetMemory(m_ArenaRange), m_Indices.data(), (size_t)bufferSize);
+        }
+        else
+        {
+            void *data;
+            vkCheck(vkMapMemory(g_pShaderDevice->GetVkDevice(), *m_pIndexBufferMemory, 0, bufferSize, 0, &data),
+                    "failed to map index buffer memory!");
+            memcpy(data, m_Indices.data(), (size_t)bufferSize);
+            vkUnmapMemory(g_pShaderDevice->GetVkDevice(), *m_pIndexBufferMemory);
+        }
     }
 
     m_bIsLocked = false;
@@ -1,12 +1,13 @@
 #pragma once
 
 #include <vector>
+#include "geometryarenavk.h"
 #include "materialsystem/imesh.h"
 #include "shaderapi/IShaderDevice.h"
 #include "vprof.h"
 #include "vulkanimpl.h"
 
-class CIndexBufferVk : public IIndexBuffer
+class CIndexBufferVk : public IIndexBuffer, public IGeometryArenaClientVk
 {
     typedef IIndexBuffer BaseClass;
 
@@ -41,24 +42,37 @@ class CIndexBufferVk : public IIndexBuffer
     // Only used by dynamic buffers, indicates the next lock should perform a discard.
     void Flush();
 
-    // Returns the VkBuffer
+    // Returns the VkBuffer, and where the indices start in it
     VkBuffer *GetVkBuffer();
+    VkDeviceSize GetBufferOffset() const { return m_ArenaRange.m_nOffset; }
+
+    // Draws bind arena buffers in place instead of copying them
+    bool IsInArena() const { return m_ArenaRange.IsValid(); }
 
     // Used to measure how much static buffer memory is touched each frame
     void HandlePerFrameTextureStats(int nFrame);
 
     bool HasEnoughRoom(int indexCount) const { return indexCount <= GetRoomRemaining(); }
 
-    uint16_t* GetIndexMemory() { return m_Indices.data(); }
+    // Reads an index of either format from the last unlocked data
+    unsigned int GetIndex(int nIndex) const;
+    const unsigned char *GetIndexMemory() const { return m_Indices.data(); }
+    int GetIndexMemorySize() const { return (int)m_Indices.size(); }
 
     VkDeviceSize GetBufferSize() { return m_nBufferSize; }
 
+    // Methods of IGeometryArenaClientVk
+    virtual void OnGeometryRangeMoved(const GeometryRangeVk_t &range) { m_ArenaRange = range; }
+
   private:
     VkBuffer *m_pIndexBuffer;
     VkDeviceMemory *m_pIndexBufferMemory;
-    std::vector<uint16_t> m_Indices;
+    GeometryRangeVk_t m_ArenaRange; // Small static buffers share a block of CGeometryArenaVk instead
+    bool m_bArenaRangeWritten;      // Later unlocks move to a new range, draws in flight read this one
+    // Raw index data, IndexSize() bytes per index
+    std::vector<unsigned char> m_Indices;
     MaterialIndexFormat_t m_IndexFormat;
-    std::vector<uint16_t> m_pIndices;
+    std::vector<unsigned char> m_pIndices;
     int m_nIndexCount;
     VkDeviceSize m_nBufferSize;
     int m_nFirstUnwrittenOffset;
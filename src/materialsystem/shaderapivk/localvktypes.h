@@ -19,6 +19,7 @@
 #include <materialsystem/IShader.h>
 #include <vector>
 #include "hardwareconfig.h"
+#include "mathlib/ssemath.h"
 #include "vulkanimpl.h"
 
 typedef void *HardwareShader_t;
@@ -35,6 +36,67 @@ typedef int PixelShader_t;
 #define INVALID_SHADER (0xFFFFFFFF)
 #define INVALID_HARDWARE_SHADER (NULL)
 
+//-----------------------------------------------------------------------------
+// Specialization constant ids of shaders built as a single module, the
+// static index is the one passed to CreateVertexShader/CreatePixelShader
+//-----------------------------------------------------------------------------
+enum
+{
+    SHADER_SPEC_STATIC_COMBO = 0,
+    SHADER_SPEC_DYNAMIC_COMBO,
+
+    SHADER_SPEC_CONSTANT_COUNT,
+};
+
+//-----------------------------------------------------------------------------
+// A bound shader stage as pipeline creation sees it
+//-----------------------------------------------------------------------------
+struct ShaderStageState_t
+{
+    VkShaderModule m_Module;                       // VK_NULL_HANDLE when no shader is bound
+    int32_t m_nCombos[SHADER_SPEC_CONSTANT_COUNT]; // Specialization data, zero unless the shader is specialized
+    bool m_bInstanced;                             // Reads the model matrix from the instance stream, follows the module
+
+    bool operator==(const ShaderStageState_t &other) const
+    {
+        return m_Module == other.m_Module && m_nCombos[SHADER_SPEC_STATIC_COMBO] == other.m_nCombos[SHADER_SPEC_STATIC_COMBO] &&
+               m_nCombos[SHADER_SPEC_DYNAMIC_COMBO] == other.m_nCombos[SHADER_SPEC_DYNAMIC_COMBO];
+    }
+    bool operator!=(const ShaderStageState_t &other) const { return !(*this == other); }
+};
+
+//-----------------------------------------------------------------------------
+// Vector constant register files, set 0 binding 1 and 2 as dynamic uniform buffers
+//-----------------------------------------------------------------------------
+enum ShaderConstantStage_t
+{
+    SHADER_CONSTANTS_VERTEX = 0,
+    SHADER_CONSTANTS_PIXEL,
+
+    SHADER_CONSTANTS_STAGE_COUNT,
+};
+
+// Registers that fit next to the bindless texture indices in the guaranteed 128 bytes of push constants
+#define SHADER_CONSTANT_PUSH_REGISTERS 3
+
+//-----------------------------------------------------------------------------
+// Registers changed since a stage's uniform buffer block was written. Shaders read
+// register r of a stage from m_Registers[m_nPushIndex + r - m_nFirst] when it falls
+// into [m_nFirst, m_nFirst + m_nCount) and from the uniform buffer otherwise.
+//-----------------------------------------------------------------------------
+struct ShaderConstantPush_t
+{
+    int16_t m_nFirst[SHADER_CONSTANTS_STAGE_COUNT];
+    int16_t m_nCount[SHADER_CONSTANTS_STAGE_COUNT];
+    int16_t m_nPushIndex[SHADER_CONSTANTS_STAGE_COUNT];
+    int16_t m_nPad[2];
+    Vector4D m_Registers[SHADER_CONSTANT_PUSH_REGISTERS];
+
+    ShaderConstantPush_t() { memset(this, 0, sizeof(*this)); }
+    bool operator==(const ShaderConstantPush_t &other) const { return memcmp(this, &other, sizeof(*this)) == 0; }
+    bool operator!=(const ShaderConstantPush_t &other) const { return !(*this == other); }
+};
+
 enum VertexShaderLightTypes_t
 {
     LIGHT_NONE = -1,
@@ -45,22 +107,25 @@ enum VertexShaderLightTypes_t
     LIGHT_AMBIENTCUBE = 4,
 };
 
-typedef struct LIGHT
+//-----------------------------------------------------------------------------
+// The lights in structure-of-arrays form, lane i of every member is light i.
+// MAX_NUM_LIGHTS is 4 so all of them fit in one fltx4.
+//-----------------------------------------------------------------------------
+struct ALIGN16 LightStateSoA_t
 {
-    VertexShaderLightTypes_t Type;
-    glm::vec4 Diffuse;
-    glm::vec4 Specular;
-    glm::vec4 Ambient;
-    glm::vec3 Position;
-    glm::vec3 Direction;
-    float Range;
-    float Falloff;
-    float Attenuation0;
-    float Attenuation1;
-    float Attenuation2;
-    float Theta;
-    float Phi;
-} LIGHT;
+    FourVectors m_Color;
+    FourVectors m_Position;
+    FourVectors m_Direction;
+    fltx4 m_Range;
+    fltx4 m_Falloff;
+    fltx4 m_Attenuation0;
+    fltx4 m_Attenuation1;
+    fltx4 m_Attenuation2;
+    fltx4 m_ThetaDot; // Cosines of the cone angles
+    fltx4 m_PhiDot;
+    fltx4 m_EnableMask;      // All bits set in the lanes of enabled lights
+    fltx4 m_DirectionalMask; // All bits set in the lanes of directional lights
+} ALIGN16_POST;
 
 typedef enum SHADEMODE
 {
@@ -147,6 +212,7 @@ struct SamplerState_t
     VkFilter m_MinFilter;
     VkFilter m_MipFilter;
     int m_nAnisotropicLevel;
+    int m_nSamplerIndex; // Into the device sampler cache
     bool m_TextureEnable;
     bool m_SRGBReadEnable;
 };
@@ -169,10 +235,10 @@ struct DynamicState_t
 
     // Ambient light color
     unsigned long m_Ambient;
-    LIGHT m_Lights[MAX_NUM_LIGHTS];
+    LightStateSoA_t m_LightState;
     LightDesc_t m_LightDescs[MAX_NUM_LIGHTS];
     bool m_LightEnable[MAX_NUM_LIGHTS];
-    Vector4D m_AmbientLightCube[6];
+    Vector4DAligned m_AmbientLightCube[6];
     unsigned char m_LightChanged[MAX_NUM_LIGHTS];
     unsigned char m_LightEnableChanged[MAX_NUM_LIGHTS];
     VertexShaderLightTypes_t m_LightType[MAX_NUM_LIGHTS];
@@ -245,7 +311,8 @@ struct DynamicState_t
 
     RECT m_ScissorRect;
 
-    VkVertexInputAttributeDescription *m_pVertexDecl;
+    // VERTEX_DECL_xxx flags of the current mesh
+    unsigned int m_VertexDecl;
 
     bool m_bSRGBWritesEnabled;
     bool m_bHWMorphingEnabled;
@@ -454,17 +521,7 @@ struct UniformBufferObject
     alignas(16) glm::mat4 model;
     alignas(16) glm::mat4 view;
     alignas(16) glm::mat4 proj;
-};
-
-struct ModelVertexVk_t
-{
-    glm::vec3 m_vecPosition;
-    glm::vec2 m_flBoneWeights;
-    unsigned int m_nBoneIndices;
-    glm::vec3 m_vecNormal;
-    glm::vec<4, uint8_t> m_nColor; // ARGB
-    glm::vec2 m_vecTexCoord;
-    glm::vec4 m_vecUserData;
+    uint32_t selectionId; // Written to the pick buffer while picking, 0 otherwise
 };
 
 #endif // LOCALVKTYPES_H
\ No newline at end of file
@@ -26,7 +26,9 @@ CMeshMgrVk::CMeshMgrVk()
     : m_pDynamicIndexBuffer(0), m_DynamicTempMesh(true), m_pVertexIDBuffer(0), m_pCurrentVertexBuffer(NULL), m_CurrentVertexFormat(0),
       m_pCurrentIndexBuffer(NULL),
       m_DynamicIndexBuffer(SHADER_BUFFER_TYPE_DYNAMIC, MATERIAL_INDEX_FORMAT_16BIT, INDEX_BUFFER_SIZE, "dynamic", false),
-      m_DynamicVertexBuffer(SHADER_BUFFER_TYPE_DYNAMIC, VERTEX_FORMAT_UNKNOWN, 0, "dynamic", false)
+      m_DynamicIndexBuffer32(SHADER_BUFFER_TYPE_DYNAMIC, MATERIAL_INDEX_FORMAT_32BIT, INDEX_BUFFER_SIZE, "dynamic", false),
+      m_DynamicVertexBuffer(SHADER_BUFFER_TYPE_DYNAMIC, VERTEX_FORMAT_UNKNOWN, 0, "dynamic", false),
+      m_VertexLayoutIndices(DefLessFunc(VertexFormat_t))
 {
     m_bUseFatVertices = false;
     m_nIndexBufferOffset = 0;
@@ -115,8 +117,9 @@ void CMeshMgrVk::CreateVertexIDBuffer()
     // if (g_pShaderDeviceMgr->GetCurrentAdapterInfo().caps.HasFastVertexTextures())
     if (g_pHardwareConfig->HasFastVertexTextures())
     {
+        // One float per vertex
         m_pVertexIDBuffer = (CVertexBufferVk *)g_pShaderDevice->CreateVertexBuffer(
-            SHADER_BUFFER_TYPE_STATIC, VERTEX_FORMAT_UNKNOWN, (int)VERTEX_BUFFER_SIZE, TEXTURE_GROUP_STATIC_VERTEX_BUFFER_OTHER);
+            SHADER_BUFFER_TYPE_STATIC, VERTEX_USERDATA_SIZE(1), (int)VERTEX_BUFFER_SIZE, TEXTURE_GROUP_STATIC_VERTEX_BUFFER_OTHER);
         FillVertexIDBuffer(m_pVertexIDBuffer, VERTEX_BUFFER_SIZE);
     }
 }
@@ -157,7 +160,10 @@ bool CMeshMgrVk::IsBufferedDynamicMesh(IMesh *pMesh) const { return (pMesh == &m
 
 bool CMeshMgrVk::IsDynamicVertexBuffer(IVertexBuffer *pVertexBuffer) const { return (pVertexBuffer == &m_DynamicVertexBuffer); }
 
-bool CMeshMgrVk::IsDynamicIndexBuffer(IIndexBuffer *pIndexBuffer) const { return (pIndexBuffer == &m_DynamicIndexBuffer); }
+bool CMeshMgrVk::IsDynamicIndexBuffer(IIndexBuffer *pIndexBuffer) const
+{
+    return (pIndexBuffer == &m_DynamicIndexBuffer) || (pIndexBuffer == &m_DynamicIndexBuffer32);
+}
 
 //-----------------------------------------------------------------------------
 // Discards the dynamic vertex and index buffer
@@ -246,15 +252,26 @@ void CMeshMgrVk::CopyStaticMeshIndexBufferToTempMeshIndexBuffer(CTempMeshVk *pDs
     Assert(!pSrcIndexMesh->IsDynamic());
     int nIndexCount = pSrcIndexMesh->IndexCount();
 
-    CMeshBuilder dstMeshBuilder;
-    dstMeshBuilder.Begin(pDstIndexMesh, pSrcIndexMesh->GetPrimitiveType(), 0, nIndexCount);
     CIndexBufferVk *srcIndexBuffer = pSrcIndexMesh->GetIndexBuffer();
     IndexDesc_t temp;
     srcIndexBuffer->Lock(nIndexCount, false, temp);
-    uint16_t *srcIndexArray = srcIndexBuffer->GetIndexMemory();
+
+    // Temp meshes only hold 16-bit indices, a mesh that needs more isn't copied at all rather than with wrapped indices
+    for (int i = 0; i < nIndexCount; i++)
+    {
+        if (srcIndexBuffer->GetIndex(i) > USHRT_MAX)
+        {
+            Warning("CMeshMgrVk: index %u doesn't fit a temp mesh, mesh will not be rendered\n", srcIndexBuffer->GetIndex(i));
+            srcIndexBuffer->Unlock(0, temp);
+            return;
+        }
+    }
+
+    CMeshBuilder dstMeshBuilder;
+    dstMeshBuilder.Begin(pDstIndexMesh, pSrcIndexMesh->GetPrimitiveType(), 0, nIndexCount);
     for (int i = 0; i < nIndexCount; i++)
     {
-        dstMeshBuilder.Index(srcIndexArray[i]);
+        dstMeshBuilder.Index((unsigned short)srcIndexBuffer->GetIndex(i));
         dstMeshBuilder.AdvanceIndex();
     }
     srcIndexBuffer->Unlock(0, temp);
@@ -398,6 +415,218 @@ void CMeshMgrVk::ComputeVertexDescription(unsigned char *pBuffer, VertexFormat_t
     ComputeVertexDesc(pBuffer, vertexFormat, (VertexDesc_t &)desc);
 }
 
+int CMeshMgrVk::VertexFormatSize(VertexFormat_t vertexFormat) const
+{
+    // FIXME: We could make this much faster
+    MeshDesc_t temp;
+    ComputeVertexDescription(0, vertexFormat, temp);
+    return temp.m_ActualVertexSize;
+}
+
+//-----------------------------------------------------------------------------
+// Vertex input layouts
+//-----------------------------------------------------------------------------
+static VkFormat FloatVertexFormat(int nFloats)
+{
+    static const VkFormat s_Formats[4] = {VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT,
+                                          VK_FORMAT_R32G32B32A32_SFLOAT};
+    Assert(nFloats >= 1 && nFloats <= 4);
+    return s_Formats[nFloats - 1];
+}
+
+static void AddVertexAttribute(VertexLayoutVk_t &layout, uint32_t location, VkFormat format, const void *pElement)
+{
+    Assert(layout.m_nAttributeCount < VERTEX_LOCATION_COUNT);
+    VkVertexInputAttributeDescription &attribute = layout.m_Attributes[layout.m_nAttributeCount++];
+    attribute.location = location;
+    attribute.binding = VERTEX_STREAM_BASE;
+    attribute.format = format;
+    attribute.offset = (uint32_t)(uintptr_t)pElement;
+}
+
+// VERTEX_PACKED_NORMAL_FORMAT holds the tangent too
+COMPILE_TIME_ASSERT(COMPRESSED_NORMALS_TYPE == COMPRESSED_NORMALS_COMBINEDTANGENTS_UBYTE4);
+
+void CMeshMgrVk::ComputeVertexLayout(VertexFormat_t vertexFormat, VertexLayoutVk_t &layout) const
+{
+    // With a null buffer the element pointers are the offsets, absent elements have a size of 0
+    MeshDesc_t desc;
+    ComputeVertexDescription(0, vertexFormat, desc);
+
+    // Compressed elements only change format, the vertex shaders unpack them
+    bool bCompressed = desc.m_CompressionType == VERTEX_COMPRESSION_ON;
+
+    layout.m_nStride = desc.m_ActualVertexSize;
+    layout.m_nAttributeCount = 0;
+
+    if (desc.m_VertexSize_Position)
+    {
+        AddVertexAttribute(layout, VERTEX_LOCATION_POSITION, VK_FORMAT_R32G32B32_SFLOAT, desc.m_pPosition);
+    }
+    if (desc.m_VertexSize_Wrinkle)
+    {
+        AddVertexAttribute(layout, VERTEX_LOCATION_WRINKLE, VK_FORMAT_R32_SFLOAT, desc.m_pWrinkle);
+    }
+    if (desc.m_VertexSize_BoneWeight)
+    {
+        VkFormat format = bCompressed ? VERTEX_PACKED_BONE_WEIGHTS_FORMAT : FloatVertexFormat(desc.m_NumBoneWeights);
+        AddVertexAttribute(layout, VERTEX_LOCATION_BONE_WEIGHTS, format, desc.m_pBoneWeight);
+    }
+    if (desc.m_VertexSize_BoneMatrixIndex)
+    {
+        AddVertexAttribute(layout, VERTEX_LOCATION_BONE_INDEX, VK_FORMAT_R8G8B8A8_UINT, desc.m_pBoneMatrixIndex);
+    }
+    if (desc.m_VertexSize_Normal)
+    {
+        VkFormat format = bCompressed ? VERTEX_PACKED_NORMAL_FORMAT : VK_FORMAT_R32G32B32_SFLOAT;
+        AddVertexAttribute(layout, VERTEX_LOCATION_NORMAL, format, desc.m_pNormal);
+    }
+
+    // D3DCOLOR, stored as BGRA
+    if (desc.m_VertexSize_Color)
+    {
+        AddVertexAttribute(layout, VERTEX_LOCATION_COLOR, VK_FORMAT_B8G8R8A8_UNORM, desc.m_pColor);
+    }
+    if (desc.m_VertexSize_Specular)
+    {
+        AddVertexAttribute(layout, VERTEX_LOCATION_SPECULAR, VK_FORMAT_B8G8R8A8_UNORM, desc.m_pSpecular);
+    }
+
+    for (int i = 0; i < VERTEX_MAX_TEXTURE_COORDINATES; ++i)
+    {
+        if (desc.m_VertexSize_TexCoord[i])
+        {
+            AddVertexAttribute(layout, VERTEX_LOCATION_TEXCOORD0 + i, FloatVertexFormat(TexCoordSize(i, vertexFormat)),
+                               desc.m_pTexCoord[i]);
+        }
+    }
+
+    if (desc.m_VertexSize_TangentS)
+    {
+        AddVertexAttribute(layout, VERTEX_LOCATION_TANGENT_S, VK_FORMAT_R32G32B32_SFLOAT, desc.m_pTangentS);
+    }
+    if (desc.m_VertexSize_TangentT)
+    {
+        AddVertexAttribute(layout, VERTEX_LOCATION_TANGENT_T, VK_FORMAT_R32G32B32_SFLOAT, desc.m_pTangentT);
+    }
+
+    // Compressed, the tangent lives in the packed normal and the user data takes no space
+    if (desc.m_VertexSize_UserData && !bCompressed)
+    {
+        AddVertexAttribute(layout, VERTEX_LOCATION_USERDATA, FloatVertexFormat(UserDataSize(vertexFormat)), desc.m_pUserData);
+    }
+}
+
+const VertexLayoutVk_t &CMeshMgrVk::GetVertexLayout(VertexFormat_t vertexFormat)
+{
+    CUtlMap<VertexFormat_t, int>::IndexType_t i = m_VertexLayoutIndices.Find(vertexFormat);
+    if (i != m_VertexLayoutIndices.InvalidIndex())
+        return m_VertexLayouts[m_VertexLayoutIndices[i]];
+
+    int nIndex = m_VertexLayouts.AddToTail();
+    ComputeVertexLayout(vertexFormat, m_VertexLayouts[nIndex]);
+    m_VertexLayoutIndices.Insert(vertexFormat, nIndex);
+    return m_VertexLayouts[nIndex];
+}
+
+static void AddVertexBinding(VertexDeclVk_t &decl, uint32_t binding, uint32_t stride,
+                             VkVertexInputRate inputRate = VK_VERTEX_INPUT_RATE_VERTEX)
+{
+    VkVertexInputBindingDescription &desc = decl.m_Bindings[decl.m_nBindingCount++];
+    desc.binding = binding;
+    desc.stride = stride;
+    desc.inputRate = inputRate;
+}
+
+static void AddVertexAttribute(VertexDeclVk_t &decl, uint32_t binding, uint32_t location, VkFormat format, uint32_t offset)
+{
+    Assert(decl.m_nAttributeCount < VERTEX_LOCATION_COUNT);
+    VkVertexInputAttributeDescription &attribute = decl.m_Attributes[decl.m_nAttributeCount++];
+    attribute.location = location;
+    attribute.binding = binding;
+    attribute.format = format;
+    attribute.offset = offset;
+}
+
+void CMeshMgrVk::GetVertexDecl(const VertexDeclKeyVk_t &key, bool bInstanceStream, VertexDeclVk_t &decl)
+{
+    decl.m_nBindingCount = 0;
+    decl.m_nAttributeCount = 0;
+
+    unsigned int nProvided = 0;
+    for (int i = VERTEX_STREAM_BASE; i < VERTEX_STREAM_DEFAULTS; i++)
+    {
+        if (key.m_Formats[i] == VERTEX_FORMAT_UNKNOWN)
+            continue;
+
+        const VertexLayoutVk_t &layout = GetVertexLayout(key.m_Formats[i]);
+        AddVertexBinding(decl, i, layout.m_nStride);
+
+        for (uint32_t j = 0; j < layout.m_nAttributeCount; j++)
+        {
+            VkVertexInputAttributeDescription attribute = layout.m_Attributes[j];
+            if (i == VERTEX_STREAM_BASE)
+            {
+                // The color mesh replaces it
+                if (attribute.location == VERTEX_LOCATION_COLOR && key.m_Formats[VERTEX_STREAM_COLOR] != VERTEX_FORMAT_UNKNOWN)
+                    continue;
+            }
+            else if (i == VERTEX_STREAM_COLOR)
+            {
+                if (attribute.location != VERTEX_LOCATION_COLOR)
+                    continue;
+            }
+            else if (i == VERTEX_STREAM_FLEX)
+            {
+                // Flex deltas go next to the base position and normal
+                if (attribute.location == VERTEX_LOCATION_POSITION)
+                    attribute.location = VERTEX_LOCATION_FLEX_POSITION;
+                else if (attribute.location == VERTEX_LOCATION_NORMAL)
+                    attribute.location = VERTEX_LOCATION_FLEX_NORMAL;
+                else
+                    continue;
+            }
+
+            AddVertexAttribute(decl, i, attribute.location, attribute.format, attribute.offset);
+            nProvided |= 1 << attribute.location;
+        }
+    }
+
+    // Every shader reads these, formats without them read constants
+    unsigned int nDefaults = (1 << VERTEX_LOCATION_POSITION) | (1 << VERTEX_LOCATION_NORMAL) | (1 << VERTEX_LOCATION_COLOR);
+    nDefaults &= ~nProvided;
+    if (nDefaults)
+    {
+        AddVertexBinding(decl, VERTEX_STREAM_DEFAULTS, 0);
+        if (nDefaults & (1 << VERTEX_LOCATION_POSITION))
+        {
+            AddVertexAttribute(decl, VERTEX_STREAM_DEFAULTS, VERTEX_LOCATION_POSITION, VK_FORMAT_R32G32B32_SFLOAT,
+                               offsetof(VertexDefaultsVk_t, m_Position));
+        }
+        if (nDefaults & (1 << VERTEX_LOCATION_NORMAL))
+        {
+            AddVertexAttribute(decl, VERTEX_STREAM_DEFAULTS, VERTEX_LOCATION_NORMAL, VK_FORMAT_R32G32B32_SFLOAT,
+                               offsetof(VertexDefaultsVk_t, m_Normal));
+        }
+        if (nDefaults & (1 << VERTEX_LOCATION_COLOR))
+        {
+            AddVertexAttribute(decl, VERTEX_STREAM_DEFAULTS, VERTEX_LOCATION_COLOR, VK_FORMAT_B8G8R8A8_UNORM,
+                               offsetof(VertexDefaultsVk_t, m_Color));
+        }
+    }
+
+    // Only for shaders that read it, its locations are past the 16 attributes every device has
+    if (bInstanceStream)
+    {
+        AddVertexBinding(decl, VERTEX_STREAM_INSTANCE, sizeof(InstanceDataVk_t), VK_VERTEX_INPUT_RATE_INSTANCE);
+        for (int i = 0; i < 3; i++)
+        {
+            AddVertexAttribute(decl, VERTEX_STREAM_INSTANCE, VERTEX_LOCATION_INSTANCE_MODEL + i, VK_FORMAT_R32G32B32A32_SFLOAT,
+                               offsetof(InstanceDataVk_t, m_Model) + i * sizeof(float[4]));
+        }
+    }
+}
+
 //-----------------------------------------------------------------------------
 // Computes the vertex format
 //-----------------------------------------------------------------------------
@@ -554,8 +783,8 @@ CVertexBufferVk *CMeshMgrVk::FindOrCreateVertexBuffer(int nDynamicBufferId, Vert
         int nBufferMemory = ShaderAPI()->GetCurrentDynamicVBSize();
         int nIndex = m_DynamicVertexBuffers.AddToTail();
         m_DynamicVertexBuffers[nIndex].m_VertexSize = 0;
-        m_DynamicVertexBuffers[nIndex].m_pBuffer =
-            (CVertexBufferVk *)g_pShaderDevice->CreateVertexBuffer(SHADER_BUFFER_TYPE_DYNAMIC, vertexFormat, 0, "dynamic");
+        m_DynamicVertexBuffers[nIndex].m_pBuffer = (CVertexBufferVk *)g_pShaderDevice->CreateVertexBuffer(
+            SHADER_BUFFER_TYPE_DYNAMIC, vertexFormat, nBufferMemory / vertexSize, "dynamic");
     }
 
     if (m_DynamicVertexBuffers[nDynamicBufferId].m_VertexSize != vertexSize)
@@ -664,7 +893,7 @@ IIndexBuffer *CMeshMgrVk::GetDynamicIndexBuffer(MaterialIndexFormat_t fmt, bool
 
     Assert(!needTempMesh); // don't handle this yet. MESHFIXME
 
-    CIndexBufferVk *pIndexBuffer = &m_DynamicIndexBuffer;
+    CIndexBufferVk *pIndexBuffer = (fmt == MATERIAL_INDEX_FORMAT_32BIT) ? &m_DynamicIndexBuffer32 : &m_DynamicIndexBuffer;
     return pIndexBuffer;
 }
 
@@ -11,12 +11,12 @@
 #include "materialsystem/imesh.h"
 #include "meshvk.h"
 #include "shaderapi/IShaderDevice.h"
+#include "tier1/utlmap.h"
 #include "vertexbuffervk.h"
 
-// VK_TODO: The num of used streams is always 1,
-// see implementation of CMeshMgr::BindVertexBuffer.
-// Everything using this should be cleaned up.
-#define MAX_VK_STREAMS 1
+// Meshes bind their color and flex meshes as separate streams, see CMeshMgrVk::GetVertexDecl.
+// VK_TODO: CMeshMgr::BindVertexBuffer still only takes stream 0.
+#define MAX_VK_STREAMS VERTEX_STREAM_COUNT
 
 static unsigned int g_nScratchIndexBuffer = 0; // shove indices into this if you don't actually want indices
 
@@ -95,7 +95,14 @@ class CMeshMgrVk
     bool IsDynamicIndexBuffer(IIndexBuffer *pIndexBuffer) const;
 
     // Returns the vertex size
-    int VertexFormatSize(VertexFormat_t vertexFormat) const { return CVertexBufferVk::VertexSize(); }
+    int VertexFormatSize(VertexFormat_t vertexFormat) const;
+
+    // Vertex input attributes of a format, cached, the reference is good until the next new format
+    const VertexLayoutVk_t &GetVertexLayout(VertexFormat_t vertexFormat);
+
+    // Combines the layouts of the streams a draw reads from into a pipeline's vertex input,
+    // bInstanceStream adds the per instance model matrix for shaders that read it
+    void GetVertexDecl(const VertexDeclKeyVk_t &key, bool bInstanceStream, VertexDeclVk_t &decl);
 
     // Computes the vertex buffer pointers
     void ComputeVertexDescription(unsigned char *pBuffer, VertexFormat_t vertexFormat, MeshDesc_t &desc) const;
@@ -137,6 +144,8 @@ class CMeshMgrVk
     // Fills a vertexID buffer
     void FillVertexIDBuffer(CVertexBufferVk *pVertexIDBuffer, int nCount);
 
+    void ComputeVertexLayout(VertexFormat_t vertexFormat, VertexLayoutVk_t &layout) const;
+
     // The dynamic index buffer
     CIndexBufferVk *m_pDynamicIndexBuffer;
 
@@ -146,6 +155,10 @@ class CMeshMgrVk
     // The dynamic vertex buffers
     CUtlVector<VertexBufferLookup_t> m_DynamicVertexBuffers;
 
+    // Vertex layouts by format
+    CUtlVector<VertexLayoutVk_t> m_VertexLayouts;
+    CUtlMap<VertexFormat_t, int> m_VertexLayoutIndices;
+
     // The buffered mesh
     CBufferedMeshVk m_BufferedMesh;
 
@@ -156,8 +169,9 @@ class CMeshMgrVk
     // The current dynamic vertex buffer
     CVertexBufferVk m_DynamicVertexBuffer;
 
-    // The current dynamic index buffer
+    // The current dynamic index buffers, 16 and 32-bit
     CIndexBufferVk m_DynamicIndexBuffer;
+    CIndexBufferVk m_DynamicIndexBuffer32;
 
     // The dynamic mesh temp version (for shaders that modify vertex data)
     // VK_TODO: do we need temp meshes?
@@ -255,7 +255,21 @@ void CBaseMeshVk::Spew(int nVertexCount, int nIndexCount, const MeshDesc_t &spew
 
 void CBaseMeshVk::ValidateData(int nVertexCount, int nIndexCount, const MeshDesc_t &spewDesc) {}
 
-void CBaseMeshVk::Draw(CPrimList *pLists, int nLists) {}
+//-----------------------------------------------------------------------------
+// Meshes without their own index ranges draw the lists one by one,
+// CMeshVk records them all against a single copy of the mesh
+//-----------------------------------------------------------------------------
+void CBaseMeshVk::Draw(CPrimList *pLists, int nLists)
+{
+    for (int i = 0; i < nLists; i++)
+    {
+        if (pLists[i].m_NumIndices > 0)
+        {
+            // Draw(int, int) is hidden by this overload
+            static_cast<IMesh *>(this)->Draw(pLists[i].m_FirstIndex, pLists[i].m_NumIndices);
+        }
+    }
+}
 
 // Copy verts and/or indices to a mesh builder. This only works for temp meshes!
 void CBaseMeshVk::CopyToMeshBuilder(int iStartVert, // Which vertices to copy.
@@ -275,6 +289,7 @@ void CBaseMeshVk::CopyToMeshBuilder(int iStartVert, // Which vertices to copy.
 
 CPrimList *CMeshVk::s_pPrims;
 int CMeshVk::s_nPrims;
+unsigned int CMeshVk::s_BaseVertex;
 unsigned int CMeshVk::s_FirstVertex;
 unsigned int CMeshVk::s_NumVertices;
 
@@ -289,6 +304,7 @@ CMeshVk::CMeshVk(const char *pTextureGroupName)
 
     m_bHasFlexVerts = false;
     m_pFlexVertexBuffer = nullptr;
+    m_FlexVertexFormat = VERTEX_FORMAT_UNKNOWN;
     m_nFlexVertOffsetInBytes = 0;
     m_nColorMeshVertOffsetInBytes = 0;
     m_pIndexBuffer = nullptr;
@@ -334,6 +350,7 @@ void CMeshVk::SetFlexMesh(IMesh *pMesh, int nVertexOffsetInBytes)
 
         CBaseMeshVk *pBaseMesh = static_cast<CBaseMeshVk *>(pMesh);
         m_pFlexVertexBuffer = pBaseMesh->GetVertexBuffer();
+        m_FlexVertexFormat = pBaseMesh->GetVertexFormat();
 
         m_bHasFlexVerts = true;
     }
@@ -341,6 +358,7 @@ void CMeshVk::SetFlexMesh(IMesh *pMesh, int nVertexOffsetInBytes)
     {
         m_flexVertCount = 0;
         m_pFlexVertexBuffer = NULL;
+        m_FlexVertexFormat = VERTEX_FORMAT_UNKNOWN;
         m_bHasFlexVerts = false;
     }
 }
@@ -370,6 +388,38 @@ void CMeshVk::SetColorMesh(IMesh *pColorMesh, int nVertexOffsetInBytes)
 
 bool CMeshVk::HasColorMesh() const { return (m_pColorMesh != NULL); }
 
+CVertexBufferVk *CMeshVk::GetStreamVertexBuffer(VertexStreamVk_t stream, VertexFormat_t &fmt, int &nFirstVertex)
+{
+    // The offsets were computed with VertexFormatSize of the stream's own format
+    CVertexBufferVk *pBuffer = NULL;
+    int nOffsetInBytes = 0;
+    fmt = VERTEX_FORMAT_UNKNOWN;
+    switch (stream)
+    {
+    case VERTEX_STREAM_COLOR:
+        if (m_pColorMesh)
+        {
+            pBuffer = m_pColorMesh->GetVertexBuffer();
+            fmt = m_pColorMesh->GetVertexFormat();
+            nOffsetInBytes = m_nColorMeshVertOffsetInBytes;
+        }
+        break;
+    case VERTEX_STREAM_FLEX:
+        if (m_bHasFlexVerts)
+        {
+            pBuffer = m_pFlexVertexBuffer;
+            fmt = m_FlexVertexFormat;
+            nOffsetInBytes = m_nFlexVertOffsetInBytes;
+        }
+        break;
+    default:
+        break;
+    }
+
+    nFirstVertex = pBuffer ? nOffsetInBytes / pBuffer->VertexSize() : 0;
+    return pBuffer;
+}
+
 //-----------------------------------------------------------------------------
 // Locks/ unlocks the vertex buffer
 //-----------------------------------------------------------------------------
@@ -852,24 +902,7 @@ void CMeshVk::SetVertexStreamState(int nVertOffsetInBytes)
             Assert(nVertOffsetInBytes == 0);
             Assert(m_pVertexBuffer);
 
-            // HACK...point stream 2 at the same VB which is bound to stream 0...
-            // NOTE: D3D debug DLLs will RIP if stream 0 has a smaller stride than the largest
-            //       offset in the stream 2 vertex decl elements (which are position(12)+wrinkle(4)+normal(12))
-            // If this fires, go find the material/shader which is requesting a really 'thin'
-            // stream 0 vertex, and fatten it up slightly (e.g. add a D3DCOLOR element)
-            int minimumStreamZeroStride = 4 * sizeof(float);
-            Assert(m_pVertexBuffer->VertexSize() >= minimumStreamZeroStride);
-            if (m_pVertexBuffer->VertexSize() < minimumStreamZeroStride)
-            {
-                static bool bWarned = false;
-                if (!bWarned)
-                {
-                    Warning("Shader specifying too-thin vertex format, should be at least %d bytes! (Supressing "
-                            "furthur warnings)\n",
-                            minimumStreamZeroStride);
-                    bWarned = true;
-                }
-            }
+            // No flex stream gets bound, so unlike D3D stream 0 doesn't need to be wide enough to stand in for it
 
             // cFlexScale.x masks flex in vertex shader
             float c[4] = {0.0f, 0.0f, 0.0f, 0.0f};
@@ -973,8 +1006,8 @@ void CMeshVk::DrawInternal(CPrimList *pLists, int nLists)
     if (i == nLists)
         return;
 
-    // can't do these in selection mode!
-    Assert(!ShaderAPI()->IsInSelectionMode());
+    // can't do these in selection mode, unless it's picking on the GPU!
+    Assert(!ShaderAPI()->IsInSelectionMode() || ShaderAPI()->IsPicking());
 
     if (!SetRenderState(0, 0))
         return;
@@ -989,6 +1022,7 @@ void CMeshVk::DrawInternal(CPrimList *pLists, int nLists)
     }
 #endif
 
+    s_BaseVertex = 0;
     s_FirstVertex = 0;
     s_NumVertices = m_pVertexBuffer->VertexCount();
 
@@ -1014,54 +1048,8 @@ void CMeshVk::RenderPass()
         return;
     }
 
-    for (int iPrim = 0; iPrim < s_nPrims; iPrim++)
-    {
-        CPrimList *pPrim = &s_pPrims[iPrim];
-
-        if (pPrim->m_NumIndices == 0)
-            continue;
-
-        g_pShaderDevice->DrawMesh(this);
-        // VK_TODO
-        /*
-        if ((m_Type == MATERIAL_POINTS) || (m_Type == MATERIAL_INSTANCED_QUADS))
-        {
-            // (For point/instanced-quad lists, we don't actually fill in indices, but we treat it as
-            // though there are indices for the list up until here).
-            g_pShaderDevice->DrawPrimitive(m_Mode, s_FirstVertex, pPrim->m_NumIndices);
-        }
-        else
-        {
-            int numPrimitives = NumPrimitives(s_NumVertices, pPrim->m_NumIndices);
-
-            {
-                VPROF("g_pShaderDeviceVk->DrawIndexedPrimitive");
-                VPROF_INCREMENT_COUNTER("DrawIndexedPrimitive", 1);
-                VPROF_INCREMENT_COUNTER("numPrimitives", numPrimitives);
-
-                g_pShaderDevice->DrawIndexedPrimitive(
-                    m_Mode, // Member of the VkPrimitiveTopology enumerated type, describing the type of primitive to
-                            // render. D3DPT_POINTLIST is not supported with this method.
-
-                    m_FirstIndex, // Offset from the start of the vertex buffer to the first vertex index. An index of 0
-                                  // in the index buffer refers to this location in the vertex buffer.
-
-                    s_FirstVertex, // Minimum vertex index for vertices used during this call. This is a zero based
-                                   // index relative to BaseVertexIndex. The first Vertex in the vertexbuffer that we
-                                   // are currently using for the current batch.
-
-                    s_NumVertices, // Number of vertices used during this call. The first vertex is located at index:
-                                   // BaseVertexIndex + MinIndex.
-
-                    pPrim->m_FirstIndex, // Index of the first index to use when accesssing the vertex buffer. Beginning
-                                         // at StartIndex to index vertices from the vertex buffer.
-
-                    numPrimitives); // Number of primitives to render. The number of vertices used is a function of the
-                                    // primitive count and the primitive type.
-            }
-        }
-        */
-    }
+    // One copy of the vertices used and the indices of all prim lists, each list becomes a draw of it
+    g_pShaderDevice->DrawMesh(this, s_BaseVertex, s_FirstVertex, s_NumVertices, s_pPrims, s_nPrims);
 }
 
 //-----------------------------------------------------------------------------
@@ -1330,6 +1318,9 @@ void CDynamicMeshVk::Draw(int nFirstIndex, int nIndexCount)
             }
         }
 
+        // Flex meshes offset the stream instead of the indices
+        s_BaseVertex = actualFirstVertex + (HasFlexMesh() ? nFirstVertex : 0);
+
         // Fix up nFirstVertex to indicate the first vertex used in the data
         if (!HasFlexMesh())
         {
@@ -1370,6 +1361,7 @@ void CDynamicMeshVk::DrawSinglePassImmediately()
         // Set the render state
         if (SetRenderState(0, 0))
         {
+            s_BaseVertex = 0;
             s_FirstVertex = m_nFirstVertex;
             s_NumVertices = m_TotalVertices;
 
@@ -1607,6 +1599,10 @@ void CTempMeshVk::Draw(int nFirstIndex, int nIndexCount)
                 // a RenderPass() call
                 Assert(!m_InPass);
             }
+            else if (ShaderAPI()->IsPicking())
+            {
+                DrawPick(nFirstIndex, nIndexCount);
+            }
             else
             {
                 TestSelection();
@@ -1657,7 +1653,7 @@ static void ComputeModelToView(glm::mat4 &modelToView)
     glm::mat4 world, view;
     ShaderAPI()->GetMatrix(MATERIAL_MODEL, (float *)&world);
     ShaderAPI()->GetMatrix(MATERIAL_VIEW, (float *)&view);
-    modelToView = glm::matrixCompMult(world, view);
+    modelToView = world * view;
 }
 
 static float ComputeCullFactor()
@@ -1693,10 +1689,15 @@ static float ComputeCullFactor()
 //-----------------------------------------------------------------------------
 // Clip to viewport
 //-----------------------------------------------------------------------------
-static int g_NumClipVerts;
-static glm::vec3 g_ClipVerts[16];
 
-static bool PointInsidePlane(glm::vec3 *pVert, int normalInd, float val, bool nearClip)
+// Vertices made while clipping one triangle, callers keep it on the stack
+struct ClipVertsVk_t
+{
+    glm::vec3 m_Verts[16];
+    int m_nCount;
+};
+
+static bool PointInsidePlane(const glm::vec3 *pVert, int normalInd, float val, bool nearClip)
 {
     if ((val > 0) || nearClip)
         return (val - (*pVert)[normalInd] >= 0);
@@ -1704,7 +1705,7 @@ static bool PointInsidePlane(glm::vec3 *pVert, int normalInd, float val, bool ne
         return ((*pVert)[normalInd] - val >= 0);
 }
 
-static void IntersectPlane(glm::vec3 *pStart, glm::vec3 *pEnd, int normalInd, float val, glm::vec3 *pOutVert)
+static void IntersectPlane(const glm::vec3 *pStart, const glm::vec3 *pEnd, int normalInd, float val, glm::vec3 *pOutVert)
 {
     glm::vec3 dir = *pEnd - *pStart;
     Assert(dir[normalInd] != 0.0f);
@@ -1717,23 +1718,24 @@ static void IntersectPlane(glm::vec3 *pStart, glm::vec3 *pEnd, int normalInd, fl
     (*pOutVert)[normalInd] = val;
 }
 
-static int ClipTriangleAgainstPlane(glm::vec3 **ppVert, int nVertexCount, glm::vec3 **ppOutVert, int normalInd, float val,
-                                    bool nearClip = false)
+static int ClipTriangleAgainstPlane(ClipVertsVk_t &clipVerts, const glm::vec3 **ppVert, int nVertexCount, const glm::vec3 **ppOutVert,
+                                    int normalInd, float val, bool nearClip = false)
 {
     // Ye Olde Sutherland-Hodgman clipping algorithm
     int numOutVerts = 0;
-    glm::vec3 *pStart = ppVert[nVertexCount - 1];
+    const glm::vec3 *pStart = ppVert[nVertexCount - 1];
     bool startInside = PointInsidePlane(pStart, normalInd, val, nearClip);
     for (int i = 0; i < nVertexCount; ++i)
     {
-        glm::vec3 *pEnd = ppVert[i];
+        const glm::vec3 *pEnd = ppVert[i];
         bool endInside = PointInsidePlane(pEnd, normalInd, val, nearClip);
         if (endInside)
         {
             if (!startInside)
             {
-                IntersectPlane(pStart, pEnd, normalInd, val, &g_ClipVerts[g_NumClipVerts]);
-                ppOutVert[numOutVerts++] = &g_ClipVerts[g_NumClipVerts++];
+                Assert(clipVerts.m_nCount < (int)ARRAYSIZE(clipVerts.m_Verts));
+                IntersectPlane(pStart, pEnd, normalInd, val, &clipVerts.m_Verts[clipVerts.m_nCount]);
+                ppOutVert[numOutVerts++] = &clipVerts.m_Verts[clipVerts.m_nCount++];
             }
             ppOutVert[numOutVerts++] = pEnd;
         }
@@ -1741,8 +1743,9 @@ static int ClipTriangleAgainstPlane(glm::vec3 **ppVert, int nVertexCount, glm::v
         {
             if (startInside)
             {
-                IntersectPlane(pStart, pEnd, normalInd, val, &g_ClipVerts[g_NumClipVerts]);
-                ppOutVert[numOutVerts++] = &g_ClipVerts[g_NumClipVerts++];
+                Assert(clipVerts.m_nCount < (int)ARRAYSIZE(clipVerts.m_Verts));
+                IntersectPlane(pStart, pEnd, normalInd, val, &clipVerts.m_Verts[clipVerts.m_nCount]);
+                ppOutVert[numOutVerts++] = &clipVerts.m_Verts[clipVerts.m_nCount++];
             }
         }
         pStart = pEnd;
@@ -1752,61 +1755,62 @@ static int ClipTriangleAgainstPlane(glm::vec3 **ppVert, int nVertexCount, glm::v
     return numOutVerts;
 }
 
-void CTempMeshVk::ClipTriangle(glm::vec3 **ppVert, float zNear, glm::mat4 &projection)
+void CTempMeshVk::ClipTriangle(const glm::vec3 **ppVert, float zNear, const glm::mat4 &projection)
 {
     int i;
     int nVertexCount = 3;
-    glm::vec3 **ppClipVert1;
-    glm::vec3 **ppClipVert2;
+    const glm::vec3 *ppClipVert1[16];
+    const glm::vec3 *ppClipVert2[16];
 
-    g_NumClipVerts = 0;
+    ClipVertsVk_t clipVerts;
+    clipVerts.m_nCount = 0;
 
     // Clip against the near plane in view space to prevent negative w.
     // Clip against each plane
-    nVertexCount = ClipTriangleAgainstPlane(ppVert, nVertexCount, ppClipVert1, 2, zNear, true);
+    nVertexCount = ClipTriangleAgainstPlane(clipVerts, ppVert, nVertexCount, ppClipVert1, 2, zNear, true);
     if (nVertexCount < 3)
         return;
 
     // Sucks that I have to do this, but I have to clip near plane in view space
     // Clipping in projection space is screwy when w < 0
     // Transform the clipped points into projection space
-    Assert(g_NumClipVerts <= 2);
+    Assert(clipVerts.m_nCount <= 2);
     for (i = 0; i < nVertexCount; ++i)
     {
-        if (ppClipVert1[i] == &g_ClipVerts[0])
+        if (ppClipVert1[i] == &clipVerts.m_Verts[0])
         {
             // VK_TODO: glm doesn't like vec3 * mat4
-            g_ClipVerts[0] = TransformVec3(*ppClipVert1[i], projection);
+            clipVerts.m_Verts[0] = TransformVec3(*ppClipVert1[i], projection);
         }
-        else if (ppClipVert1[i] == &g_ClipVerts[1])
+        else if (ppClipVert1[i] == &clipVerts.m_Verts[1])
         {
-            g_ClipVerts[1] = TransformVec3(*ppClipVert1[i], projection);
+            clipVerts.m_Verts[1] = TransformVec3(*ppClipVert1[i], projection);
         }
         else
         {
-            g_ClipVerts[g_NumClipVerts] = TransformVec3(*ppClipVert1[i], projection);
-            ppClipVert1[i] = &g_ClipVerts[g_NumClipVerts];
-            ++g_NumClipVerts;
+            clipVerts.m_Verts[clipVerts.m_nCount] = TransformVec3(*ppClipVert1[i], projection);
+            ppClipVert1[i] = &clipVerts.m_Verts[clipVerts.m_nCount];
+            ++clipVerts.m_nCount;
         }
     }
 
-    nVertexCount = ClipTriangleAgainstPlane(ppClipVert1, nVertexCount, ppClipVert2, 2, 1.0f);
+    nVertexCount = ClipTriangleAgainstPlane(clipVerts, ppClipVert1, nVertexCount, ppClipVert2, 2, 1.0f);
     if (nVertexCount < 3)
         return;
 
-    nVertexCount = ClipTriangleAgainstPlane(ppClipVert2, nVertexCount, ppClipVert1, 0, 1.0f);
+    nVertexCount = ClipTriangleAgainstPlane(clipVerts, ppClipVert2, nVertexCount, ppClipVert1, 0, 1.0f);
     if (nVertexCount < 3)
         return;
 
-    nVertexCount = ClipTriangleAgainstPlane(ppClipVert1, nVertexCount, ppClipVert2, 0, -1.0f);
+    nVertexCount = ClipTriangleAgainstPlane(clipVerts, ppClipVert1, nVertexCount, ppClipVert2, 0, -1.0f);
     if (nVertexCount < 3)
         return;
 
-    nVertexCount = ClipTriangleAgainstPlane(ppClipVert2, nVertexCount, ppClipVert1, 1, 1.0f);
+    nVertexCount = ClipTriangleAgainstPlane(clipVerts, ppClipVert2, nVertexCount, ppClipVert1, 1, 1.0f);
     if (nVertexCount < 3)
         return;
 
-    nVertexCount = ClipTriangleAgainstPlane(ppClipVert1, nVertexCount, ppClipVert2, 1, -1.0f);
+    nVertexCount = ClipTriangleAgainstPlane(clipVerts, ppClipVert1, nVertexCount, ppClipVert2, 1, -1.0f);
     if (nVertexCount < 3)
         return;
 
@@ -1824,6 +1828,123 @@ void CTempMeshVk::ClipTriangle(glm::vec3 **ppVert, float zNear, glm::mat4 &proje
     ShaderAPI()->RegisterSelectionHit(minz, maxz);
 }
 
+// Planes of the view frustum a vertex is outside of, the same ones ClipTriangle clips against
+enum SelectionOutcode_t
+{
+    SELECTION_OUTSIDE_NEAR = 0x1,
+    SELECTION_OUTSIDE_FAR = 0x2,
+    SELECTION_OUTSIDE_RIGHT = 0x4,
+    SELECTION_OUTSIDE_LEFT = 0x8,
+    SELECTION_OUTSIDE_TOP = 0x10,
+    SELECTION_OUTSIDE_BOTTOM = 0x20,
+};
+
+// Coefficients of one component of v * mat, where glm column i holds those of component i
+static void LoadTransformSIMD(const glm::mat4 &mat, fltx4 pCoef[4][4])
+{
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            pCoef[i][j] = ReplicateX4(mat[i][j]);
+        }
+    }
+}
+
+// One component of four points with w = 1
+static inline fltx4 TransformComponentSIMD(const fltx4 pCoef[4], const FourVectors &v)
+{
+    return MaddSIMD(v.x, pCoef[0], MaddSIMD(v.y, pCoef[1], MaddSIMD(v.z, pCoef[2], pCoef[3])));
+}
+
+//-----------------------------------------------------------------------------
+// Transforms every vertex the indices reference into view space four at a time,
+// along with its projected depth and the frustum planes it is outside of
+//-----------------------------------------------------------------------------
+void CTempMeshVk::TransformSelectionVertices(const glm::mat4 &modelToView, const glm::mat4 &projection, float zNear)
+{
+    int nVertexCount = 0;
+    for (int i = 0; i < m_IndexData.Count(); i++)
+    {
+        nVertexCount = MAX(nVertexCount, m_IndexData[i] + 1);
+    }
+    Assert(nVertexCount * m_VertexSize <= m_VertexData.Count());
+
+    m_SelectionViewPos.SetCount(nVertexCount);
+    m_SelectionDepth.SetCount(nVertexCount);
+    m_SelectionOutcodes.SetCount(nVertexCount);
+
+    // The model and view matrices are affine, the projection only has to be applied once for w
+    fltx4 viewCoef[4][4];
+    fltx4 projCoef[4][4];
+    LoadTransformSIMD(modelToView, viewCoef);
+    LoadTransformSIMD(projection, projCoef);
+    fltx4 zNear4 = ReplicateX4(zNear);
+
+    for (int i = 0; i < nVertexCount; i += 4)
+    {
+        // LoadAndSwizzle reads a float past each position, so the last group is copied out first
+        FourVectors position;
+        if (i + 4 < nVertexCount)
+        {
+            const unsigned char *pVertex = &m_VertexData[i * m_VertexSize];
+            position.LoadAndSwizzle(*(const Vector *)pVertex, *(const Vector *)(pVertex + m_VertexSize),
+                                    *(const Vector *)(pVertex + 2 * m_VertexSize), *(const Vector *)(pVertex + 3 * m_VertexSize));
+        }
+        else
+        {
+            ALIGN16 float padded[4][4] ALIGN16_POST;
+            for (int j = 0; j < 4; j++)
+            {
+                const float *pPosition = (const float *)&m_VertexData[MIN(i + j, nVertexCount - 1) * m_VertexSize];
+                padded[j][0] = pPosition[0];
+                padded[j][1] = pPosition[1];
+                padded[j][2] = pPosition[2];
+                padded[j][3] = 0.0f;
+            }
+            position.LoadAndSwizzleAligned(padded[0], padded[1], padded[2], padded[3]);
+        }
+
+        FourVectors view;
+        view.x = TransformComponentSIMD(viewCoef[0], position);
+        view.y = TransformComponentSIMD(viewCoef[1], position);
+        view.z = TransformComponentSIMD(viewCoef[2], position);
+
+        fltx4 clipX = TransformComponentSIMD(projCoef[0], view);
+        fltx4 clipY = TransformComponentSIMD(projCoef[1], view);
+        fltx4 clipZ = TransformComponentSIMD(projCoef[2], view);
+        fltx4 clipW = TransformComponentSIMD(projCoef[3], view);
+        fltx4 negClipW = NegSIMD(clipW);
+        fltx4 depth = DivSIMD(clipZ, clipW);
+
+        // Compared against w these hold for points behind the camera too, so a triangle
+        // with all three vertices outside one plane has nothing left after clipping
+        int nNear = TestSignSIMD(CmpGtSIMD(view.z, zNear4));
+        int nFar = TestSignSIMD(CmpGtSIMD(clipZ, clipW));
+        int nRight = TestSignSIMD(CmpGtSIMD(clipX, clipW));
+        int nLeft = TestSignSIMD(CmpLtSIMD(clipX, negClipW));
+        int nTop = TestSignSIMD(CmpGtSIMD(clipY, clipW));
+        int nBottom = TestSignSIMD(CmpLtSIMD(clipY, negClipW));
+
+        int nLanes = MIN(4, nVertexCount - i);
+        for (int j = 0; j < nLanes; j++)
+        {
+            m_SelectionViewPos[i + j] = glm::vec3(SubFloat(view.x, j), SubFloat(view.y, j), SubFloat(view.z, j));
+            m_SelectionDepth[i + j] = SubFloat(depth, j);
+
+            int nBit = 1 << j;
+            unsigned char outcode = 0;
+            outcode |= (nNear & nBit) ? SELECTION_OUTSIDE_NEAR : 0;
+            outcode |= (nFar & nBit) ? SELECTION_OUTSIDE_FAR : 0;
+            outcode |= (nRight & nBit) ? SELECTION_OUTSIDE_RIGHT : 0;
+            outcode |= (nLeft & nBit) ? SELECTION_OUTSIDE_LEFT : 0;
+            outcode |= (nTop & nBit) ? SELECTION_OUTSIDE_TOP : 0;
+            outcode |= (nBottom & nBit) ? SELECTION_OUTSIDE_BOTTOM : 0;
+            m_SelectionOutcodes[i + j] = outcode;
+        }
+    }
+}
+
 //-----------------------------------------------------------------------------
 // Selection mode
 //-----------------------------------------------------------------------------
@@ -1842,8 +1963,7 @@ void CTempMeshVk::TestSelection()
     ShaderAPI()->GetMatrix(MATERIAL_PROJECTION, (float *)&projection);
     float zNear = -projection[3][2] / projection[2][2];
 
-    glm::vec3 *pPos[3];
-    glm::vec3 edge[2];
+    TransformSelectionVertices(modelToView, projection, zNear);
 
     int numTriangles;
     if (m_Type == MATERIAL_TRIANGLES)
@@ -1857,15 +1977,7 @@ void CTempMeshVk::TestSelection()
     if (m_Type == MATERIAL_TRIANGLE_STRIP)
         cullFactor *= -1.0f;
 
-    // We'll need some temporary memory to tell us if we're transformed the vert
-    int nVertexCount = m_VertexData.Count() / m_VertexSize;
-    static CUtlVector<unsigned char> transformedVert;
-    int transformedVertSize = (nVertexCount + 7) >> 3;
-    transformedVert.RemoveAll();
-    transformedVert.EnsureCapacity(transformedVertSize);
-    transformedVert.AddMultipleToTail(transformedVertSize);
-    memset(transformedVert.Base(), 0, transformedVertSize);
-
+    const glm::vec3 *pPos[3];
     int indexPos;
     for (int i = 0; i < numTriangles; ++i)
     {
@@ -1881,6 +1993,13 @@ void CTempMeshVk::TestSelection()
             indexPos = i;
         }
 
+        int index[3] = {m_IndexData[indexPos], m_IndexData[indexPos + 1], m_IndexData[indexPos + 2]};
+
+        // Outside one plane entirely
+        unsigned char outsideAll = m_SelectionOutcodes[index[0]] & m_SelectionOutcodes[index[1]] & m_SelectionOutcodes[index[2]];
+        if (outsideAll)
+            continue;
+
         // BAH. Gotta clip to the near clip plane in view space to prevent
         // negative w coords; negative coords throw off the projection-space clipper.
 
@@ -1888,18 +2007,9 @@ void CTempMeshVk::TestSelection()
         int inFrontIdx = -1;
         for (int j = 0; j < 3; ++j)
         {
-            int index = m_IndexData[indexPos];
-            glm::vec3 *pPosition = (glm::vec3 *)&m_VertexData[index * m_VertexSize];
-            if ((transformedVert[index >> 3] & (1 << (index & 0x7))) == 0)
-            {
-                *pPosition = TransformVec3(*pPosition, modelToView);
-                transformedVert[index >> 3] |= (1 << (index & 0x7));
-            }
-
-            pPos[j] = pPosition;
+            pPos[j] = &m_SelectionViewPos[index[j]];
             if (pPos[j]->z < 0.0f)
                 inFrontIdx = j;
-            ++indexPos;
         }
 
         // all points are behind the camera
@@ -1907,18 +2017,54 @@ void CTempMeshVk::TestSelection()
             continue;
 
         // backface cull....
-        edge[0] = *pPos[1] - *pPos[0];
-        edge[1] = *pPos[2] - *pPos[0];
-        glm::vec3 normal = edge[0] - edge[1];
+        glm::vec3 normal = glm::cross(*pPos[1] - *pPos[0], *pPos[2] - *pPos[0]);
         const float dot = glm::dot(normal, *pPos[inFrontIdx]);
         if (dot * cullFactor > 0.0f)
             continue;
 
+        // Inside every plane, nothing to clip
+        unsigned char outsideAny = m_SelectionOutcodes[index[0]] | m_SelectionOutcodes[index[1]] | m_SelectionOutcodes[index[2]];
+        if (!outsideAny)
+        {
+            float minz = MIN(m_SelectionDepth[index[0]], MIN(m_SelectionDepth[index[1]], m_SelectionDepth[index[2]]));
+            float maxz = MAX(m_SelectionDepth[index[0]], MAX(m_SelectionDepth[index[1]], m_SelectionDepth[index[2]]));
+            ShaderAPI()->RegisterSelectionHit(minz, maxz);
+            continue;
+        }
+
         // Clip to viewport
         ClipTriangle(pPos, zNear, projection);
     }
 }
 
+//-----------------------------------------------------------------------------
+// Picking draws the triangles once through the dynamic mesh, the pick buffer does the hit test
+//-----------------------------------------------------------------------------
+void CTempMeshVk::DrawPick(int nFirstIndex, int nIndexCount)
+{
+    // Points and lines can't be hit, same as TestSelection
+    if ((m_Type != MATERIAL_TRIANGLES) && (m_Type != MATERIAL_TRIANGLE_STRIP))
+        return;
+
+    if ((nFirstIndex == -1) && (nIndexCount == 0))
+    {
+        nFirstIndex = 0;
+        nIndexCount = m_IndexData.Count();
+    }
+    if (nIndexCount == 0)
+        return;
+
+    int nVertexCount = m_VertexData.Count() / m_VertexSize;
+    CDynamicMeshVk *pMesh = GetDynamicMesh();
+
+    CMeshBuilder meshBuilder;
+    meshBuilder.Begin(pMesh, m_Type, nVertexCount, nIndexCount);
+    CopyToMeshBuilder(0, nVertexCount, nFirstIndex, nIndexCount, 0, meshBuilder);
+    meshBuilder.End();
+
+    pMesh->DrawSinglePassImmediately();
+}
+
 //-----------------------------------------------------------------------------
 // Begins a render pass
 //-----------------------------------------------------------------------------
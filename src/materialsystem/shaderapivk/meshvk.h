@@ -12,6 +12,7 @@
 #include "localvktypes.h"
 #include "materialsystem/imaterial.h"
 #include "materialsystem/imesh.h"
+#include "vertexvk.h"
 
 class CIndexBufferVk;
 class CVertexBufferVk;
@@ -138,6 +139,14 @@ abstract_class CBaseMeshVk : public IMesh
     virtual CVertexBufferVk *GetVertexBuffer() { return 0; }
     virtual CIndexBufferVk *GetIndexBuffer() { return 0; }
 
+    // Buffer bound to a secondary stream, its format and the vertex matching vertex 0 of this mesh, NULL if the stream is unused
+    virtual CVertexBufferVk *GetStreamVertexBuffer(VertexStreamVk_t stream, VertexFormat_t &fmt, int &nFirstVertex)
+    {
+        fmt = VERTEX_FORMAT_UNKNOWN;
+        nFirstVertex = 0;
+        return 0;
+    }
+
     // Do I need to reset the vertex format?
     virtual bool NeedsVertexFormatReset(VertexFormat_t fmt) const;
 
@@ -196,6 +205,7 @@ class CMeshVk : public CBaseMeshVk
     // returns a static vertex buffer...
     CVertexBufferVk *GetVertexBuffer() { return m_pVertexBuffer; }
     CIndexBufferVk *GetIndexBuffer() { return m_pIndexBuffer; }
+    CVertexBufferVk *GetStreamVertexBuffer(VertexStreamVk_t stream, VertexFormat_t &fmt, int &nFirstVertex);
 
     void SetColorMesh(IMesh *pColorMesh, int nVertexOffsetInBytes);
     void SetFlexMesh(IMesh *pMesh, int nVertexOffsetInBytes);
@@ -259,6 +269,7 @@ class CMeshVk : public CBaseMeshVk
     int m_nColorMeshVertOffsetInBytes;
 
     CVertexBufferVk *m_pFlexVertexBuffer;
+    VertexFormat_t m_FlexVertexFormat; // The dynamic buffer only knows its vertex size
 
     bool m_bHasFlexVerts;
     int m_nFlexVertOffsetInBytes;
@@ -281,6 +292,7 @@ class CMeshVk : public CBaseMeshVk
     // Used in rendering sub-parts of the mesh
     static CPrimList *s_pPrims;
     static int s_nPrims;
+    static unsigned int s_BaseVertex;  // Vertex of the buffer an index of 0 refers to
     static unsigned int s_FirstVertex; // Gets reset during CMeshVk::DrawInternal
     static unsigned int s_NumVertices;
     int m_FirstIndex;
@@ -416,13 +428,20 @@ class CTempMeshVk : public CBaseMeshVk
   private:
     // Selection mode
     void TestSelection();
-    void ClipTriangle(glm::vec3 **ppVert, float zNear, glm::mat4 &proj);
+    void DrawPick(int nFirstIndex, int nIndexCount);
+    void TransformSelectionVertices(const glm::mat4 &modelToView, const glm::mat4 &projection, float zNear);
+    void ClipTriangle(const glm::vec3 **ppVert, float zNear, const glm::mat4 &proj);
 
     CDynamicMeshVk *GetDynamicMesh();
 
     CUtlVector<unsigned char, CUtlMemoryAligned<unsigned char, 32>> m_VertexData;
     CUtlVector<uint16_t> m_IndexData;
 
+    // Selection mode scratch, per vertex view space position, projected depth and SelectionOutcode_t
+    CUtlVector<glm::vec3> m_SelectionViewPos;
+    CUtlVector<float> m_SelectionDepth;
+    CUtlVector<unsigned char> m_SelectionOutcodes;
+
     uint16_t m_VertexSize;
     MaterialPrimitiveType_t m_Type;
     int m_LockedVerts;
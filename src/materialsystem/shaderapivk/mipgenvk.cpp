@@ -0,0 +1,156 @@
+#include "mipgenvk.h"
+#include "filesystem.h"
+#include "shaderdevicevk.h"
+#include "tier1/utlbuffer.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+enum
+{
+    MIPGEN_GROUP_SIZE = 8,
+};
+
+CMipGeneratorVk::CMipGeneratorVk()
+{
+    m_PhysicalDevice = VK_NULL_HANDLE;
+    m_bStorageWriteWithoutFormat = false;
+    m_DescriptorSetLayout = VK_NULL_HANDLE;
+    m_PipelineLayout = VK_NULL_HANDLE;
+    m_Pipeline = VK_NULL_HANDLE;
+}
+
+CMipGeneratorVk::~CMipGeneratorVk() { Assert(m_Pipeline == VK_NULL_HANDLE); }
+
+void CMipGeneratorVk::Init(VkPhysicalDevice physicalDevice, bool bStorageWriteWithoutFormat)
+{
+    m_PhysicalDevice = physicalDevice;
+    m_bStorageWriteWithoutFormat = bStorageWriteWithoutFormat;
+
+    // The shader doesn't know the destination format
+    if (m_bStorageWriteWithoutFormat)
+    {
+        CreateComputePipeline();
+    }
+}
+
+void CMipGeneratorVk::Shutdown()
+{
+    VkDevice device = g_pShaderDevice->GetVkDevice();
+    if (m_Pipeline != VK_NULL_HANDLE)
+    {
+        vkDestroyPipeline(device, m_Pipeline, g_pAllocCallbacks);
+    }
+    if (m_PipelineLayout != VK_NULL_HANDLE)
+    {
+        vkDestroyPipelineLayout(device, m_PipelineLayout, g_pAllocCallbacks);
+    }
+    if (m_DescriptorSetLayout != VK_NULL_HANDLE)
+    {
+        vkDestroyDescriptorSetLayout(device, m_DescriptorSetLayout, g_pAllocCallbacks);
+    }
+
+    m_Pipeline = VK_NULL_HANDLE;
+    m_PipelineLayout = VK_NULL_HANDLE;
+    m_DescriptorSetLayout = VK_NULL_HANDLE;
+}
+
+MipGenMode_t CMipGeneratorVk::ChooseMode(VkFormat format, bool bSRGB, bool bVolume) const
+{
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(m_PhysicalDevice, format, &props);
+    VkFormatFeatureFlags features = props.optimalTilingFeatures;
+
+    const VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+    const VkFormatFeatureFlags compute = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+    bool bBlit = (features & blit) == blit;
+    bool bLinearBlit = bBlit && (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+    bool bCompute = m_Pipeline != VK_NULL_HANDLE && !bVolume && (features & compute) == compute;
+
+    // Blits filter the raw values, sRGB data has to be decoded first
+    if (bCompute && (bSRGB || !bLinearBlit))
+        return MIPGEN_COMPUTE;
+
+    if (bLinearBlit)
+        return MIPGEN_BLIT_LINEAR;
+
+    if (bBlit)
+        return MIPGEN_BLIT_NEAREST;
+
+    return MIPGEN_NONE;
+}
+
+void CMipGeneratorVk::Dispatch(VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, uint32_t srcWidth, uint32_t srcHeight,
+                               uint32_t dstWidth, uint32_t dstHeight, uint32_t layers, bool bSRGB)
+{
+    Assert(m_Pipeline != VK_NULL_HANDLE);
+
+    MipGenPushConstants_t pushConstants;
+    pushConstants.m_nSrcWidth = (int32_t)srcWidth;
+    pushConstants.m_nSrcHeight = (int32_t)srcHeight;
+    pushConstants.m_bSRGB = bSRGB ? 1 : 0;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_Pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_PipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, m_PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+    uint32_t groupsX = (dstWidth + MIPGEN_GROUP_SIZE - 1) / MIPGEN_GROUP_SIZE;
+    uint32_t groupsY = (dstHeight + MIPGEN_GROUP_SIZE - 1) / MIPGEN_GROUP_SIZE;
+    vkCmdDispatch(commandBuffer, groupsX, groupsY, layers);
+}
+
+void CMipGeneratorVk::CreateComputePipeline()
+{
+    CUtlBuffer code;
+    if (!g_pFullFileSystem->ReadFile("shaders/mipgen.spv", "EXECUTABLE_PATH", code))
+    {
+        Warning("CMipGeneratorVk: shaders/mipgen.spv not found, mips are generated with blits only\n");
+        return;
+    }
+
+    VkDevice device = g_pShaderDevice->GetVkDevice();
+
+    VkDescriptorSetLayoutBinding bindings[2] = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = ARRAYSIZE(bindings);
+    layoutInfo.pBindings = bindings;
+    vkCheck(vkCreateDescriptorSetLayout(device, &layoutInfo, g_pAllocCallbacks, &m_DescriptorSetLayout),
+            "failed to create mip generation descriptor set layout");
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(MipGenPushConstants_t);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_DescriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    vkCheck(vkCreatePipelineLayout(device, &pipelineLayoutInfo, g_pAllocCallbacks, &m_PipelineLayout),
+            "failed to create mip generation pipeline layout");
+
+    VkShaderModule shaderModule = g_pShaderDevice->CreateShaderModule((const uint32_t *)code.Base(), code.TellPut());
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = m_PipelineLayout;
+    vkCheck(vkCreateComputePipelines(device, g_pShaderDevice->GetPipelineCache(), 1, &pipelineInfo, g_pAllocCallbacks, &m_Pipeline),
+            "failed to create mip generation pipeline");
+
+    vkDestroyShaderModule(device, shaderModule, g_pAllocCallbacks);
+}
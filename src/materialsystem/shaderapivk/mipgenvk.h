@@ -0,0 +1,64 @@
+//
+
+#ifndef MIPGENVK_H
+#define MIPGENVK_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "vulkanimpl.h"
+
+//-----------------------------------------------------------------------------
+// How a texture's mip chain gets filled from level 0
+//-----------------------------------------------------------------------------
+enum MipGenMode_t
+{
+    MIPGEN_NONE = 0,     // Format can't be blitted or written from compute
+    MIPGEN_BLIT_LINEAR,  // vkCmdBlitImage with VK_FILTER_LINEAR
+    MIPGEN_BLIT_NEAREST, // Blittable but not linearly filterable, and no compute path
+    MIPGEN_COMPUTE,      // 2x2 box filter in shaders/mipgen.comp
+};
+
+// Push constants of shaders/mipgen.comp
+struct MipGenPushConstants_t
+{
+    int32_t m_nSrcWidth;
+    int32_t m_nSrcHeight;
+    uint32_t m_bSRGB; // Filter in linear space, the texture stores sRGB encoded data
+};
+
+//-----------------------------------------------------------------------------
+// Picks a mip generation path per format and owns the compute fallback pipeline.
+// The barriers and per-level descriptors live with the texture, see CTextureVk::GenerateMipmaps.
+//-----------------------------------------------------------------------------
+class CMipGeneratorVk
+{
+  public:
+    CMipGeneratorVk();
+    ~CMipGeneratorVk();
+
+    void Init(VkPhysicalDevice physicalDevice, bool bStorageWriteWithoutFormat);
+    void Shutdown();
+
+    // Volume textures are never generated in compute
+    MipGenMode_t ChooseMode(VkFormat format, bool bSRGB, bool bVolume) const;
+
+    // Binding 0 is the source level as a combined image sampler, binding 1 the destination level as a storage image
+    VkDescriptorSetLayout GetDescriptorSetLayout() const { return m_DescriptorSetLayout; }
+
+    // Records one level, 8x8 threads per group and one group layer per array layer
+    void Dispatch(VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth,
+                  uint32_t dstHeight, uint32_t layers, bool bSRGB);
+
+  private:
+    void CreateComputePipeline();
+
+    VkPhysicalDevice m_PhysicalDevice;
+    bool m_bStorageWriteWithoutFormat;
+    VkDescriptorSetLayout m_DescriptorSetLayout;
+    VkPipelineLayout m_PipelineLayout;
+    VkPipeline m_Pipeline;
+};
+
+#endif // MIPGENVK_H
@@ -0,0 +1,230 @@
+#include "pickbuffervk.h"
+#include "buffervkutil.h"
+#include "filesystem.h"
+#include "shaderdevicevk.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlmap.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Color and depth texels at the largest pick size, depth is at most 4 bytes too
+static const VkDeviceSize PICK_READBACK_SIZE = PICK_BUFFER_MAX_SIZE * PICK_BUFFER_MAX_SIZE * sizeof(uint32_t) * 2;
+
+CPickBufferVk::CPickBufferVk()
+{
+    m_PhysicalDevice = VK_NULL_HANDLE;
+    m_FragShaderModule = VK_NULL_HANDLE;
+    m_DepthFormat = VK_FORMAT_UNDEFINED;
+    m_nWidth = 1;
+    m_nHeight = 1;
+    m_ColorImage = VK_NULL_HANDLE;
+    m_ColorMemory = VK_NULL_HANDLE;
+    m_ColorView = VK_NULL_HANDLE;
+    m_DepthImage = VK_NULL_HANDLE;
+    m_DepthMemory = VK_NULL_HANDLE;
+    m_DepthView = VK_NULL_HANDLE;
+    m_ReadbackBuffer = VK_NULL_HANDLE;
+    m_ReadbackMemory = VK_NULL_HANDLE;
+    m_pReadback = NULL;
+    m_Fence = VK_NULL_HANDLE;
+}
+
+CPickBufferVk::~CPickBufferVk() { Assert(m_FragShaderModule == VK_NULL_HANDLE); }
+
+void CPickBufferVk::Init(VkPhysicalDevice physicalDevice)
+{
+    m_PhysicalDevice = physicalDevice;
+
+    CUtlBuffer code;
+    if (!g_pFullFileSystem->ReadFile("shaders/pick.spv", "EXECUTABLE_PATH", code))
+    {
+        Warning("CPickBufferVk: shaders/pick.spv not found, selection tests triangles on the CPU\n");
+        return;
+    }
+
+    m_FragShaderModule = g_pShaderDevice->CreateShaderModule((const uint32_t *)code.Base(), code.TellPut());
+    CreateTargets();
+}
+
+void CPickBufferVk::Shutdown()
+{
+    if (m_FragShaderModule == VK_NULL_HANDLE)
+        return;
+
+    // The device is idle, only the framebuffers of the render pass cache still point at the views
+    VkDevice device = g_pShaderDevice->GetVkDevice();
+    g_pShaderDevice->GetRenderPassCache().ReleaseFramebuffers(m_ColorView);
+    g_pShaderDevice->GetRenderPassCache().ReleaseFramebuffers(m_DepthView);
+
+    vkDestroyImageView(device, m_ColorView, g_pAllocCallbacks);
+    vkDestroyImage(device, m_ColorImage, g_pAllocCallbacks);
+    vkFreeMemory(device, m_ColorMemory, g_pAllocCallbacks);
+    vkDestroyImageView(device, m_DepthView, g_pAllocCallbacks);
+    vkDestroyImage(device, m_DepthImage, g_pAllocCallbacks);
+    vkFreeMemory(device, m_DepthMemory, g_pAllocCallbacks);
+
+    // Freeing the memory unmaps it
+    vkDestroyBuffer(device, m_ReadbackBuffer, g_pAllocCallbacks);
+    vkFreeMemory(device, m_ReadbackMemory, g_pAllocCallbacks);
+    vkDestroyFence(device, m_Fence, g_pAllocCallbacks);
+    vkDestroyShaderModule(device, m_FragShaderModule, g_pAllocCallbacks);
+
+    m_ColorView = VK_NULL_HANDLE;
+    m_ColorImage = VK_NULL_HANDLE;
+    m_ColorMemory = VK_NULL_HANDLE;
+    m_DepthView = VK_NULL_HANDLE;
+    m_DepthImage = VK_NULL_HANDLE;
+    m_DepthMemory = VK_NULL_HANDLE;
+    m_ReadbackBuffer = VK_NULL_HANDLE;
+    m_ReadbackMemory = VK_NULL_HANDLE;
+    m_pReadback = NULL;
+    m_Fence = VK_NULL_HANDLE;
+    m_FragShaderModule = VK_NULL_HANDLE;
+}
+
+void CPickBufferVk::SetSize(int nWidth, int nHeight)
+{
+    m_nWidth = (uint32_t)clamp(nWidth, 1, (int)PICK_BUFFER_MAX_SIZE);
+    m_nHeight = (uint32_t)clamp(nHeight, 1, (int)PICK_BUFFER_MAX_SIZE);
+}
+
+void CPickBufferVk::RecordReadback(VkCommandBuffer commandBuffer)
+{
+    // The render pass already moved both to the transfer layout, only its attachment writes need waiting on
+    VkImageMemoryBarrier barriers[2] = {};
+    for (int i = 0; i < ARRAYSIZE(barriers); i++)
+    {
+        barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barriers[i].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barriers[i].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].subresourceRange.levelCount = 1;
+        barriers[i].subresourceRange.layerCount = 1;
+    }
+    barriers[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barriers[0].image = m_ColorImage;
+    barriers[0].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barriers[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    barriers[1].image = m_DepthImage;
+    barriers[1].subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, ARRAYSIZE(barriers), barriers);
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {m_nWidth, m_nHeight, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, m_ColorImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_ReadbackBuffer, 1, &region);
+
+    region.bufferOffset = GetDepthOffset();
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    vkCmdCopyImageToBuffer(commandBuffer, m_DepthImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_ReadbackBuffer, 1, &region);
+
+    VkMemoryBarrier hostBarrier = {};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0,
+                         nullptr);
+}
+
+void CPickBufferVk::Resolve(CUtlVector<PickHitVk_t> &hits)
+{
+    VkDevice device = g_pShaderDevice->GetVkDevice();
+    vkCheck(vkWaitForFences(device, 1, &m_Fence, VK_TRUE, UINT64_MAX), "failed to wait for pick buffer readback");
+    vkCheck(vkResetFences(device, 1, &m_Fence), "failed to reset pick buffer fence");
+
+    // Hits stay in the order their ids were first seen, callers sort by id if they care
+    CUtlMap<uint32_t, int> hitIndices(DefLessFunc(uint32_t));
+    const uint32_t *pIds = (const uint32_t *)m_pReadback;
+    const unsigned char *pDepth = m_pReadback + GetDepthOffset();
+    for (uint32_t i = 0; i < m_nWidth * m_nHeight; i++)
+    {
+        if (pIds[i] == 0)
+            continue;
+
+        float z = m_DepthFormat == VK_FORMAT_D32_SFLOAT ? ((const float *)pDepth)[i] : ((const uint16_t *)pDepth)[i] / 65535.0f;
+
+        CUtlMap<uint32_t, int>::IndexType_t index = hitIndices.Find(pIds[i]);
+        if (!hitIndices.IsValidIndex(index))
+        {
+            PickHitVk_t hit;
+            hit.m_nId = pIds[i];
+            hit.m_flMinZ = z;
+            hit.m_flMaxZ = z;
+            hitIndices.Insert(pIds[i], hits.AddToTail(hit));
+            continue;
+        }
+
+        PickHitVk_t &hit = hits[hitIndices[index]];
+        hit.m_flMinZ = MIN(hit.m_flMinZ, z);
+        hit.m_flMaxZ = MAX(hit.m_flMaxZ, z);
+    }
+}
+
+void CPickBufferVk::CreateImage(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspectMask, VkImage &image,
+                                VkDeviceMemory &memory, VkImageView &view)
+{
+    VkDevice device = g_pShaderDevice->GetVkDevice();
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {PICK_BUFFER_MAX_SIZE, PICK_BUFFER_MAX_SIZE, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = usage | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    vkCheck(vkCreateImage(device, &imageInfo, g_pAllocCallbacks, &image), "failed to create pick buffer image");
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memRequirements.size;
+    allocInfo.memoryTypeIndex =
+        g_pShaderDeviceMgr->FindMemoryType(0, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    vkCheck(vkAllocateMemory(device, &allocInfo, g_pAllocCallbacks, &memory), "failed to allocate pick buffer memory");
+    vkCheck(vkBindImageMemory(device, image, memory, 0), "failed to bind pick buffer memory");
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.aspectMask = aspectMask;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.layerCount = 1;
+    vkCheck(vkCreateImageView(device, &viewInfo, g_pAllocCallbacks, &view), "failed to create pick buffer image view");
+}
+
+void CPickBufferVk::CreateTargets()
+{
+    // D32 keeps the depth the CPU path would report, D16 is the fallback every device renders to
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(m_PhysicalDevice, VK_FORMAT_D32_SFLOAT, &props);
+    bool bD32 = (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) != 0;
+    m_DepthFormat = bD32 ? VK_FORMAT_D32_SFLOAT : VK_FORMAT_D16_UNORM;
+
+    CreateImage(PICK_BUFFER_COLOR_FORMAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT, m_ColorImage, m_ColorMemory,
+                m_ColorView);
+    CreateImage(m_DepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, m_DepthImage, m_DepthMemory,
+                m_DepthView);
+
+    CreateBuffer(PICK_READBACK_SIZE, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_ReadbackBuffer, m_ReadbackMemory);
+    vkCheck(vkMapMemory(g_pShaderDevice->GetVkDevice(), m_ReadbackMemory, 0, PICK_READBACK_SIZE, 0, (void **)&m_pReadback),
+            "failed to map pick buffer readback memory!");
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    vkCheck(vkCreateFence(g_pShaderDevice->GetVkDevice(), &fenceInfo, g_pAllocCallbacks, &m_Fence), "failed to create pick buffer fence");
+}
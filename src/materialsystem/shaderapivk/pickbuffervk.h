@@ -0,0 +1,100 @@
+//
+
+#ifndef PICKBUFFERVK_H
+#define PICKBUFFERVK_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlvector.h"
+#include "vulkanimpl.h"
+
+//-----------------------------------------------------------------------------
+// Important enumerations
+//-----------------------------------------------------------------------------
+enum
+{
+    // Largest PickMatrix region in pixels, bigger regions are clamped
+    PICK_BUFFER_MAX_SIZE = 64,
+};
+
+// Draws write their selection id here, 0 is cleared to and means nothing was hit
+static const VkFormat PICK_BUFFER_COLOR_FORMAT = VK_FORMAT_R32_UINT;
+
+// Depth range a selection id covers in the pick region, window z in [0, 1]
+struct PickHitVk_t
+{
+    uint32_t m_nId;
+    float m_flMinZ;
+    float m_flMaxZ;
+};
+
+//-----------------------------------------------------------------------------
+// Targets of GPU selection. Draws in selection mode write the id of their name stack
+// into an integer color image covering only the PickMatrix region, depth tested so each
+// pixel keeps the nearest surface. Both images are copied into host memory after the pass
+// and the CPU only waits on the fence once the hits are gathered.
+//-----------------------------------------------------------------------------
+class CPickBufferVk
+{
+  public:
+    CPickBufferVk();
+    ~CPickBufferVk();
+
+    void Init(VkPhysicalDevice physicalDevice);
+    void Shutdown();
+
+    // shaders/pick.spv was found, selection tests triangles on the CPU otherwise
+    bool IsSupported() const { return m_FragShaderModule != VK_NULL_HANDLE; }
+
+    // Writes the selection id of the draw's uniform buffer, see shaders/pick.frag
+    VkShaderModule GetFragmentShader() const { return m_FragShaderModule; }
+
+    // Only the top left of the targets is rendered to, clamped to PICK_BUFFER_MAX_SIZE
+    void SetSize(int nWidth, int nHeight);
+    uint32_t GetWidth() const { return m_nWidth; }
+    uint32_t GetHeight() const { return m_nHeight; }
+
+    VkFormat GetDepthFormat() const { return m_DepthFormat; }
+    VkImageView GetColorView() const { return m_ColorView; }
+    VkImageView GetDepthView() const { return m_DepthView; }
+
+    // Records the copy into host memory after the pick pass, which leaves both targets in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+    void RecordReadback(VkCommandBuffer commandBuffer);
+
+    // Signaled by the submit with the readback
+    VkFence GetFence() const { return m_Fence; }
+
+    // Waits for the readback, then gathers the depth range of every id that covers a pixel
+    void Resolve(CUtlVector<PickHitVk_t> &hits);
+
+  private:
+    void CreateImage(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspectMask, VkImage &image, VkDeviceMemory &memory,
+                     VkImageView &view);
+    void CreateTargets();
+
+    // Color texels, then depth texels, both tightly packed at the pick size
+    VkDeviceSize GetDepthOffset() const { return (VkDeviceSize)m_nWidth * m_nHeight * sizeof(uint32_t); }
+
+    VkPhysicalDevice m_PhysicalDevice;
+    VkShaderModule m_FragShaderModule;
+    VkFormat m_DepthFormat;
+    uint32_t m_nWidth;
+    uint32_t m_nHeight;
+
+    VkImage m_ColorImage;
+    VkDeviceMemory m_ColorMemory;
+    VkImageView m_ColorView;
+    VkImage m_DepthImage;
+    VkDeviceMemory m_DepthMemory;
+    VkImageView m_DepthView;
+
+    // Host visible and mapped for as long as it lives
+    VkBuffer m_ReadbackBuffer;
+    VkDeviceMemory m_ReadbackMemory;
+    unsigned char *m_pReadback;
+    VkFence m_Fence;
+};
+
+#endif // PICKBUFFERVK_H
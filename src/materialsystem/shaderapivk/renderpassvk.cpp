@@ -0,0 +1,177 @@
+#include "renderpassvk.h"
+#include "shaderdevicevk.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CRenderPassCacheVk::CRenderPassCacheVk() {}
+
+CRenderPassCacheVk::~CRenderPassCacheVk() { Assert(m_RenderPasses.Count() == 0 && m_Framebuffers.Count() == 0); }
+
+VkRenderPass CRenderPassCacheVk::GetRenderPass(const RenderPassKey_t &key)
+{
+    for (int i = 0; i < m_RenderPasses.Count(); i++)
+    {
+        if (m_RenderPasses[i].m_Key == key)
+            return m_RenderPasses[i].m_RenderPass;
+    }
+
+    int i = m_RenderPasses.AddToTail();
+    m_RenderPasses[i].m_Key = key;
+    m_RenderPasses[i].m_RenderPass = CreateRenderPass(key);
+    return m_RenderPasses[i].m_RenderPass;
+}
+
+VkFramebuffer CRenderPassCacheVk::GetFramebuffer(VkRenderPass renderPass, int nAttachments, const VkImageView *pAttachments, uint32_t width,
+                                                 uint32_t height)
+{
+    Assert(nAttachments > 0 && nAttachments <= MAX_ATTACHMENTS);
+
+    for (int i = 0; i < m_Framebuffers.Count(); i++)
+    {
+        const Framebuffer_t &fb = m_Framebuffers[i];
+        if (fb.m_RenderPass == renderPass && fb.m_nAttachments == nAttachments && fb.m_nWidth == width && fb.m_nHeight == height &&
+            !memcmp(fb.m_Attachments, pAttachments, nAttachments * sizeof(VkImageView)))
+        {
+            return fb.m_Framebuffer;
+        }
+    }
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = renderPass;
+    framebufferInfo.attachmentCount = nAttachments;
+    framebufferInfo.pAttachments = pAttachments;
+    framebufferInfo.width = width;
+    framebufferInfo.height = height;
+    framebufferInfo.layers = 1;
+
+    int i = m_Framebuffers.AddToTail();
+    Framebuffer_t &fb = m_Framebuffers[i];
+    fb.m_RenderPass = renderPass;
+    fb.m_nAttachments = nAttachments;
+    memcpy(fb.m_Attachments, pAttachments, nAttachments * sizeof(VkImageView));
+    fb.m_nWidth = width;
+    fb.m_nHeight = height;
+    vkCheck(vkCreateFramebuffer(g_pShaderDevice->GetVkDevice(), &framebufferInfo, g_pAllocCallbacks, &fb.m_Framebuffer),
+            "failed to create framebuffer");
+
+    return fb.m_Framebuffer;
+}
+
+void CRenderPassCacheVk::ReleaseFramebuffers(VkImageView view)
+{
+    for (int i = m_Framebuffers.Count() - 1; i >= 0; i--)
+    {
+        const Framebuffer_t &fb = m_Framebuffers[i];
+        for (int j = 0; j < fb.m_nAttachments; j++)
+        {
+            if (fb.m_Attachments[j] == view)
+            {
+                g_pShaderDevice->GetDeletionQueue().DestroyFramebuffer(fb.m_Framebuffer);
+                m_Framebuffers.FastRemove(i);
+                break;
+            }
+        }
+    }
+}
+
+void CRenderPassCacheVk::Shutdown()
+{
+    for (int i = 0; i < m_Framebuffers.Count(); i++)
+    {
+        vkDestroyFramebuffer(g_pShaderDevice->GetVkDevice(), m_Framebuffers[i].m_Framebuffer, g_pAllocCallbacks);
+    }
+    m_Framebuffers.RemoveAll();
+
+    for (int i = 0; i < m_RenderPasses.Count(); i++)
+    {
+        vkDestroyRenderPass(g_pShaderDevice->GetVkDevice(), m_RenderPasses[i].m_RenderPass, g_pAllocCallbacks);
+    }
+    m_RenderPasses.RemoveAll();
+}
+
+VkRenderPass CRenderPassCacheVk::CreateRenderPass(const RenderPassKey_t &key)
+{
+    VkAttachmentDescription attachments[MAX_ATTACHMENTS] = {};
+    uint32_t nAttachments = 0;
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+
+    VkAttachmentReference colorAttachmentRef = {};
+    if (key.m_ColorFormat != VK_FORMAT_UNDEFINED)
+    {
+        VkAttachmentDescription &colorAttachment = attachments[nAttachments];
+        colorAttachment.format = key.m_ColorFormat;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = key.m_ColorLoadOp;
+        colorAttachment.storeOp = key.m_ColorStoreOp;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout = key.m_ColorInitialLayout;
+        colorAttachment.finalLayout = key.m_ColorFinalLayout;
+
+        colorAttachmentRef.attachment = nAttachments++;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+    }
+
+    VkAttachmentReference depthAttachmentRef = {};
+    if (key.m_DepthFormat != VK_FORMAT_UNDEFINED)
+    {
+        // Stencil shares the depth ops
+        VkAttachmentDescription &depthAttachment = attachments[nAttachments];
+        depthAttachment.format = key.m_DepthFormat;
+        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthAttachment.loadOp = key.m_DepthLoadOp;
+        depthAttachment.storeOp = key.m_DepthStoreOp;
+        depthAttachment.stencilLoadOp = key.m_DepthLoadOp;
+        depthAttachment.stencilStoreOp = key.m_DepthStoreOp;
+        depthAttachment.initialLayout = key.m_DepthInitialLayout;
+        depthAttachment.finalLayout = key.m_DepthFinalLayout;
+
+        depthAttachmentRef.attachment = nAttachments++;
+        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        subpass.pDepthStencilAttachment = &depthAttachmentRef;
+    }
+
+    Assert(nAttachments > 0);
+
+    // Wait for earlier passes writing to or sampling from the same images
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                              VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    // Make render target writes visible to shaders sampling them afterwards
+    VkSubpassDependency outDependency = {};
+    outDependency.srcSubpass = 0;
+    outDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    outDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    outDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    outDependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    outDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    VkSubpassDependency dependencies[] = {dependency, outDependency};
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = nAttachments;
+    renderPassInfo.pAttachments = attachments;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = ARRAYSIZE(dependencies);
+    renderPassInfo.pDependencies = dependencies;
+
+    VkRenderPass renderPass;
+    vkCheck(vkCreateRenderPass(g_pShaderDevice->GetVkDevice(), &renderPassInfo, g_pAllocCallbacks, &renderPass),
+            "failed to create render pass");
+    return renderPass;
+}
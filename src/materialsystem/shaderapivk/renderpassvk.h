@@ -0,0 +1,85 @@
+//
+
+#ifndef RENDERPASSVK_H
+#define RENDERPASSVK_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlvector.h"
+#include "vulkanimpl.h"
+
+//-----------------------------------------------------------------------------
+// Everything that goes into a VkRenderPass.
+// A format of VK_FORMAT_UNDEFINED means the attachment is not used.
+//-----------------------------------------------------------------------------
+struct RenderPassKey_t
+{
+    VkFormat m_ColorFormat;
+    VkAttachmentLoadOp m_ColorLoadOp;
+    VkAttachmentStoreOp m_ColorStoreOp;
+    VkImageLayout m_ColorInitialLayout;
+    VkImageLayout m_ColorFinalLayout;
+
+    VkFormat m_DepthFormat;
+    VkAttachmentLoadOp m_DepthLoadOp;
+    VkAttachmentStoreOp m_DepthStoreOp;
+    VkImageLayout m_DepthInitialLayout;
+    VkImageLayout m_DepthFinalLayout;
+
+    RenderPassKey_t() { memset(this, 0, sizeof(*this)); }
+    bool operator==(const RenderPassKey_t &other) const { return memcmp(this, &other, sizeof(*this)) == 0; }
+};
+
+//-----------------------------------------------------------------------------
+// Caches render passes by attachment set and framebuffers by render pass + views.
+// There are only ever a handful of each so lookups are linear.
+//-----------------------------------------------------------------------------
+class CRenderPassCacheVk
+{
+  public:
+    CRenderPassCacheVk();
+    ~CRenderPassCacheVk();
+
+    VkRenderPass GetRenderPass(const RenderPassKey_t &key);
+
+    // Attachments are color first (if any), then depth (if any)
+    VkFramebuffer GetFramebuffer(VkRenderPass renderPass, int nAttachments, const VkImageView *pAttachments, uint32_t width,
+                                 uint32_t height);
+
+    // Destroys every framebuffer referencing the view, call before destroying the view.
+    // The caller is responsible for making sure the framebuffers are no longer in use.
+    void ReleaseFramebuffers(VkImageView view);
+
+    void Shutdown();
+
+  private:
+    enum
+    {
+        MAX_ATTACHMENTS = 2,
+    };
+
+    struct RenderPass_t
+    {
+        RenderPassKey_t m_Key;
+        VkRenderPass m_RenderPass;
+    };
+
+    struct Framebuffer_t
+    {
+        VkRenderPass m_RenderPass;
+        int m_nAttachments;
+        VkImageView m_Attachments[MAX_ATTACHMENTS];
+        uint32_t m_nWidth;
+        uint32_t m_nHeight;
+        VkFramebuffer m_Framebuffer;
+    };
+
+    VkRenderPass CreateRenderPass(const RenderPassKey_t &key);
+
+    CUtlVector<RenderPass_t> m_RenderPasses;
+    CUtlVector<Framebuffer_t> m_Framebuffers;
+};
+
+#endif // RENDERPASSVK_H
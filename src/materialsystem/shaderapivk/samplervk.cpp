@@ -0,0 +1,85 @@
+#include "samplervk.h"
+#include "shaderdevicevk.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CSamplerCacheVk::CSamplerCacheVk() : m_SamplerIndices(DefLessFunc(unsigned int))
+{
+    m_bSupportsAnisotropy = false;
+    m_flMaxAnisotropy = 1.0f;
+    m_nMaxSamplers = 0;
+}
+
+CSamplerCacheVk::~CSamplerCacheVk() { Assert(m_Samplers.Count() == 0); }
+
+void CSamplerCacheVk::Init(bool bSupportsAnisotropy, float flMaxAnisotropy, uint32_t nMaxSamplers)
+{
+    m_bSupportsAnisotropy = bSupportsAnisotropy;
+    m_flMaxAnisotropy = flMaxAnisotropy;
+    m_nMaxSamplers = nMaxSamplers;
+
+    // Linear, clamped, no mips
+    SamplerKey_t key;
+    key.m_MinFilter = VK_FILTER_LINEAR;
+    key.m_MagFilter = VK_FILTER_LINEAR;
+    key.m_AddressU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    key.m_AddressV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    key.m_AddressW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    FindOrCreateSampler(key);
+}
+
+void CSamplerCacheVk::Shutdown()
+{
+    for (int i = 0; i < m_Samplers.Count(); i++)
+    {
+        vkDestroySampler(g_pShaderDevice->GetVkDevice(), m_Samplers[i].m_Sampler, g_pAllocCallbacks);
+    }
+    m_Samplers.RemoveAll();
+    m_SamplerIndices.RemoveAll();
+}
+
+int CSamplerCacheVk::FindOrCreateSampler(const SamplerKey_t &key)
+{
+    CUtlMap<unsigned int, int>::IndexType_t i = m_SamplerIndices.Find(key.m_nBits);
+    if (i != m_SamplerIndices.InvalidIndex())
+        return m_SamplerIndices[i];
+
+    if ((uint32_t)m_Samplers.Count() >= m_nMaxSamplers)
+    {
+        Warning("CSamplerCacheVk: out of samplers (%d), using the default\n", m_Samplers.Count());
+        return 0;
+    }
+
+    int nIndex = m_Samplers.AddToTail();
+    m_Samplers[nIndex].m_Key = key;
+    m_Samplers[nIndex].m_Sampler = CreateSampler(key);
+    m_SamplerIndices.Insert(key.m_nBits, nIndex);
+    g_pShaderDevice->GetBindlessTextures().SetSampler(nIndex, m_Samplers[nIndex].m_Sampler);
+    return nIndex;
+}
+
+VkSampler CSamplerCacheVk::CreateSampler(const SamplerKey_t &key)
+{
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = (VkFilter)key.m_MagFilter;
+    samplerInfo.minFilter = (VkFilter)key.m_MinFilter;
+    samplerInfo.mipmapMode = (VkSamplerMipmapMode)key.m_MipmapMode;
+    samplerInfo.addressModeU = (VkSamplerAddressMode)key.m_AddressU;
+    samplerInfo.addressModeV = (VkSamplerAddressMode)key.m_AddressV;
+    samplerInfo.addressModeW = (VkSamplerAddressMode)key.m_AddressW;
+    samplerInfo.mipLodBias = 0.0f;
+    samplerInfo.anisotropyEnable = (m_bSupportsAnisotropy && key.m_nAnisotropy > 1) ? VK_TRUE : VK_FALSE;
+    samplerInfo.maxAnisotropy = MIN((float)key.m_nAnisotropy, m_flMaxAnisotropy);
+    samplerInfo.compareEnable = key.m_bCompare ? VK_TRUE : VK_FALSE;
+    samplerInfo.compareOp = (VkCompareOp)key.m_CompareOp;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = key.m_bMipmaps ? VK_LOD_CLAMP_NONE : 0.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+    VkSampler sampler;
+    vkCheck(vkCreateSampler(g_pShaderDevice->GetVkDevice(), &samplerInfo, g_pAllocCallbacks, &sampler), "failed to create sampler");
+    return sampler;
+}
@@ -0,0 +1,78 @@
+//
+
+#ifndef SAMPLERVK_H
+#define SAMPLERVK_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlmap.h"
+#include "tier1/utlvector.h"
+#include "vulkanimpl.h"
+
+//-----------------------------------------------------------------------------
+// Everything that goes into a VkSampler, packed into 32 bits
+//-----------------------------------------------------------------------------
+struct SamplerKey_t
+{
+    union
+    {
+        struct
+        {
+            unsigned int m_MinFilter : 1;  // VkFilter
+            unsigned int m_MagFilter : 1;  // VkFilter
+            unsigned int m_MipmapMode : 1; // VkSamplerMipmapMode
+            unsigned int m_bMipmaps : 1;
+            unsigned int m_AddressU : 3; // VkSamplerAddressMode
+            unsigned int m_AddressV : 3;
+            unsigned int m_AddressW : 3;
+            unsigned int m_nAnisotropy : 5; // 0 and 1 both mean off
+            unsigned int m_bCompare : 1;
+            unsigned int m_CompareOp : 3; // VkCompareOp
+        };
+        unsigned int m_nBits;
+    };
+
+    SamplerKey_t() { m_nBits = 0; }
+    bool operator==(const SamplerKey_t &other) const { return m_nBits == other.m_nBits; }
+    bool operator!=(const SamplerKey_t &other) const { return m_nBits != other.m_nBits; }
+};
+
+COMPILE_TIME_ASSERT(sizeof(SamplerKey_t) == sizeof(unsigned int));
+
+//-----------------------------------------------------------------------------
+// Dedupes VkSamplers, there are only a few dozen distinct ones in practice
+// and maxSamplerAllocationCount can be as low as 4000.
+// Samplers are referenced by index, index 0 is always a valid default sampler.
+//-----------------------------------------------------------------------------
+class CSamplerCacheVk
+{
+  public:
+    CSamplerCacheVk();
+    ~CSamplerCacheVk();
+
+    void Init(bool bSupportsAnisotropy, float flMaxAnisotropy, uint32_t nMaxSamplers);
+    void Shutdown();
+
+    int FindOrCreateSampler(const SamplerKey_t &key);
+    VkSampler GetSampler(int nIndex) const { return m_Samplers[nIndex].m_Sampler; }
+    int GetSamplerCount() const { return m_Samplers.Count(); }
+
+  private:
+    struct Sampler_t
+    {
+        SamplerKey_t m_Key;
+        VkSampler m_Sampler;
+    };
+
+    VkSampler CreateSampler(const SamplerKey_t &key);
+
+    CUtlVector<Sampler_t> m_Samplers;
+    CUtlMap<unsigned int, int> m_SamplerIndices;
+    bool m_bSupportsAnisotropy;
+    float m_flMaxAnisotropy;
+    uint32_t m_nMaxSamplers;
+};
+
+#endif // SAMPLERVK_H
@@ -5,6 +5,7 @@
 #include "shaderapi/ishaderutil.h"
 #include "shaderapivk_global.h"
 #include "shadermanagervk.h"
+#include "vtf/vtf.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -28,6 +29,28 @@ CShaderAPIVk::CShaderAPIVk()
     }
 
     m_nDynamicVBSize = DYNAMIC_VERTEX_BUFFER_MEMORY;
+    m_ModifyTextureHandle = INVALID_SHADERAPI_TEXTURE_HANDLE;
+    m_nTextureMemoryUsedLastFrame = m_nTextureMemoryUsedTotal = 0;
+    m_nTextureMemoryUsedPicMip1 = m_nTextureMemoryUsedPicMip2 = 0;
+
+    m_maxBoneLoaded = 0;
+    m_nBonePaletteCount = 0;
+    m_bBoneMatricesDirty = false;
+
+    m_InSelectionMode = false;
+    m_pSelectionBuffer = m_pSelectionBufferEnd = m_pCurrSelectionRecord = NULL;
+    m_SelectionMinZ = FLT_MAX;
+    m_SelectionMaxZ = FLT_MIN;
+    m_NumHits = 0;
+    m_nSelectionId = 0;
+    m_bPickRegionSet = false;
+
+    for (int i = 0; i < SHADER_CONSTANTS_STAGE_COUNT; i++)
+    {
+        m_nConstantDirtyFirst[i] = INT_MAX;
+        m_nConstantDirtyLast[i] = -1;
+        m_nConstantHighWater[i] = 0;
+    }
 }
 
 CShaderAPIVk::~CShaderAPIVk()
@@ -116,7 +139,7 @@ void CShaderAPIVk::OnDeviceShutdown()
         return;
 
     // Deallocate all textures
-    // DeleteAllTextures();
+    DeleteAllTextures();
 
     // Release render targets
     // ReleaseInternalRenderTargets();
@@ -167,7 +190,15 @@ void CShaderAPIVk::SetStencilWriteMask(uint32 msk) {}
 
 void CShaderAPIVk::ClearStencilBufferRectangle(int xmin, int ymin, int xmax, int ymax, int value) {}
 
-void CShaderAPIVk::DisableAllLocalLights() {}
+void CShaderAPIVk::DisableAllLocalLights()
+{
+    LightDesc_t desc;
+    desc.m_Type = MATERIAL_LIGHT_DISABLE;
+    for (int i = 0; i < MAX_NUM_LIGHTS; ++i)
+    {
+        SetLight(i, desc);
+    }
+}
 
 int CShaderAPIVk::CompareSnapshots(StateSnapshot_t snapshot0, StateSnapshot_t snapshot1) { return 0; }
 
@@ -269,7 +300,9 @@ void CShaderAPIVk::CreateTextures(ShaderAPITextureHandle_t *pHandles, int count,
                                   const char *pTextureGroupName)
 {
     for (int k = 0; k < count; ++k)
-        pHandles[k] = 0;
+    {
+        pHandles[k] = CreateTexture(width, height, depth, dstImageFormat, numMipLevels, numCopies, flags, pDebugName, pTextureGroupName);
+    }
 }
 
 void CShaderAPIVk::AcquireThreadOwnership() {}
@@ -292,7 +325,10 @@ void CShaderAPIVk::OverrideAlphaWriteEnable(bool bEnable, bool bAlphaWriteEnable
 
 void CShaderAPIVk::OverrideColorWriteEnable(bool bOverrideEnable, bool bColorWriteEnable) {}
 
-void CShaderAPIVk::ClearBuffersObeyStencilEx(bool bClearColor, bool bClearAlpha, bool bClearDepth) {}
+void CShaderAPIVk::ClearBuffersObeyStencilEx(bool bClearColor, bool bClearAlpha, bool bClearDepth)
+{
+    ClearBuffers(bClearColor || bClearAlpha, bClearDepth, false, -1, -1);
+}
 
 void CShaderAPIVk::CopyRenderTargetToScratchTexture(ShaderAPITextureHandle_t srcRt, ShaderAPITextureHandle_t dstTex, Rect_t *pSrcRect,
                                                     Rect_t *pDstRect)
@@ -468,7 +504,31 @@ void CShaderAPIVk::PerspectiveOffCenterX(double fovx, double aspect, double zNea
 
 void CShaderAPIVk::PickMatrix(int x, int y, int width, int height)
 {
-    // VK_TODO
+    if (MatrixIsChanging())
+    {
+        // This is done in screen space, so we need the viewport
+        const VkViewport &viewport = m_DesiredState.m_Viewport;
+
+        // Compute the location of the pick points in projection space...
+        float px = 2.0f * (x - viewport.x) / viewport.width - 1.0f;
+        float py = 2.0f * (y - viewport.y) / viewport.height - 1.0f;
+        float pw = 2.0f * width / viewport.width;
+        float ph = 2.0f * height / viewport.height;
+
+        // we need to translate (px, py) to the origin
+        // and scale so (pw,ph) -> (2, 2)
+        glm::mat4x4 matrix(1.0f);
+        matrix[0][0] = 2.0f / pw;
+        matrix[1][1] = 2.0f / ph;
+        matrix[3][0] = -2.0f * px / pw;
+        matrix[3][1] = 2.0f * py / ph;
+        m_MatrixStack[m_CurrStack].MultMatrixLocal(matrix);
+        UpdateMatrixTransform();
+    }
+
+    // Only the region is rendered while picking
+    g_pShaderDevice->GetPickBuffer().SetSize(width, height);
+    m_bPickRegionSet = g_pShaderDevice->GetPickBuffer().IsSupported();
 }
 
 void CShaderAPIVk::MultMatrix(float *m)
@@ -545,11 +605,69 @@ void CShaderAPIVk::Color4ub(unsigned char r, unsigned char g, unsigned char b, u
 
 void CShaderAPIVk::Color4ubv(unsigned char const *pColor) {}
 
-void CShaderAPIVk::SetVertexShaderConstant(int var, float const *pVec, int numConst, bool bForce) {}
+void CShaderAPIVk::SetVertexShaderConstant(int var, float const *pVec, int numConst, bool bForce)
+{
+    SetShaderConstants(SHADER_CONSTANTS_VERTEX, m_DesiredState.m_pVectorVertexShaderConstant,
+                       g_pHardwareConfig->Caps().m_NumVertexShaderConstants, var, pVec, numConst, bForce);
+}
+
+void CShaderAPIVk::SetPixelShaderConstant(int var, float const *pVec, int numConst, bool bForce)
+{
+    SetShaderConstants(SHADER_CONSTANTS_PIXEL, m_DesiredState.m_pVectorPixelShaderConstant,
+                       g_pHardwareConfig->Caps().m_NumPixelShaderConstants, var, pVec, numConst, bForce);
+}
+
+//-----------------------------------------------------------------------------
+// Only registers that actually change widen the dirty range, nothing is uploaded here
+//-----------------------------------------------------------------------------
+void CShaderAPIVk::SetShaderConstants(ShaderConstantStage_t stage, Vector4D *pConstants, int nMaxConstants, int var, float const *pVec,
+                                      int numConst, bool bForce)
+{
+    Assert(var >= 0 && var + numConst <= nMaxConstants);
+    if (!pConstants || numConst <= 0)
+        return;
+
+    numConst = MIN(numConst, nMaxConstants - var);
+    if (numConst <= 0)
+        return;
+
+    // Shaders set the same constants for every draw, skip the ones that didn't change
+    if (!bForce)
+    {
+        while (numConst > 0 && memcmp(pConstants[var].Base(), pVec, 4 * sizeof(float)) == 0)
+        {
+            var++;
+            pVec += 4;
+            numConst--;
+        }
+        while (numConst > 0 && memcmp(pConstants[var + numConst - 1].Base(), pVec + 4 * (numConst - 1), 4 * sizeof(float)) == 0)
+        {
+            numConst--;
+        }
+        if (numConst == 0)
+            return;
+    }
+
+    V_memcpy(pConstants[var].Base(), pVec, numConst * 4 * sizeof(float));
 
-void CShaderAPIVk::SetPixelShaderConstant(int var, float const *pVec, int numConst, bool bForce) {}
+    m_nConstantDirtyFirst[stage] = MIN(m_nConstantDirtyFirst[stage], var);
+    m_nConstantDirtyLast[stage] = MAX(m_nConstantDirtyLast[stage], var + numConst - 1);
+    m_nConstantHighWater[stage] = MAX(m_nConstantHighWater[stage], var + numConst);
+}
 
-int CShaderAPIVk::GetCurrentNumBones() const { return 0; }
+bool CShaderAPIVk::GetShaderConstantDirtyRange(ShaderConstantStage_t stage, int &nFirst, int &nLast)
+{
+    if (m_nConstantDirtyFirst[stage] > m_nConstantDirtyLast[stage])
+        return false;
+
+    nFirst = m_nConstantDirtyFirst[stage];
+    nLast = m_nConstantDirtyLast[stage];
+    m_nConstantDirtyFirst[stage] = INT_MAX;
+    m_nConstantDirtyLast[stage] = -1;
+    return true;
+}
+
+int CShaderAPIVk::GetCurrentNumBones() const { return m_DynamicState.m_NumBones; }
 
 int CShaderAPIVk::GetCurrentLightCombo() const { return 0; }
 
@@ -711,17 +829,74 @@ int CShaderAPIVk::GetMaxLights() const { return MAX_LIGHTS; }
 
 const LightDesc_t &CShaderAPIVk::GetLight(int lightNum) const
 {
-    static LightDesc_t light;
-    return light;
+    Assert(lightNum >= 0 && lightNum < MAX_NUM_LIGHTS);
+    return m_DynamicState.m_LightDescs[lightNum];
 }
 
 void CShaderAPIVk::SetPixelShaderFogParams(int reg) {}
 
-void CShaderAPIVk::SetVertexShaderStateAmbientLightCube() {}
+void CShaderAPIVk::SetVertexShaderStateAmbientLightCube()
+{
+    if (m_CachedAmbientLightCube != STATE_CHANGED)
+        return;
+
+    SetVertexShaderConstant(VERTEX_SHADER_AMBIENT_LIGHT, m_DynamicState.m_AmbientLightCube[0].Base(), 6);
+    m_CachedAmbientLightCube = 0;
+}
 
-void CShaderAPIVk::SetPixelShaderStateAmbientLightCube(int pshReg, bool bForceToBlack) {}
+void CShaderAPIVk::SetPixelShaderStateAmbientLightCube(int pshReg, bool bForceToBlack)
+{
+    if (bForceToBlack)
+    {
+        Vector4D black[6];
+        Q_memset(black, 0, sizeof(black));
+        SetPixelShaderConstant(pshReg, black[0].Base(), 6);
+        return;
+    }
 
-void CShaderAPIVk::CommitPixelShaderLighting(int pshReg) {}
+    SetPixelShaderConstant(pshReg, m_DynamicState.m_AmbientLightCube[0].Base(), 6);
+}
+
+//-----------------------------------------------------------------------------
+// Same layout as dx9: c0-c5 are color0, pos0, color1, pos1, color2, pos2 and the
+// fourth light's color is in c0-c2.w, its position in c3-c5.w
+//-----------------------------------------------------------------------------
+void CShaderAPIVk::CommitPixelShaderLighting(int pshReg)
+{
+    const LightStateSoA_t &lights = m_DynamicState.m_LightState;
+
+    // The shaders only know point lights, directional ones move far away against their direction
+    FourVectors camera;
+    camera.DuplicateVector(m_WorldSpaceCameraPosition.AsVector3D());
+    fltx4 farAway = ReplicateX4(-10000.0f);
+    fltx4 posX = MaskedAssign(lights.m_DirectionalMask, MaddSIMD(farAway, lights.m_Direction.x, camera.x), lights.m_Position.x);
+    fltx4 posY = MaskedAssign(lights.m_DirectionalMask, MaddSIMD(farAway, lights.m_Direction.y, camera.y), lights.m_Position.y);
+    fltx4 posZ = MaskedAssign(lights.m_DirectionalMask, MaddSIMD(farAway, lights.m_Direction.z, camera.z), lights.m_Position.z);
+
+    // Disabled lights contribute black
+    posX = AndSIMD(posX, lights.m_EnableMask);
+    posY = AndSIMD(posY, lights.m_EnableMask);
+    posZ = AndSIMD(posZ, lights.m_EnableMask);
+    fltx4 colorX = AndSIMD(lights.m_Color.x, lights.m_EnableMask);
+    fltx4 colorY = AndSIMD(lights.m_Color.y, lights.m_EnableMask);
+    fltx4 colorZ = AndSIMD(lights.m_Color.z, lights.m_EnableMask);
+
+    // Lane i becomes light i, the fourth light ends up in the last row
+    fltx4 posW = Four_Zeros;
+    fltx4 colorW = Four_Zeros;
+    TransposeSIMD(posX, posY, posZ, posW);
+    TransposeSIMD(colorX, colorY, colorZ, colorW);
+
+    Vector4DAligned lightState[6];
+    StoreAlignedSIMD(lightState[0].Base(), SetWSIMD(colorX, SplatXSIMD(colorW)));
+    StoreAlignedSIMD(lightState[1].Base(), SetWSIMD(posX, SplatYSIMD(colorW)));
+    StoreAlignedSIMD(lightState[2].Base(), SetWSIMD(colorY, SplatZSIMD(colorW)));
+    StoreAlignedSIMD(lightState[3].Base(), SetWSIMD(posY, SplatXSIMD(posW)));
+    StoreAlignedSIMD(lightState[4].Base(), SetWSIMD(colorZ, SplatYSIMD(posW)));
+    StoreAlignedSIMD(lightState[5].Base(), SetWSIMD(posZ, SplatZSIMD(posW)));
+
+    SetPixelShaderConstant(pshReg, lightState[0].Base(), 6);
+}
 
 CMeshBuilder *CShaderAPIVk::GetVertexModifyBuilder() { return 0; }
 
@@ -789,7 +964,37 @@ const Vector &CShaderAPIVk::GetToneMappingScaleLinear() const { return *new Vect
 
 float CShaderAPIVk::GetLightMapScaleFactor() const { return 1.0f; }
 
-void CShaderAPIVk::LoadBoneMatrix(int boneIndex, const float *m) {}
+void CShaderAPIVk::LoadBoneMatrix(int boneIndex, const float *m)
+{
+    Assert(boneIndex >= 0 && boneIndex < NUM_MODEL_TRANSFORMS);
+    if (boneIndex < 0 || boneIndex >= NUM_MODEL_TRANSFORMS)
+        return;
+
+    V_memcpy(m_boneMatrix[boneIndex].Base(), m, sizeof(matrix3x4_t));
+    m_maxBoneLoaded = MAX(m_maxBoneLoaded, boneIndex);
+    m_bBoneMatricesDirty = true;
+}
+
+//-----------------------------------------------------------------------------
+// Like the skinning constant upload in dx9, the next model starts counting its bones from 0
+//-----------------------------------------------------------------------------
+bool CShaderAPIVk::GetDirtyBoneMatrices(const matrix3x4_t *&pBones, int &nCount, bool bForce)
+{
+    if (m_bBoneMatricesDirty)
+    {
+        m_nBonePaletteCount = m_maxBoneLoaded + 1;
+        m_maxBoneLoaded = 0;
+        m_bBoneMatricesDirty = false;
+    }
+    else if (!bForce || m_nBonePaletteCount == 0)
+    {
+        return false;
+    }
+
+    pBones = m_boneMatrix;
+    nCount = m_nBonePaletteCount;
+    return true;
+}
 
 void CShaderAPIVk::GetDXLevelDefaults(uint &max_dxlevel, uint &recommended_dxlevel) {}
 
@@ -798,7 +1003,18 @@ const FlashlightState_t &CShaderAPIVk::GetFlashlightStateEx(VMatrix &worldToText
     return *new FlashlightState_t;
 }
 
-float CShaderAPIVk::GetAmbientLightCubeLuminance() { return 1.0f; }
+float CShaderAPIVk::GetAmbientLightCubeLuminance()
+{
+    fltx4 sum = LoadAlignedSIMD(m_DynamicState.m_AmbientLightCube[0].Base());
+    for (int i = 1; i < 6; i++)
+    {
+        sum = AddSIMD(sum, LoadAlignedSIMD(m_DynamicState.m_AmbientLightCube[i].Base()));
+    }
+
+    // Rec. 601 luma weights, the average over the 6 faces
+    static const float s_Luminance[4] = {0.3f / 6.0f, 0.59f / 6.0f, 0.11f / 6.0f, 0.0f};
+    return SubFloat(Dot3SIMD(sum, LoadUnalignedSIMD(s_Luminance)), 0);
+}
 
 void CShaderAPIVk::GetDX9LightState(LightState_t *state) const
 {
@@ -854,7 +1070,21 @@ void CShaderAPIVk::EnableGetAllTextures(bool bEnable) {}
 
 KeyValues *CShaderAPIVk::GetDebugTextureList() { return m_pDebugTextureList; }
 
-int CShaderAPIVk::GetTextureMemoryUsed(TextureMemoryType eTextureMemory) { return 0; }
+int CShaderAPIVk::GetTextureMemoryUsed(TextureMemoryType eTextureMemory)
+{
+    switch (eTextureMemory)
+    {
+    case MEMORY_BOUND_LAST_FRAME:
+        return m_nTextureMemoryUsedLastFrame;
+    case MEMORY_TOTAL_LOADED:
+        return m_nTextureMemoryUsedTotal;
+    case MEMORY_ESTIMATE_PICMIP_1:
+        return m_nTextureMemoryUsedPicMip1;
+    case MEMORY_ESTIMATE_PICMIP_2:
+        return m_nTextureMemoryUsedPicMip2;
+    }
+    return 0;
+}
 
 bool CShaderAPIVk::IsDebugTextureListFresh(int numFramesAllowed /* = 1 */)
 {
@@ -950,7 +1180,15 @@ int CShaderAPIVk::GetViewports(ShaderViewport_t *pViewports, int nMax) const
     return 1;
 }
 
-void CShaderAPIVk::ClearBuffers(bool bClearColor, bool bClearDepth, bool bClearStencil, int renderTargetWidth, int renderTargetHeight) {}
+void CShaderAPIVk::ClearBuffers(bool bClearColor, bool bClearDepth, bool bClearStencil, int renderTargetWidth, int renderTargetHeight)
+{
+    if (!g_pShaderDevice->GetCurrentViewport())
+        return;
+
+    // VK_TODO: stencil is cleared along with depth, there's no stencil-only clear
+    FlushBufferedPrimitives();
+    g_pShaderDevice->GetCurrentViewport()->ClearBuffers(bClearColor, bClearDepth);
+}
 
 void CShaderAPIVk::ClearColor3ub(unsigned char r, unsigned char g, unsigned char b)
 {
@@ -964,7 +1202,7 @@ void CShaderAPIVk::ClearColor4ub(unsigned char r, unsigned char g, unsigned char
 
 void CShaderAPIVk::BindVertexShader(VertexShaderHandle_t hVertexShader) { g_pShaderManager->BindVertexShader(hVertexShader); }
 
-void CShaderAPIVk::BindGeometryShader(GeometryShaderHandle_t hGeometryShader) { Assert(hGeometryShader == GEOMETRY_SHADER_HANDLE_INVALID); }
+void CShaderAPIVk::BindGeometryShader(GeometryShaderHandle_t hGeometryShader) { g_pShaderManager->BindGeometryShader(hGeometryShader); }
 
 void CShaderAPIVk::BindPixelShader(PixelShaderHandle_t hPixelShader) { g_pShaderManager->BindPixelShader(hPixelShader); }
 
@@ -997,11 +1235,29 @@ StateSnapshot_t CShaderAPIVk::TakeSnapshot()
     return id;
 }
 
-void CShaderAPIVk::TexMinFilter(ShaderTexFilterMode_t texFilterMode) {}
+void CShaderAPIVk::TexMinFilter(ShaderTexFilterMode_t texFilterMode)
+{
+    if (IsValidTexture(m_ModifyTextureHandle))
+    {
+        GetTexture(m_ModifyTextureHandle).SetMinFilter(texFilterMode);
+    }
+}
 
-void CShaderAPIVk::TexMagFilter(ShaderTexFilterMode_t texFilterMode) {}
+void CShaderAPIVk::TexMagFilter(ShaderTexFilterMode_t texFilterMode)
+{
+    if (IsValidTexture(m_ModifyTextureHandle))
+    {
+        GetTexture(m_ModifyTextureHandle).SetMagFilter(texFilterMode);
+    }
+}
 
-void CShaderAPIVk::TexWrap(ShaderTexCoordComponent_t coord, ShaderTexWrapMode_t wrapMode) {}
+void CShaderAPIVk::TexWrap(ShaderTexCoordComponent_t coord, ShaderTexWrapMode_t wrapMode)
+{
+    if (IsValidTexture(m_ModifyTextureHandle))
+    {
+        GetTexture(m_ModifyTextureHandle).SetWrap(coord, wrapMode);
+    }
+}
 
 void CShaderAPIVk::CopyRenderTargetToTexture(ShaderAPITextureHandle_t textureHandle) {}
 
@@ -1131,15 +1387,93 @@ void CShaderAPIVk::RenderPass(int nPass, int nPassCount)
     m_nCurrentSnapshot = -1;
 }
 
-void CShaderAPIVk::SetNumBoneWeights(int numBones) {}
+void CShaderAPIVk::SetNumBoneWeights(int numBones) { m_DynamicState.m_NumBones = numBones; }
 
-void CShaderAPIVk::SetLight(int lightNum, const LightDesc_t &desc) {}
+void CShaderAPIVk::SetLight(int lightNum, const LightDesc_t &desc)
+{
+    Assert(lightNum >= 0 && lightNum < MAX_NUM_LIGHTS);
+    if (lightNum < 0 || lightNum >= MAX_NUM_LIGHTS)
+        return;
 
-void CShaderAPIVk::SetLightingOrigin(Vector vLightingOrigin) {}
+    bool bEnable = desc.m_Type != MATERIAL_LIGHT_DISABLE;
+    if (bEnable != m_DynamicState.m_LightEnable[lightNum])
+    {
+        m_DynamicState.m_LightEnable[lightNum] = bEnable;
+        m_DynamicState.m_LightEnableChanged[lightNum] = STATE_CHANGED;
+        m_DynamicState.m_NumLights += bEnable ? 1 : -1;
+    }
 
-void CShaderAPIVk::SetAmbientLight(float r, float g, float b) {}
+    LightStateSoA_t &lights = m_DynamicState.m_LightState;
+    SubInt(lights.m_EnableMask, lightNum) = bEnable ? ~0 : 0;
+    SubInt(lights.m_DirectionalMask, lightNum) = desc.m_Type == MATERIAL_LIGHT_DIRECTIONAL ? ~0 : 0;
 
-void CShaderAPIVk::SetAmbientLightCube(Vector4D cube[6]) {}
+    if (!bEnable)
+    {
+        m_DynamicState.m_LightDescs[lightNum].m_Type = MATERIAL_LIGHT_DISABLE;
+        m_DynamicState.m_LightType[lightNum] = LIGHT_NONE;
+        return;
+    }
+
+    m_DynamicState.m_LightDescs[lightNum] = desc;
+    m_DynamicState.m_LightChanged[lightNum] = STATE_CHANGED;
+
+    switch (desc.m_Type)
+    {
+    case MATERIAL_LIGHT_POINT:
+        m_DynamicState.m_LightType[lightNum] = LIGHT_POINT;
+        break;
+    case MATERIAL_LIGHT_DIRECTIONAL:
+        m_DynamicState.m_LightType[lightNum] = LIGHT_DIRECTIONAL;
+        break;
+    case MATERIAL_LIGHT_SPOT:
+        m_DynamicState.m_LightType[lightNum] = LIGHT_SPOT;
+        break;
+    default:
+        Assert(0);
+        m_DynamicState.m_LightType[lightNum] = LIGHT_NONE;
+        break;
+    }
+
+    // Lane lightNum of every member is this light
+    lights.m_Color.X(lightNum) = desc.m_Color.x;
+    lights.m_Color.Y(lightNum) = desc.m_Color.y;
+    lights.m_Color.Z(lightNum) = desc.m_Color.z;
+    lights.m_Position.X(lightNum) = desc.m_Position.x;
+    lights.m_Position.Y(lightNum) = desc.m_Position.y;
+    lights.m_Position.Z(lightNum) = desc.m_Position.z;
+    lights.m_Direction.X(lightNum) = desc.m_Direction.x;
+    lights.m_Direction.Y(lightNum) = desc.m_Direction.y;
+    lights.m_Direction.Z(lightNum) = desc.m_Direction.z;
+    SubFloat(lights.m_Range, lightNum) = desc.m_Range;
+    SubFloat(lights.m_Falloff, lightNum) = desc.m_Falloff;
+    SubFloat(lights.m_Attenuation0, lightNum) = desc.m_Attenuation0;
+    SubFloat(lights.m_Attenuation1, lightNum) = desc.m_Attenuation1;
+    SubFloat(lights.m_Attenuation2, lightNum) = desc.m_Attenuation2;
+    SubFloat(lights.m_ThetaDot, lightNum) = desc.m_ThetaDot;
+    SubFloat(lights.m_PhiDot, lightNum) = desc.m_PhiDot;
+}
+
+void CShaderAPIVk::SetLightingOrigin(Vector vLightingOrigin) { m_DynamicState.m_vLightingOrigin = vLightingOrigin; }
+
+void CShaderAPIVk::SetAmbientLight(float r, float g, float b)
+{
+    unsigned int red = (unsigned int)clamp((int)(r * 255.0f), 0, 255);
+    unsigned int green = (unsigned int)clamp((int)(g * 255.0f), 0, 255);
+    unsigned int blue = (unsigned int)clamp((int)(b * 255.0f), 0, 255);
+    m_DynamicState.m_Ambient = 0xFF000000 | (red << 16) | (green << 8) | blue;
+}
+
+void CShaderAPIVk::SetAmbientLightCube(Vector4D cube[6])
+{
+    if (!Q_memcmp(cube, m_DynamicState.m_AmbientLightCube, 6 * sizeof(Vector4D)))
+        return;
+
+    for (int i = 0; i < 6; i++)
+    {
+        m_DynamicState.m_AmbientLightCube[i] = cube[i];
+    }
+    m_CachedAmbientLightCube = STATE_CHANGED;
+}
 
 void CShaderAPIVk::ShadeMode(ShaderShadeMode_t mode) {}
 
@@ -1285,34 +1619,114 @@ bool CShaderAPIVk::DoRenderTargetsNeedSeparateDepthBuffer() const { return false
 ShaderAPITextureHandle_t CShaderAPIVk::CreateTexture(int width, int height, int depth, ImageFormat dstImageFormat, int numMipLevels,
                                                      int numCopies, int flags, const char *pDebugName, const char *pTextureGroupName)
 {
-    return 0;
+    // VK_TODO: numCopies > 1 is only used for dynamic textures on the 360, we always create a single copy
+    ShaderAPITextureHandle_t hTexture = m_Textures.AddToTail();
+    m_Textures[hTexture].Init(width, height, depth, dstImageFormat, numMipLevels, flags, pDebugName, pTextureGroupName);
+
+    m_nTextureMemoryUsedTotal += m_Textures[hTexture].GetSizeInBytes();
+
+    return hTexture;
 }
 
-void CShaderAPIVk::DeleteTexture(ShaderAPITextureHandle_t textureHandle) {}
+void CShaderAPIVk::DeleteTexture(ShaderAPITextureHandle_t textureHandle)
+{
+    if (!IsValidTexture(textureHandle))
+        return;
+
+    // Unbind it from any samplers
+    for (int i = 0; i < MAX_SAMPLERS; ++i)
+    {
+        if (m_DynamicState.m_SamplerState[i].m_BoundTexture == textureHandle)
+        {
+            m_DynamicState.m_SamplerState[i].m_BoundTexture = INVALID_SHADERAPI_TEXTURE_HANDLE;
+            m_BindlessTextures.m_nTextures[i] = BINDLESS_TEXTURE_NONE;
+        }
+    }
+
+    if (m_ModifyTextureHandle == textureHandle)
+    {
+        m_ModifyTextureHandle = INVALID_SHADERAPI_TEXTURE_HANDLE;
+    }
+
+    m_nTextureMemoryUsedTotal -= m_Textures[textureHandle].GetSizeInBytes();
+
+    // Frames in flight keep the image alive through the deletion queue
+    m_Textures.Remove(textureHandle);
+}
+
+void CShaderAPIVk::DeleteAllTextures()
+{
+    m_Textures.RemoveAll();
+    m_ModifyTextureHandle = INVALID_SHADERAPI_TEXTURE_HANDLE;
+    m_nTextureMemoryUsedTotal = 0;
+}
 
 ShaderAPITextureHandle_t CShaderAPIVk::CreateDepthTexture(ImageFormat renderTargetFormat, int width, int height, const char *pDebugName,
                                                           bool bTexture)
 {
-    return 0;
+    // Depth that is never sampled doesn't need to leave the GPU's tile memory
+    ShaderAPITextureHandle_t hTexture = m_Textures.AddToTail();
+    m_Textures[hTexture].InitDepth(width, height, !bTexture, pDebugName);
+
+    m_nTextureMemoryUsedTotal += m_Textures[hTexture].GetSizeInBytes();
+
+    return hTexture;
 }
 
-bool CShaderAPIVk::IsTexture(ShaderAPITextureHandle_t textureHandle) { return true; }
+bool CShaderAPIVk::IsTexture(ShaderAPITextureHandle_t textureHandle) { return IsValidTexture(textureHandle); }
 
 bool CShaderAPIVk::IsTextureResident(ShaderAPITextureHandle_t textureHandle) { return true; }
 
-void CShaderAPIVk::ModifyTexture(ShaderAPITextureHandle_t textureHandle) {}
+void CShaderAPIVk::ModifyTexture(ShaderAPITextureHandle_t textureHandle)
+{
+    Assert(IsValidTexture(textureHandle));
+    m_ModifyTextureHandle = textureHandle;
+}
 
 void CShaderAPIVk::TexImage2D(int level, int cubeFaceID, ImageFormat dstFormat, int zOffset, int width, int height, ImageFormat srcFormat,
                               bool bSrcIsTiled, void *imageData)
 {
+    if (!IsValidTexture(m_ModifyTextureHandle))
+        return;
+
+    GetTexture(m_ModifyTextureHandle).UploadImage(level, cubeFaceID, 0, 0, zOffset, width, height, srcFormat, 0, imageData);
 }
 
 void CShaderAPIVk::TexSubImage2D(int level, int cubeFaceID, int xOffset, int yOffset, int zOffset, int width, int height,
                                  ImageFormat srcFormat, int srcStride, bool bSrcIsTiled, void *imageData)
 {
+    if (!IsValidTexture(m_ModifyTextureHandle))
+        return;
+
+    GetTexture(m_ModifyTextureHandle)
+        .UploadImage(level, cubeFaceID, xOffset, yOffset, zOffset, width, height, srcFormat, srcStride, imageData);
 }
 
-void CShaderAPIVk::TexImageFromVTF(IVTFTexture *pVTF, int iVTFFrame) {}
+void CShaderAPIVk::TexImageFromVTF(IVTFTexture *pVTF, int iVTFFrame)
+{
+    if (!IsValidTexture(m_ModifyTextureHandle))
+        return;
+
+    CTextureVk &texture = GetTexture(m_ModifyTextureHandle);
+
+    // Spheremaps are stored as a 7th face, we don't use them
+    int nFaceCount = (texture.GetFlags() & TEXTURE_CREATE_CUBEMAP) ? 6 : 1;
+    int nMipCount = MIN(pVTF->MipCount(), texture.GetMipLevels());
+
+    for (int iFace = 0; iFace < nFaceCount; ++iFace)
+    {
+        for (int iMip = 0; iMip < nMipCount; ++iMip)
+        {
+            int nWidth, nHeight, nDepth;
+            pVTF->ComputeMipLevelDimensions(iMip, &nWidth, &nHeight, &nDepth);
+            for (int z = 0; z < nDepth; ++z)
+            {
+                unsigned char *pBits = pVTF->ImageData(iVTFFrame, iFace, iMip, 0, 0, z);
+                texture.UploadImage(iMip, iFace, 0, 0, z, nWidth, nHeight, pVTF->Format(), 0, pBits);
+            }
+        }
+    }
+}
 
 bool CShaderAPIVk::TexLock(int level, int cubeFaceID, int xOffset, int yOffset, int width, int height, CPixelWriter &writer)
 {
@@ -1323,11 +1737,69 @@ void CShaderAPIVk::TexUnlock() {}
 
 void CShaderAPIVk::TexSetPriority(int priority) {}
 
-void CShaderAPIVk::BindTexture(Sampler_t sampler, ShaderAPITextureHandle_t textureHandle) {}
+void CShaderAPIVk::BindTexture(Sampler_t sampler, ShaderAPITextureHandle_t textureHandle)
+{
+    Assert(sampler >= 0 && sampler < MAX_SAMPLERS);
 
-void CShaderAPIVk::SetRenderTarget(ShaderAPITextureHandle_t colorTextureHandle, ShaderAPITextureHandle_t depthTextureHandle) {}
+    SamplerState_t &samplerState = m_DynamicState.m_SamplerState[sampler];
+    samplerState.m_BoundTexture = textureHandle;
+    samplerState.m_nSamplerIndex = 0;
+    m_BindlessTextures.m_nTextures[sampler] = BINDLESS_TEXTURE_NONE;
+    if (IsValidTexture(textureHandle))
+    {
+        CTextureVk &texture = GetTexture(textureHandle);
+        if (texture.NeedsMipmaps() && m_PendingMipmaps.Find(textureHandle) == m_PendingMipmaps.InvalidIndex())
+        {
+            m_PendingMipmaps.AddToTail(textureHandle);
+        }
+        samplerState.m_nSamplerIndex = texture.GetSamplerIndex(samplerState.m_nAnisotropicLevel);
 
-void CShaderAPIVk::ClearBuffersObeyStencil(bool bClearColor, bool bClearDepth) {}
+        // Samplers past the end of the bindless array fall back to the default one
+        uint32_t nSamplerIndex = samplerState.m_nSamplerIndex;
+        if (nSamplerIndex >= g_pShaderDevice->GetBindlessTextures().GetMaxSamplers())
+        {
+            nSamplerIndex = 0;
+        }
+        m_BindlessTextures.m_nTextures[sampler] = PackBindlessIndex(texture.GetBindlessSlot(), nSamplerIndex);
+    }
+}
+
+void CShaderAPIVk::RecordPendingMipmaps(VkCommandBuffer commandBuffer)
+{
+    // Textures may have been deleted, or already generated by another viewport's frame
+    for (int i = 0; i < m_PendingMipmaps.Count(); i++)
+    {
+        if (IsValidTexture(m_PendingMipmaps[i]) && GetTexture(m_PendingMipmaps[i]).NeedsMipmaps())
+        {
+            GetTexture(m_PendingMipmaps[i]).GenerateMipmaps(commandBuffer);
+        }
+    }
+    m_PendingMipmaps.RemoveAll();
+}
+
+void CShaderAPIVk::SetRenderTarget(ShaderAPITextureHandle_t colorTextureHandle, ShaderAPITextureHandle_t depthTextureHandle)
+{
+    Assert(colorTextureHandle == SHADER_RENDERTARGET_BACKBUFFER || IsValidTexture(colorTextureHandle));
+    Assert(depthTextureHandle == SHADER_RENDERTARGET_DEPTHBUFFER || depthTextureHandle == SHADER_RENDERTARGET_NONE ||
+           IsValidTexture(depthTextureHandle));
+
+    // Draws so far go to the old target
+    FlushBufferedPrimitives();
+
+    m_UsingTextureRenderTarget = (colorTextureHandle != SHADER_RENDERTARGET_BACKBUFFER);
+    if (m_UsingTextureRenderTarget && IsValidTexture(colorTextureHandle))
+    {
+        m_ViewportMaxWidth = GetTexture(colorTextureHandle).GetWidth();
+        m_ViewportMaxHeight = GetTexture(colorTextureHandle).GetHeight();
+    }
+
+    if (g_pShaderDevice->GetCurrentViewport())
+    {
+        g_pShaderDevice->GetCurrentViewport()->SetRenderTarget(colorTextureHandle, depthTextureHandle);
+    }
+}
+
+void CShaderAPIVk::ClearBuffersObeyStencil(bool bClearColor, bool bClearDepth) { ClearBuffers(bClearColor, bClearDepth, false, -1, -1); }
 
 void CShaderAPIVk::ReadPixels(int x, int y, int width, int height, unsigned char *data, ImageFormat dstFormat) {}
 
@@ -1353,17 +1825,137 @@ void CShaderAPIVk::EndFrame()
     // ExportTextureList();
 }
 
-int CShaderAPIVk::SelectionMode(bool selectionMode) { return 0; }
+static int __cdecl PickHitIdLessFunc(const PickHitVk_t *pLeft, const PickHitVk_t *pRight)
+{
+    return pLeft->m_nId < pRight->m_nId ? -1 : (pLeft->m_nId > pRight->m_nId ? 1 : 0);
+}
+
+int CShaderAPIVk::SelectionMode(bool selectionMode)
+{
+    if (m_InSelectionMode)
+    {
+        WriteHitRecord();
 
-void CShaderAPIVk::SelectionBuffer(unsigned int *pBuffer, int size) {}
+        // Pick buffer hits are written once everything is drawn, ids count up in draw order like the CPU records
+        CViewportVk *pViewport = g_pShaderDevice->GetCurrentViewport();
+        if (m_SelectionRecords.Count() > 0 && pViewport)
+        {
+            CUtlVector<PickHitVk_t> hits;
+            pViewport->ResolvePick(hits);
+            hits.Sort(PickHitIdLessFunc);
+            for (int i = 0; i < hits.Count(); i++)
+            {
+                const SelectionRecord_t &record = m_SelectionRecords[hits[i].m_nId - 1];
+                RegisterSelectionHit(hits[i].m_flMinZ, hits[i].m_flMaxZ);
+                WriteSelectionRecord(&m_SelectionRecordNames[record.m_nFirstName], record.m_nNameCount);
+            }
+        }
+    }
+
+    int numHits = m_NumHits;
+    m_InSelectionMode = selectionMode;
+    m_pCurrSelectionRecord = m_pSelectionBuffer;
+    m_NumHits = 0;
+
+    m_SelectionRecords.RemoveAll();
+    m_SelectionRecordNames.RemoveAll();
+    m_nSelectionId = 0;
+    if (!selectionMode)
+    {
+        m_bPickRegionSet = false;
+    }
+    return numHits;
+}
+
+void CShaderAPIVk::SelectionBuffer(unsigned int *pBuffer, int size)
+{
+    Assert(!m_InSelectionMode);
+    Assert(pBuffer && size);
+    m_pSelectionBufferEnd = pBuffer + size;
+    m_pSelectionBuffer = pBuffer;
+    m_pCurrSelectionRecord = pBuffer;
+}
 
-void CShaderAPIVk::ClearSelectionNames() {}
+void CShaderAPIVk::ClearSelectionNames()
+{
+    if (m_InSelectionMode)
+    {
+        WriteHitRecord();
+    }
+    m_SelectionNames.Clear();
+}
 
-void CShaderAPIVk::LoadSelectionName(int name) {}
+void CShaderAPIVk::LoadSelectionName(int name)
+{
+    if (m_InSelectionMode)
+    {
+        WriteHitRecord();
+        Assert(m_SelectionNames.Count() > 0);
+        m_SelectionNames.Top() = name;
+    }
+}
 
-void CShaderAPIVk::PushSelectionName(int name) {}
+void CShaderAPIVk::PushSelectionName(int name)
+{
+    if (m_InSelectionMode)
+    {
+        WriteHitRecord();
+        m_SelectionNames.Push(name);
+    }
+}
 
-void CShaderAPIVk::PopSelectionName() {}
+void CShaderAPIVk::PopSelectionName()
+{
+    if (m_InSelectionMode)
+    {
+        WriteHitRecord();
+        m_SelectionNames.Pop();
+    }
+}
+
+void CShaderAPIVk::WriteHitRecord()
+{
+    FlushBufferedPrimitives();
+
+    // Draws with the next names get a new selection id
+    m_nSelectionId = 0;
+
+    WriteSelectionRecord(m_SelectionNames.Base(), m_SelectionNames.Count());
+}
+
+void CShaderAPIVk::WriteSelectionRecord(const int *pNames, int nNames)
+{
+    if (nNames && (m_SelectionMinZ != FLT_MAX))
+    {
+        Assert(m_pCurrSelectionRecord + nNames + 3 < m_pSelectionBufferEnd);
+        *m_pCurrSelectionRecord++ = nNames;
+        *m_pCurrSelectionRecord++ = (int)((double)m_SelectionMinZ * (double)0xFFFFFFFF);
+        *m_pCurrSelectionRecord++ = (int)((double)m_SelectionMaxZ * (double)0xFFFFFFFF);
+        for (int i = 0; i < nNames; ++i)
+        {
+            *m_pCurrSelectionRecord++ = pNames[i];
+        }
+
+        ++m_NumHits;
+    }
+
+    m_SelectionMinZ = FLT_MAX;
+    m_SelectionMaxZ = FLT_MIN;
+}
+
+uint32_t CShaderAPIVk::GetSelectionId()
+{
+    // Name stacks only get an id once something is drawn with them
+    if (m_nSelectionId == 0 && m_SelectionNames.Count() > 0)
+    {
+        SelectionRecord_t record;
+        record.m_nFirstName = m_SelectionRecordNames.Count();
+        record.m_nNameCount = m_SelectionNames.Count();
+        m_SelectionRecordNames.AddMultipleToTail(m_SelectionNames.Count(), m_SelectionNames.Base());
+        m_nSelectionId = m_SelectionRecords.AddToTail(record) + 1;
+    }
+    return m_nSelectionId;
+}
 
 void CShaderAPIVk::ForceHardwareSync() {}
 
@@ -1538,6 +2130,12 @@ void CShaderAPIVk::InitVertexAndPixelShaders()
                                            g_pHardwareConfig->Caps().m_NumIntegerVertexShaderConstants, true);
         }
 
+        // The zeroed registers above aren't worth uploading, only what shaders set from here on is
+        for (int i = 0; i < SHADER_CONSTANTS_STAGE_COUNT; i++)
+        {
+            m_nConstantHighWater[i] = 0;
+        }
+
         SetStandardVertexShaderConstants(OVERBRIGHT);
     }
 
@@ -1764,8 +2362,12 @@ void CShaderAPIVk::ResetRenderState(bool bFullReset)
     */
 
     m_DynamicState.m_NumLights = 0;
+    Q_memset(&m_DynamicState.m_LightState, 0, sizeof(m_DynamicState.m_LightState));
+    Q_memset(m_DynamicState.m_AmbientLightCube, 0, sizeof(m_DynamicState.m_AmbientLightCube));
     for (i = 0; i < MAX_NUM_LIGHTS; ++i)
     {
+        m_DynamicState.m_LightDescs[i].m_Type = MATERIAL_LIGHT_DISABLE;
+        m_DynamicState.m_LightType[i] = LIGHT_NONE;
         m_DynamicState.m_LightEnable[i] = false;
         m_DynamicState.m_LightChanged[i] = STATE_CHANGED;
         m_DynamicState.m_LightEnableChanged[i] = STATE_CHANGED;
@@ -1866,7 +2468,7 @@ void CShaderAPIVk::ResetRenderState(bool bFullReset)
     m_pRenderMesh = 0;
 
     // Reset cached vertex decl
-    m_DynamicState.m_pVertexDecl = NULL;
+    m_DynamicState.m_VertexDecl = 0;
 
     // Reset the render target to be the normal backbuffer
     // AcquireInternalRenderTargets();
@@ -1965,12 +2567,31 @@ void CShaderAPIVk::DestroyVertexBuffers(bool bExitingLevel)
 
 void CShaderAPIVk::SetVertexDecl(VertexFormat_t vertexFormat, bool bHasColorMesh, bool bUsingFlex, bool bUsingMorph)
 {
-    // VK_TODO
+    // Every buffer holds the same Vertex layout, so the format doesn't change the bindings.
+    // The vertex ID is gl_VertexIndex and needs no stream.
+    unsigned int nDecl = 0;
+    if (bHasColorMesh)
+    {
+        nDecl |= VERTEX_DECL_COLOR_STREAM;
+    }
+    if (bUsingFlex)
+    {
+        nDecl |= VERTEX_DECL_FLEX_STREAM;
+    }
+    m_DynamicState.m_VertexDecl = nDecl;
 }
 
 void CShaderAPIVk::EvictManagedResources() {}
 
-void CShaderAPIVk::SetAnisotropicLevel(int nAnisotropyLevel) {}
+void CShaderAPIVk::SetAnisotropicLevel(int nAnisotropyLevel)
+{
+    // Only affects textures using SHADER_TEXFILTERMODE_ANISOTROPIC, picked up on the next bind
+    nAnisotropyLevel = clamp(nAnisotropyLevel, 1, MAX(g_pHardwareConfig->Caps().m_nMaxAnisotropy, 1));
+    for (int i = 0; i < MAX_SAMPLERS; ++i)
+    {
+        m_DynamicState.m_SamplerState[i].m_nAnisotropicLevel = nAnisotropyLevel;
+    }
+}
 
 void CShaderAPIVk::SetStandardVertexShaderConstants(float fOverbright) {}
 
@@ -2001,6 +2622,11 @@ MorphFormat_t CShaderAPIVk::ComputeMorphFormat(int numSnapshots, StateSnapshot_t
 void CShaderAPIVk::SetRenderTargetEx(int nRenderTargetID, ShaderAPITextureHandle_t colorTextureHandle,
                                      ShaderAPITextureHandle_t depthTextureHandle)
 {
+    // VK_TODO: multiple render targets
+    if (nRenderTargetID == 0)
+    {
+        SetRenderTarget(colorTextureHandle, depthTextureHandle);
+    }
 }
 
 void CShaderAPIVk::CopyRenderTargetToTextureEx(ShaderAPITextureHandle_t textureHandle, int nRenderTargetID, Rect_t *pSrcRect,
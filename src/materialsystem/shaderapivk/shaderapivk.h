@@ -19,6 +19,7 @@
 #include "shaderapi/ishaderapi.h"
 #include "shaderdevicevk.h"
 #include "shadershadowvk.h"
+#include "texturevk.h"
 #include "materialsystem/idebugtextureinfo.h"
 #include "utlstack.h"
 // clang-format on
@@ -591,6 +592,12 @@ class CShaderAPIVk : public IShaderAPI, public IDebugTextureInfo
     // We hit somefin in selection mode
     void RegisterSelectionHit(float minz, float maxz);
 
+    // Selection mode with a PickMatrix region renders selection ids into the pick buffer, see CPickBufferVk
+    bool IsPicking() const { return m_InSelectionMode && m_bPickRegionSet; }
+
+    // Id the current selection names are written to the pick buffer as, 0 when there are none
+    uint32_t GetSelectionId();
+
     // Get the currently bound material
     IMaterial *GetBoundMaterial() { return m_pMaterial; }
 
@@ -704,6 +711,45 @@ class CShaderAPIVk : public IShaderAPI, public IDebugTextureInfo
     // Gets at a particular transform
     glm::mat4x4 GetTransform(int i) { return m_MatrixStack[i].GetTop(); }
 
+    // Gets at a texture by handle.
+    // The render target placeholders are never valid, the linked list can't tell in release.
+    CTextureVk &GetTexture(ShaderAPITextureHandle_t hTexture) { return m_Textures[hTexture]; }
+    bool IsValidTexture(ShaderAPITextureHandle_t hTexture) const
+    {
+        return hTexture != INVALID_SHADERAPI_TEXTURE_HANDLE && hTexture != SHADER_RENDERTARGET_BACKBUFFER &&
+               hTexture != SHADER_RENDERTARGET_NONE && m_Textures.IsValidIndex(hTexture);
+    }
+
+    // Deletes all textures
+    void DeleteAllTextures();
+
+    // Regenerates the mips of textures bound since level 0 was uploaded to, recorded ahead of a frame's render passes
+    void RecordPendingMipmaps(VkCommandBuffer commandBuffer);
+
+    // Bound textures for the next draw as bindless indices, one per sampler stage
+    const BindlessPushConstants_t &GetBindlessTextures() const { return m_BindlessTextures; }
+
+    // Vector constants as last set, the viewport uploads them per draw
+    const Vector4D *GetShaderConstants(ShaderConstantStage_t stage) const
+    {
+        return stage == SHADER_CONSTANTS_VERTEX ? m_DesiredState.m_pVectorVertexShaderConstant
+                                                : m_DesiredState.m_pVectorPixelShaderConstant;
+    }
+
+    // One past the highest register set since the constants were reset, nothing above it is ever read
+    int GetShaderConstantHighWater(ShaderConstantStage_t stage) const { return m_nConstantHighWater[stage]; }
+
+    // Registers changed since the last call, returns false if nothing changed
+    bool GetShaderConstantDirtyRange(ShaderConstantStage_t stage, int &nFirst, int &nLast);
+
+    // Bones loaded since the last call, returns false if the palette didn't change.
+    // bForce returns the last palette anyway, for callers that lost track of it.
+    bool GetDirtyBoneMatrices(const matrix3x4_t *&pBones, int &nCount, bool bForce);
+    int GetNumBoneWeights() const { return m_DynamicState.m_NumBones; }
+
+    // Secondary vertex streams of the mesh being drawn, VERTEX_DECL_xxx flags
+    unsigned int GetVertexDecl() const { return m_DynamicState.m_VertexDecl; }
+
 #ifdef TF
     void TexLodClamp(int finest) override;
 
@@ -724,6 +770,8 @@ class CShaderAPIVk : public IShaderAPI, public IDebugTextureInfo
     MatrixStack m_MatrixStack[NUM_MATRIX_MODES];
     matrix3x4_t m_boneMatrix[NUM_MODEL_TRANSFORMS];
     int m_maxBoneLoaded;
+    int m_nBonePaletteCount; // Bones in the palette last handed out
+    bool m_bBoneMatricesDirty;
 
     // Current matrix mode
     /*D3DTRANSFORMSTATETYPE*/ int m_MatrixMode;
@@ -745,6 +793,19 @@ class CShaderAPIVk : public IShaderAPI, public IDebugTextureInfo
     // to match the desired state after returning from alt-tab.
     DynamicState_t m_DesiredState;
 
+    // Textures, the handle is the index into the list
+    CUtlFixedLinkedList<CTextureVk> m_Textures;
+    ShaderAPITextureHandle_t m_ModifyTextureHandle;
+    BindlessPushConstants_t m_BindlessTextures;
+    CUtlVector<ShaderAPITextureHandle_t> m_PendingMipmaps;
+
+    // Vector constant registers written since the last draw, first > last when clean
+    void SetShaderConstants(ShaderConstantStage_t stage, Vector4D *pConstants, int nMaxConstants, int var, float const *pVec, int numConst,
+                            bool bForce);
+    int m_nConstantDirtyFirst[SHADER_CONSTANTS_STAGE_COUNT];
+    int m_nConstantDirtyLast[SHADER_CONSTANTS_STAGE_COUNT];
+    int m_nConstantHighWater[SHADER_CONSTANTS_STAGE_COUNT];
+
     // Render data
     CBaseMeshVk *m_pRenderMesh;
     int m_nDynamicVBSize;
@@ -760,6 +821,21 @@ class CShaderAPIVk : public IShaderAPI, public IDebugTextureInfo
     float m_SelectionMaxZ;
     int m_NumHits;
 
+    // Writes a hit record for the names if anything was hit since the last one
+    void WriteHitRecord();
+    void WriteSelectionRecord(const int *pNames, int nNames);
+
+    // Name stacks drawn while picking, selection id N is record N - 1
+    struct SelectionRecord_t
+    {
+        int m_nFirstName; // In m_SelectionRecordNames
+        int m_nNameCount;
+    };
+    CUtlVector<SelectionRecord_t> m_SelectionRecords;
+    CUtlVector<int> m_SelectionRecordNames;
+    uint32_t m_nSelectionId; // 0 until something is drawn with the current names
+    bool m_bPickRegionSet;
+
     // Shadow depth bias states
     float m_fShadowSlopeScaleDepthBias;
     float m_fShadowDepthBias;
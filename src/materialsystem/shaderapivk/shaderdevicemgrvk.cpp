@@ -401,6 +401,22 @@ uint32_t CShaderDeviceMgrVk::FindMemoryType(int adapter, uint32_t typeFilter, Vk
     Error("failed to find suitable memory type!");
 }
 
+bool CShaderDeviceMgrVk::HasMemoryType(int adapter, uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(GetAdapter(adapter), &memProperties);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+    {
+        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 bool CShaderDeviceMgrVk::CheckValidationLayerSupport()
 {
     // Get available layers
@@ -469,6 +485,13 @@ void CShaderDeviceMgrVk::ReadHardwareCaps(HardwareCaps_t &caps)
 
 VkInstance CShaderDeviceMgrVk::GetInstance() { return m_hInstance; }
 
+static bool SupportsVertexFormat(VkPhysicalDevice device, VkFormat format)
+{
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(device, format, &props);
+    return (props.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) != 0;
+}
+
 HardwareCaps_t CShaderDeviceMgrVk::GetHardwareCaps(MyVkAdapterInfo adapterInfo)
 {
     HardwareCaps_t caps{};
@@ -489,12 +512,17 @@ HardwareCaps_t CShaderDeviceMgrVk::GetHardwareCaps(MyVkAdapterInfo adapterInfo)
     caps.m_SupportsPixelShaders_2_0 = false;
     caps.m_SupportsPixelShaders_2_b = false;
     caps.m_SupportsShaderModel_3_0 = false;
-    caps.m_SupportsCompressedTextures = COMPRESSED_TEXTURES_OFF;
-    caps.m_SupportsCompressedVertices = VERTEX_COMPRESSION_NONE;
+    // DXT data is always accepted, devices without textureCompressionBC decode it on upload.
+    // Reporting it as unsupported would make the material system decompress everything on the main thread instead.
+    caps.m_SupportsCompressedTextures = COMPRESSED_TEXTURES_ON;
+    // Packed normals and bone weights are fetched like their D3DDECLTYPEs, see VERTEX_PACKED_NORMAL_FORMAT
+    bool bCompressedVertices = SupportsVertexFormat(adapterInfo.device, VERTEX_PACKED_NORMAL_FORMAT) &&
+                               SupportsVertexFormat(adapterInfo.device, VERTEX_PACKED_BONE_WEIGHTS_FORMAT);
+    caps.m_SupportsCompressedVertices = bCompressedVertices ? VERTEX_COMPRESSION_ON : VERTEX_COMPRESSION_NONE;
     caps.m_bSupportsAnisotropicFiltering = true;
     caps.m_bSupportsMagAnisotropicFiltering = true;
     caps.m_bSupportsVertexTextures = true;
-    caps.m_nMaxAnisotropy = 16;
+    caps.m_nMaxAnisotropy = (int)adapterInfo.props.limits.maxSamplerAnisotropy;
     caps.m_MaxTextureWidth = adapterInfo.props.limits.maxImageDimension2D;
     caps.m_MaxTextureHeight = adapterInfo.props.limits.maxImageDimension2D;
     caps.m_MaxTextureDepth = adapterInfo.props.limits.maxImageDimension3D;
@@ -90,6 +90,7 @@ class CShaderDeviceMgrVk : public IShaderDeviceMgr
     void InitAdapterInfo();
 
     uint32_t FindMemoryType(int adapter, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+    bool HasMemoryType(int adapter, uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
     bool CheckValidationLayerSupport();
 
@@ -14,10 +14,21 @@ EXPOSE_SINGLE_INTERFACE_GLOBALVAR(CShaderDeviceVk, IShaderDevice, SHADER_DEVICE_
 
 const std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME};
 
+static bool HasExtension(const std::vector<std::string> &extensions, const char *pName)
+{
+    for (const std::string &ext : extensions)
+    {
+        if (ext == pName)
+            return true;
+    }
+    return false;
+}
+
 CShaderDeviceVk::CShaderDeviceVk()
 {
     m_PhysicalDevice = VK_NULL_HANDLE;
     m_Device = VK_NULL_HANDLE;
+    m_CommandPool = VK_NULL_HANDLE;
     m_CurrentViewport = -1;
     m_Viewports = std::vector<CViewportVk *>();
 }
@@ -41,7 +52,7 @@ void CShaderDeviceVk::InitDevice(VkPhysicalDevice physicalDevice)
 #ifdef DEBUG
     Msg("Supported device extensions:\n");
 #endif
-    std::vector<char *> supportedExtensions;
+    std::vector<std::string> supportedExtensions;
     uint32_t extCount = 0;
     vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extCount, nullptr);
     if (extCount > 0)
@@ -73,17 +84,106 @@ void CShaderDeviceVk::InitDevice(VkPhysicalDevice physicalDevice)
     createInfo.pQueueCreateInfos = &queueCreateInfo;
     createInfo.enabledLayerCount = validationLayers.size();
     createInfo.ppEnabledLayerNames = validationLayers.data();
-    createInfo.enabledExtensionCount = deviceExtensions.size();
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
     createInfo.pEnabledFeatures = &features;
 
+    // Every supported core feature is enabled, geometryShader included
+    m_bSupportsGeometryShaders = features.geometryShader == VK_TRUE;
+
     // Enable dynamic features
     VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamicFeatures{};
     dynamicFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
     dynamicFeatures.extendedDynamicState = true;
     createInfo.pNext = &dynamicFeatures;
 
+    // Bindless textures need descriptor indexing, core in 1.2
+    std::vector<const char *> enabledExtensions = deviceExtensions;
+    bool bHasDescriptorIndexing = properties.apiVersion >= VK_API_VERSION_1_2;
+    if (!bHasDescriptorIndexing && HasExtension(supportedExtensions, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) &&
+        HasExtension(supportedExtensions, VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+    {
+        bHasDescriptorIndexing = true;
+        enabledExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    }
+
+    VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+    if (bHasDescriptorIndexing)
+    {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &indexingFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+        VkPhysicalDeviceProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &indexingProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+    }
+
+    m_bSupportsBindless = indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+                          indexingFeatures.descriptorBindingUpdateUnusedWhilePending &&
+                          indexingFeatures.descriptorBindingPartiallyBound && indexingFeatures.runtimeDescriptorArray;
+
+    uint32_t nMaxBindlessTextures = 0;
+    uint32_t nMaxBindlessSamplers = 0;
+    if (m_bSupportsBindless)
+    {
+        // Leave room in the per-stage limits for whatever else the pipeline layout binds
+        uint32_t nStageTextures = indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages;
+        uint32_t nStageSamplers = indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers;
+        nMaxBindlessTextures = MIN(indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+                                   nStageTextures > BINDLESS_RESERVED_DESCRIPTORS ? nStageTextures - BINDLESS_RESERVED_DESCRIPTORS : 0);
+        nMaxBindlessSamplers = MIN(indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+                                   nStageSamplers > BINDLESS_RESERVED_DESCRIPTORS ? nStageSamplers - BINDLESS_RESERVED_DESCRIPTORS : 0);
+
+        // Too small to hold a level's textures, stay on per-draw descriptor sets
+        m_bSupportsBindless = nMaxBindlessTextures >= BINDLESS_MIN_TEXTURES && nMaxBindlessSamplers >= BINDLESS_MIN_SAMPLERS;
+    }
+
+    if (m_bSupportsBindless)
+    {
+        // Only enable what CBindlessTexturesVk uses
+        indexingFeatures = {};
+        indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+        indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+        dynamicFeatures.pNext = &indexingFeatures;
+    }
+
+    createInfo.enabledExtensionCount = enabledExtensions.size();
+    createInfo.ppEnabledExtensionNames = enabledExtensions.data();
+
+    // Without BC support compressed textures get decoded on upload, see CTextureVk
+    m_bSupportsBCTextures = features.textureCompressionBC == VK_TRUE;
+
+    // Pick a depth format usable as both attachment and texture
+    VkFormat depthFormats[] = {VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT};
+    for (VkFormat depthFormat : depthFormats)
+    {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, depthFormat, &props);
+        const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+        if ((props.optimalTilingFeatures & required) == required)
+        {
+            m_DepthFormat = depthFormat;
+            break;
+        }
+    }
+
+    if (m_DepthFormat == VK_FORMAT_UNDEFINED)
+    {
+        Error("failed to find supported depth format");
+    }
+
     size_t minUboAlignment = properties.limits.minUniformBufferOffsetAlignment;
+    m_nMinUBOOffsetAlignment = MAX(minUboAlignment, (size_t)16);
+    m_nMinSSBOOffsetAlignment = MAX((size_t)properties.limits.minStorageBufferOffsetAlignment, (size_t)16);
+    m_nMaxVertexInputAttributes = properties.limits.maxVertexInputAttributes;
     m_DynamicUBOAlignment = sizeof(UniformBufferObject);
     if (minUboAlignment > 0)
     {
@@ -93,10 +193,33 @@ void CShaderDeviceVk::InitDevice(VkPhysicalDevice physicalDevice)
     // Create logical device
     vkCheck(vkCreateDevice(physicalDevice, &createInfo, g_pAllocCallbacks, &m_Device), "failed to create device");
 
+    VkPipelineCacheCreateInfo pipelineCacheInfo = {};
+    pipelineCacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    vkCheck(vkCreatePipelineCache(m_Device, &pipelineCacheInfo, g_pAllocCallbacks, &m_PipelineCache), "failed to create pipeline cache");
+
     // Get queue
     vkGetDeviceQueue(m_Device, queueFamily, 0, &m_GraphicsQueue);
     vkGetDeviceQueue(m_Device, queueFamily, 0, &m_PresentQueue);
 
+    // Command pool for transfers that happen outside of a viewport's frame
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = queueFamily;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    vkCheck(vkCreateCommandPool(m_Device, &poolInfo, g_pAllocCallbacks, &m_CommandPool), "failed to create command pool");
+
+    // Sampler indices past the bindless array would be unwritten descriptors, the cache hands out the default instead
+    uint32_t nMaxSamplers = properties.limits.maxSamplerAllocationCount;
+    if (m_bSupportsBindless)
+    {
+        m_BindlessTextures.Init(MIN(nMaxBindlessTextures, 65536u), MIN(nMaxBindlessSamplers, 1024u));
+        nMaxSamplers = MIN(nMaxSamplers, m_BindlessTextures.GetMaxSamplers());
+    }
+
+    m_SamplerCache.Init(features.samplerAnisotropy == VK_TRUE, properties.limits.maxSamplerAnisotropy, nMaxSamplers);
+    m_MipGenerator.Init(physicalDevice, features.shaderStorageImageWriteWithoutFormat == VK_TRUE);
+    m_PickBuffer.Init(physicalDevice);
+
     m_bInitialized = true;
 }
 
@@ -163,6 +286,7 @@ void CShaderDeviceVk::Present()
     }
 
     MeshMgr()->DiscardVertexBuffers();
+    m_GeometryArena.Compact();
 }
 
 void CShaderDeviceVk::GetWindowSize(int &nWidth, int &nHeight) const
@@ -255,6 +379,54 @@ VkShaderModule CShaderDeviceVk::CreateShaderModule(const uint32_t *code, const s
     return shaderModule;
 }
 
+void CShaderDeviceVk::DestroyShaderModule(VkShaderModule shaderModule)
+{
+    if (shaderModule == VK_NULL_HANDLE)
+        return;
+
+    for (size_t i = 0; i < m_Viewports.size(); i++)
+    {
+        m_Viewports[i]->ReleasePipelines(shaderModule);
+    }
+    m_DeletionQueue.DestroyShaderModule(shaderModule);
+}
+
+VkCommandBuffer CShaderDeviceVk::BeginSingleTimeCommands()
+{
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = m_CommandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    vkCheck(vkAllocateCommandBuffers(m_Device, &allocInfo, &commandBuffer), "failed to allocate command buffer");
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkCheck(vkBeginCommandBuffer(commandBuffer, &beginInfo), "failed to begin command buffer");
+
+    return commandBuffer;
+}
+
+void CShaderDeviceVk::EndSingleTimeCommands(VkCommandBuffer commandBuffer)
+{
+    vkCheck(vkEndCommandBuffer(commandBuffer), "failed to end command buffer");
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+
+    vkCheck(vkQueueSubmit(m_GraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE), "failed to submit queue");
+    vkQueueWaitIdle(m_GraphicsQueue);
+    vkFreeCommandBuffers(m_Device, m_CommandPool, 1, &commandBuffer);
+
+    // Every submitted frame is done too
+    m_DeletionQueue.OnIdle();
+}
+
 IShaderBuffer *CShaderDeviceVk::CompileShader(const char *pProgram, size_t nBufLen, const char *pShaderVersion)
 {
     return g_pShaderManager->CompileShader(pProgram, nBufLen, pShaderVersion);
@@ -269,11 +441,10 @@ void CShaderDeviceVk::DestroyVertexShader(VertexShaderHandle_t hShader) { g_pSha
 
 GeometryShaderHandle_t CShaderDeviceVk::CreateGeometryShader(IShaderBuffer *pShaderBuffer)
 {
-    Assert(0);
-    return GEOMETRY_SHADER_HANDLE_INVALID;
+    return g_pShaderManager->CreateGeometryShader(pShaderBuffer);
 }
 
-void CShaderDeviceVk::DestroyGeometryShader(GeometryShaderHandle_t hShader) { Assert(hShader == GEOMETRY_SHADER_HANDLE_INVALID); }
+void CShaderDeviceVk::DestroyGeometryShader(GeometryShaderHandle_t hShader) { g_pShaderManager->DestroyGeometryShader(hShader); }
 
 PixelShaderHandle_t CShaderDeviceVk::CreatePixelShader(IShaderBuffer *pShaderBuffer)
 {
@@ -375,10 +546,31 @@ void CShaderDeviceVk::ShutdownDevice()
     m_Viewports.clear();
     m_CurrentViewport = -1;
 
+    // Nothing can be in flight anymore, release everything still queued
+    vkDeviceWaitIdle(m_Device);
+    m_DeletionQueue.Flush();
+
+    m_GeometryArena.Shutdown();
+    m_PickBuffer.Shutdown();
+    m_RenderPassCache.Shutdown();
+    m_MipGenerator.Shutdown();
+    m_SamplerCache.Shutdown();
+    m_BindlessTextures.Shutdown();
+
+    vkDestroyPipelineCache(m_Device, m_PipelineCache, g_pAllocCallbacks);
+    m_PipelineCache = VK_NULL_HANDLE;
+
+    vkDestroyCommandPool(m_Device, m_CommandPool, g_pAllocCallbacks);
+    m_CommandPool = VK_NULL_HANDLE;
+
     vkDestroyDevice(m_Device, g_pAllocCallbacks);
     m_Device = nullptr;
 
     m_bInitialized = false;
 }
 
-void CShaderDeviceVk::DrawMesh(CBaseMeshVk *pMesh) { GetCurrentViewport()->DrawMesh(pMesh); }
+void CShaderDeviceVk::DrawMesh(CBaseMeshVk *pMesh, int nBaseVertex, int nFirstVertex, int nVertexCount, const CPrimList *pPrims,
+                               int nPrims)
+{
+    GetCurrentViewport()->DrawMesh(pMesh, nBaseVertex, nFirstVertex, nVertexCount, pPrims, nPrims);
+}
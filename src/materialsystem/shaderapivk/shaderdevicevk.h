@@ -8,6 +8,13 @@
 #endif
 
 #include "shaderapi/IShaderDevice.h"
+#include "bindlessvk.h"
+#include "deletionqueuevk.h"
+#include "geometryarenavk.h"
+#include "mipgenvk.h"
+#include "pickbuffervk.h"
+#include "renderpassvk.h"
+#include "samplervk.h"
 #include "shaderdevicemgrvk.h"
 #include "viewportvk.h"
 
@@ -25,6 +32,32 @@ class CShaderDeviceVk : public IShaderDevice
     VkQueue GetPresentQueue() const { return m_PresentQueue; }
     VkQueue GetGraphicsQueue() const { return m_GraphicsQueue; }
     size_t GetUBOAlignment() const { return m_DynamicUBOAlignment; }
+    size_t GetMinUBOOffsetAlignment() const { return m_nMinUBOOffsetAlignment; }
+    size_t GetMinSSBOOffsetAlignment() const { return m_nMinSSBOOffsetAlignment; }
+    uint32_t GetMaxVertexInputAttributes() const { return m_nMaxVertexInputAttributes; }
+    bool SupportsBCTextures() const { return m_bSupportsBCTextures; }
+    bool SupportsGeometryShaders() const { return m_bSupportsGeometryShaders; }
+    VkFormat GetDepthFormat() const { return m_DepthFormat; }
+    CRenderPassCacheVk &GetRenderPassCache() { return m_RenderPassCache; }
+    CSamplerCacheVk &GetSamplerCache() { return m_SamplerCache; }
+
+    // Textures are sampled through one big descriptor set when supported
+    bool SupportsBindless() const { return m_bSupportsBindless; }
+    CBindlessTexturesVk &GetBindlessTextures() { return m_BindlessTextures; }
+
+    CMipGeneratorVk &GetMipGenerator() { return m_MipGenerator; }
+
+    // Selection mode renders ids into this when it's supported, see CPickBufferVk
+    CPickBufferVk &GetPickBuffer() { return m_PickBuffer; }
+
+    // Shared by every pipeline we create, dedupes the driver side of specialized pipelines
+    VkPipelineCache GetPipelineCache() const { return m_PipelineCache; }
+
+    // Objects the GPU may still be using are destroyed through here, see CDeletionQueueVk
+    CDeletionQueueVk &GetDeletionQueue() { return m_DeletionQueue; }
+
+    // Small static vertex and index buffers live in here, see CGeometryArenaVk
+    CGeometryArenaVk &GetGeometryArena() { return m_GeometryArena; }
 
     // Releases/reloads resources when other apps want some memory
     void ReleaseResources() override;
@@ -69,6 +102,13 @@ class CShaderDeviceVk : public IShaderDevice
 
     VkShaderModule CreateShaderModule(const uint32_t *code, const size_t size);
 
+    // Deferred like every other destroy, pipelines using the module are dropped right away
+    void DestroyShaderModule(VkShaderModule shaderModule);
+
+    // One-shot command buffers for uploads and layout transitions outside of the frame
+    VkCommandBuffer BeginSingleTimeCommands();
+    void EndSingleTimeCommands(VkCommandBuffer commandBuffer);
+
     // Shader compilation
     IShaderBuffer *CompileShader(const char *pProgram, size_t nBufLen, const char *pShaderVersion) override;
 
@@ -111,17 +151,33 @@ class CShaderDeviceVk : public IShaderDevice
     bool IsDeactivated() const;
     bool IsInitialized() const { return m_bInitialized; }
 
-    void DrawMesh(CBaseMeshVk *pMesh);
+    void DrawMesh(CBaseMeshVk *pMesh, int nBaseVertex, int nFirstVertex, int nVertexCount, const CPrimList *pPrims, int nPrims);
 
   private:
     VkPhysicalDevice m_PhysicalDevice;
     VkDevice m_Device;
     VkQueue m_GraphicsQueue;
     VkQueue m_PresentQueue;
+    VkCommandPool m_CommandPool;
     std::vector<CViewportVk *> m_Viewports;
     int m_CurrentViewport = -1;
     bool m_bInitialized = false;
     size_t m_DynamicUBOAlignment;
+    size_t m_nMinUBOOffsetAlignment;
+    size_t m_nMinSSBOOffsetAlignment;
+    uint32_t m_nMaxVertexInputAttributes;
+    bool m_bSupportsBCTextures = false;
+    bool m_bSupportsGeometryShaders = false;
+    VkFormat m_DepthFormat = VK_FORMAT_UNDEFINED;
+    CRenderPassCacheVk m_RenderPassCache;
+    CSamplerCacheVk m_SamplerCache;
+    bool m_bSupportsBindless = false;
+    CBindlessTexturesVk m_BindlessTextures;
+    CMipGeneratorVk m_MipGenerator;
+    CPickBufferVk m_PickBuffer;
+    VkPipelineCache m_PipelineCache = VK_NULL_HANDLE;
+    CDeletionQueueVk m_DeletionQueue;
+    CGeometryArenaVk m_GeometryArena;
 };
 
 extern CShaderDeviceVk *g_pShaderDevice;
@@ -1,4 +1,5 @@
 #include "shadermanagervk.h"
+#include <memory>
 #include <sstream>
 #include <stdlib.h>
 #include <time.h>
@@ -13,6 +14,7 @@
 #include "shaderdevicevk.h"
 #include "tier0/dbg.h"
 #include "tier0/icommandline.h"
+#include "tier1/checksum_md5.h"
 #include "tier1/diff.h"
 #include "tier1/lzmaDecoder.h"
 #include "tier1/utlbuffer.h"
@@ -25,6 +27,17 @@
 
 //#define DISASSEMBLE_SPIRV
 
+// Compiled SPIR-V lives in DEFAULT_WRITE_PATH, bump the version when the compiler setup changes
+#define SPIRV_CACHE_PATH "shadercache"
+#define SPIRV_CACHE_VERSION 2
+#define SPIRV_MAGIC 0x07230203
+#define SPIRV_HEADER_SIZE 20 // Magic, version, generator, bound and schema words
+
+static ConVar mat_vk_async_shader_load("mat_vk_async_shader_load", "1", 0,
+                                       "Decompress shader combos and create their modules on the thread pool at load");
+static ConVar mat_vk_specialized_shaders("mat_vk_specialized_shaders", "1", 0,
+                                         "Use shaders/spirv/*.spv modules with specialization constants over .vcs combos when present");
+
 //-----------------------------------------------------------------------------
 // Globals
 //-----------------------------------------------------------------------------
@@ -37,6 +50,62 @@ CShaderManagerVk *g_pShaderManager = &g_ShaderManagerVk;
 CShaderManagerVk::CShaderManagerVk()
     : m_ShaderSymbolTable(0, 32, true /* caseInsensitive */), m_VertexShaderDict(32), m_PixelShaderDict(32), m_ShaderFileCache(32)
 {
+    V_memset(&m_VertexStage, 0, sizeof(m_VertexStage));
+    V_memset(&m_PixelStage, 0, sizeof(m_PixelStage));
+}
+
+//-----------------------------------------------------------------------------
+// What pipeline creation needs for a bound combo, only specialized shaders care which one
+//-----------------------------------------------------------------------------
+static void SetStageState(ShaderStageState_t &stage, VkShaderModule shaderModule, bool bSpecialized, int nStaticIndex, int nDynamicIndex,
+                          bool bInstanced = false)
+{
+    stage.m_Module = shaderModule;
+    stage.m_nCombos[SHADER_SPEC_STATIC_COMBO] = bSpecialized ? nStaticIndex : 0;
+    stage.m_nCombos[SHADER_SPEC_DYNAMIC_COMBO] = bSpecialized ? nDynamicIndex : 0;
+    stage.m_bInstanced = bInstanced;
+}
+
+//-----------------------------------------------------------------------------
+// Whether a SPIR-V module has an input variable at this location
+//-----------------------------------------------------------------------------
+static bool HasInputLocation(const uint32_t *pCode, size_t nWords, uint32_t nLocation)
+{
+    enum
+    {
+        SPV_OP_VARIABLE = 59,
+        SPV_OP_DECORATE = 71,
+        SPV_DECORATION_LOCATION = 30,
+        SPV_STORAGE_CLASS_INPUT = 1,
+        SPV_HEADER_WORDS = 5,
+    };
+
+    if (nWords < SPV_HEADER_WORDS || pCode[0] != SPIRV_MAGIC)
+        return false;
+
+    // Decorations come before the variables they decorate
+    CUtlVector<uint32_t> ids;
+    size_t i = SPV_HEADER_WORDS;
+    while (i < nWords)
+    {
+        uint32_t nOp = pCode[i] & 0xffff;
+        uint32_t nCount = pCode[i] >> 16;
+        if (nCount == 0 || i + nCount > nWords)
+            break;
+
+        if (nOp == SPV_OP_DECORATE && nCount >= 4 && pCode[i + 2] == SPV_DECORATION_LOCATION && pCode[i + 3] == nLocation)
+        {
+            ids.AddToTail(pCode[i + 1]);
+        }
+        else if (nOp == SPV_OP_VARIABLE && nCount >= 4 && pCode[i + 3] == SPV_STORAGE_CLASS_INPUT && ids.HasElement(pCode[i + 2]))
+        {
+            return true;
+        }
+
+        i += nCount;
+    }
+
+    return false;
 }
 
 CShaderManagerVk::~CShaderManagerVk() {}
@@ -53,19 +122,136 @@ void CShaderManagerVk::Shutdown()
 }
 
 //-----------------------------------------------------------------------------
-// Compiles shaders
+// SPIR-V cache, keyed by everything that goes into a compile
+//-----------------------------------------------------------------------------
+static void SetupSpvOptions(glslang::SpvOptions &spvOptions)
+{
+#ifdef DEBUG
+    spvOptions.generateDebugInfo = true;
+    spvOptions.stripDebugInfo = false;
+    spvOptions.disableOptimizer = true;
+    spvOptions.optimizeSize = false;
+    spvOptions.disassemble = false;
+    spvOptions.validate = true;
+#else
+    spvOptions.generateDebugInfo = false;
+    spvOptions.stripDebugInfo = true;
+    spvOptions.disableOptimizer = false;
+    spvOptions.optimizeSize = true;
+    spvOptions.disassemble = false;
+#endif
+}
+
+static void GetSpirvCacheFileName(const char *pProgram, size_t nBufLen, const char *pShaderVersion, const glslang::SpvOptions &spvOptions,
+                                  char *pFileName, int nMaxLen)
+{
+    uint8 options[] = {SPIRV_CACHE_VERSION,         spvOptions.generateDebugInfo, spvOptions.stripDebugInfo,
+                       spvOptions.disableOptimizer, spvOptions.optimizeSize,      spvOptions.validate};
+
+    MD5Context_t context;
+    MD5Init(&context);
+    MD5Update(&context, (const unsigned char *)pProgram, nBufLen);
+    MD5Update(&context, (const unsigned char *)pShaderVersion, V_strlen(pShaderVersion) + 1);
+    MD5Update(&context, options, sizeof(options));
+
+    unsigned char digest[MD5_DIGEST_LENGTH];
+    MD5Final(digest, &context);
+    V_snprintf(pFileName, nMaxLen, SPIRV_CACHE_PATH "/%s.spv", MD5_Print(digest, MD5_DIGEST_LENGTH));
+}
+
+static IShaderBuffer *ReadCachedSpirv(const char *pFileName)
+{
+    CUtlBuffer buf;
+    if (!g_pFullFileSystem->ReadFile(pFileName, "DEFAULT_WRITE_PATH", buf))
+        return nullptr;
+
+    // reject truncated or foreign files, they get recompiled and overwritten
+    int nSize = buf.TellPut();
+    if (nSize < (int)sizeof(uint32_t) || (nSize % sizeof(uint32_t)) != 0 || *(const uint32_t *)buf.Base() != SPIRV_MAGIC)
+        return nullptr;
+
+    auto *spirv = new std::vector<uint32_t>(nSize / sizeof(uint32_t));
+    V_memcpy(spirv->data(), buf.Base(), nSize);
+    return new CShaderBuffer<std::vector<uint32_t>>(spirv);
+}
+
+static void WriteCachedSpirv(const char *pFileName, const std::vector<uint32_t> &spirv)
+{
+    CUtlBuffer buf;
+    buf.Put(spirv.data(), spirv.size() * sizeof(uint32_t));
+
+    g_pFullFileSystem->CreateDirHierarchy(SPIRV_CACHE_PATH, "DEFAULT_WRITE_PATH");
+    g_pFullFileSystem->WriteFile(pFileName, "DEFAULT_WRITE_PATH", buf);
+}
+
+//-----------------------------------------------------------------------------
+// Maps a shader version such as "vs_3_0" to its glslang stage
+//-----------------------------------------------------------------------------
+static bool GetShaderStage(const char *pShaderVersion, EShLanguage &stage)
+{
+    if (!V_strnicmp(pShaderVersion, "vs_", 3))
+    {
+        stage = EShLangVertex;
+    }
+    else if (!V_strnicmp(pShaderVersion, "ps_", 3))
+    {
+        stage = EShLangFragment;
+    }
+    else if (!V_strnicmp(pShaderVersion, "gs_", 3))
+    {
+        stage = EShLangGeometry;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Compiles shaders, glslang's process is initialized once in Init for every compile
 //-----------------------------------------------------------------------------
 IShaderBuffer *CShaderManagerVk::CompileShader(const char *pProgram, size_t nBufLen, const char *pShaderVersion)
 {
-    EShLanguage stage = EShLangVertex; // VK_TODO: Handle pixel shaders
-    glslang::TProgram &program = *new glslang::TProgram;
-    glslang::TShader *shader = new glslang::TShader(stage);
+    if (nBufLen == 0)
+    {
+        nBufLen = V_strlen(pProgram);
+    }
+    if (!pShaderVersion)
+    {
+        pShaderVersion = "";
+    }
+
+    EShLanguage stage;
+    if (!GetShaderStage(pShaderVersion, stage))
+    {
+        Warning("CompileShader: unknown shader version '%s'\n", pShaderVersion);
+        return nullptr;
+    }
+
+    std::unique_ptr<glslang::SpvOptions> spvOptions(new glslang::SpvOptions);
+    SetupSpvOptions(*spvOptions);
+
+    char cacheFileName[MAX_PATH];
+    GetSpirvCacheFileName(pProgram, nBufLen, pShaderVersion, *spvOptions, cacheFileName, sizeof(cacheFileName));
+    IShaderBuffer *pCached = ReadCachedSpirv(cacheFileName);
+    if (pCached)
+    {
+        return pCached;
+    }
+
+    // the program refers to the shader, declared after it so it's destroyed first
+    std::unique_ptr<glslang::TShader> shader(new glslang::TShader(stage));
+    std::unique_ptr<glslang::TProgram> program(new glslang::TProgram);
     TBuiltInResource Resources = DefaultTBuiltInResource;
     EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules | EShMsgReadHlsl | EShMsgHlslLegalization);
     const char *pShaderStrings[1];
+    int nShaderLengths[1];
     pShaderStrings[0] = pProgram;
+    nShaderLengths[0] = (int)nBufLen;
 
-    shader->setStrings(pShaderStrings, 1);
+    shader->setStringsWithLengths(pShaderStrings, nShaderLengths, 1);
 
     if (!shader->parse(&Resources, 110, false, messages))
     {
@@ -74,44 +260,27 @@ IShaderBuffer *CShaderManagerVk::CompileShader(const char *pProgram, size_t nBuf
         return nullptr;
     }
 
-    program.addShader(shader);
-    if (!program.link(messages))
+    program->addShader(shader.get());
+    if (!program->link(messages))
     {
-        Warning(program.getInfoLog());
-        Warning(program.getInfoDebugLog());
+        Warning(program->getInfoLog());
+        Warning(program->getInfoDebugLog());
         return nullptr;
     }
 
-    stage = EShLangVertex; // VK_FIXME: Gets changed by program.link() for some reason
-    auto *spirv = new std::vector<uint32_t>;
-    auto *logger = new spv::SpvBuildLogger;
-    auto *spvOptions = new glslang::SpvOptions;
-
-#ifdef DEBUG
-    spvOptions->generateDebugInfo = true;
-    spvOptions->stripDebugInfo = false;
-    spvOptions->disableOptimizer = true;
-    spvOptions->optimizeSize = false;
-    spvOptions->disassemble = false;
-    spvOptions->validate = true;
-#else
-    spvOptions->generateDebugInfo = false;
-    spvOptions->stripDebugInfo = true;
-    spvOptions->disableOptimizer = false;
-    spvOptions->optimizeSize = true;
-    spvOptions->disassemble = false;
-#endif
-
-    const glslang::TIntermediate *intermediate = program.getIntermediate(stage);
+    const glslang::TIntermediate *intermediate = program->getIntermediate(stage);
     if (!intermediate)
     {
-        Warning(program.getInfoLog());
-        Warning(program.getInfoDebugLog());
+        Warning(program->getInfoLog());
+        Warning(program->getInfoDebugLog());
         return nullptr;
     }
 
+    auto *spirv = new std::vector<uint32_t>;
+    std::unique_ptr<spv::SpvBuildLogger> logger(new spv::SpvBuildLogger);
+
     // VK_FIXME: stack corrupt
-    glslang::GlslangToSpv(*intermediate, *spirv, logger, spvOptions);
+    glslang::GlslangToSpv(*intermediate, *spirv, logger.get(), spvOptions.get());
 
 #ifdef DISASSEMBLE_SPIRV
     std::ostringstream stream;
@@ -119,14 +288,9 @@ IShaderBuffer *CShaderManagerVk::CompileShader(const char *pProgram, size_t nBuf
     Msg(stream.str().c_str());
 #endif
 
-    auto *pShaderBuffer = new CShaderBuffer<std::vector<uint32_t>>(spirv);
+    WriteCachedSpirv(cacheFileName, *spirv);
 
-    delete &program;
-    delete shader;
-    delete spvOptions;
-    delete logger;
-
-    return pShaderBuffer;
+    return new CShaderBuffer<std::vector<uint32_t>>(spirv);
 }
 
 VertexShaderHandle_t CShaderManagerVk::CreateVertexShader(IShaderBuffer *pShaderBuffer)
@@ -149,7 +313,7 @@ void CShaderManagerVk::DestroyVertexShader(VertexShaderHandle_t hShader)
 
     auto i = (VertexShaderIndex_t)hShader;
     VkShaderModule shaderModule = m_RawVertexShaderDict[i];
-    vkDestroyShaderModule(g_pShaderDevice->GetVkDevice(), shaderModule, g_pAllocCallbacks);
+    g_pShaderDevice->DestroyShaderModule(shaderModule);
 
     m_RawVertexShaderDict.Remove(i);
 }
@@ -174,48 +338,87 @@ void CShaderManagerVk::DestroyPixelShader(PixelShaderHandle_t hShader)
 
     auto i = (PixelShaderIndex_t)hShader;
     VkShaderModule shaderModule = m_RawPixelShaderDict[i];
-    vkDestroyShaderModule(g_pShaderDevice->GetVkDevice(), shaderModule, g_pAllocCallbacks);
+    g_pShaderDevice->DestroyShaderModule(shaderModule);
 
     m_RawPixelShaderDict.Remove(i);
 }
 
+GeometryShaderHandle_t CShaderManagerVk::CreateGeometryShader(IShaderBuffer *pShaderBuffer)
+{
+    if (!pShaderBuffer)
+        return GEOMETRY_SHADER_HANDLE_INVALID;
+
+    if (!g_pShaderDevice->SupportsGeometryShaders())
+    {
+        Warning("CreateGeometryShader: device doesn't support geometry shaders\n");
+        return GEOMETRY_SHADER_HANDLE_INVALID;
+    }
+
+    const uint32_t *code = (uint32_t *)pShaderBuffer->GetBits();
+    const size_t size = pShaderBuffer->GetSize() * sizeof(uint32_t);
+
+    VkShaderModule shaderModule = g_pShaderDevice->CreateShaderModule(code, size);
+
+    GeometryShaderIndex_t i = m_RawGeometryShaderDict.AddToTail(shaderModule);
+    return (GeometryShaderHandle_t)i;
+}
+
+void CShaderManagerVk::DestroyGeometryShader(GeometryShaderHandle_t hShader)
+{
+    if (hShader == GEOMETRY_SHADER_HANDLE_INVALID)
+        return;
+
+    auto i = (GeometryShaderIndex_t)hShader;
+    VkShaderModule shaderModule = m_RawGeometryShaderDict[i];
+    g_pShaderDevice->DestroyShaderModule(shaderModule);
+
+    m_RawGeometryShaderDict.Remove(i);
+}
+
 //-----------------------------------------------------------------------------
-// Open the shader file, optionally gets the header
+// Reads the whole shader file into the cache and validates the header
 //-----------------------------------------------------------------------------
-FileHandle_t CShaderManagerVk::OpenFileAndLoadHeader(const char *pFileName, ShaderHeader_t *pHeader)
+bool CShaderManagerVk::LoadShaderFile(const char *pFileName, ShaderFileCache_t *pFileCache)
 {
-    FileHandle_t fp = g_pFullFileSystem->Open(pFileName, "rb", "GAME");
-    if (fp == FILESYSTEM_INVALID_HANDLE)
+    CUtlBuffer &fileData = pFileCache->m_FileData;
+    fileData.Purge();
+    if (!g_pFullFileSystem->ReadFile(pFileName, "GAME", fileData))
     {
-        return FILESYSTEM_INVALID_HANDLE;
+        return false;
     }
 
-    if (pHeader)
+    ShaderHeader_t *pHeader = &pFileCache->m_Header;
+    if (fileData.TellPut() < (int)sizeof(ShaderHeader_t))
     {
-        // read the header
-        g_pFullFileSystem->Read(pHeader, sizeof(ShaderHeader_t), fp);
+        Warning("Shader %s is truncated\n", pFileName);
+        fileData.Purge();
+        return false;
+    }
 
-        switch (pHeader->m_nVersion)
-        {
-        case 4:
-            // version with combos done as diffs vs a reference combo
-            // vsh/psh or older fxc
-            break;
+    // read the header
+    fileData.Get(pHeader, sizeof(ShaderHeader_t));
 
-        case 5:
-        case 6:
-            // version with optimal dictionary and compressed combo block
-            break;
+    switch (pHeader->m_nVersion)
+    {
+    case 4:
+        // version with combos done as diffs vs a reference combo
+        // vsh/psh or older fxc
+        break;
 
-        default:
-            Assert(0);
-            Warning("Shader %s is the wrong version %d, expecting %d\n", pFileName, pHeader->m_nVersion, SHADER_VCS_VERSION_NUMBER);
-            g_pFullFileSystem->Close(fp);
-            return FILESYSTEM_INVALID_HANDLE;
-        }
+    case 5:
+    case 6:
+        // version with optimal dictionary and compressed combo block
+        break;
+
+    default:
+        Assert(0);
+        Warning("Shader %s is the wrong version %d, expecting %d\n", pFileName, pHeader->m_nVersion, SHADER_VCS_VERSION_NUMBER);
+        pHeader->m_nVersion = 0;
+        fileData.Purge();
+        return false;
     }
 
-    return fp;
+    return true;
 }
 
 //---------------------------------------------------------------------------------------------------------
@@ -262,32 +465,26 @@ bool CShaderManagerVk::LoadAndCreateShaders(ShaderLookup_t &lookup, bool bVertex
     ShaderFileCache_t *pFileCache = &m_ShaderFileCache[fileCacheIndex];
     ShaderHeader_t *pHeader = &pFileCache->m_Header;
 
-    FileHandle_t hFile = FILESYSTEM_INVALID_HANDLE;
-    if (pFileCache->IsValid())
+    // one module for every combo when the shader was built for specialization
+    if (mat_vk_specialized_shaders.GetBool() && LoadSpecializedShader(lookup, pFileCache, bVertexShader))
     {
-        // using cached header, just open file, no read of header needed
-        hFile = OpenFileAndLoadHeader(m_ShaderSymbolTable.String(pFileCache->m_Filename), NULL);
-        if (hFile == FILESYSTEM_INVALID_HANDLE)
-        {
-            // shouldn't happen
-            Assert(0);
-            return false;
-        }
+        return true;
     }
-    else
+
+    // a cached file is already in memory, no i/o needed
+    CUtlBuffer &fileData = pFileCache->m_FileData;
+    if (!pFileCache->IsValid())
     {
         V_memset(pHeader, 0, sizeof(ShaderHeader_t));
 
         // try the vsh/psh dir first
         char filename[MAX_PATH];
         Q_snprintf(filename, MAX_PATH, "shaders\\%s\\%s" SHADER_FNAME_EXTENSION, bVertexShader ? "vsh" : "psh", pName);
-        hFile = OpenFileAndLoadHeader(filename, pHeader);
-        if (hFile == FILESYSTEM_INVALID_HANDLE)
+        if (!LoadShaderFile(filename, pFileCache))
         {
             // next, try the fxc dir
             Q_snprintf(filename, MAX_PATH, "shaders\\fxc\\%s" SHADER_FNAME_EXTENSION, pName);
-            hFile = OpenFileAndLoadHeader(filename, pHeader);
-            if (hFile == FILESYSTEM_INVALID_HANDLE)
+            if (!LoadShaderFile(filename, pFileCache))
             {
                 lookup.m_Flags |= SHADER_FAILED_LOAD;
                 Warning("Couldn't load %s shader %s\n", bVertexShader ? "vertex" : "pixel", pName);
@@ -308,24 +505,22 @@ bool CShaderManagerVk::LoadAndCreateShaders(ShaderLookup_t &lookup, bool bVertex
             {
                 // cache the reference combo
                 pFileCache->m_ReferenceCombo.EnsureCapacity(referenceComboSize);
-                g_pFullFileSystem->Read(pFileCache->m_ReferenceCombo.Base(), referenceComboSize, hFile);
+                fileData.Get(pFileCache->m_ReferenceCombo.Base(), referenceComboSize);
             }
         }
         else
         {
             // cache the dictionary
             pFileCache->m_StaticComboRecords.EnsureCount(pHeader->m_nNumStaticCombos);
-            g_pFullFileSystem->Read(pFileCache->m_StaticComboRecords.Base(), pHeader->m_nNumStaticCombos * sizeof(StaticComboRecord_t),
-                                    hFile);
+            fileData.Get(pFileCache->m_StaticComboRecords.Base(), pHeader->m_nNumStaticCombos * sizeof(StaticComboRecord_t));
             if (pFileCache->IsVersion6())
             {
                 // read static combo alias records
-                int nNumDups;
-                g_pFullFileSystem->Read(&nNumDups, sizeof(nNumDups), hFile);
+                int nNumDups = fileData.GetInt();
                 if (nNumDups)
                 {
                     pFileCache->m_StaticComboDupRecords.EnsureCount(nNumDups);
-                    g_pFullFileSystem->Read(pFileCache->m_StaticComboDupRecords.Base(), nNumDups * sizeof(StaticComboAliasRecord_t), hFile);
+                    fileData.Get(pFileCache->m_StaticComboDupRecords.Base(), nNumDups * sizeof(StaticComboAliasRecord_t));
                 }
             }
         }
@@ -334,10 +529,10 @@ bool CShaderManagerVk::LoadAndCreateShaders(ShaderLookup_t &lookup, bool bVertex
     // FIXME: should make lookup and ShaderStaticCombos_t are pool allocated.
     int i;
     lookup.m_ShaderStaticCombos.m_nCount = pHeader->m_nDynamicCombos;
-    lookup.m_ShaderStaticCombos.m_pHardwareShaders = new HardwareShader_t[pHeader->m_nDynamicCombos];
+    lookup.m_ShaderStaticCombos.m_pShaderModules = new VkShaderModule[pHeader->m_nDynamicCombos];
     for (i = 0; i < pHeader->m_nDynamicCombos; i++)
     {
-        lookup.m_ShaderStaticCombos.m_pHardwareShaders[i] = INVALID_HARDWARE_SHADER;
+        lookup.m_ShaderStaticCombos.m_pShaderModules[i] = VK_NULL_HANDLE;
     }
 
     int nStartingOffset = 0;
@@ -349,8 +544,8 @@ bool CShaderManagerVk::LoadAndCreateShaders(ShaderLookup_t &lookup, bool bVertex
 
         // read in shader's dynamic combos directory
         lookup.m_pComboDictionary = new ShaderDictionaryEntry_t[pHeader->m_nDynamicCombos];
-        g_pFullFileSystem->Seek(hFile, nDictionaryOffset + lookup.m_nStaticIndex * sizeof(ShaderDictionaryEntry_t), FILESYSTEM_SEEK_HEAD);
-        g_pFullFileSystem->Read(lookup.m_pComboDictionary, pHeader->m_nDynamicCombos * sizeof(ShaderDictionaryEntry_t), hFile);
+        fileData.SeekGet(CUtlBuffer::SEEK_HEAD, nDictionaryOffset + lookup.m_nStaticIndex * sizeof(ShaderDictionaryEntry_t));
+        fileData.Get(lookup.m_pComboDictionary, pHeader->m_nDynamicCombos * sizeof(ShaderDictionaryEntry_t));
 
         // want single read of all this shader's dynamic combos into a target buffer
         // shaders are written sequentially, determine starting offset and length
@@ -373,7 +568,6 @@ bool CShaderManagerVk::LoadAndCreateShaders(ShaderLookup_t &lookup, bool bVertex
         }
         if (!nStartingOffset)
         {
-            g_pFullFileSystem->Close(hFile);
             Warning("Shader '%s' - All dynamic combos skipped. This is bad!\n", m_ShaderSymbolTable.String(pFileCache->m_Filename));
             return false;
         }
@@ -383,7 +577,6 @@ bool CShaderManagerVk::LoadAndCreateShaders(ShaderLookup_t &lookup, bool bVertex
         int nStaticComboIdx = pFileCache->FindCombo(lookup.m_nStaticIndex / pFileCache->m_Header.m_nDynamicCombos);
         if (nStaticComboIdx == -1)
         {
-            g_pFullFileSystem->Close(hFile);
             lookup.m_Flags |= SHADER_FAILED_LOAD;
             Warning("Shader '%s' - Couldn't load combo %d of shader (dyn=%d)\n", m_ShaderSymbolTable.String(pFileCache->m_Filename),
                     lookup.m_nStaticIndex, pFileCache->m_Header.m_nDynamicCombos);
@@ -394,41 +587,259 @@ bool CShaderManagerVk::LoadAndCreateShaders(ShaderLookup_t &lookup, bool bVertex
         nEndingOffset = pFileCache->m_StaticComboRecords[nStaticComboIdx + 1].m_nFileOffset;
     }
 
-    // align offsets for unbuffered optimal i/o - fastest i/o possible
-    unsigned nOffsetAlign, nSizeAlign, nBufferAlign;
-    g_pFullFileSystem->GetOptimalIOConstraints(hFile, &nOffsetAlign, &nSizeAlign, &nBufferAlign);
-    unsigned int nAlignedOffset = AlignValue((nStartingOffset - nOffsetAlign) + 1, nOffsetAlign);
-    unsigned int nAlignedBytesToRead = AlignValue(nEndingOffset - nAlignedOffset, nSizeAlign);
+    if (pFileCache->IsOldVersion())
+    {
+        // VK_TODO: diff-vs-reference combos are never produced for SPIR-V
+        Warning("Shader '%s' - version %d shaders are not supported\n", m_ShaderSymbolTable.String(pFileCache->m_Filename),
+                pHeader->m_nVersion);
+        lookup.m_Flags |= SHADER_FAILED_LOAD;
+        return false;
+    }
 
-    // used for adjusting provided buffer to actual data
-    lookup.m_nDataOffset = nStartingOffset - nAlignedOffset;
+    // Only remember where the combos are, they get unpacked on a worker or when one is first bound
+    lookup.m_nComboFileOffset = nStartingOffset;
+    lookup.m_nComboFileSize = nEndingOffset - nStartingOffset;
 
-    bool bOK = true;
+    // Lookups never move, the job can hold on to this one until it's destroyed
+    if (mat_vk_async_shader_load.GetBool() && g_pThreadPool)
+    {
+        lookup.m_pLoadJob = ThreadExecute(this, &CShaderManagerVk::LoadDynamicCombosJob, &lookup);
+    }
 
-    // printf("\n CShaderManagerVk::LoadAndCreateShaders - reading %d bytes from file offset %d", nAlignedBytesToRead, nAlignedOffset);
-    // single optimal read of all dynamic combos into monolithic buffer
-    uint8 *pOptimalBuffer = (uint8 *)g_pFullFileSystem->AllocOptimalReadBuffer(hFile, nAlignedBytesToRead, nAlignedOffset);
-    g_pFullFileSystem->Seek(hFile, nAlignedOffset, FILESYSTEM_SEEK_HEAD);
-    g_pFullFileSystem->Read(pOptimalBuffer, nAlignedBytesToRead, hFile);
+    return true;
+}
 
-    if (pFileCache->IsOldVersion())
+//-----------------------------------------------------------------------------
+// Shares one module between all static combos of a shader, found once per file cache entry
+//-----------------------------------------------------------------------------
+bool CShaderManagerVk::LoadSpecializedShader(ShaderLookup_t &lookup, ShaderFileCache_t *pFileCache, bool bVertexShader)
+{
+    if (pFileCache->m_SpecializedModule == VK_NULL_HANDLE)
     {
-        // bOK = CreateDynamicCombos_Ver4(&lookup, pOptimalBuffer);
-        bOK = false;
+        // already known to be a .vcs shader
+        if (pFileCache->IsValid())
+            return false;
+
+        char filename[MAX_PATH];
+        Q_snprintf(filename, MAX_PATH, "shaders\\spirv\\%s\\%s.spv", bVertexShader ? "vsh" : "psh",
+                   m_ShaderSymbolTable.String(lookup.m_Name));
+
+        CUtlBuffer code;
+        if (!g_pFullFileSystem->ReadFile(filename, "GAME", code))
+            return false;
+
+        // vkCreateShaderModule doesn't validate, reject truncated or foreign files here
+        int nSize = code.TellPut();
+        if (nSize < SPIRV_HEADER_SIZE || (nSize % sizeof(uint32_t)) != 0 || *(const uint32_t *)code.Base() != SPIRV_MAGIC)
+        {
+            Warning("Shader %s isn't valid SPIR-V\n", filename);
+            return false;
+        }
+
+        pFileCache->m_Name = lookup.m_Name;
+        pFileCache->m_Filename = m_ShaderSymbolTable.AddString(filename);
+        pFileCache->m_bVertexShader = bVertexShader;
+        pFileCache->m_SpecializedModule = g_pShaderDevice->CreateShaderModule((const uint32_t *)code.Base(), code.TellPut());
+        pFileCache->m_bInstanced = bVertexShader && HasInputLocation((const uint32_t *)code.Base(), code.TellPut() / sizeof(uint32_t),
+                                                                     VERTEX_LOCATION_INSTANCE_MODEL);
+
+        if (bVertexShader)
+        {
+            s_NumVertexShadersCreated++;
+        }
+        else
+        {
+            s_NumPixelShadersCreated++;
+        }
     }
 
-    g_pFullFileSystem->FreeOptimalReadBuffer(pOptimalBuffer);
+    lookup.m_bSpecialized = true;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Unpacks the SPIR-V of every dynamic combo of a static combo from the cached file
+//-----------------------------------------------------------------------------
+bool CShaderManagerVk::LoadDynamicCombos(ShaderLookup_t &lookup)
+{
+    ShaderFileCache_t *pFileCache = &m_ShaderFileCache[lookup.m_hShaderFileCache];
+    const CUtlBuffer &fileData = pFileCache->m_FileData;
+    if (lookup.m_nComboFileOffset + lookup.m_nComboFileSize > fileData.TellPut())
+    {
+        Assert(0);
+        return false;
+    }
 
-    g_pFullFileSystem->Close(hFile);
+    lookup.m_ShaderStaticCombos.m_pCreationData = new ShaderStaticCombos_t::ShaderCreationData_t[lookup.m_ShaderStaticCombos.m_nCount];
 
+    // per call, this runs on several workers at once
+    CUtlMemory<uint8> unpackBuffer(0, MAX_SHADER_UNPACKED_BLOCK_SIZE);
+
+    // decode straight out of the cached file
+    bool bOK = true;
+    const uint8 *pReadPtr = (const uint8 *)fileData.Base() + lookup.m_nComboFileOffset;
+    const uint8 *pReadEnd = pReadPtr + lookup.m_nComboFileSize;
+    while (pReadPtr + sizeof(uint32) <= pReadEnd)
+    {
+        uint32 nBlockSize = *(const uint32 *)pReadPtr;
+        pReadPtr += sizeof(uint32);
+        if (nBlockSize == 0xffffffff)
+            break;
+
+        uint32 nPackedSize = nBlockSize & 0x3fffffff;
+        if (pReadPtr + nPackedSize > pReadEnd)
+        {
+            bOK = false;
+            break;
+        }
+
+        if (!UnpackComboBlock(lookup, pReadPtr, nBlockSize, unpackBuffer.Base()))
+        {
+            bOK = false;
+            break;
+        }
+        pReadPtr += nPackedSize;
+    }
+
+    // no warnings here, the symbol table isn't safe to read from workers
     if (!bOK)
     {
-        lookup.m_Flags |= SHADER_FAILED_LOAD;
+        delete[] lookup.m_ShaderStaticCombos.m_pCreationData;
+        lookup.m_ShaderStaticCombos.m_pCreationData = NULL;
     }
 
     return bOK;
 }
 
+//-----------------------------------------------------------------------------
+// Decompresses one block and copies out the combos in it, each is { id, size, SPIR-V }
+//-----------------------------------------------------------------------------
+bool CShaderManagerVk::UnpackComboBlock(ShaderLookup_t &lookup, const uint8 *pBlock, uint32 nBlockSize, uint8 *pUnpackBuffer)
+{
+    const uint8 *pUnpacked;
+    uint32 nUnpackedSize;
+    switch (nBlockSize & 0xc0000000)
+    {
+    case 0x80000000:
+        // stored
+        pUnpacked = pBlock;
+        nUnpackedSize = nBlockSize & 0x3fffffff;
+        break;
+
+    case 0x40000000:
+        if (CLZMA::GetActualSize((unsigned char *)pBlock) > MAX_SHADER_UNPACKED_BLOCK_SIZE)
+            return false;
+
+        nUnpackedSize = CLZMA::Uncompress((unsigned char *)pBlock, pUnpackBuffer);
+        pUnpacked = pUnpackBuffer;
+        break;
+
+    default:
+        // bzip2 blocks predate lzma and aren't written by the current compiler
+        return false;
+    }
+
+    const uint8 *pEnd = pUnpacked + nUnpackedSize;
+    while (pUnpacked + 2 * sizeof(uint32) <= pEnd)
+    {
+        uint32 nComboID = ((const uint32 *)pUnpacked)[0];
+        uint32 nComboSize = ((const uint32 *)pUnpacked)[1];
+        pUnpacked += 2 * sizeof(uint32);
+
+        if (pUnpacked + nComboSize > pEnd || nComboID >= (uint32)lookup.m_ShaderStaticCombos.m_nCount)
+            return false;
+
+        // SPIR-V is a stream of words
+        Assert((nComboSize % sizeof(uint32)) == 0);
+
+        CUtlVector<uint8> &byteCode = lookup.m_ShaderStaticCombos.m_pCreationData[nComboID].ByteCode;
+        byteCode.SetCount(nComboSize);
+        V_memcpy(byteCode.Base(), pUnpacked, nComboSize);
+        pUnpacked += nComboSize;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Creates the module of a dynamic combo the first time it is bound
+//-----------------------------------------------------------------------------
+VkShaderModule CShaderManagerVk::GetShaderModule(ShaderLookup_t &lookup, int nDynamicIndex)
+{
+    if (lookup.m_bSpecialized)
+        return m_ShaderFileCache[lookup.m_hShaderFileCache].m_SpecializedModule;
+
+    ShaderStaticCombos_t &combos = lookup.m_ShaderStaticCombos;
+    Assert(nDynamicIndex >= 0 && nDynamicIndex < combos.m_nCount);
+
+    WaitForLoadJob(lookup);
+
+    VkShaderModule &shaderModule = combos.m_pShaderModules[nDynamicIndex];
+    if (shaderModule != VK_NULL_HANDLE)
+        return shaderModule;
+
+    if (!combos.m_pCreationData && !LoadDynamicCombos(lookup))
+    {
+        Warning("Shader '%s' - corrupt combo block in static combo %d\n",
+                m_ShaderSymbolTable.String(m_ShaderFileCache[lookup.m_hShaderFileCache].m_Filename), lookup.m_nStaticIndex);
+        lookup.m_Flags |= SHADER_FAILED_LOAD;
+        return VK_NULL_HANDLE;
+    }
+
+    CUtlVector<uint8> &byteCode = combos.m_pCreationData[nDynamicIndex].ByteCode;
+    if (byteCode.Count() == 0)
+    {
+        // skipped combo
+        return VK_NULL_HANDLE;
+    }
+
+    shaderModule = g_pShaderDevice->CreateShaderModule((const uint32_t *)byteCode.Base(), byteCode.Count());
+    if (m_ShaderFileCache[lookup.m_hShaderFileCache].m_bVertexShader)
+    {
+        s_NumVertexShadersCreated++;
+    }
+    else
+    {
+        s_NumPixelShadersCreated++;
+    }
+
+    // the module keeps its own copy
+    byteCode.Purge();
+    return shaderModule;
+}
+
+//-----------------------------------------------------------------------------
+// Unpacks a static combo and creates all of its modules on the thread pool
+//-----------------------------------------------------------------------------
+void CShaderManagerVk::LoadDynamicCombosJob(ShaderLookup_t *pLookup)
+{
+    // failures are reported by GetShaderModule on the main thread
+    if (!LoadDynamicCombos(*pLookup))
+        return;
+
+    ShaderStaticCombos_t &combos = pLookup->m_ShaderStaticCombos;
+    for (int i = 0; i < combos.m_nCount; i++)
+    {
+        CUtlVector<uint8> &byteCode = combos.m_pCreationData[i].ByteCode;
+        if (byteCode.Count() == 0)
+            continue;
+
+        combos.m_pShaderModules[i] = g_pShaderDevice->CreateShaderModule((const uint32_t *)byteCode.Base(), byteCode.Count());
+        byteCode.Purge();
+    }
+}
+
+void CShaderManagerVk::WaitForLoadJob(ShaderLookup_t &lookup)
+{
+    if (!lookup.m_pLoadJob)
+        return;
+
+    // Runs the job here if no worker has picked it up yet, otherwise blocks until the worker is done
+    lookup.m_pLoadJob->Execute();
+    lookup.m_pLoadJob->Release();
+    lookup.m_pLoadJob = NULL;
+}
+
 //-----------------------------------------------------------------------------
 // Creates and destroys vertex shaders
 //-----------------------------------------------------------------------------
@@ -545,6 +956,8 @@ void *CShaderManagerVk::GetCurrentVertexShader() { return (void *)m_HardwareVert
 
 void *CShaderManagerVk::GetCurrentPixelShader() { return (void *)m_HardwarePixelShader; }
 
+void *CShaderManagerVk::GetCurrentGeometryShader() { return (void *)m_HardwareGeometryShader; }
+
 //-----------------------------------------------------------------------------
 // The low-level dx call to set the vertex shader state
 //-----------------------------------------------------------------------------
@@ -559,8 +972,9 @@ void CShaderManagerVk::SetVertexShaderState(HardwareShader_t shader, DataCacheHa
 
 void CShaderManagerVk::BindVertexShader(VertexShaderHandle_t hVertexShader)
 {
-    auto hHardwareShader = (HardwareShader_t *)m_RawVertexShaderDict[(VertexShaderIndex_t)hVertexShader];
-    SetVertexShaderState(hHardwareShader);
+    VkShaderModule shaderModule = m_RawVertexShaderDict[(VertexShaderIndex_t)hVertexShader];
+    SetVertexShaderState((HardwareShader_t)shaderModule);
+    SetStageState(m_VertexStage, shaderModule, false, 0, 0);
 }
 
 //-----------------------------------------------------------------------------
@@ -572,6 +986,7 @@ void CShaderManagerVk::SetVertexShader(VertexShader_t shader)
     if (shader == INVALID_SHADER)
     {
         SetVertexShaderState(0);
+        SetStageState(m_VertexStage, VK_NULL_HANDLE, false, 0, 0);
         return;
     }
 
@@ -592,8 +1007,9 @@ void CShaderManagerVk::SetVertexShader(VertexShader_t shader)
         return;
     }
 
-    Assert(vshIndex < vshLookup.m_ShaderStaticCombos.m_nCount);
-    HardwareShader_t dxshader = vshLookup.m_ShaderStaticCombos.m_pHardwareShaders[vshIndex];
+    Assert(vshLookup.m_bSpecialized || vshIndex < vshLookup.m_ShaderStaticCombos.m_nCount);
+    VkShaderModule shaderModule = GetShaderModule(vshLookup, vshIndex);
+    HardwareShader_t dxshader = (HardwareShader_t)shaderModule;
 
     Assert(dxshader);
 
@@ -605,6 +1021,8 @@ void CShaderManagerVk::SetVertexShader(VertexShader_t shader)
     }
 
     SetVertexShaderState(dxshader);
+    bool bInstanced = vshLookup.m_bSpecialized && m_ShaderFileCache[vshLookup.m_hShaderFileCache].m_bInstanced;
+    SetStageState(m_VertexStage, shaderModule, vshLookup.m_bSpecialized, vshLookup.m_nStaticIndex, vshIndex, bInstanced);
 }
 
 //-----------------------------------------------------------------------------
@@ -621,8 +1039,23 @@ void CShaderManagerVk::SetPixelShaderState(HardwareShader_t shader, DataCacheHan
 
 void CShaderManagerVk::BindPixelShader(PixelShaderHandle_t hPixelShader)
 {
-    auto hHardwareShader = (HardwareShader_t *)m_RawPixelShaderDict[(PixelShaderIndex_t)hPixelShader];
-    SetPixelShaderState(hHardwareShader);
+    VkShaderModule shaderModule = m_RawPixelShaderDict[(PixelShaderIndex_t)hPixelShader];
+    SetPixelShaderState((HardwareShader_t)shaderModule);
+    SetStageState(m_PixelStage, shaderModule, false, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Geometry shaders only come from runtime compiles, there are no combos
+//-----------------------------------------------------------------------------
+void CShaderManagerVk::BindGeometryShader(GeometryShaderHandle_t hGeometryShader)
+{
+    if (hGeometryShader == GEOMETRY_SHADER_HANDLE_INVALID)
+    {
+        m_HardwareGeometryShader = 0;
+        return;
+    }
+
+    m_HardwareGeometryShader = (HardwareShader_t)m_RawGeometryShaderDict[(GeometryShaderIndex_t)hGeometryShader];
 }
 
 //-----------------------------------------------------------------------------
@@ -633,6 +1066,7 @@ void CShaderManagerVk::SetPixelShader(PixelShader_t shader)
     if (shader == INVALID_SHADER)
     {
         SetPixelShaderState(0);
+        SetStageState(m_PixelStage, VK_NULL_HANDLE, false, 0, 0);
         return;
     }
 
@@ -648,10 +1082,12 @@ void CShaderManagerVk::SetPixelShader(PixelShader_t shader)
         return;
     }
 
-    HardwareShader_t dxshader = pshLookup.m_ShaderStaticCombos.m_pHardwareShaders[pshIndex];
+    VkShaderModule shaderModule = GetShaderModule(pshLookup, pshIndex);
+    HardwareShader_t dxshader = (HardwareShader_t)shaderModule;
 
     AssertMsg(dxshader != INVALID_HARDWARE_SHADER, "Failed to set pixel shader.");
     SetPixelShaderState(dxshader);
+    SetStageState(m_PixelStage, shaderModule, pshLookup.m_bSpecialized, pshLookup.m_nStaticIndex, pshIndex);
 }
 
 //-----------------------------------------------------------------------------
@@ -662,6 +1098,7 @@ void CShaderManagerVk::ResetShaderState()
     // This will force the calls to SetVertexShader + SetPixelShader to actually set the state
     m_HardwareVertexShader = (HardwareShader_t)-1;
     m_HardwarePixelShader = (HardwareShader_t)-1;
+    m_HardwareGeometryShader = 0;
 
     SetVertexShader(INVALID_SHADER);
     SetPixelShader(INVALID_SHADER);
@@ -672,16 +1109,19 @@ void CShaderManagerVk::ResetShaderState()
 //-----------------------------------------------------------------------------
 void CShaderManagerVk::DestroyVertexShader(VertexShader_t shader)
 {
+    WaitForLoadJob(m_VertexShaderDict[shader]);
+
     ShaderStaticCombos_t &combos = m_VertexShaderDict[shader].m_ShaderStaticCombos;
     int i;
     for (i = 0; i < combos.m_nCount; i++)
     {
-        if (combos.m_pHardwareShaders[i] != INVALID_HARDWARE_SHADER)
+        if (combos.m_pShaderModules[i] != VK_NULL_HANDLE)
         {
+            g_pShaderDevice->DestroyShaderModule(combos.m_pShaderModules[i]);
         }
     }
-    delete[] combos.m_pHardwareShaders;
-    combos.m_pHardwareShaders = NULL;
+    delete[] combos.m_pShaderModules;
+    combos.m_pShaderModules = NULL;
 
     if (combos.m_pCreationData != NULL)
     {
@@ -697,16 +1137,19 @@ void CShaderManagerVk::DestroyVertexShader(VertexShader_t shader)
 //-----------------------------------------------------------------------------
 void CShaderManagerVk::DestroyPixelShader(PixelShader_t pixelShader)
 {
+    WaitForLoadJob(m_PixelShaderDict[pixelShader]);
+
     ShaderStaticCombos_t &combos = m_PixelShaderDict[pixelShader].m_ShaderStaticCombos;
     int i;
     for (i = 0; i < combos.m_nCount; i++)
     {
-        if (combos.m_pHardwareShaders[i] != INVALID_HARDWARE_SHADER)
+        if (combos.m_pShaderModules[i] != VK_NULL_HANDLE)
         {
+            g_pShaderDevice->DestroyShaderModule(combos.m_pShaderModules[i]);
         }
     }
-    delete[] combos.m_pHardwareShaders;
-    combos.m_pHardwareShaders = NULL;
+    delete[] combos.m_pShaderModules;
+    combos.m_pShaderModules = NULL;
 
     if (combos.m_pCreationData != NULL)
     {
@@ -739,6 +1182,14 @@ void CShaderManagerVk::DestroyAllShaders(void)
     }
 
     // invalidate the file cache
+    for (int cacheIndex = m_ShaderFileCache.Head(); cacheIndex != m_ShaderFileCache.InvalidIndex();
+         cacheIndex = m_ShaderFileCache.Next(cacheIndex))
+    {
+        if (m_ShaderFileCache[cacheIndex].m_SpecializedModule != VK_NULL_HANDLE)
+        {
+            g_pShaderDevice->DestroyShaderModule(m_ShaderFileCache[cacheIndex].m_SpecializedModule);
+        }
+    }
     m_ShaderFileCache.Purge();
 }
 
@@ -753,6 +1204,11 @@ void CShaderManagerVk::SpewVertexAndPixelShaders(void)
          cacheIndex = m_ShaderFileCache.Next(cacheIndex))
     {
         ShaderFileCache_t *pCache = &m_ShaderFileCache[cacheIndex];
+        if (pCache->m_SpecializedModule != VK_NULL_HANDLE)
+        {
+            Msg("Specialized '%s'\n", m_ShaderSymbolTable.String(pCache->m_Filename));
+            continue;
+        }
         Msg("Total Combos:%9d Static:%9d Dynamic:%7d SeekTable:%7d Ver:%d '%s'\n", pCache->m_Header.m_nTotalCombos,
             pCache->m_Header.m_nTotalCombos / pCache->m_Header.m_nDynamicCombos, pCache->m_Header.m_nDynamicCombos,
             pCache->IsOldVersion() ? 0 : pCache->m_Header.m_nNumStaticCombos, pCache->m_Header.m_nVersion,
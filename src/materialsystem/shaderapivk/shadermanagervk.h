@@ -26,6 +26,7 @@
 #include "tier1/utllinkedlist.h"
 #include "tier1/utlsymbol.h"
 #include "tier1/utlvector.h"
+#include "vstdlib/jobthread.h"
 
 #pragma push_macro("max")
 #pragma push_macro("min")
@@ -61,6 +62,8 @@ abstract_class IShaderManager
     virtual void DestroyVertexShader(VertexShaderHandle_t hShader) = 0;
     virtual PixelShaderHandle_t CreatePixelShader(IShaderBuffer * pShaderBuffer) = 0;
     virtual void DestroyPixelShader(PixelShaderHandle_t hShader) = 0;
+    virtual GeometryShaderHandle_t CreateGeometryShader(IShaderBuffer * pShaderBuffer) = 0;
+    virtual void DestroyGeometryShader(GeometryShaderHandle_t hShader) = 0;
 
     // Creates vertex, pixel shaders
     virtual VertexShader_t CreateVertexShader(const char *pVertexShaderFile, int nStaticVshIndex = 0, char *debugLabel = NULL) = 0;
@@ -80,6 +83,7 @@ abstract_class IShaderManager
     // Returns the current vertex + pixel shaders
     virtual void *GetCurrentVertexShader() = 0;
     virtual void *GetCurrentPixelShader() = 0;
+    virtual void *GetCurrentGeometryShader() = 0;
 
     virtual void ClearVertexAndPixelShaderRefCounts() = 0;
     virtual void PurgeUnusedVertexAndPixelShaders() = 0;
@@ -87,6 +91,7 @@ abstract_class IShaderManager
     // The low-level dx call to set the vertex shader state
     virtual void BindVertexShader(VertexShaderHandle_t shader) = 0;
     virtual void BindPixelShader(PixelShaderHandle_t shader) = 0;
+    virtual void BindGeometryShader(GeometryShaderHandle_t shader) = 0;
 };
 
 //-----------------------------------------------------------------------------
@@ -217,6 +222,13 @@ struct ShaderFileCache_t
     ShaderHeader_t m_Header;
     bool m_bVertexShader;
 
+    // The whole .vcs, read once and shared by every static combo that uses the file
+    CUtlBuffer m_FileData;
+
+    // Shaders built as one module for all combos, which are picked with specialization constants
+    VkShaderModule m_SpecializedModule;
+    bool m_bInstanced; // The module is a vertex shader reading the instance stream
+
     // valid for diff version only - contains the microcode used as the reference for diff algorithm
     CUtlBuffer m_ReferenceCombo;
 
@@ -228,6 +240,8 @@ struct ShaderFileCache_t
     {
         // invalid until version established
         m_Header.m_nVersion = 0;
+        m_SpecializedModule = VK_NULL_HANDLE;
+        m_bInstanced = false;
     }
 
     bool IsValid() const { return m_Header.m_nVersion != 0; }
@@ -264,14 +278,18 @@ class CShaderManagerVk : public IShaderManager
     virtual void DestroyVertexShader(VertexShaderHandle_t hShader);
     virtual PixelShaderHandle_t CreatePixelShader(IShaderBuffer *pShaderBuffer);
     virtual void DestroyPixelShader(PixelShaderHandle_t hShader);
+    virtual GeometryShaderHandle_t CreateGeometryShader(IShaderBuffer *pShaderBuffer);
+    virtual void DestroyGeometryShader(GeometryShaderHandle_t hShader);
     virtual VertexShader_t CreateVertexShader(const char *pVertexShaderFile, int nStaticVshIndex = 0, char *debugLabel = NULL);
     virtual PixelShader_t CreatePixelShader(const char *pPixelShaderFile, int nStaticPshIndex = 0, char *debugLabel = NULL);
     virtual void SetVertexShader(VertexShader_t shader);
     virtual void SetPixelShader(PixelShader_t shader);
     virtual void BindVertexShader(VertexShaderHandle_t shader);
     virtual void BindPixelShader(PixelShaderHandle_t shader);
+    virtual void BindGeometryShader(GeometryShaderHandle_t shader);
     virtual void *GetCurrentVertexShader();
     virtual void *GetCurrentPixelShader();
+    virtual void *GetCurrentGeometryShader();
     virtual void ResetShaderState();
     void FlushShaders();
     virtual void ClearVertexAndPixelShaderRefCounts();
@@ -280,22 +298,29 @@ class CShaderManagerVk : public IShaderManager
     const char *GetActiveVertexShaderName();
     const char *GetActivePixelShaderName();
 
+    // Bound modules and their specialization for pipeline creation
+    const ShaderStageState_t &GetVertexStage() const { return m_VertexStage; }
+    const ShaderStageState_t &GetPixelStage() const { return m_PixelStage; }
+
   private:
     typedef CUtlFixedLinkedList<VkShaderModule *>::IndexType_t VertexShaderIndex_t;
     typedef CUtlFixedLinkedList<VkShaderModule *>::IndexType_t PixelShaderIndex_t;
+    typedef CUtlFixedLinkedList<VkShaderModule *>::IndexType_t GeometryShaderIndex_t;
 
     struct ShaderStaticCombos_t
     {
         int m_nCount;
 
         // Can't use CUtlVector here since you CUtlLinkedList<CUtlVector<>> doesn't work.
-        HardwareShader_t *m_pHardwareShaders;
+        // Modules are created the first time their dynamic combo is bound.
+        VkShaderModule *m_pShaderModules;
         struct ShaderCreationData_t
         {
             CUtlVector<uint8> ByteCode;
             uint32 iCentroidMask;
         };
 
+        // SPIR-V of every dynamic combo, unpacked on first bind, freed per combo once its module exists
         ShaderCreationData_t *m_pCreationData;
     };
 
@@ -311,6 +336,16 @@ class CShaderManagerVk : public IShaderManager
         // for queued loading, bias an aligned optimal buffer forward to correct location
         int m_nDataOffset;
 
+        // Where this static combo's compressed blocks live in the file, read on first bind
+        int m_nComboFileOffset;
+        int m_nComboFileSize;
+
+        // Decompression and module creation queued at load, finished at the latest on first bind
+        CJob *m_pLoadJob;
+
+        // Uses the file cache's single module instead of per combo ones
+        bool m_bSpecialized;
+
         // diff version, valid during load only
         ShaderDictionaryEntry_t *m_pComboDictionary;
 
@@ -319,8 +354,12 @@ class CShaderManagerVk : public IShaderManager
             m_Flags = 0;
             m_nRefCount = 0;
             m_ShaderStaticCombos.m_nCount = 0;
-            m_ShaderStaticCombos.m_pHardwareShaders = 0;
+            m_ShaderStaticCombos.m_pShaderModules = 0;
             m_ShaderStaticCombos.m_pCreationData = 0;
+            m_nComboFileOffset = 0;
+            m_nComboFileSize = 0;
+            m_pLoadJob = NULL;
+            m_bSpecialized = false;
             m_pComboDictionary = NULL;
         }
         void IncRefCount() { m_nRefCount++; }
@@ -343,7 +382,19 @@ class CShaderManagerVk : public IShaderManager
     void DestroyPixelShader(PixelShader_t shader);
 
     bool LoadAndCreateShaders(ShaderLookup_t &lookup, bool bVertexShader, char *debugLabel = NULL);
-    FileHandle_t OpenFileAndLoadHeader(const char *pFileName, ShaderHeader_t *pHeader);
+    bool LoadSpecializedShader(ShaderLookup_t &lookup, ShaderFileCache_t *pFileCache, bool bVertexShader);
+
+    // Reads and unpacks every dynamic combo of a static combo
+    bool LoadDynamicCombos(ShaderLookup_t &lookup);
+    bool UnpackComboBlock(ShaderLookup_t &lookup, const uint8 *pBlock, uint32 nBlockSize, uint8 *pUnpackBuffer);
+
+    // Thread pool entry point, unpacks and creates every module of a static combo
+    void LoadDynamicCombosJob(ShaderLookup_t *pLookup);
+    void WaitForLoadJob(ShaderLookup_t &lookup);
+
+    // Creates the module for a dynamic combo on first use, VK_NULL_HANDLE for skipped combos
+    VkShaderModule GetShaderModule(ShaderLookup_t &lookup, int nDynamicIndex);
+    bool LoadShaderFile(const char *pFileName, ShaderFileCache_t *pFileCache);
 
     void WriteTranslatedFile(ShaderLookup_t *pLookup, int dynamicCombo, char *pFileContents, char *pFileExtension);
 
@@ -352,12 +403,16 @@ class CShaderManagerVk : public IShaderManager
 
     CUtlSymbolTable m_ShaderSymbolTable;
 
-    // The current vertex and pixel shader
+    // The current vertex, pixel and geometry shader
     HardwareShader_t m_HardwareVertexShader;
     HardwareShader_t m_HardwarePixelShader;
+    HardwareShader_t m_HardwareGeometryShader;
+    ShaderStageState_t m_VertexStage;
+    ShaderStageState_t m_PixelStage;
 
     CUtlFixedLinkedList<VkShaderModule> m_RawVertexShaderDict;
     CUtlFixedLinkedList<VkShaderModule> m_RawPixelShaderDict;
+    CUtlFixedLinkedList<VkShaderModule> m_RawGeometryShaderDict;
 
     CUtlFixedLinkedList<ShaderFileCache_t> m_ShaderFileCache;
 };
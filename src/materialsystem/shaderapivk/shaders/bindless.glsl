@@ -0,0 +1,28 @@
+// Bindless texture access, matches CBindlessTexturesVk and BindlessPushConstants_t.
+// Include after #version with GL_EXT_nonuniform_qualifier enabled.
+
+// Every resident texture, aliased per view type
+layout(set = 1, binding = 0) uniform texture2D g_Textures2D[];
+layout(set = 1, binding = 0) uniform textureCube g_TexturesCube[];
+layout(set = 1, binding = 0) uniform texture3D g_Textures3D[];
+
+// Every cached sampler
+layout(set = 1, binding = 1) uniform sampler g_Samplers[];
+
+// One packed entry per sampler stage: texture slot in the low 20 bits, sampler index in the high 12
+layout(push_constant) uniform BindlessTextures {
+    uint textures[16];
+} g_Bindless;
+
+#define BINDLESS_TEXTURE(stage) (g_Bindless.textures[stage] & 0xFFFFFu)
+#define BINDLESS_SAMPLER(stage) (g_Bindless.textures[stage] >> 20)
+
+vec4 SampleTexture2D(int stage, vec2 uv)
+{
+    return texture(sampler2D(g_Textures2D[BINDLESS_TEXTURE(stage)], g_Samplers[BINDLESS_SAMPLER(stage)]), uv);
+}
+
+vec4 SampleTextureCube(int stage, vec3 dir)
+{
+    return texture(samplerCube(g_TexturesCube[BINDLESS_TEXTURE(stage)], g_Samplers[BINDLESS_SAMPLER(stage)]), dir);
+}
@@ -3,7 +3,10 @@
 cd /d %~dp0
 
 echo Compiling shaders
-for /r %%i in (*.frag, *.vert) do "%VULKAN_SDK%/Bin/glslangValidator.exe" -V %%i
+for %%i in (shader.frag, shader.vert) do "%VULKAN_SDK%/Bin/glslangValidator.exe" -V %%i
+rem Other shaders are named after their source file, the stage name alone would collide
+for /r %%i in (*.comp) do "%VULKAN_SDK%/Bin/glslangValidator.exe" -V %%i -o %%~dpni.spv
+"%VULKAN_SDK%/Bin/glslangValidator.exe" -V pick.frag -o pick.spv
 
 echo Moving shaders
 ROBOCOPY %~dp0 %~dp0../../../../game/bin/shaders *.spv /MOV
@@ -0,0 +1,17 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Same block as shader.vert, the selection id is only read here
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    uint selectionId;
+} ubo;
+
+// R32_UINT pick buffer, see CPickBufferVk
+layout(location = 0) out uint outId;
+
+void main() {
+    outId = ubo.selectionId;
+}
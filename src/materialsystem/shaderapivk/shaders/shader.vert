@@ -11,9 +11,14 @@ layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec4 inColor;
 
+// Rows of the model matrix, one per instance, see VERTEX_LOCATION_INSTANCE_MODEL
+layout(location = 12) in vec4 inModel[3];
+
 layout(location = 0) out vec4 fragColor;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    vec4 position = vec4(inPosition, 1.0);
+    vec3 worldPosition = vec3(dot(inModel[0], position), dot(inModel[1], position), dot(inModel[2], position));
+    gl_Position = ubo.proj * ubo.view * vec4(worldPosition, 1.0);
     fragColor = inColor;
 }
\ No newline at end of file
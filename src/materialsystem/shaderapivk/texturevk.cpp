@@ -0,0 +1,784 @@
+#include "texturevk.h"
+#include "bcdecodevk.h"
+#include "buffervkutil.h"
+#include "shaderdevicevk.h"
+#include "texture_group_names.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+// Constructor, destructor
+//-----------------------------------------------------------------------------
+CTextureVk::CTextureVk()
+{
+    m_Image = VK_NULL_HANDLE;
+    m_ImageMemory = VK_NULL_HANDLE;
+    m_ImageView = VK_NULL_HANDLE;
+    m_SampledImageView = VK_NULL_HANDLE;
+    m_AttachmentView = VK_NULL_HANDLE;
+    m_Format = VK_FORMAT_UNDEFINED;
+    m_ImageFormat = IMAGE_FORMAT_UNKNOWN;
+    m_StorageFormat = IMAGE_FORMAT_UNKNOWN;
+    m_nWidth = 0;
+    m_nHeight = 0;
+    m_nDepth = 0;
+    m_nLayers = 0;
+    m_nMipLevels = 0;
+    m_nFlags = 0;
+    m_nSizeInBytes = 0;
+    m_Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    m_bTransient = false;
+    m_bAnisotropic = false;
+    m_nSamplerIndex = -1;
+    m_nBindlessSlot = BINDLESS_TEXTURE_NONE;
+    m_MipGenMode = MIPGEN_NONE;
+    m_bMipsDirty = false;
+    m_MipDescriptorPool = VK_NULL_HANDLE;
+}
+
+CTextureVk::~CTextureVk() { Shutdown(); }
+
+//-----------------------------------------------------------------------------
+// Creates a color texture covering all mips and faces, render targets included
+//-----------------------------------------------------------------------------
+void CTextureVk::Init(int width, int height, int depth, ImageFormat format, int numMipLevels, int flags, const char *pDebugName,
+                      const char *pTextureGroupName)
+{
+    Assert(!IsInitialized());
+
+    m_nWidth = width;
+    m_nHeight = height;
+    m_nDepth = depth > 0 ? depth : 1;
+    m_nLayers = (flags & TEXTURE_CREATE_CUBEMAP) ? 6 : 1;
+    m_nMipLevels = numMipLevels > 0 ? numMipLevels : 1;
+    if ((flags & TEXTURE_CREATE_AUTOMIPMAP) && m_nMipLevels == 1)
+    {
+        // Full chain down to 1x1
+        int nMaxSize = MAX(MAX(width, height), m_nDepth);
+        while (nMaxSize > 1)
+        {
+            nMaxSize >>= 1;
+            m_nMipLevels++;
+        }
+    }
+    m_nFlags = flags;
+    m_ImageFormat = format;
+    m_StorageFormat = format;
+    m_DebugName = pDebugName;
+    m_TextureGroupName = pTextureGroupName;
+
+    m_Format = imgfmt2vkfmt(format);
+    if (IsBlockCompressed(m_Format) && !g_pShaderDevice->SupportsBCTextures())
+    {
+        // No textureCompressionBC, decode on upload
+        m_StorageFormat = IMAGE_FORMAT_RGBA8888;
+        m_Format = VK_FORMAT_R8G8B8A8_UNORM;
+    }
+    else if (m_Format == VK_FORMAT_UNDEFINED)
+    {
+        // VK_TODO: formats without a direct VkFormat are converted to RGBA8888 on upload
+        m_StorageFormat = IMAGE_FORMAT_RGBA8888;
+        m_Format = VK_FORMAT_R8G8B8A8_UNORM;
+    }
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (flags & TEXTURE_CREATE_RENDERTARGET)
+    {
+        usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    }
+
+    m_MipGenMode = MIPGEN_NONE;
+    m_bMipsDirty = false;
+    if ((flags & TEXTURE_CREATE_AUTOMIPMAP) && m_nMipLevels > 1)
+    {
+        m_MipGenMode = g_pShaderDevice->GetMipGenerator().ChooseMode(m_Format, (flags & TEXTURE_CREATE_SRGB) != 0, m_nDepth > 1);
+        if (m_MipGenMode == MIPGEN_COMPUTE)
+        {
+            usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+        }
+        else if (m_MipGenMode == MIPGEN_NONE)
+        {
+            // Nothing would ever fill the lower mips, sample level 0 only rather than undefined data
+            // VK_TODO: CPU box filter on upload
+            Warning("CTextureVk::Init: can't generate mips for %s in format %d, using mip 0 only\n", pDebugName, m_Format);
+            m_nMipLevels = 1;
+        }
+    }
+
+    // Same defaults as the D3D shaderapi: bilinear, trilinear with mips, clamped
+    m_SamplerKey = SamplerKey_t();
+    m_SamplerKey.m_MinFilter = VK_FILTER_LINEAR;
+    m_SamplerKey.m_MagFilter = VK_FILTER_LINEAR;
+    m_SamplerKey.m_MipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    m_SamplerKey.m_bMipmaps = m_nMipLevels > 1;
+    m_SamplerKey.m_AddressU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    m_SamplerKey.m_AddressV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    m_SamplerKey.m_AddressW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    m_nSamplerIndex = -1;
+
+    // Keep every subresource in the shader read layout between uploads and render passes
+    m_Layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    CreateImage(usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+}
+
+void CTextureVk::InitDepth(int width, int height, bool bTransient, const char *pDebugName)
+{
+    Assert(!IsInitialized());
+
+    m_nWidth = width;
+    m_nHeight = height;
+    m_nDepth = 1;
+    m_nLayers = 1;
+    m_nMipLevels = 1;
+    m_nFlags = TEXTURE_CREATE_DEPTHBUFFER;
+    m_ImageFormat = IMAGE_FORMAT_UNKNOWN;
+    m_StorageFormat = IMAGE_FORMAT_UNKNOWN;
+    m_DebugName = pDebugName;
+    m_TextureGroupName = TEXTURE_GROUP_RENDER_TARGET;
+    m_Format = g_pShaderDevice->GetDepthFormat();
+
+    VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (m_Format != VK_FORMAT_D32_SFLOAT)
+    {
+        aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    VkMemoryPropertyFlags memoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    m_bTransient = bTransient;
+    if (bTransient)
+    {
+        // Lazily allocated memory may never be backed at all on tilers
+        usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        memoryProperties |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        m_Layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    }
+    else
+    {
+        usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+        m_Layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+
+    // Sampled depth is used for shadow maps, compare like D3D's hardware shadow mapping
+    m_SamplerKey = SamplerKey_t();
+    m_SamplerKey.m_MinFilter = VK_FILTER_LINEAR;
+    m_SamplerKey.m_MagFilter = VK_FILTER_LINEAR;
+    m_SamplerKey.m_AddressU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    m_SamplerKey.m_AddressV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    m_SamplerKey.m_AddressW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    m_SamplerKey.m_bCompare = true;
+    m_SamplerKey.m_CompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    m_nSamplerIndex = -1;
+
+    CreateImage(usage, memoryProperties, aspectMask);
+}
+
+//-----------------------------------------------------------------------------
+// Creates the image, its memory and a view, then moves it to its resting layout
+//-----------------------------------------------------------------------------
+void CTextureVk::CreateImage(VkImageUsageFlags usage, VkMemoryPropertyFlags memoryProperties, VkImageAspectFlags aspectMask)
+{
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = (m_nDepth > 1) ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = m_nWidth;
+    imageInfo.extent.height = m_nHeight;
+    imageInfo.extent.depth = m_nDepth;
+    imageInfo.mipLevels = m_nMipLevels;
+    imageInfo.arrayLayers = m_nLayers;
+    imageInfo.format = m_Format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = usage;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (m_nFlags & TEXTURE_CREATE_CUBEMAP)
+    {
+        imageInfo.flags |= VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+    }
+
+    vkCheck(vkCreateImage(g_pShaderDevice->GetVkDevice(), &imageInfo, g_pAllocCallbacks, &m_Image), "failed to create image");
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(g_pShaderDevice->GetVkDevice(), m_Image, &memRequirements);
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memRequirements.size;
+    if ((memoryProperties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) &&
+        !g_pShaderDeviceMgr->HasMemoryType(0, memRequirements.memoryTypeBits, memoryProperties))
+    {
+        // Desktop GPUs usually don't have lazily allocated memory
+        memoryProperties &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    }
+    allocInfo.memoryTypeIndex = g_pShaderDeviceMgr->FindMemoryType(0, memRequirements.memoryTypeBits, memoryProperties);
+    vkCheck(vkAllocateMemory(g_pShaderDevice->GetVkDevice(), &allocInfo, g_pAllocCallbacks, &m_ImageMemory),
+            "failed to allocate image memory");
+    vkCheck(vkBindImageMemory(g_pShaderDevice->GetVkDevice(), m_Image, m_ImageMemory, 0), "failed to bind image memory");
+
+    m_nSizeInBytes = (int)memRequirements.size;
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = m_Image;
+    if (m_nFlags & TEXTURE_CREATE_CUBEMAP)
+    {
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+    }
+    else if (m_nDepth > 1)
+    {
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_3D;
+    }
+    else
+    {
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    }
+    viewInfo.format = m_Format;
+    viewInfo.subresourceRange.aspectMask = aspectMask;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = m_nMipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = m_nLayers;
+    vkCheck(vkCreateImageView(g_pShaderDevice->GetVkDevice(), &viewInfo, g_pAllocCallbacks, &m_ImageView),
+            "failed to create image view");
+
+    // Framebuffer attachments must be a single mip
+    m_AttachmentView = m_ImageView;
+    if ((usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT) && m_nMipLevels > 1)
+    {
+        VkImageViewCreateInfo attachmentViewInfo = viewInfo;
+        attachmentViewInfo.subresourceRange.levelCount = 1;
+        vkCheck(vkCreateImageView(g_pShaderDevice->GetVkDevice(), &attachmentViewInfo, g_pAllocCallbacks, &m_AttachmentView),
+                "failed to create image view");
+    }
+
+    if (usage & VK_IMAGE_USAGE_SAMPLED_BIT)
+    {
+        // Only one aspect can be sampled at a time
+        m_SampledImageView = m_ImageView;
+        if (aspectMask == (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT))
+        {
+            VkImageViewCreateInfo sampledViewInfo = viewInfo;
+            sampledViewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+            vkCheck(vkCreateImageView(g_pShaderDevice->GetVkDevice(), &sampledViewInfo, g_pAllocCallbacks, &m_SampledImageView),
+                    "failed to create image view");
+        }
+
+        m_nBindlessSlot = g_pShaderDevice->GetBindlessTextures().AllocTextureSlot(m_SampledImageView, m_Layout);
+    }
+
+    VkCommandBuffer commandBuffer = g_pShaderDevice->BeginSingleTimeCommands();
+    TransitionImageLayout(commandBuffer, viewInfo.subresourceRange, VK_IMAGE_LAYOUT_UNDEFINED, m_Layout);
+    g_pShaderDevice->EndSingleTimeCommands(commandBuffer);
+}
+
+void CTextureVk::Shutdown()
+{
+    if (!IsInitialized())
+        return;
+
+    // Frames in flight may still sample or render to it, everything goes through the deletion queue
+    CDeletionQueueVk &deletionQueue = g_pShaderDevice->GetDeletionQueue();
+
+    g_pShaderDevice->GetRenderPassCache().ReleaseFramebuffers(m_AttachmentView);
+    if (m_nBindlessSlot != BINDLESS_TEXTURE_NONE)
+    {
+        deletionQueue.FreeBindlessSlot(m_nBindlessSlot);
+    }
+
+    if (m_MipDescriptorPool != VK_NULL_HANDLE)
+    {
+        // Frees the sets as well
+        deletionQueue.DestroyDescriptorPool(m_MipDescriptorPool);
+        m_MipDescriptorPool = VK_NULL_HANDLE;
+        m_MipDescriptorSets.RemoveAll();
+    }
+    for (int i = 0; i < m_MipViews.Count(); i++)
+    {
+        deletionQueue.DestroyImageView(m_MipViews[i]);
+    }
+    m_MipViews.RemoveAll();
+
+    if (m_SampledImageView != m_ImageView)
+    {
+        deletionQueue.DestroyImageView(m_SampledImageView);
+    }
+    if (m_AttachmentView != m_ImageView)
+    {
+        deletionQueue.DestroyImageView(m_AttachmentView);
+    }
+    deletionQueue.DestroyImageView(m_ImageView);
+    deletionQueue.DestroyImage(m_Image);
+    deletionQueue.FreeMemory(m_ImageMemory);
+
+    m_ImageView = VK_NULL_HANDLE;
+    m_SampledImageView = VK_NULL_HANDLE;
+    m_AttachmentView = VK_NULL_HANDLE;
+    m_nBindlessSlot = BINDLESS_TEXTURE_NONE;
+    m_MipGenMode = MIPGEN_NONE;
+    m_bMipsDirty = false;
+    m_Image = VK_NULL_HANDLE;
+    m_ImageMemory = VK_NULL_HANDLE;
+    m_nSizeInBytes = 0;
+    m_Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    m_bTransient = false;
+}
+
+//-----------------------------------------------------------------------------
+// Uploads through a staging buffer, converting the source data if needed
+//-----------------------------------------------------------------------------
+void CTextureVk::UploadImage(int level, int cubeFaceID, int xOffset, int yOffset, int zOffset, int width, int height,
+                             ImageFormat srcFormat, int srcStride, const void *pImageData)
+{
+    Assert(IsInitialized());
+    Assert(cubeFaceID < m_nLayers);
+
+    // Automipmapped textures that can't generate mips only have level 0
+    if (!pImageData || width <= 0 || height <= 0 || level >= m_nMipLevels)
+        return;
+
+    const unsigned char *pSrc = (const unsigned char *)pImageData;
+    uint32_t rowLength = 0;
+    std::vector<unsigned char> converted;
+
+    if (srcFormat != m_StorageFormat)
+    {
+        converted.resize(ImageLoader::GetMemRequired(width, height, 1, m_StorageFormat, false));
+
+        bool bConverted;
+        if (m_StorageFormat == IMAGE_FORMAT_RGBA8888 && IsBCDecodeSupported(srcFormat))
+        {
+            bConverted = DecodeBCImage(pSrc, srcFormat, converted.data(), width, height);
+        }
+        else
+        {
+            bConverted = ImageLoader::ConvertImageFormat(pSrc, srcFormat, converted.data(), m_StorageFormat, width, height, srcStride);
+        }
+
+        if (!bConverted)
+        {
+            Warning("CTextureVk::UploadImage: can't convert %s to %s for %s\n", ImageLoader::GetName(srcFormat),
+                    ImageLoader::GetName(m_StorageFormat), GetDebugName());
+            return;
+        }
+        pSrc = converted.data();
+    }
+    else if (srcStride > 0 && !ImageLoader::IsCompressed(srcFormat))
+    {
+        rowLength = srcStride / ImageLoader::SizeInBytes(srcFormat);
+    }
+
+    VkDeviceSize imageSize;
+    if (rowLength)
+    {
+        imageSize = (VkDeviceSize)srcStride * height;
+    }
+    else
+    {
+        imageSize = ImageLoader::GetMemRequired(width, height, 1, m_StorageFormat, false);
+    }
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 stagingBuffer, stagingBufferMemory);
+
+    void *pData;
+    vkMapMemory(g_pShaderDevice->GetVkDevice(), stagingBufferMemory, 0, imageSize, 0, &pData);
+    memcpy(pData, pSrc, (size_t)imageSize);
+    vkUnmapMemory(g_pShaderDevice->GetVkDevice(), stagingBufferMemory);
+
+    VkImageSubresourceRange range = {};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.baseMipLevel = level;
+    range.levelCount = 1;
+    range.baseArrayLayer = cubeFaceID;
+    range.layerCount = 1;
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = rowLength;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = level;
+    region.imageSubresource.baseArrayLayer = cubeFaceID;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {xOffset, yOffset, zOffset};
+    region.imageExtent = {(uint32_t)width, (uint32_t)height, 1};
+
+    VkCommandBuffer commandBuffer = g_pShaderDevice->BeginSingleTimeCommands();
+    TransitionImageLayout(commandBuffer, range, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, m_Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    TransitionImageLayout(commandBuffer, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    g_pShaderDevice->EndSingleTimeCommands(commandBuffer);
+
+    vkDestroyBuffer(g_pShaderDevice->GetVkDevice(), stagingBuffer, g_pAllocCallbacks);
+    vkFreeMemory(g_pShaderDevice->GetVkDevice(), stagingBufferMemory, g_pAllocCallbacks);
+
+    if (level == 0 && HasAutoMipmaps())
+    {
+        m_bMipsDirty = true;
+    }
+}
+
+void CTextureVk::TransitionImageLayout(VkCommandBuffer commandBuffer, const VkImageSubresourceRange &range, VkImageLayout oldLayout,
+                                       VkImageLayout newLayout)
+{
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = m_Image;
+    barrier.subresourceRange = range;
+
+    VkPipelineStageFlags srcStage;
+    VkPipelineStageFlags dstStage;
+    if (newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    {
+        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        srcStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+    else if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        dstStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    }
+    else
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+static void ImageBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseMipLevel, uint32_t levelCount, uint32_t layerCount,
+                         VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+                         VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = baseMipLevel;
+    barrier.subresourceRange.levelCount = levelCount;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = layerCount;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// Level 0 may have just been rendered to, copied to or written by a previous generation
+static const VkPipelineStageFlags s_MipSourceStages =
+    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+static const VkAccessFlags s_MipSourceAccess =
+    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+static const VkPipelineStageFlags s_MipConsumerStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+void CTextureVk::GenerateMipmaps(VkCommandBuffer commandBuffer)
+{
+    Assert(m_Layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    switch (m_MipGenMode)
+    {
+    case MIPGEN_BLIT_LINEAR:
+    case MIPGEN_BLIT_NEAREST:
+        BlitMipmaps(commandBuffer);
+        break;
+    case MIPGEN_COMPUTE:
+        ComputeMipmaps(commandBuffer);
+        break;
+    default:
+        return;
+    }
+
+    m_bMipsDirty = false;
+}
+
+//-----------------------------------------------------------------------------
+// Each level is blitted from the previous one, then everything goes back to shader read
+//-----------------------------------------------------------------------------
+void CTextureVk::BlitMipmaps(VkCommandBuffer commandBuffer)
+{
+    ImageBarrier(commandBuffer, m_Image, 0, 1, m_nLayers, m_Layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, s_MipSourceStages,
+                 s_MipSourceAccess, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    ImageBarrier(commandBuffer, m_Image, 1, m_nMipLevels - 1, m_nLayers, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                 s_MipConsumerStages, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    VkFilter filter = (m_MipGenMode == MIPGEN_BLIT_LINEAR) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+    int32_t srcWidth = m_nWidth;
+    int32_t srcHeight = m_nHeight;
+    int32_t srcDepth = m_nDepth;
+    for (int level = 1; level < m_nMipLevels; level++)
+    {
+        int32_t dstWidth = MAX(srcWidth >> 1, 1);
+        int32_t dstHeight = MAX(srcHeight >> 1, 1);
+        int32_t dstDepth = MAX(srcDepth >> 1, 1);
+
+        VkImageBlit blit = {};
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = level - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = m_nLayers;
+        blit.srcOffsets[1] = {srcWidth, srcHeight, srcDepth};
+        blit.dstSubresource = blit.srcSubresource;
+        blit.dstSubresource.mipLevel = level;
+        blit.dstOffsets[1] = {dstWidth, dstHeight, dstDepth};
+        vkCmdBlitImage(commandBuffer, m_Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                       &blit, filter);
+
+        // This level is the source of the next one
+        ImageBarrier(commandBuffer, m_Image, level, 1, m_nLayers, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+        srcDepth = dstDepth;
+    }
+
+    ImageBarrier(commandBuffer, m_Image, 0, m_nMipLevels, m_nLayers, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_Layout,
+                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, s_MipConsumerStages, VK_ACCESS_SHADER_READ_BIT);
+}
+
+//-----------------------------------------------------------------------------
+// Compute fallback, levels are written in GENERAL and read back in shader read layout
+//-----------------------------------------------------------------------------
+void CTextureVk::ComputeMipmaps(VkCommandBuffer commandBuffer)
+{
+    if (m_MipDescriptorSets.Count() == 0)
+    {
+        CreateMipDescriptorSets();
+    }
+
+    CMipGeneratorVk &mipGenerator = g_pShaderDevice->GetMipGenerator();
+    bool bSRGB = (m_nFlags & TEXTURE_CREATE_SRGB) != 0;
+
+    ImageBarrier(commandBuffer, m_Image, 0, 1, m_nLayers, m_Layout, m_Layout, s_MipSourceStages, s_MipSourceAccess,
+                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    ImageBarrier(commandBuffer, m_Image, 1, m_nMipLevels - 1, m_nLayers, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                 s_MipConsumerStages, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+    uint32_t srcWidth = m_nWidth;
+    uint32_t srcHeight = m_nHeight;
+    for (int level = 1; level < m_nMipLevels; level++)
+    {
+        uint32_t dstWidth = MAX(srcWidth >> 1, 1u);
+        uint32_t dstHeight = MAX(srcHeight >> 1, 1u);
+        mipGenerator.Dispatch(commandBuffer, m_MipDescriptorSets[level - 1], srcWidth, srcHeight, dstWidth, dstHeight, m_nLayers, bSRGB);
+
+        // Readable by the next level's dispatch and by draws
+        ImageBarrier(commandBuffer, m_Image, level, 1, m_nLayers, VK_IMAGE_LAYOUT_GENERAL, m_Layout, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                     VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | s_MipConsumerStages, VK_ACCESS_SHADER_READ_BIT);
+
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
+}
+
+void CTextureVk::CreateMipDescriptorSets()
+{
+    VkDevice device = g_pShaderDevice->GetVkDevice();
+    uint32_t nSets = m_nMipLevels - 1;
+
+    for (int level = 0; level < m_nMipLevels; level++)
+    {
+        VkImageViewCreateInfo viewInfo = {};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = m_Image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+        viewInfo.format = m_Format;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel = level;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount = m_nLayers;
+
+        VkImageView view;
+        vkCheck(vkCreateImageView(device, &viewInfo, g_pAllocCallbacks, &view), "failed to create image view");
+        m_MipViews.AddToTail(view);
+    }
+
+    VkDescriptorPoolSize poolSizes[2] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = nSets;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = nSets;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = ARRAYSIZE(poolSizes);
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = nSets;
+    vkCheck(vkCreateDescriptorPool(device, &poolInfo, g_pAllocCallbacks, &m_MipDescriptorPool), "failed to create descriptor pool");
+
+    CUtlVector<VkDescriptorSetLayout> layouts;
+    layouts.SetCount(nSets);
+    for (uint32_t i = 0; i < nSets; i++)
+    {
+        layouts[i] = g_pShaderDevice->GetMipGenerator().GetDescriptorSetLayout();
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_MipDescriptorPool;
+    allocInfo.descriptorSetCount = nSets;
+    allocInfo.pSetLayouts = layouts.Base();
+    m_MipDescriptorSets.SetCount(nSets);
+    vkCheck(vkAllocateDescriptorSets(device, &allocInfo, m_MipDescriptorSets.Base()), "failed to allocate descriptor sets");
+
+    // Set i reads level i and writes level i + 1, texelFetch ignores the sampler's filtering
+    VkSampler sampler = g_pShaderDevice->GetSamplerCache().GetSampler(0);
+    for (uint32_t i = 0; i < nSets; i++)
+    {
+        VkDescriptorImageInfo srcInfo = {};
+        srcInfo.sampler = sampler;
+        srcInfo.imageView = m_MipViews[i];
+        srcInfo.imageLayout = m_Layout;
+
+        VkDescriptorImageInfo dstInfo = {};
+        dstInfo.imageView = m_MipViews[i + 1];
+        dstInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet descriptorWrites[2] = {};
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = m_MipDescriptorSets[i];
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pImageInfo = &srcInfo;
+        descriptorWrites[1] = descriptorWrites[0];
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descriptorWrites[1].pImageInfo = &dstInfo;
+        vkUpdateDescriptorSets(device, ARRAYSIZE(descriptorWrites), descriptorWrites, 0, nullptr);
+    }
+}
+
+void CTextureVk::SetMinFilter(ShaderTexFilterMode_t texFilterMode)
+{
+    m_bAnisotropic = false;
+    m_SamplerKey.m_bMipmaps = true;
+    switch (texFilterMode)
+    {
+    case SHADER_TEXFILTERMODE_NEAREST:
+        m_SamplerKey.m_MinFilter = VK_FILTER_NEAREST;
+        m_SamplerKey.m_bMipmaps = false;
+        break;
+    case SHADER_TEXFILTERMODE_LINEAR:
+        m_SamplerKey.m_MinFilter = VK_FILTER_LINEAR;
+        m_SamplerKey.m_bMipmaps = false;
+        break;
+    case SHADER_TEXFILTERMODE_NEAREST_MIPMAP_NEAREST:
+        m_SamplerKey.m_MinFilter = VK_FILTER_NEAREST;
+        m_SamplerKey.m_MipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        break;
+    case SHADER_TEXFILTERMODE_LINEAR_MIPMAP_NEAREST:
+        m_SamplerKey.m_MinFilter = VK_FILTER_LINEAR;
+        m_SamplerKey.m_MipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        break;
+    case SHADER_TEXFILTERMODE_NEAREST_MIPMAP_LINEAR:
+        m_SamplerKey.m_MinFilter = VK_FILTER_NEAREST;
+        m_SamplerKey.m_MipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        break;
+    case SHADER_TEXFILTERMODE_LINEAR_MIPMAP_LINEAR:
+        m_SamplerKey.m_MinFilter = VK_FILTER_LINEAR;
+        m_SamplerKey.m_MipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        break;
+    case SHADER_TEXFILTERMODE_ANISOTROPIC:
+        m_SamplerKey.m_MinFilter = VK_FILTER_LINEAR;
+        m_SamplerKey.m_MipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        m_bAnisotropic = true;
+        break;
+    default:
+        Assert(0);
+        break;
+    }
+
+    // Mip filtering on a texture without mips would sample garbage
+    if (m_nMipLevels <= 1)
+    {
+        m_SamplerKey.m_bMipmaps = false;
+    }
+}
+
+void CTextureVk::SetMagFilter(ShaderTexFilterMode_t texFilterMode)
+{
+    m_SamplerKey.m_MagFilter = (texFilterMode == SHADER_TEXFILTERMODE_NEAREST) ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
+}
+
+void CTextureVk::SetWrap(ShaderTexCoordComponent_t coord, ShaderTexWrapMode_t wrapMode)
+{
+    VkSamplerAddressMode addressMode;
+    switch (wrapMode)
+    {
+    case SHADER_TEXWRAPMODE_REPEAT:
+        addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        break;
+    case SHADER_TEXWRAPMODE_BORDER:
+        addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+        break;
+    case SHADER_TEXWRAPMODE_CLAMP:
+    default:
+        addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        break;
+    }
+
+    switch (coord)
+    {
+    case SHADER_TEXCOORD_S:
+        m_SamplerKey.m_AddressU = addressMode;
+        break;
+    case SHADER_TEXCOORD_T:
+        m_SamplerKey.m_AddressV = addressMode;
+        break;
+    case SHADER_TEXCOORD_U:
+        m_SamplerKey.m_AddressW = addressMode;
+        break;
+    default:
+        Assert(0);
+        break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Only hits the cache when the state changed since the last bind
+//-----------------------------------------------------------------------------
+int CTextureVk::GetSamplerIndex(int nAnisotropicLevel)
+{
+    SamplerKey_t key = m_SamplerKey;
+    if (m_bAnisotropic)
+    {
+        key.m_nAnisotropy = clamp(nAnisotropicLevel, 1, 16);
+    }
+
+    if (m_nSamplerIndex < 0 || key != m_BoundSamplerKey)
+    {
+        m_nSamplerIndex = g_pShaderDevice->GetSamplerCache().FindOrCreateSampler(key);
+        m_BoundSamplerKey = key;
+    }
+
+    return m_nSamplerIndex;
+}
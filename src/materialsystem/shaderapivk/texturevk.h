@@ -0,0 +1,134 @@
+//
+
+#ifndef TEXTUREVK_H
+#define TEXTUREVK_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "localvktypes.h"
+#include "mipgenvk.h"
+#include "samplervk.h"
+#include "shaderapi/ishaderapi.h"
+#include "tier1/utlstring.h"
+#include "vulkanimpl.h"
+
+//-----------------------------------------------------------------------------
+// A texture backed by a single VkImage.
+// Cubemaps are stored as 6 array layers, volume textures as a 3D image.
+//-----------------------------------------------------------------------------
+class CTextureVk
+{
+  public:
+    CTextureVk();
+    ~CTextureVk();
+
+    // Creates, destroys the image
+    void Init(int width, int height, int depth, ImageFormat format, int numMipLevels, int flags, const char *pDebugName,
+              const char *pTextureGroupName);
+    void Shutdown();
+
+    // Creates a depth buffer in the device depth format.
+    // Transient depth can't be sampled and its contents never leave tile memory where supported.
+    void InitDepth(int width, int height, bool bTransient, const char *pDebugName);
+
+    bool IsInitialized() const { return m_Image != VK_NULL_HANDLE; }
+
+    // Uploads a rectangle of a single mip level and face.
+    // srcStride of 0 means tightly packed.
+    void UploadImage(int level, int cubeFaceID, int xOffset, int yOffset, int zOffset, int width, int height, ImageFormat srcFormat,
+                     int srcStride, const void *pImageData);
+
+    VkImage GetImage() const { return m_Image; }
+    VkImageView GetImageView() const { return m_ImageView; }
+
+    // Single mip view for framebuffers
+    VkImageView GetAttachmentView() const { return m_AttachmentView; }
+    VkFormat GetVkFormat() const { return m_Format; }
+
+    // The format the material system asked for
+    ImageFormat GetImageFormat() const { return m_ImageFormat; }
+
+    // The format the data is actually stored in, differs when BC data is decoded on the CPU
+    ImageFormat GetStorageFormat() const { return m_StorageFormat; }
+
+    int GetWidth() const { return m_nWidth; }
+    int GetHeight() const { return m_nHeight; }
+    int GetDepth() const { return m_nDepth; }
+    int GetMipLevels() const { return m_nMipLevels; }
+    int GetFlags() const { return m_nFlags; }
+    int GetSizeInBytes() const { return m_nSizeInBytes; }
+    const char *GetDebugName() const { return m_DebugName.Get(); }
+
+    bool IsRenderTarget() const { return (m_nFlags & TEXTURE_CREATE_RENDERTARGET) != 0; }
+    bool IsDepth() const { return (m_nFlags & TEXTURE_CREATE_DEPTHBUFFER) != 0; }
+    bool IsTransient() const { return m_bTransient; }
+
+    // The layout the image is kept in between render passes and uploads
+    VkImageLayout GetLayout() const { return m_Layout; }
+
+    // Sampler state, resolved to a cached sampler when the texture gets bound
+    void SetMinFilter(ShaderTexFilterMode_t texFilterMode);
+    void SetMagFilter(ShaderTexFilterMode_t texFilterMode);
+    void SetWrap(ShaderTexCoordComponent_t coord, ShaderTexWrapMode_t wrapMode);
+    int GetSamplerIndex(int nAnisotropicLevel);
+
+    // Index into the bindless texture array, BINDLESS_TEXTURE_NONE if not sampled or not bindless
+    uint32_t GetBindlessSlot() const { return m_nBindlessSlot; }
+
+    // TEXTURE_CREATE_AUTOMIPMAP textures fill their mips from level 0 on the GPU
+    bool HasAutoMipmaps() const { return m_MipGenMode != MIPGEN_NONE; }
+
+    // Records mip generation, every level is back in GetLayout() afterwards
+    void GenerateMipmaps(VkCommandBuffer commandBuffer);
+
+    // Level 0 was uploaded to since the mips were last generated
+    bool NeedsMipmaps() const { return m_bMipsDirty; }
+
+  private:
+    void CreateImage(VkImageUsageFlags usage, VkMemoryPropertyFlags memoryProperties, VkImageAspectFlags aspectMask);
+    void TransitionImageLayout(VkCommandBuffer commandBuffer, const VkImageSubresourceRange &range, VkImageLayout oldLayout,
+                               VkImageLayout newLayout);
+    void BlitMipmaps(VkCommandBuffer commandBuffer);
+    void ComputeMipmaps(VkCommandBuffer commandBuffer);
+    void CreateMipDescriptorSets();
+
+    VkImage m_Image;
+    VkDeviceMemory m_ImageMemory;
+    VkImageView m_ImageView;
+    // Depth only view for sampling depth/stencil images, otherwise m_ImageView
+    VkImageView m_SampledImageView;
+    // Mip 0 only view for render targets with mips, otherwise m_ImageView
+    VkImageView m_AttachmentView;
+    VkFormat m_Format;
+    ImageFormat m_ImageFormat;
+    ImageFormat m_StorageFormat;
+    int m_nWidth;
+    int m_nHeight;
+    int m_nDepth;
+    int m_nLayers;
+    int m_nMipLevels;
+    int m_nFlags;
+    int m_nSizeInBytes;
+    VkImageLayout m_Layout;
+    bool m_bTransient;
+
+    SamplerKey_t m_SamplerKey;
+    bool m_bAnisotropic;
+    SamplerKey_t m_BoundSamplerKey;
+    int m_nSamplerIndex;
+    uint32_t m_nBindlessSlot;
+
+    MipGenMode_t m_MipGenMode;
+    bool m_bMipsDirty;
+    // Compute mip generation only, one view per level and one set per generated level
+    CUtlVector<VkImageView> m_MipViews;
+    VkDescriptorPool m_MipDescriptorPool;
+    CUtlVector<VkDescriptorSet> m_MipDescriptorSets;
+
+    CUtlString m_DebugName;
+    CUtlString m_TextureGroupName;
+};
+
+#endif // TEXTUREVK_H
@@ -1,5 +1,6 @@
 #include "vertexbuffervk.h"
 #include "buffervkutil.h"
+#include "meshmgrvk.h"
 #include "shaderdevicevk.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -26,15 +27,16 @@ CVertexBufferVk::CVertexBufferVk(ShaderBufferType_t type, VertexFormat_t fmt, in
 
     m_VertexFormat = fmt;
     m_pVertexBuffer = NULL;
-    // m_Vertices = vertices;
+    // Sized in bytes for VERTEX_FORMAT_UNKNOWN
+    m_nVertexSize = g_pMeshMgr->VertexFormatSize(fmt);
     m_nVertexCount = vertexCount;
-    m_nBufferSize = vertexCount * VertexSize();
+    m_nBufferSize = (VkDeviceSize)vertexCount * VertexSize();
     m_nFirstUnwrittenOffset = 0;
     m_bIsLocked = false;
+    m_bArenaRangeWritten = false;
     m_bIsDynamic = (type == SHADER_BUFFER_TYPE_DYNAMIC) || (type == SHADER_BUFFER_TYPE_DYNAMIC_TEMP);
     m_bFlush = false;
     m_bDestination = destination;
-    m_Vertices = std::vector<Vertex>();
 
 #ifdef VPROF_ENABLED
     if (!m_bIsDynamic)
@@ -65,8 +67,18 @@ CVertexBufferVk::~CVertexBufferVk() { Free(); }
 //-----------------------------------------------------------------------------
 bool CVertexBufferVk::Allocate()
 {
-    Assert(!m_pVertexBuffer);
+    Assert(!m_pVertexBuffer && !m_ArenaRange.IsValid());
     m_nFirstUnwrittenOffset = 0;
+    m_bArenaRangeWritten = false;
+
+    // Bound in place by the viewport, so small static buffers can be packed together
+    if (!m_bIsDynamic && !m_bDestination && g_pShaderDevice->GetGeometryArena().Alloc(m_nBufferSize, this, m_ArenaRange))
+    {
+#ifdef _DEBUG
+        ++s_nBufferCount;
+#endif
+        return true;
+    }
 
     m_pVertexBuffer = new VkBuffer();
     m_pVertexBufferMemory = new VkDeviceMemory();
@@ -90,21 +102,27 @@ bool CVertexBufferVk::Allocate()
 
 void CVertexBufferVk::Free()
 {
+    if (m_ArenaRange.IsValid())
+    {
+#ifdef _DEBUG
+        --s_nBufferCount;
+#endif
+        g_pShaderDevice->GetGeometryArena().Free(m_ArenaRange);
+    }
+
     if (m_pVertexBuffer)
     {
 #ifdef _DEBUG
         --s_nBufferCount;
 #endif
-        // Destroy buffer
-        vkDestroyBuffer(g_pShaderDevice->GetVkDevice(), *m_pVertexBuffer, nullptr);
+        // Frames in flight may still read from it
+        g_pShaderDevice->GetDeletionQueue().DestroyBuffer(*m_pVertexBuffer);
         m_pVertexBuffer = nullptr;
 
-        // Free memory
-        vkFreeMemory(g_pShaderDevice->GetVkDevice(), *m_pVertexBufferMemory, nullptr);
+        g_pShaderDevice->GetDeletionQueue().FreeMemory(*m_pVertexBufferMemory);
         m_pVertexBufferMemory = nullptr;
     }
     // m_pVertexMemory.clear();
-    // m_Vertices.clear();
 }
 
 //-----------------------------------------------------------------------------
@@ -142,7 +160,13 @@ void CVertexBufferVk::Flush()
 //-----------------------------------------------------------------------------
 // Returns the VkBuffer
 //-----------------------------------------------------------------------------
-VkBuffer *CVertexBufferVk::GetVkBuffer() { return m_pVertexBuffer; }
+VkBuffer *CVertexBufferVk::GetVkBuffer()
+{
+    if (m_ArenaRange.IsValid())
+        return g_pShaderDevice->GetGeometryArena().GetVkBuffer(m_ArenaRange);
+
+    return m_pVertexBuffer;
+}
 
 //-----------------------------------------------------------------------------
 // Casts a dynamic buffer to be a particular vertex type
@@ -155,8 +179,8 @@ void CVertexBufferVk::BeginCastBuffer(VertexFormat_t format)
         return;
 
     m_VertexFormat = format;
-    int nVertexSize = VertexSize();
-    m_nVertexCount = m_nBufferSize / nVertexSize;
+    m_nVertexSize = g_pMeshMgr->VertexFormatSize(format);
+    m_nVertexCount = m_nBufferSize / m_nVertexSize;
 
     // snap current position up to the next position based on expected size
     // so append can safely guarantee nooverwrite regardless of a format growth or shrinkage
@@ -197,7 +221,7 @@ bool CVertexBufferVk::Lock(int nMaxVertexCount, bool bAppend, VertexDesc_t &desc
     }
 
     m_nFirstUnwrittenOffset = 0;
-    m_pVertexMemory.resize(nMaxVertexCount);
+    m_pVertexMemory.resize(nMaxVertexCount * VertexSize());
 
     m_bIsLocked = true;
     return true;
@@ -211,36 +235,41 @@ void CVertexBufferVk::Unlock(int nWrittenVertexCount, VertexDesc_t &desc)
 
     if (nWrittenVertexCount > 0)
     {
-        m_Vertices.resize(m_nFirstUnwrittenOffset + nWrittenVertexCount);
+        // The vertices were written in the format's own layout, they go up as they are
+        Assert(nWrittenVertexCount * VertexSize() <= (int)m_pVertexMemory.size());
+        VkDeviceSize writeOffset = (VkDeviceSize)m_nFirstUnwrittenOffset * VertexSize();
+        VkDeviceSize writeSize = (VkDeviceSize)nWrittenVertexCount * VertexSize();
 
-        // Create vertices
-        for (int i = 0; i < nWrittenVertexCount; i++)
-        {
-            Vertex vert;
-            vert.position = VertexPosition(desc, i);
-            vert.normal = VertexNormal(desc, i);
-            vert.color = VertexColor(desc, i);
-            m_Vertices[i + m_nFirstUnwrittenOffset] = vert;
-        }
-
-        m_nFirstUnwrittenOffset += nWrittenVertexCount;
-
-        VkDeviceSize bufferSize = m_Vertices.size() * VertexSize();
+        VkDeviceSize bufferSize = writeOffset + writeSize;
         if (bufferSize > m_nBufferSize)
         {
             Warning("Writing more vertices than reserved buffer size! This probably shouldn't happen.\n");
             Free();
-            m_nVertexCount = m_Vertices.size();
+            m_nVertexCount = m_nFirstUnwrittenOffset + nWrittenVertexCount;
             m_nBufferSize = bufferSize;
             Allocate();
         }
 
+        m_nFirstUnwrittenOffset += nWrittenVertexCount;
+
         // Copy vertex data to the buffer
-        void *data;
-        vkCheck(vkMapMemory(g_pShaderDevice->GetVkDevice(), *m_pVertexBufferMemory, 0, bufferSize, 0, &data),
-                "failed to map vertex buffer memory!");
-        memcpy(data, m_Vertices.data(), bufferSize);
-        vkUnmapMemory(g_pShaderDevice->GetVkDevice(), *m_pVertexBufferMemory);
+        if (m_ArenaRange.IsValid())
+        {
+            if (m_bArenaRangeWritten)
+            {
+                g_pShaderDevice->GetGeometryArena().Reallocate(m_ArenaRange);
+            }
+            m_bArenaRangeWritten = true;
+            memcpy(g_pShaderDevice->GetGeometryArena().GetMemory(m_ArenaRange) + writeOffset, m_pVertexMemory.data(), writeSize);
+        }
+        else
+        {
+            void *data;
+            vkCheck(vkMapMemory(g_pShaderDevice->GetVkDevice(), *m_pVertexBufferMemory, writeOffset, writeSize, 0, &data),
+                    "failed to map vertex buffer memory!");
+            memcpy(data, m_pVertexMemory.data(), writeSize);
+            vkUnmapMemory(g_pShaderDevice->GetVkDevice(), *m_pVertexBufferMemory);
+        }
     }
 
     m_bIsLocked = false;
@@ -7,6 +7,7 @@
 #pragma once
 #endif
 
+#include "geometryarenavk.h"
 #include "localvktypes.h"
 #include "materialsystem/imesh.h"
 #include "shaderapi/IShaderDevice.h"
@@ -23,7 +24,7 @@ enum
     MAX_QUAD_INDICES = 16384,
 };
 
-class CVertexBufferVk : public IVertexBuffer
+class CVertexBufferVk : public IVertexBuffer, public IGeometryArenaClientVk
 {
     typedef IVertexBuffer BaseClass;
 
@@ -49,14 +50,18 @@ class CVertexBufferVk : public IVertexBuffer
     bool Allocate();
     void Free();
 
-    // Returns the vertex size
-    static int VertexSize() { return sizeof(Vertex); }
+    // Returns the vertex size, vertices are stored the way ComputeVertexDesc lays out the format
+    int VertexSize() const { return m_nVertexSize; }
 
     // Only used by dynamic buffers, indicates the next lock should perform a discard.
     void Flush();
 
-    // Returns the VkBuffer
+    // Returns the VkBuffer, and where the vertices start in it
     VkBuffer *GetVkBuffer();
+    VkDeviceSize GetBufferOffset() const { return m_ArenaRange.m_nOffset; }
+
+    // Draws bind arena buffers in place instead of copying them
+    bool IsInArena() const { return m_ArenaRange.IsValid(); }
 
     // Used to measure how much static buffer memory is touched each frame
     void HandlePerFrameTextureStats(int nFrame);
@@ -77,14 +82,22 @@ class CVertexBufferVk : public IVertexBuffer
 
     unsigned char *GetVertexMemory() { return (unsigned char *)m_pVertexMemory.data(); }
 
+    // What the last lock wrote, starting at vertex 0 since locks never append
+    const unsigned char *GetVertexMemory() const { return m_pVertexMemory.data(); }
+    int GetVertexMemorySize() const { return (int)m_pVertexMemory.size(); }
+
     VkDeviceSize GetBufferSize() { return m_nBufferSize; }
 
+    // Methods of IGeometryArenaClientVk
+    virtual void OnGeometryRangeMoved(const GeometryRangeVk_t &range) { m_ArenaRange = range; }
+
   protected:
     VkBuffer *m_pVertexBuffer;
     VertexFormat_t m_VertexFormat;
     VkDeviceMemory *m_pVertexBufferMemory;
-    std::vector<Vertex> m_Vertices;
-    std::vector<ModelVertexVk_t> m_pVertexMemory;
+    GeometryRangeVk_t m_ArenaRange; // Small static buffers share a block of CGeometryArenaVk instead
+    bool m_bArenaRangeWritten;      // Later unlocks move to a new range, draws in flight read this one
+    std::vector<unsigned char> m_pVertexMemory;
     int m_nVertexCount;
     int m_nVertexSize;
     VkDeviceSize m_nBufferSize;
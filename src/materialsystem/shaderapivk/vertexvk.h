@@ -7,53 +7,110 @@
 #pragma once
 #endif
 
-#include <array>
-#include <glm/vec3.hpp>
-#include <glm/vec4.hpp>
 #include <vulkan/vulkan_core.h>
+#include "materialsystem/imesh.h"
 
-struct Vertex
+//-----------------------------------------------------------------------------
+// Vertex input bindings, a binding's number is its stream
+//-----------------------------------------------------------------------------
+enum VertexStreamVk_t
 {
-    glm::vec<3, float> position;
-    glm::vec<3, float> normal;
-    glm::vec<4, uint8_t> color;
+    VERTEX_STREAM_BASE = 0,
+    VERTEX_STREAM_COLOR,    // Color mesh, replaces the color of the base stream
+    VERTEX_STREAM_FLEX,     // Flex mesh, position and normal deltas
+    VERTEX_STREAM_DEFAULTS, // Zero stride, feeds the inputs every shader has but the streams don't provide
+    VERTEX_STREAM_INSTANCE, // Per instance, an InstanceDataVk_t for every instance of a draw
+    VERTEX_STREAM_COUNT,
+};
 
-    static VkVertexInputBindingDescription GetBindingDescription()
-    {
-        VkVertexInputBindingDescription bindingDescription{};
+// Secondary streams a vertex declaration reads from
+enum VertexDeclFlags_t
+{
+    VERTEX_DECL_COLOR_STREAM = 0x1,
+    VERTEX_DECL_FLEX_STREAM = 0x2,
+};
+
+//-----------------------------------------------------------------------------
+// Shader input locations of the vertex elements
+// More than the 16 locations Vulkan guarantees, pipelines using locations past maxVertexInputAttributes aren't created.
+// The instance rows come before the texcoords so the fallback shader always fits.
+//-----------------------------------------------------------------------------
+enum VertexLocationVk_t
+{
+    VERTEX_LOCATION_POSITION = 0,
+    VERTEX_LOCATION_NORMAL,
+    VERTEX_LOCATION_COLOR,
+    VERTEX_LOCATION_FLEX_POSITION,
+    VERTEX_LOCATION_FLEX_NORMAL,
+    VERTEX_LOCATION_BONE_WEIGHTS,
+    VERTEX_LOCATION_BONE_INDEX,
+    VERTEX_LOCATION_SPECULAR,
+    VERTEX_LOCATION_TANGENT_S,
+    VERTEX_LOCATION_TANGENT_T,
+    VERTEX_LOCATION_USERDATA,
+    VERTEX_LOCATION_WRINKLE,
+    VERTEX_LOCATION_INSTANCE_MODEL, // Three rows of the model matrix
+    VERTEX_LOCATION_TEXCOORD0 = VERTEX_LOCATION_INSTANCE_MODEL + 3,
+    VERTEX_LOCATION_COUNT = VERTEX_LOCATION_TEXCOORD0 + VERTEX_MAX_TEXTURE_COORDINATES,
+};
 
-        bindingDescription.binding = 0;
-        bindingDescription.stride = sizeof(Vertex);
-        // VK_TODO: should we use VK_VERTEX_INPUT_RATE_INSTANCE ?
-        // do we use instancing?
-        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+// The fallback shader reads nothing past the instance rows
+COMPILE_TIME_ASSERT(VERTEX_LOCATION_TEXCOORD0 <= 16);
 
-        return bindingDescription;
-    }
+// Elements of VERTEX_COMPRESSION_ON, fetched as unnormalized floats like D3DDECLTYPE_UBYTE4 and D3DDECLTYPE_SHORT2.
+// They stay at the normal and bone weight locations, the vertex shaders unpack them the same as on dx9.
+static const VkFormat VERTEX_PACKED_NORMAL_FORMAT = VK_FORMAT_R8G8B8A8_USCALED;      // PackNormal_UBYTE4 normal in xy, tangent in zw
+static const VkFormat VERTEX_PACKED_BONE_WEIGHTS_FORMAT = VK_FORMAT_R16G16_SSCALED; // Weights scaled to 32768, minus one
 
-    // VK_TODO: probably should take in IMAGE_FORMAT and return format based on that,
-    // use imgfmt2vkfmt in vulkanimpl.h.
-    static std::array<VkVertexInputAttributeDescription, 3> GetAttributeDescriptions()
-    {
-        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
+// Layout of the defaults stream, see CViewportVk::CreateDefaultVertexBuffer
+struct VertexDefaultsVk_t
+{
+    float m_Position[3];
+    float m_Normal[3];
+    unsigned char m_Color[4];
+};
 
-        attributeDescriptions[0].binding = 0;
-        attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, position);
+// Layout of the instance stream, the model matrix as a matrix3x4_t.
+// Shaders that read it instead of the uniform buffer's model matrix can have repeated draws collapsed into instances.
+struct InstanceDataVk_t
+{
+    float m_Model[3][4];
+};
+
+//-----------------------------------------------------------------------------
+// The attributes of one VertexFormat_t, tightly packed like ComputeVertexDesc lays them out.
+// Bindings are filled in when the layouts of the streams are combined into a declaration.
+//-----------------------------------------------------------------------------
+struct VertexLayoutVk_t
+{
+    uint32_t m_nStride;
+    uint32_t m_nAttributeCount;
+    VkVertexInputAttributeDescription m_Attributes[VERTEX_LOCATION_COUNT];
+};
 
-        attributeDescriptions[1].binding = 0;
-        attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, normal);
+struct VertexDeclVk_t
+{
+    uint32_t m_nBindingCount;
+    uint32_t m_nAttributeCount;
+    VkVertexInputBindingDescription m_Bindings[VERTEX_STREAM_COUNT];
+    VkVertexInputAttributeDescription m_Attributes[VERTEX_LOCATION_COUNT];
+};
 
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_B8G8R8A8_UNORM;
-        attributeDescriptions[2].offset = offsetof(Vertex, color);
+// Vertex formats of the streams a draw reads from, VERTEX_FORMAT_UNKNOWN for unused streams
+struct VertexDeclKeyVk_t
+{
+    VertexFormat_t m_Formats[VERTEX_STREAM_DEFAULTS];
 
-        return attributeDescriptions;
+    bool operator==(const VertexDeclKeyVk_t &other) const
+    {
+        for (int i = 0; i < VERTEX_STREAM_DEFAULTS; i++)
+        {
+            if (m_Formats[i] != other.m_Formats[i])
+                return false;
+        }
+        return true;
     }
+    bool operator!=(const VertexDeclKeyVk_t &other) const { return !(*this == other); }
 };
 
-#endif // VERTEXVK_H
\ No newline at end of file
+#endif // VERTEXVK_H
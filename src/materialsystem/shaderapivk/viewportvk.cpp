@@ -2,7 +2,9 @@
 #include <chrono>
 #include <fstream>
 #include "buffervkutil.h"
+#include "meshmgrvk.h"
 #include "shaderapivk.h"
+#include "shadermanagervk.h"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -18,7 +20,30 @@
 const int MAX_FRAMES_IN_FLIGHT = 2;
 const uint64_t MAX_MESHES = 1024; // VK_TODO: find a way to remove these
 const uint64_t MAX_VERTICES = 65535 * 64;
-const uint64_t MAX_INDICES = 65535 * 64;
+const uint64_t MAX_INDICES = 65535 * 64; // 32-bit, 16-bit meshes share the same bytes
+const uint64_t VERTEX_BUFFER_BYTES = MAX_VERTICES * 32;
+const VkDeviceSize VERTEX_STREAM_ALIGNMENT = 16;
+const VkDeviceSize SHADER_CONSTANT_BUFFER_SIZE = 4 * 1024 * 1024;
+const VkDeviceSize BONE_PALETTE_BUFFER_SIZE = 2 * 1024 * 1024;
+const VkDeviceSize BONE_PALETTE_RANGE = NUM_MODEL_TRANSFORMS * sizeof(matrix3x4_t);
+const uint64_t MAX_INSTANCES = 65536;               // Initial size of the instance buffers
+const size_t MAX_DYNAMIC_INSTANCE_SIZE = 64 * 1024; // Bigger dynamic draws aren't compared for repeats
+
+// Viewport whose constant blocks and bone palette match what was consumed from the shader API last
+static CViewportVk *s_pConstantViewport = nullptr;
+
+// Descriptor range of a stage's register file
+static VkDeviceSize GetShaderConstantRange(ShaderConstantStage_t stage)
+{
+    int nConstants = stage == SHADER_CONSTANTS_VERTEX ? g_pHardwareConfig->Caps().m_NumVertexShaderConstants
+                                                      : g_pHardwareConfig->Caps().m_NumPixelShaderConstants;
+    return nConstants * sizeof(Vector4D);
+}
+
+static VkDeviceSize GetMaxShaderConstantRange()
+{
+    return MAX(GetShaderConstantRange(SHADER_CONSTANTS_VERTEX), GetShaderConstantRange(SHADER_CONSTANTS_PIXEL));
+}
 
 CViewportVk::CViewportVk()
 {
@@ -26,11 +51,9 @@ CViewportVk::CViewportVk()
     m_Swapchain = VK_NULL_HANDLE;
     m_VertShaderModule = VK_NULL_HANDLE;
     m_FragShaderModule = VK_NULL_HANDLE;
-    m_RenderPass = VK_NULL_HANDLE;
     m_DescriptorSetLayout = VK_NULL_HANDLE;
     m_DescriptorPool = VK_NULL_HANDLE;
     m_PipelineLayout = VK_NULL_HANDLE;
-    m_GraphicsPipeline = VK_NULL_HANDLE;
     m_CommandPool = VK_NULL_HANDLE;
 
     m_bIsMinimized = false;
@@ -44,12 +67,34 @@ CViewportVk::CViewportVk()
 
     m_pVertexBuffer = nullptr;
     m_pIndexBuffer = nullptr;
+    m_pDefaultVertexBuffer = nullptr;
     m_ViewHWnd = nullptr;
 
+    m_ColorTarget = SHADER_RENDERTARGET_BACKBUFFER;
+    m_DepthTarget = SHADER_RENDERTARGET_DEPTHBUFFER;
+
+    m_nShaderConstantSize = 0;
+    for (int i = 0; i < SHADER_CONSTANTS_STAGE_COUNT; i++)
+    {
+        m_nConstantBlock[i] = -1;
+        m_nConstantDeltaFirst[i] = INT_MAX;
+        m_nConstantDeltaLast[i] = -1;
+    }
+
+    m_nBonePaletteSize = 0;
+    m_nBonePalette = -1;
+    m_nLastDynamicMesh = -1;
+
     _backBufferFormat = IMAGE_FORMAT_UNKNOWN;
 }
 
-CViewportVk::~CViewportVk() {}
+CViewportVk::~CViewportVk()
+{
+    if (s_pConstantViewport == this)
+    {
+        s_pConstantViewport = nullptr;
+    }
+}
 
 // Get details about swapchain support
 SwapchainSupportDetails CViewportVk::QuerySwapchainSupport(VkPhysicalDevice device)
@@ -131,14 +176,14 @@ void CViewportVk::InitDevice(void *hWnd)
     CreateVkSurface();
     CreateSwapchain();
     CreateImageViews();
-    CreateRenderPass();
+    CreateDepthBuffer();
     CreateDescriptorSetlayout();
-    CreateGraphicsPipeline();
-    CreateFramebuffers();
+    CreatePipelineLayout();
     CreateCommandPool();
-    m_pVertexBuffer = (CVertexBufferVk *)g_pShaderDevice->CreateVertexBuffer(SHADER_BUFFER_TYPE_STATIC, VERTEX_FORMAT_UNKNOWN, MAX_VERTICES,
-                                                                             "CVertexBufferVk", true);
-    m_pIndexBuffer = (CIndexBufferVk *)g_pShaderDevice->CreateIndexBuffer(SHADER_BUFFER_TYPE_STATIC, MATERIAL_INDEX_FORMAT_16BIT,
+    m_pVertexBuffer = (CVertexBufferVk *)g_pShaderDevice->CreateVertexBuffer(SHADER_BUFFER_TYPE_STATIC, VERTEX_FORMAT_UNKNOWN,
+                                                                             VERTEX_BUFFER_BYTES, "CVertexBufferVk", true);
+    CreateDefaultVertexBuffer();
+    m_pIndexBuffer = (CIndexBufferVk *)g_pShaderDevice->CreateIndexBuffer(SHADER_BUFFER_TYPE_STATIC, MATERIAL_INDEX_FORMAT_32BIT,
                                                                           MAX_INDICES, "CIndexBufferVk", true);
     CreateUniformBuffers();
     CreateDescriptorPool();
@@ -222,9 +267,8 @@ void CViewportVk::RecreateSwapchain()
 
     CreateSwapchain();
     CreateImageViews();
-    CreateRenderPass();
-    CreateGraphicsPipeline();
-    CreateFramebuffers();
+    CreateDepthBuffer();
+    CreatePipelineLayout();
     CreateUniformBuffers();
     CreateDescriptorPool();
     CreateDescriptorSets();
@@ -256,62 +300,42 @@ void CViewportVk::CreateImageViews()
     }
 }
 
-void CViewportVk::CreateRenderPass()
+void CViewportVk::CreateDepthBuffer()
 {
-    VkAttachmentDescription colorAttachment = {};
-    colorAttachment.format = m_SwapchainImageFormat;
-    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-    VkAttachmentReference colorAttachmentRef = {};
-    colorAttachmentRef.attachment = 0;
-    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkSubpassDescription subpass = {};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef;
-
-    VkRenderPassCreateInfo renderPassInfo = {};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
-    renderPassInfo.subpassCount = 1;
-    renderPassInfo.pSubpasses = &subpass;
-
-    // Subpass dependecies
-    VkSubpassDependency dependency = {};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
-
-    vkCheck(vkCreateRenderPass(g_pShaderDevice->GetVkDevice(), &renderPassInfo, g_pAllocCallbacks, &m_RenderPass),
-            "failed to create render pass");
+    // Nothing reads the depth buffer after the frame, let it live in tile memory where possible
+    m_DepthBuffer.InitDepth(m_SwapchainExtent.width, m_SwapchainExtent.height, true, "_rt_ViewportDepth");
 }
 
 void CViewportVk::CreateDescriptorSetlayout()
 {
-    VkDescriptorSetLayoutBinding uboLayoutBinding{};
-    uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-    uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-    uboLayoutBinding.pImmutableSamplers = nullptr;
+    // Binding 0 is the per-draw matrices, 1 and 2 the vertex and pixel shader constants, 3 the bone palette.
+    // The pick fragment shader reads the selection id from binding 0.
+    VkDescriptorSetLayoutBinding uboLayoutBindings[2 + SHADER_CONSTANTS_STAGE_COUNT] = {};
+    uboLayoutBindings[0].binding = 0;
+    uboLayoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    uboLayoutBindings[0].descriptorCount = 1;
+    uboLayoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    if (g_pShaderDevice->SupportsGeometryShaders())
+    {
+        uboLayoutBindings[0].stageFlags |= VK_SHADER_STAGE_GEOMETRY_BIT;
+    }
+    uboLayoutBindings[0].pImmutableSamplers = nullptr;
+    for (int i = 0; i < SHADER_CONSTANTS_STAGE_COUNT; i++)
+    {
+        uboLayoutBindings[1 + i].binding = 1 + i;
+        uboLayoutBindings[1 + i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        uboLayoutBindings[1 + i].descriptorCount = 1;
+        uboLayoutBindings[1 + i].stageFlags = i == SHADER_CONSTANTS_VERTEX ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT;
+    }
+    uboLayoutBindings[1 + SHADER_CONSTANTS_STAGE_COUNT].binding = 1 + SHADER_CONSTANTS_STAGE_COUNT;
+    uboLayoutBindings[1 + SHADER_CONSTANTS_STAGE_COUNT].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    uboLayoutBindings[1 + SHADER_CONSTANTS_STAGE_COUNT].descriptorCount = 1;
+    uboLayoutBindings[1 + SHADER_CONSTANTS_STAGE_COUNT].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 1;
-    layoutInfo.pBindings = &uboLayoutBinding;
+    layoutInfo.bindingCount = ARRAYSIZE(uboLayoutBindings);
+    layoutInfo.pBindings = uboLayoutBindings;
 
     vkCheck(vkCreateDescriptorSetLayout(g_pShaderDevice->GetVkDevice(), &layoutInfo, g_pAllocCallbacks, &m_DescriptorSetLayout),
             "failed to create descriptor set layout");
@@ -319,50 +343,69 @@ void CViewportVk::CreateDescriptorSetlayout()
 
 void CViewportVk::CreateDescriptorSets()
 {
-    std::vector<VkDescriptorSetLayout> layouts(m_SwapchainImages.size(), m_DescriptorSetLayout);
+    std::vector<VkDescriptorSetLayout> layouts(GetBufferSetCount(), m_DescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = m_DescriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(m_SwapchainImages.size());
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(GetBufferSetCount());
     allocInfo.pSetLayouts = layouts.data();
 
-    m_DescriptorSets.resize(m_SwapchainImages.size());
+    m_DescriptorSets.resize(GetBufferSetCount());
     vkCheck(vkAllocateDescriptorSets(g_pShaderDevice->GetVkDevice(), &allocInfo, m_DescriptorSets.data()),
             "failed to allocate descriptor sets");
 
-    for (size_t i = 0; i < m_SwapchainImages.size(); i++)
+    for (size_t i = 0; i < GetBufferSetCount(); i++)
     {
-        VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = m_UniformBuffers[i];
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformBufferObject);
+        WriteDescriptorSet(i);
+    }
+}
 
-        VkWriteDescriptorSet descriptorWrite{};
-        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrite.dstSet = m_DescriptorSets[i];
-        descriptorWrite.dstBinding = 0;
-        descriptorWrite.dstArrayElement = 0;
-        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-        descriptorWrite.descriptorCount = 1;
-        descriptorWrite.pBufferInfo = &bufferInfo;
-        descriptorWrite.pImageInfo = nullptr;
-        descriptorWrite.pTexelBufferView = nullptr;
+void CViewportVk::WriteDescriptorSet(size_t i)
+{
+    VkDescriptorBufferInfo bufferInfos[2 + SHADER_CONSTANTS_STAGE_COUNT] = {};
+    bufferInfos[0].buffer = m_UniformBuffers[i];
+    bufferInfos[0].offset = 0;
+    bufferInfos[0].range = sizeof(UniformBufferObject);
+    for (int j = 0; j < SHADER_CONSTANTS_STAGE_COUNT; j++)
+    {
+        bufferInfos[1 + j].buffer = m_ConstantBuffers[i];
+        bufferInfos[1 + j].offset = 0;
+        bufferInfos[1 + j].range = GetShaderConstantRange((ShaderConstantStage_t)j);
+    }
+    bufferInfos[1 + SHADER_CONSTANTS_STAGE_COUNT].buffer = m_BoneBuffers[i];
+    bufferInfos[1 + SHADER_CONSTANTS_STAGE_COUNT].offset = 0;
+    bufferInfos[1 + SHADER_CONSTANTS_STAGE_COUNT].range = BONE_PALETTE_RANGE;
 
-        vkUpdateDescriptorSets(g_pShaderDevice->GetVkDevice(), 1, &descriptorWrite, 0, nullptr);
+    VkWriteDescriptorSet descriptorWrites[ARRAYSIZE(bufferInfos)] = {};
+    for (int j = 0; j < ARRAYSIZE(bufferInfos); j++)
+    {
+        descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[j].dstSet = m_DescriptorSets[i];
+        descriptorWrites[j].dstBinding = j;
+        descriptorWrites[j].dstArrayElement = 0;
+        bool bBones = j == 1 + SHADER_CONSTANTS_STAGE_COUNT;
+        descriptorWrites[j].descriptorType =
+            bBones ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        descriptorWrites[j].descriptorCount = 1;
+        descriptorWrites[j].pBufferInfo = &bufferInfos[j];
     }
+
+    vkUpdateDescriptorSets(g_pShaderDevice->GetVkDevice(), ARRAYSIZE(descriptorWrites), descriptorWrites, 0, nullptr);
 }
 
 void CViewportVk::CreateDescriptorPool()
 {
-    VkDescriptorPoolSize poolSize{};
-    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-    poolSize.descriptorCount = static_cast<uint32_t>(m_SwapchainImages.size());
+    VkDescriptorPoolSize poolSizes[2] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = static_cast<uint32_t>(GetBufferSetCount()) * (1 + SHADER_CONSTANTS_STAGE_COUNT);
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    poolSizes[1].descriptorCount = static_cast<uint32_t>(GetBufferSetCount());
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 1;
-    poolInfo.pPoolSizes = &poolSize;
-    poolInfo.maxSets = static_cast<uint32_t>(m_SwapchainImages.size());
+    poolInfo.poolSizeCount = ARRAYSIZE(poolSizes);
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = static_cast<uint32_t>(GetBufferSetCount());
     poolInfo.flags = 0;
 
     vkCheck(vkCreateDescriptorPool(g_pShaderDevice->GetVkDevice(), &poolInfo, g_pAllocCallbacks, &m_DescriptorPool),
@@ -388,41 +431,136 @@ static std::vector<char> ReadFile(const std::string &filename)
     return buffer;
 }
 
-void CViewportVk::CreateGraphicsPipeline()
+void CViewportVk::CreatePipelineLayout()
+{
+    // Set 0 is the per-draw UBOs, set 1 every texture when bindless.
+    // Push constants are the bindless texture indices followed by the pushed shader constants.
+    VkDescriptorSetLayout setLayouts[2] = {m_DescriptorSetLayout, VK_NULL_HANDLE};
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(BindlessPushConstants_t) + sizeof(ShaderConstantPush_t);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    if (g_pShaderDevice->SupportsBindless())
+    {
+        setLayouts[1] = g_pShaderDevice->GetBindlessTextures().GetDescriptorSetLayout();
+        pipelineLayoutInfo.setLayoutCount = 2;
+    }
+
+    vkCheck(vkCreatePipelineLayout(g_pShaderDevice->GetVkDevice(), &pipelineLayoutInfo, g_pAllocCallbacks, &m_PipelineLayout),
+            "failed to create pipeline layout");
+}
+
+VkPipeline CViewportVk::CreateGraphicsPipeline(VkRenderPass renderPass, bool bColor, bool bDepth, bool bPick,
+                                               const ShaderStageState_t &vertexShader, const ShaderStageState_t &pixelShader,
+                                               VkShaderModule geometryShader, const VertexDeclKeyVk_t &vertexDecl)
 {
-    // Shader modules
-    auto vertShaderCode = ReadFile("shaders/vert.spv");
-    auto fragShaderCode = ReadFile("shaders/frag.spv");
+    // Shader modules, a half-bound pair falls back too since the stage interfaces wouldn't match.
+    // The pick fragment shader has no inputs, so picking keeps any bound vertex shader.
+    bool bFallback = vertexShader.m_Module == VK_NULL_HANDLE || (!bPick && pixelShader.m_Module == VK_NULL_HANDLE);
+    if (bFallback && m_VertShaderModule == VK_NULL_HANDLE)
+    {
+        auto vertShaderCode = ReadFile("shaders/vert.spv");
+        auto fragShaderCode = ReadFile("shaders/frag.spv");
 
-    m_VertShaderModule =
-        g_pShaderDevice->CreateShaderModule(reinterpret_cast<const uint32_t *>(vertShaderCode.data()), vertShaderCode.size());
-    m_FragShaderModule =
-        g_pShaderDevice->CreateShaderModule(reinterpret_cast<const uint32_t *>(fragShaderCode.data()), fragShaderCode.size());
+        m_VertShaderModule =
+            g_pShaderDevice->CreateShaderModule(reinterpret_cast<const uint32_t *>(vertShaderCode.data()), vertShaderCode.size());
+        m_FragShaderModule =
+            g_pShaderDevice->CreateShaderModule(reinterpret_cast<const uint32_t *>(fragShaderCode.data()), fragShaderCode.size());
+    }
+
+    // Combo indices of specialized shaders, ignored by modules that don't declare the constants
+    VkSpecializationMapEntry specEntries[SHADER_SPEC_CONSTANT_COUNT];
+    for (int i = 0; i < SHADER_SPEC_CONSTANT_COUNT; i++)
+    {
+        specEntries[i].constantID = i;
+        specEntries[i].offset = i * sizeof(int32_t);
+        specEntries[i].size = sizeof(int32_t);
+    }
+
+    VkSpecializationInfo vertSpecInfo = {};
+    vertSpecInfo.mapEntryCount = SHADER_SPEC_CONSTANT_COUNT;
+    vertSpecInfo.pMapEntries = specEntries;
+    vertSpecInfo.dataSize = sizeof(vertexShader.m_nCombos);
+    vertSpecInfo.pData = vertexShader.m_nCombos;
+
+    VkSpecializationInfo fragSpecInfo = vertSpecInfo;
+    fragSpecInfo.pData = pixelShader.m_nCombos;
 
     // Shader stages
     VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
     vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = m_VertShaderModule;
+    vertShaderStageInfo.module = bFallback ? m_VertShaderModule : vertexShader.m_Module;
     vertShaderStageInfo.pName = "main";
+    vertShaderStageInfo.pSpecializationInfo = bFallback ? nullptr : &vertSpecInfo;
 
     VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
     fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = m_FragShaderModule;
+    fragShaderStageInfo.module = bFallback ? m_FragShaderModule : pixelShader.m_Module;
     fragShaderStageInfo.pName = "main";
+    fragShaderStageInfo.pSpecializationInfo = bFallback ? nullptr : &fragSpecInfo;
+    if (bPick)
+    {
+        // Only writes the draw's selection id
+        fragShaderStageInfo.module = g_pShaderDevice->GetPickBuffer().GetFragmentShader();
+        fragShaderStageInfo.pSpecializationInfo = nullptr;
+    }
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+    // The fallback vertex shader's outputs wouldn't match what a geometry shader reads
+    VkPipelineShaderStageCreateInfo geomShaderStageInfo = {};
+    geomShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    geomShaderStageInfo.stage = VK_SHADER_STAGE_GEOMETRY_BIT;
+    geomShaderStageInfo.module = geometryShader;
+    geomShaderStageInfo.pName = "main";
+    bool bGeometry = geometryShader != VK_NULL_HANDLE && !bFallback;
 
-    // Vertex input
-    auto bindingDescription = Vertex::GetBindingDescription();
-    auto attributeDescriptions = Vertex::GetAttributeDescriptions();
+    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo, geomShaderStageInfo};
+
+    // Vertex input, the fallback shader reads the instance stream
+    VertexDeclVk_t decl;
+    g_pMeshMgr->GetVertexDecl(vertexDecl, bFallback || vertexShader.m_bInstanced, decl);
+
+    // Elements the fallback shader doesn't read are dropped, so it fits the 16 locations every device has
+    if (bFallback)
+    {
+        uint32_t nAttributes = 0;
+        for (uint32_t i = 0; i < decl.m_nAttributeCount; i++)
+        {
+            uint32_t location = decl.m_Attributes[i].location;
+            if (location <= VERTEX_LOCATION_COLOR || (location >= VERTEX_LOCATION_INSTANCE_MODEL && location < VERTEX_LOCATION_TEXCOORD0))
+            {
+                decl.m_Attributes[nAttributes++] = decl.m_Attributes[i];
+            }
+        }
+        decl.m_nAttributeCount = nAttributes;
+    }
+
+    // Locations count against the limit as much as the number of attributes does
+    uint32_t nMaxAttributes = g_pShaderDevice->GetMaxVertexInputAttributes();
+    bool bAttributesFit = decl.m_nAttributeCount <= nMaxAttributes;
+    for (uint32_t i = 0; i < decl.m_nAttributeCount; i++)
+    {
+        bAttributesFit &= decl.m_Attributes[i].location < nMaxAttributes;
+    }
+    if (!bAttributesFit)
+    {
+        Warning("CViewportVk: vertex input doesn't fit the device's %u attributes, mesh will not be rendered\n", nMaxAttributes);
+        return VK_NULL_HANDLE;
+    }
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+    vertexInputInfo.vertexBindingDescriptionCount = decl.m_nBindingCount;
+    vertexInputInfo.pVertexBindingDescriptions = decl.m_Bindings;
+    vertexInputInfo.vertexAttributeDescriptionCount = decl.m_nAttributeCount;
+    vertexInputInfo.pVertexAttributeDescriptions = decl.m_Attributes;
 
     // Input assembly
     VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
@@ -430,33 +568,21 @@ void CViewportVk::CreateGraphicsPipeline()
     inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    // Viewport and scissors
-    VkViewport viewport = {};
-    viewport.width = (float)m_SwapchainExtent.width;
-    viewport.x = 0.0f;
-    // Use bottom left as 0,0
-    viewport.height = -(float)m_SwapchainExtent.height;
-    viewport.y = (float)m_SwapchainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    VkRect2D scissor = {};
-    scissor.offset = {0, 0};
-    scissor.extent = m_SwapchainExtent;
-
+    // Viewport and scissors, set per render pass since render targets differ in size
     VkPipelineViewportStateCreateInfo viewportState = {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
+    viewportState.pViewports = nullptr;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+    viewportState.pScissors = nullptr;
 
     // Rasterizer
     VkPipelineRasterizationStateCreateInfo rasterizer = {};
     rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
     rasterizer.depthClampEnable = VK_FALSE;
     rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_LINE;
+    // Picking has to cover every pixel of the triangles, like the CPU selection test
+    rasterizer.polygonMode = bPick ? VK_POLYGON_MODE_FILL : VK_POLYGON_MODE_LINE;
     rasterizer.lineWidth = 1.0f;
     rasterizer.cullMode = g_pShaderAPI->GetCullMode();
     rasterizer.frontFace = g_pShaderAPI->GetFrontFace();
@@ -476,7 +602,14 @@ void CViewportVk::CreateGraphicsPipeline()
     multisampling.alphaToOneEnable = VK_FALSE;
 
     // Depth and stencil testing
-    VkPipelineDepthStencilStateCreateInfo *depthstencil = nullptr;
+    // VK_TODO: take these from the shadow state
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
 
     // Color blending
     VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
@@ -489,12 +622,18 @@ void CViewportVk::CreateGraphicsPipeline()
     colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
     colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
     colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    if (bPick)
+    {
+        // Integer formats can't blend
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
+    }
 
     VkPipelineColorBlendStateCreateInfo colorBlending = {};
     colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
     colorBlending.logicOpEnable = VK_FALSE;
     colorBlending.logicOp = VK_LOGIC_OP_COPY;
-    colorBlending.attachmentCount = 1;
+    colorBlending.attachmentCount = bColor ? 1 : 0;
     colorBlending.pAttachments = &colorBlendAttachment;
     colorBlending.blendConstants[0] = 0.0f;
     colorBlending.blendConstants[1] = 0.0f;
@@ -502,70 +641,90 @@ void CViewportVk::CreateGraphicsPipeline()
     colorBlending.blendConstants[3] = 0.0f;
 
     // Dynamic states
-    VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT};
+    VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT, VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
     VkPipelineDynamicStateCreateInfo dynamicState = {};
     dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamicState.dynamicStateCount = 1;
+    dynamicState.dynamicStateCount = ARRAYSIZE(dynamicStates);
     dynamicState.pDynamicStates = dynamicStates;
 
-    // Pipeline layout
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &m_DescriptorSetLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-    pipelineLayoutInfo.pPushConstantRanges = nullptr;
-
-    vkCheck(vkCreatePipelineLayout(g_pShaderDevice->GetVkDevice(), &pipelineLayoutInfo, g_pAllocCallbacks, &m_PipelineLayout),
-            "failed to create pipeline layout");
-
     // Pipeline
     VkGraphicsPipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
+    pipelineInfo.stageCount = bGeometry ? 3 : 2;
     pipelineInfo.pStages = shaderStages;
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssembly;
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = depthstencil;
+    pipelineInfo.pDepthStencilState = bDepth ? &depthStencil : nullptr;
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = m_PipelineLayout;
-    pipelineInfo.renderPass = m_RenderPass;
+    pipelineInfo.renderPass = renderPass;
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineInfo.basePipelineIndex = -1;
 
-    vkCheck(
-        vkCreateGraphicsPipelines(g_pShaderDevice->GetVkDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, g_pAllocCallbacks, &m_GraphicsPipeline),
-        "failed to create graphics pipeline");
+    VkPipeline pipeline;
+    vkCheck(vkCreateGraphicsPipelines(g_pShaderDevice->GetVkDevice(), g_pShaderDevice->GetPipelineCache(), 1, &pipelineInfo,
+                                      g_pAllocCallbacks, &pipeline),
+            "failed to create graphics pipeline");
 
-    // Cleanup
-    vkDestroyShaderModule(g_pShaderDevice->GetVkDevice(), m_FragShaderModule, g_pAllocCallbacks);
-    vkDestroyShaderModule(g_pShaderDevice->GetVkDevice(), m_VertShaderModule, g_pAllocCallbacks);
+    return pipeline;
 }
 
-void CViewportVk::CreateFramebuffers()
+size_t CViewportVk::PipelineKeyHash::operator()(const PipelineKey &key) const
 {
-    m_SwapchainFramebuffers.resize(m_SwapchainImageViews.size());
-
-    for (size_t i = 0; i < m_SwapchainImageViews.size(); i++)
-    {
-        VkImageView attachments[] = {m_SwapchainImageViews[i]};
+    CRC32_t crc;
+    CRC32_Init(&crc);
+    CRC32_ProcessBuffer(&crc, &key.colorFormat, sizeof(key.colorFormat));
+    CRC32_ProcessBuffer(&crc, &key.depthFormat, sizeof(key.depthFormat));
+    CRC32_ProcessBuffer(&crc, &key.vertexShader.m_Module, sizeof(key.vertexShader.m_Module));
+    CRC32_ProcessBuffer(&crc, key.vertexShader.m_nCombos, sizeof(key.vertexShader.m_nCombos));
+    CRC32_ProcessBuffer(&crc, &key.pixelShader.m_Module, sizeof(key.pixelShader.m_Module));
+    CRC32_ProcessBuffer(&crc, key.pixelShader.m_nCombos, sizeof(key.pixelShader.m_nCombos));
+    CRC32_ProcessBuffer(&crc, &key.geometryShader, sizeof(key.geometryShader));
+    CRC32_ProcessBuffer(&crc, key.vertexDecl.m_Formats, sizeof(key.vertexDecl.m_Formats));
+    CRC32_Final(&crc);
+    return crc;
+}
 
-        VkFramebufferCreateInfo framebufferInfo = {};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = m_RenderPass;
-        framebufferInfo.attachmentCount = 1;
-        framebufferInfo.pAttachments = attachments;
-        framebufferInfo.width = m_SwapchainExtent.width;
-        framebufferInfo.height = m_SwapchainExtent.height;
-        framebufferInfo.layers = 1;
+VkPipeline CViewportVk::GetGraphicsPipeline(VkRenderPass renderPass, VkFormat colorFormat, VkFormat depthFormat, const MeshOffset &mesh)
+{
+    PipelineKey key;
+    key.colorFormat = colorFormat;
+    key.depthFormat = depthFormat;
+    key.vertexShader = mesh.vertexShader;
+    key.pixelShader = mesh.pixelShader;
+    key.geometryShader = mesh.geometryShader;
+    key.vertexDecl = mesh.vertexDecl;
+
+    auto it = m_GraphicsPipelines.find(key);
+    if (it != m_GraphicsPipelines.end())
+        return it->second;
+
+    // Only the pick buffer has an integer color format
+    VkPipeline pipeline = CreateGraphicsPipeline(renderPass, colorFormat != VK_FORMAT_UNDEFINED, depthFormat != VK_FORMAT_UNDEFINED,
+                                                 colorFormat == PICK_BUFFER_COLOR_FORMAT, mesh.vertexShader, mesh.pixelShader,
+                                                 mesh.geometryShader, mesh.vertexDecl);
+    m_GraphicsPipelines.emplace(key, pipeline);
+    return pipeline;
+}
 
-        vkCheck(vkCreateFramebuffer(g_pShaderDevice->GetVkDevice(), &framebufferInfo, g_pAllocCallbacks, &m_SwapchainFramebuffers[i]),
-                "failed to create framebuffers");
+void CViewportVk::ReleasePipelines(VkShaderModule shaderModule)
+{
+    for (auto it = m_GraphicsPipelines.begin(); it != m_GraphicsPipelines.end();)
+    {
+        if (it->first.UsesModule(shaderModule))
+        {
+            g_pShaderDevice->GetDeletionQueue().DestroyPipeline(it->second);
+            it = m_GraphicsPipelines.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
     }
 }
 
@@ -582,23 +741,101 @@ void CViewportVk::CreateCommandPool()
     vkCheck(vkCreateCommandPool(g_pShaderDevice->GetVkDevice(), &poolInfo, nullptr, &m_CommandPool), "failed to create command pool");
 }
 
+void CViewportVk::CreateDefaultVertexBuffer()
+{
+    // Origin, a normal facing +z and opaque white
+    VertexDefaultsVk_t defaults = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {255, 255, 255, 255}};
+
+    // VERTEX_FORMAT_UNKNOWN buffers are sized in bytes
+    CVertexBufferVk *pStagingBuffer = (CVertexBufferVk *)g_pShaderDevice->CreateVertexBuffer(
+        SHADER_BUFFER_TYPE_STATIC, VERTEX_FORMAT_UNKNOWN, sizeof(defaults), "CVertexBufferVk defaults staging", false);
+    VertexDesc_t desc;
+    pStagingBuffer->Lock(sizeof(defaults), false, desc);
+    memcpy(pStagingBuffer->GetVertexMemory(), &defaults, sizeof(defaults));
+    pStagingBuffer->Unlock(sizeof(defaults), desc);
+
+    m_pDefaultVertexBuffer = (CVertexBufferVk *)g_pShaderDevice->CreateVertexBuffer(SHADER_BUFFER_TYPE_STATIC, VERTEX_FORMAT_UNKNOWN,
+                                                                                    sizeof(defaults), "CVertexBufferVk defaults", true);
+    CopyBuffer(*pStagingBuffer->GetVkBuffer(), *m_pDefaultVertexBuffer->GetVkBuffer(), pStagingBuffer->GetBufferOffset(), 0,
+               sizeof(defaults));
+    delete pStagingBuffer;
+}
+
 void CViewportVk::CreateUniformBuffers()
 {
     const VkDeviceSize bufferSize = MAX_MESHES * g_pShaderDevice->GetUBOAlignment();
 
-    m_UniformBuffers.resize(m_SwapchainImages.size());
-    m_UniformBuffersMemory.resize(m_SwapchainImages.size());
+    m_UniformBuffers.resize(GetBufferSetCount());
+    m_UniformBuffersMemory.resize(GetBufferSetCount());
 
-    for (size_t i = 0; i < m_SwapchainImages.size(); i++)
+    for (size_t i = 0; i < GetBufferSetCount(); i++)
     {
         CreateBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, m_UniformBuffers[i],
                      m_UniformBuffersMemory[i]);
     }
+
+    // Blocks only hold registers up to the high-water mark, the rest of the descriptor range may run past the last one.
+    // The data keeps whatever it grew to for the rest of the session.
+    m_ShaderConstantData.resize(MAX(m_ShaderConstantData.size(), (size_t)SHADER_CONSTANT_BUFFER_SIZE));
+    const VkDeviceSize constantBufferSize = m_ShaderConstantData.size() + GetMaxShaderConstantRange();
+
+    m_ConstantBuffers.resize(GetBufferSetCount());
+    m_ConstantBuffersMemory.resize(GetBufferSetCount());
+    m_ConstantBufferSizes.assign(GetBufferSetCount(), constantBufferSize);
+
+    for (size_t i = 0; i < GetBufferSetCount(); i++)
+    {
+        CreateBuffer(constantBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_ConstantBuffers[i],
+                     m_ConstantBuffersMemory[i]);
+    }
+
+    // Same for the bone palettes, a palette only holds the bones its model loaded
+    m_BonePaletteData.resize(MAX(m_BonePaletteData.size(), (size_t)BONE_PALETTE_BUFFER_SIZE));
+    const VkDeviceSize boneBufferSize = m_BonePaletteData.size() + BONE_PALETTE_RANGE;
+
+    m_BoneBuffers.resize(GetBufferSetCount());
+    m_BoneBuffersMemory.resize(GetBufferSetCount());
+    m_BoneBufferSizes.assign(GetBufferSetCount(), boneBufferSize);
+
+    for (size_t i = 0; i < GetBufferSetCount(); i++)
+    {
+        CreateBuffer(boneBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_BoneBuffers[i], m_BoneBuffersMemory[i]);
+    }
+
+    const VkDeviceSize instanceBufferSize = MAX(m_InstanceData.capacity(), (size_t)MAX_INSTANCES) * sizeof(InstanceDataVk_t);
+
+    m_InstanceBuffers.resize(GetBufferSetCount());
+    m_InstanceBuffersMemory.resize(GetBufferSetCount());
+    m_InstanceBufferSizes.assign(GetBufferSetCount(), instanceBufferSize);
+
+    for (size_t i = 0; i < GetBufferSetCount(); i++)
+    {
+        CreateBuffer(instanceBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_InstanceBuffers[i],
+                     m_InstanceBuffersMemory[i]);
+    }
+
+    m_InstanceData.reserve(MAX_INSTANCES);
+}
+
+//-----------------------------------------------------------------------------
+// Swaps a per-image buffer for a bigger one, the old one lives until the GPU
+// is done with it. The caller rewrites the image's descriptor set.
+//-----------------------------------------------------------------------------
+void CViewportVk::ReplaceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer &buffer, VkDeviceMemory &memory)
+{
+    CDeletionQueueVk &deletionQueue = g_pShaderDevice->GetDeletionQueue();
+    deletionQueue.DestroyBuffer(buffer);
+    deletionQueue.FreeMemory(memory);
+
+    CreateBuffer(size, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory);
 }
 
 void CViewportVk::CreateCommandBuffers()
 {
-    m_CommandBuffers.resize(m_SwapchainFramebuffers.size());
+    m_CommandBuffers.resize(m_SwapchainImages.size());
 
     VkCommandBufferAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -615,6 +852,7 @@ void CViewportVk::CreateSyncObjects()
     m_ImageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     m_RenderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     m_InFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    m_InFlightSerials.resize(MAX_FRAMES_IN_FLIGHT, 0);
 
     VkSemaphoreCreateInfo semaphoreInfo = {};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -689,6 +927,283 @@ void CViewportVk::UpdateUniformBuffer(uint32_t currentImage)
     MemAlloc_FreeAligned(dynamicUBO);
 }
 
+void CViewportVk::UpdateShaderConstantBuffer(uint32_t currentImage)
+{
+    if (m_nShaderConstantSize == 0)
+    {
+        return;
+    }
+
+    const VkDeviceSize nRange = GetMaxShaderConstantRange();
+    const VkDeviceSize nBufferSize = m_ShaderConstantData.size() + nRange;
+    if (m_ConstantBufferSizes[currentImage] < nBufferSize)
+    {
+        ReplaceBuffer(nBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, m_ConstantBuffers[currentImage],
+                      m_ConstantBuffersMemory[currentImage]);
+        m_ConstantBufferSizes[currentImage] = nBufferSize;
+        WriteDescriptorSet(currentImage);
+    }
+
+    // The last block's descriptor range runs past the data. Registers above the high-water mark
+    // were never set, they only have to read as something defined, so the tail is zeroed.
+    // Coherent, nothing to flush
+    void *pData;
+    vkCheck(vkMapMemory(g_pShaderDevice->GetVkDevice(), m_ConstantBuffersMemory[currentImage], 0, m_nShaderConstantSize + nRange, 0,
+                        &pData),
+            "failed to map shader constant buffer");
+    V_memcpy(pData, m_ShaderConstantData.data(), m_nShaderConstantSize);
+    V_memset((uint8_t *)pData + m_nShaderConstantSize, 0, nRange);
+    vkUnmapMemory(g_pShaderDevice->GetVkDevice(), m_ConstantBuffersMemory[currentImage]);
+}
+
+//-----------------------------------------------------------------------------
+// A stage gets a new block when it has none this frame or its changes don't fit
+// the push constants anymore. Blocks only copy registers up to the high-water mark.
+//-----------------------------------------------------------------------------
+void CViewportVk::CommitShaderConstants(MeshOffset &mesh)
+{
+    int nPushed = 0;
+    for (int i = 0; i < SHADER_CONSTANTS_STAGE_COUNT; i++)
+    {
+        ShaderConstantStage_t stage = (ShaderConstantStage_t)i;
+        const Vector4D *pConstants = g_pShaderAPI->GetShaderConstants(stage);
+
+        int nFirst, nLast;
+        if (g_pShaderAPI->GetShaderConstantDirtyRange(stage, nFirst, nLast))
+        {
+            m_nConstantDeltaFirst[i] = MIN(m_nConstantDeltaFirst[i], nFirst);
+            m_nConstantDeltaLast[i] = MAX(m_nConstantDeltaLast[i], nLast);
+        }
+
+        bool bDirty = m_nConstantDeltaFirst[i] <= m_nConstantDeltaLast[i];
+        int nDelta = bDirty ? m_nConstantDeltaLast[i] - m_nConstantDeltaFirst[i] + 1 : 0;
+
+        if (pConstants && (m_nConstantBlock[i] < 0 || nPushed + nDelta > SHADER_CONSTANT_PUSH_REGISTERS))
+        {
+            VkDeviceSize nAlignment = g_pShaderDevice->GetMinUBOOffsetAlignment();
+            VkDeviceSize nOffset = (m_nShaderConstantSize + nAlignment - 1) & ~(nAlignment - 1);
+            VkDeviceSize nSize = g_pShaderAPI->GetShaderConstantHighWater(stage) * sizeof(Vector4D);
+            if (nOffset + nSize > m_ShaderConstantData.size())
+            {
+                // The image buffers follow at present
+                m_ShaderConstantData.resize(MAX(m_ShaderConstantData.size() * 2, nOffset + nSize));
+            }
+
+            V_memcpy(&m_ShaderConstantData[nOffset], pConstants, nSize);
+            m_nShaderConstantSize = nOffset + nSize;
+            m_nConstantBlock[i] = (int)nOffset;
+            m_nConstantDeltaFirst[i] = INT_MAX;
+            m_nConstantDeltaLast[i] = -1;
+            bDirty = false;
+        }
+
+        mesh.constantOffsets[i] = (uint32_t)MAX(m_nConstantBlock[i], 0);
+
+        if (bDirty && pConstants)
+        {
+            int nCount = MIN(nDelta, SHADER_CONSTANT_PUSH_REGISTERS - nPushed);
+            mesh.constants.m_nFirst[i] = (int16_t)m_nConstantDeltaFirst[i];
+            mesh.constants.m_nCount[i] = (int16_t)nCount;
+            mesh.constants.m_nPushIndex[i] = (int16_t)nPushed;
+            V_memcpy(&mesh.constants.m_Registers[nPushed], &pConstants[m_nConstantDeltaFirst[i]], nCount * sizeof(Vector4D));
+            nPushed += nCount;
+        }
+    }
+}
+
+void CViewportVk::UpdateBonePaletteBuffer(uint32_t currentImage)
+{
+    if (m_nBonePaletteSize == 0)
+    {
+        return;
+    }
+
+    const VkDeviceSize nBufferSize = m_BonePaletteData.size() + BONE_PALETTE_RANGE;
+    if (m_BoneBufferSizes[currentImage] < nBufferSize)
+    {
+        ReplaceBuffer(nBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_BoneBuffers[currentImage], m_BoneBuffersMemory[currentImage]);
+        m_BoneBufferSizes[currentImage] = nBufferSize;
+        WriteDescriptorSet(currentImage);
+    }
+
+    void *pData;
+    vkCheck(vkMapMemory(g_pShaderDevice->GetVkDevice(), m_BoneBuffersMemory[currentImage], 0, m_nBonePaletteSize, 0, &pData),
+            "failed to map bone palette buffer");
+    V_memcpy(pData, m_BonePaletteData.data(), m_nBonePaletteSize);
+    vkUnmapMemory(g_pShaderDevice->GetVkDevice(), m_BoneBuffersMemory[currentImage]);
+}
+
+void CViewportVk::CommitBonePalette(MeshOffset &mesh)
+{
+    const matrix3x4_t *pBones;
+    int nBones;
+    // Without a palette this frame, either a new frame or another viewport consumed the changes, so reload it
+    if (g_pShaderAPI->GetDirtyBoneMatrices(pBones, nBones, m_nBonePalette < 0))
+    {
+        // Every pass of every instance of a model loads the same bones
+        uint32_t nSize = nBones * sizeof(matrix3x4_t);
+        CRC32_t crc = CRC32_ProcessSingleBuffer(pBones, nSize);
+        auto it = m_BonePalettes.find(crc);
+        if (it != m_BonePalettes.end() && it->second.size == nSize && memcmp(&m_BonePaletteData[it->second.offset], pBones, nSize) == 0)
+        {
+            m_nBonePalette = (int)it->second.offset;
+        }
+        else
+        {
+            VkDeviceSize nAlignment = g_pShaderDevice->GetMinSSBOOffsetAlignment();
+            VkDeviceSize nOffset = (m_nBonePaletteSize + nAlignment - 1) & ~(nAlignment - 1);
+            if (nOffset + nSize > m_BonePaletteData.size())
+            {
+                // The image buffers follow at present
+                m_BonePaletteData.resize(MAX(m_BonePaletteData.size() * 2, nOffset + nSize));
+            }
+
+            V_memcpy(&m_BonePaletteData[nOffset], pBones, nSize);
+            m_nBonePaletteSize = nOffset + nSize;
+            m_nBonePalette = (int)nOffset;
+
+            BonePalette &palette = m_BonePalettes[crc];
+            palette.offset = (uint32_t)nOffset;
+            palette.size = nSize;
+        }
+    }
+
+    // Unskinned draws never read it
+    mesh.bonePaletteOffset = g_pShaderAPI->GetNumBoneWeights() > 0 ? (uint32_t)MAX(m_nBonePalette, 0) : 0;
+}
+
+// The rows of the model matrix, ubo.model is transposed to column-major
+static void GetInstanceData(const UniformBufferObject &ubo, InstanceDataVk_t &instance)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            instance.m_Model[i][j] = ubo.model[j][i];
+        }
+    }
+}
+
+void CViewportVk::UpdateInstanceBuffer(uint32_t currentImage)
+{
+    if (m_InstanceData.empty())
+    {
+        return;
+    }
+
+    // Not in the descriptor set, UpdateCommandBuffer binds whatever buffer the image has
+    VkDeviceSize nSize = m_InstanceData.size() * sizeof(InstanceDataVk_t);
+    if (m_InstanceBufferSizes[currentImage] < nSize)
+    {
+        VkDeviceSize nBufferSize = m_InstanceData.capacity() * sizeof(InstanceDataVk_t);
+        ReplaceBuffer(nBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, m_InstanceBuffers[currentImage],
+                      m_InstanceBuffersMemory[currentImage]);
+        m_InstanceBufferSizes[currentImage] = nBufferSize;
+    }
+
+    void *pData;
+    vkCheck(vkMapMemory(g_pShaderDevice->GetVkDevice(), m_InstanceBuffersMemory[currentImage], 0, nSize, 0, &pData),
+            "failed to map instance buffer");
+    V_memcpy(pData, m_InstanceData.data(), nSize);
+    vkUnmapMemory(g_pShaderDevice->GetVkDevice(), m_InstanceBuffersMemory[currentImage]);
+}
+
+//-----------------------------------------------------------------------------
+// A draw of the same static data with the same state as the last one, except for the model matrix,
+// only adds its matrix to the last draw's instances. Shaders have to read the model matrix from the
+// instance stream for that, the uniform buffer only has the first instance's.
+//-----------------------------------------------------------------------------
+bool CViewportVk::AddInstance(const MeshOffset &mesh, const CPrimList *pPrims, int nPrims)
+{
+    if (!mesh.instanced || m_DrawMeshes.empty() || m_RenderPasses.back().meshCount == 0 || !IsCurrentPass(m_RenderPasses.back()))
+        return false;
+
+    // Instances have to be contiguous in the stream
+    MeshOffset &last = m_DrawMeshes.back();
+    if (last.firstInstance + last.instanceCount != (int)m_InstanceData.size())
+        return false;
+
+    if (mesh.dynamic && (m_nLastDynamicMesh != (int)m_DrawMeshes.size() - 1 || m_DynamicData != m_LastDynamicData))
+        return false;
+
+    if (!last.instanced || last.vertexDecl != mesh.vertexDecl || last.indexSource != mesh.indexSource ||
+        last.sourceFirstIndex != mesh.sourceFirstIndex || last.indexCount != mesh.indexCount || last.vertexCount != mesh.vertexCount ||
+        last.vertexOffset != mesh.vertexOffset || last.topology != mesh.topology)
+        return false;
+
+    for (int i = 0; i < VERTEX_STREAM_DEFAULTS; i++)
+    {
+        if (last.sources[i] != mesh.sources[i] || last.sourceFirstVertex[i] != mesh.sourceFirstVertex[i])
+            return false;
+    }
+
+    if (last.vertexShader != mesh.vertexShader || last.pixelShader != mesh.pixelShader || last.geometryShader != mesh.geometryShader ||
+        last.textures != mesh.textures || last.constants != mesh.constants || last.bonePaletteOffset != mesh.bonePaletteOffset ||
+        memcmp(last.constantOffsets, mesh.constantOffsets, sizeof(mesh.constantOffsets)) != 0 || last.ubo.view != mesh.ubo.view ||
+        last.ubo.proj != mesh.ubo.proj || last.ubo.selectionId != mesh.ubo.selectionId)
+        return false;
+
+    // Same prim lists too
+    int nRange = last.firstRange;
+    for (int i = 0; i < nPrims; i++)
+    {
+        if (pPrims[i].m_NumIndices == 0)
+            continue;
+
+        if (nRange == last.firstRange + last.rangeCount)
+            return false;
+
+        const DrawRange &range = m_DrawRanges[nRange++];
+        if (range.firstIndex != pPrims[i].m_FirstIndex - mesh.sourceFirstIndex || range.indexCount != pPrims[i].m_NumIndices)
+            return false;
+    }
+    if (nRange != last.firstRange + last.rangeCount)
+        return false;
+
+    InstanceDataVk_t instance;
+    GetInstanceData(mesh.ubo, instance);
+    m_InstanceData.push_back(instance);
+    last.instanceCount++;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Copies what a draw reads from its dynamic buffers out of their CPU copies,
+// returns false if a copy doesn't cover the draw
+//-----------------------------------------------------------------------------
+bool CViewportVk::GetDynamicData(const MeshOffset &mesh, std::vector<uint8_t> &data) const
+{
+    data.resize(0);
+
+    for (int i = VERTEX_STREAM_BASE; i < VERTEX_STREAM_DEFAULTS; i++)
+    {
+        const CVertexBufferVk *pStreamBuffer = mesh.sources[i];
+        if (!pStreamBuffer || !pStreamBuffer->IsDynamic())
+            continue;
+
+        int nOffset = mesh.sourceFirstVertex[i] * pStreamBuffer->VertexSize();
+        int nSize = mesh.vertexCount * pStreamBuffer->VertexSize();
+        if (nOffset + nSize > pStreamBuffer->GetVertexMemorySize() || data.size() + nSize > MAX_DYNAMIC_INSTANCE_SIZE)
+            return false;
+
+        const unsigned char *pVertices = pStreamBuffer->GetVertexMemory() + nOffset;
+        data.insert(data.end(), pVertices, pVertices + nSize);
+    }
+
+    if (mesh.indexSource->IsDynamic())
+    {
+        int nOffset = mesh.sourceFirstIndex * mesh.indexSource->IndexSize();
+        int nSize = mesh.indexCount * mesh.indexSource->IndexSize();
+        if (nOffset + nSize > mesh.indexSource->GetIndexMemorySize() || data.size() + nSize > MAX_DYNAMIC_INSTANCE_SIZE)
+            return false;
+
+        const unsigned char *pIndices = mesh.indexSource->GetIndexMemory() + nOffset;
+        data.insert(data.end(), pIndices, pIndices + nSize);
+    }
+
+    return true;
+}
+
 void CViewportVk::UpdateCommandBuffer(uint32_t currentImage)
 {
     VkCommandBufferBeginInfo beginInfo = {};
@@ -698,61 +1213,41 @@ void CViewportVk::UpdateCommandBuffer(uint32_t currentImage)
 
     vkCheck(vkBeginCommandBuffer(m_CommandBuffers[currentImage], &beginInfo), "failed to begin command buffer");
 
-    VkRenderPassBeginInfo renderPassInfo = {};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = m_RenderPass;
-    renderPassInfo.framebuffer = m_SwapchainFramebuffers[currentImage];
-    renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = m_SwapchainExtent;
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &m_ClearColor;
+    // Uploads are done by now, so the mips are ready before any pass samples them
+    g_pShaderAPI->RecordPendingMipmaps(m_CommandBuffers[currentImage]);
 
-    vkCmdBeginRenderPass(m_CommandBuffers[currentImage], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // The swapchain image has to end up in the present layout even if nothing was drawn to it
+    bool bBackBufferUsed = false;
+    for (const RenderPassInfo &pass : m_RenderPasses)
+    {
+        bBackBufferUsed |= pass.colorTarget == SHADER_RENDERTARGET_BACKBUFFER;
+    }
 
-    vkCmdBindPipeline(m_CommandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, m_GraphicsPipeline);
+    if (!bBackBufferUsed)
+    {
+        RenderPassInfo pass = {};
+        pass.colorTarget = SHADER_RENDERTARGET_BACKBUFFER;
+        pass.depthTarget = SHADER_RENDERTARGET_NONE;
+        pass.clearColor = true;
+        pass.clearColorValue = m_ClearColor;
+        pass.firstMesh = (int)m_DrawMeshes.size();
+        m_RenderPasses.push_back(pass);
+    }
 
     if (!m_DrawMeshes.empty())
     {
-        VkBuffer vertexBuffers[] = {*(m_pVertexBuffer->GetVkBuffer())};
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(m_CommandBuffers[currentImage], 0, 1, vertexBuffers, offsets);
-
-        vkCmdBindIndexBuffer(m_CommandBuffers[currentImage], *m_pIndexBuffer->GetVkBuffer(), 0, VK_INDEX_TYPE_UINT16);
+        // Pipelines without the defaults stream ignore its binding, the other streams are bound per mesh
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(m_CommandBuffers[currentImage], VERTEX_STREAM_DEFAULTS, 1, m_pDefaultVertexBuffer->GetVkBuffer(), &offset);
 
-        for (size_t i = 0; i < m_DrawMeshes.size(); i++)
-        {
-            // bind descriptor set for current mesh
-            uint32_t dynamicOffset = i * g_pShaderDevice->GetUBOAlignment();
-            vkCmdBindDescriptorSets(m_CommandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, m_PipelineLayout, 0, 1,
-                                    &m_DescriptorSets[currentImage], 1, &dynamicOffset);
-
-            /*
-                VK_FIXME: Hammer draws line lists somewhere
-
-                vkCmdDrawIndexed(): the last primitive topology VK_PRIMITIVE_TOPOLOGY_LINE_LIST state set by
-                vkCmdSetPrimitiveTopologyEXT is not compatible with the pipeline topology VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST.
-                The Vulkan spec states: If the bound graphics pipeline state was created with the
-                VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT dynamic state enabled then vkCmdSetPrimitiveTopologyEXT must have been
-                called in the current command buffer prior to this draw command, and the primitiveTopology parameter of
-                vkCmdSetPrimitiveTopologyEXT must be of the same topology class as the pipeline
-                VkPipelineInputAssemblyStateCreateInfo::topology state
-                (https://vulkan.lunarg.com/doc/view/1.2.162.0/windows/1.2-extensions/vkspec.html#VUID-vkCmdDrawIndexed-primitiveTopology-03420)
-
-                TL;DR: pipeline created with VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, so this can only be another triangle class
-                (_LIST, _STRIP, _FAN, _LIST_WITH_ADJACENCY, _STRIP_WITH_ADJACENCY)
-            */
-
-            // set topology
-            VULKAN_HPP_DEFAULT_DISPATCHER.vkCmdSetPrimitiveTopologyEXT(m_CommandBuffers[currentImage], m_DrawMeshes[i].topology);
-
-            // draw
-            Assert(m_DrawMeshes[i].firstIndex + m_DrawMeshes[i].indexCount <= m_pIndexBuffer->IndexCount());
-            vkCmdDrawIndexed(m_CommandBuffers[currentImage], m_DrawMeshes[i].indexCount, 1, m_DrawMeshes[i].firstIndex,
-                             m_DrawMeshes[i].firstVertex, 0);
-        }
+        // Draws pick their instances with firstInstance
+        vkCmdBindVertexBuffers(m_CommandBuffers[currentImage], VERTEX_STREAM_INSTANCE, 1, &m_InstanceBuffers[currentImage], &offset);
     }
 
-    vkCmdEndRenderPass(m_CommandBuffers[currentImage]);
+    for (size_t i = 0; i < m_RenderPasses.size(); i++)
+    {
+        RecordRenderPass(m_CommandBuffers[currentImage], currentImage, i);
+    }
 
     vkCheck(vkEndCommandBuffer(m_CommandBuffers[currentImage]), "failed to end command buffer");
 
@@ -760,6 +1255,308 @@ void CViewportVk::UpdateCommandBuffer(uint32_t currentImage)
     m_VertexBufferOffset = 0;
     m_IndexBufferOffset = 0;
     m_DrawMeshes.resize(0);
+    m_DrawRanges.resize(0);
+    m_RenderPasses.resize(0);
+    m_InstanceData.resize(0);
+
+    // Constant blocks and bone palettes start over with the next frame's buffer
+    m_nShaderConstantSize = 0;
+    for (int i = 0; i < SHADER_CONSTANTS_STAGE_COUNT; i++)
+    {
+        m_nConstantBlock[i] = -1;
+    }
+    m_nBonePaletteSize = 0;
+    m_nBonePalette = -1;
+    m_BonePalettes.clear();
+    m_nLastDynamicMesh = -1;
+}
+
+//-----------------------------------------------------------------------------
+// Load and store ops are picked from how the attachments are used across the frame:
+// cleared attachments are never loaded, and depth nobody reads later is never stored.
+//-----------------------------------------------------------------------------
+void CViewportVk::RecordRenderPass(VkCommandBuffer commandBuffer, uint32_t currentImage, size_t iPass)
+{
+    const RenderPassInfo &pass = m_RenderPasses[iPass];
+
+    RenderPassKey_t key;
+    VkImageView attachments[2];
+    VkClearValue clearValues[2];
+    int nAttachments = 0;
+    VkExtent2D extent = {UINT32_MAX, UINT32_MAX};
+
+    // Color
+    CTextureVk *pColor = nullptr;
+    CPickBufferVk &pickBuffer = g_pShaderDevice->GetPickBuffer();
+    if (pass.pick)
+    {
+        // Ids and depth are read back right after the pass, see ResolvePick
+        key.m_ColorFormat = PICK_BUFFER_COLOR_FORMAT;
+        key.m_ColorLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        key.m_ColorStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+        key.m_ColorInitialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        key.m_ColorFinalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+        attachments[nAttachments] = pickBuffer.GetColorView();
+        extent.width = pickBuffer.GetWidth();
+        extent.height = pickBuffer.GetHeight();
+    }
+    else if (pass.colorTarget == SHADER_RENDERTARGET_BACKBUFFER)
+    {
+        bool bWrittenBefore = false;
+        for (size_t i = 0; i < iPass; i++)
+        {
+            bWrittenBefore |= m_RenderPasses[i].colorTarget == SHADER_RENDERTARGET_BACKBUFFER;
+        }
+
+        // The previous frame's contents are gone after present, so the first pass always clears
+        bool bLoad = bWrittenBefore && !pass.clearColor;
+        key.m_ColorFormat = m_SwapchainImageFormat;
+        key.m_ColorLoadOp = bLoad ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+        key.m_ColorStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+        key.m_ColorInitialLayout = bLoad ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_UNDEFINED;
+        key.m_ColorFinalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        attachments[nAttachments] = m_SwapchainImageViews[currentImage];
+        extent = m_SwapchainExtent;
+    }
+    else if (g_pShaderAPI->IsValidTexture(pass.colorTarget))
+    {
+        // Render targets keep their contents across frames
+        CTextureVk &texture = g_pShaderAPI->GetTexture(pass.colorTarget);
+        pColor = &texture;
+        key.m_ColorFormat = texture.GetVkFormat();
+        key.m_ColorLoadOp = pass.clearColor ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+        key.m_ColorStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+        key.m_ColorInitialLayout = pass.clearColor ? VK_IMAGE_LAYOUT_UNDEFINED : texture.GetLayout();
+        key.m_ColorFinalLayout = texture.GetLayout();
+
+        attachments[nAttachments] = texture.GetAttachmentView();
+        extent.width = texture.GetWidth();
+        extent.height = texture.GetHeight();
+    }
+
+    if (key.m_ColorFormat != VK_FORMAT_UNDEFINED)
+    {
+        clearValues[nAttachments++] = pass.clearColorValue;
+    }
+
+    // Depth
+    CTextureVk *pDepth = nullptr;
+    if (pass.depthTarget == SHADER_RENDERTARGET_DEPTHBUFFER)
+    {
+        pDepth = &m_DepthBuffer;
+    }
+    else if (g_pShaderAPI->IsValidTexture(pass.depthTarget))
+    {
+        pDepth = &g_pShaderAPI->GetTexture(pass.depthTarget);
+    }
+
+    if (pass.pick)
+    {
+        key.m_DepthFormat = pickBuffer.GetDepthFormat();
+        key.m_DepthLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        key.m_DepthStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+        key.m_DepthInitialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        key.m_DepthFinalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+        attachments[nAttachments] = pickBuffer.GetDepthView();
+        clearValues[nAttachments].depthStencil = {1.0f, 0};
+        nAttachments++;
+    }
+    else if (pDepth)
+    {
+        // Transient depth only has contents if an earlier pass this frame stored them
+        bool bLoad = !pass.clearDepth;
+        if (bLoad && pDepth->IsTransient())
+        {
+            bLoad = false;
+            for (size_t i = 0; i < iPass; i++)
+            {
+                bLoad |= m_RenderPasses[i].depthTarget == pass.depthTarget;
+            }
+        }
+
+        // and only needs storing if a later pass loads them
+        bool bStore = !pDepth->IsTransient();
+        for (size_t i = iPass + 1; i < m_RenderPasses.size() && !bStore; i++)
+        {
+            if (m_RenderPasses[i].depthTarget == pass.depthTarget)
+            {
+                bStore = !m_RenderPasses[i].clearDepth;
+                break;
+            }
+        }
+
+        // Pipelines always depth test, so depth without contents is cleared rather than left undefined
+        // VK_TODO: DONT_CARE once depth test and write come from the shadow state and are off for the pass
+        key.m_DepthFormat = pDepth->GetVkFormat();
+        key.m_DepthLoadOp = bLoad ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+        key.m_DepthStoreOp = bStore ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        key.m_DepthInitialLayout = bLoad ? pDepth->GetLayout() : VK_IMAGE_LAYOUT_UNDEFINED;
+        key.m_DepthFinalLayout = pDepth->GetLayout();
+
+        attachments[nAttachments] = pDepth->GetAttachmentView();
+        clearValues[nAttachments].depthStencil = {1.0f, 0};
+        nAttachments++;
+
+        extent.width = MIN(extent.width, (uint32_t)pDepth->GetWidth());
+        extent.height = MIN(extent.height, (uint32_t)pDepth->GetHeight());
+    }
+
+    // Render target was deleted mid-frame
+    if (nAttachments == 0)
+        return;
+
+    CRenderPassCacheVk &cache = g_pShaderDevice->GetRenderPassCache();
+    VkRenderPass renderPass = cache.GetRenderPass(key);
+
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer = cache.GetFramebuffer(renderPass, nAttachments, attachments, extent.width, extent.height);
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = extent;
+    renderPassInfo.clearValueCount = nAttachments;
+    renderPassInfo.pClearValues = clearValues;
+
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    if (pass.meshCount > 0)
+    {
+        // Use bottom left as 0,0
+        VkViewport viewport = {};
+        viewport.x = 0.0f;
+        viewport.y = (float)extent.height;
+        viewport.width = (float)extent.width;
+        viewport.height = -(float)extent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        VkRect2D scissor = {};
+        scissor.offset = {0, 0};
+        scissor.extent = extent;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        // Every texture is reachable from here on, draws only push indices
+        if (g_pShaderDevice->SupportsBindless())
+        {
+            VkDescriptorSet bindlessSet = g_pShaderDevice->GetBindlessTextures().GetDescriptorSet();
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_PipelineLayout, 1, 1, &bindlessSet, 0, nullptr);
+        }
+    }
+
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+    VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+    VkBuffer boundStreamBuffers[VERTEX_STREAM_DEFAULTS] = {};
+    VkDeviceSize boundStreamOffsets[VERTEX_STREAM_DEFAULTS];
+    for (int j = 0; j < VERTEX_STREAM_DEFAULTS; j++)
+    {
+        boundStreamOffsets[j] = VK_WHOLE_SIZE;
+    }
+    const BindlessPushConstants_t *pPushedTextures = nullptr;
+    const ShaderConstantPush_t *pPushedConstants = nullptr;
+    for (int i = pass.firstMesh; i < pass.firstMesh + pass.meshCount; i++)
+    {
+        VkPipeline pipeline = GetGraphicsPipeline(renderPass, key.m_ColorFormat, key.m_DepthFormat, m_DrawMeshes[i]);
+        if (pipeline == VK_NULL_HANDLE)
+            continue;
+
+        if (pipeline != boundPipeline)
+        {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            boundPipeline = pipeline;
+        }
+
+        // Streams live in m_pVertexBuffer or an arena block, mostly only the offsets change
+        for (int j = VERTEX_STREAM_BASE; j < VERTEX_STREAM_DEFAULTS; j++)
+        {
+            VkBuffer streamBuffer = m_DrawMeshes[i].streamBuffers[j];
+            VkDeviceSize streamOffset = m_DrawMeshes[i].streamOffsets[j];
+            if (m_DrawMeshes[i].vertexDecl.m_Formats[j] == VERTEX_FORMAT_UNKNOWN ||
+                (streamBuffer == boundStreamBuffers[j] && streamOffset == boundStreamOffsets[j]))
+                continue;
+
+            vkCmdBindVertexBuffers(commandBuffer, j, 1, &streamBuffer, &streamOffset);
+            boundStreamBuffers[j] = streamBuffer;
+            boundStreamOffsets[j] = streamOffset;
+        }
+
+        // Both index sizes live in the same buffers, firstIndex counts from their start
+        if (m_DrawMeshes[i].indexBuffer != boundIndexBuffer || m_DrawMeshes[i].indexType != boundIndexType)
+        {
+            vkCmdBindIndexBuffer(commandBuffer, m_DrawMeshes[i].indexBuffer, 0, m_DrawMeshes[i].indexType);
+            boundIndexBuffer = m_DrawMeshes[i].indexBuffer;
+            boundIndexType = m_DrawMeshes[i].indexType;
+        }
+
+        // bind descriptor set for current mesh
+        uint32_t dynamicOffsets[2 + SHADER_CONSTANTS_STAGE_COUNT];
+        dynamicOffsets[0] = i * g_pShaderDevice->GetUBOAlignment();
+        for (int j = 0; j < SHADER_CONSTANTS_STAGE_COUNT; j++)
+        {
+            dynamicOffsets[1 + j] = m_DrawMeshes[i].constantOffsets[j];
+        }
+        dynamicOffsets[1 + SHADER_CONSTANTS_STAGE_COUNT] = m_DrawMeshes[i].bonePaletteOffset;
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_PipelineLayout, 0, 1, &m_DescriptorSets[currentImage],
+                                ARRAYSIZE(dynamicOffsets), dynamicOffsets);
+
+        if (g_pShaderDevice->SupportsBindless() && (!pPushedTextures || *pPushedTextures != m_DrawMeshes[i].textures))
+        {
+            pPushedTextures = &m_DrawMeshes[i].textures;
+            vkCmdPushConstants(commandBuffer, m_PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                               sizeof(BindlessPushConstants_t), pPushedTextures);
+        }
+
+        if (!pPushedConstants || *pPushedConstants != m_DrawMeshes[i].constants)
+        {
+            pPushedConstants = &m_DrawMeshes[i].constants;
+            vkCmdPushConstants(commandBuffer, m_PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                               sizeof(BindlessPushConstants_t), sizeof(ShaderConstantPush_t), pPushedConstants);
+        }
+
+        /*
+            VK_FIXME: Hammer draws line lists somewhere
+
+            vkCmdDrawIndexed(): the last primitive topology VK_PRIMITIVE_TOPOLOGY_LINE_LIST state set by
+            vkCmdSetPrimitiveTopologyEXT is not compatible with the pipeline topology VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST.
+            The Vulkan spec states: If the bound graphics pipeline state was created with the
+            VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT dynamic state enabled then vkCmdSetPrimitiveTopologyEXT must have been
+            called in the current command buffer prior to this draw command, and the primitiveTopology parameter of
+            vkCmdSetPrimitiveTopologyEXT must be of the same topology class as the pipeline
+            VkPipelineInputAssemblyStateCreateInfo::topology state
+            (https://vulkan.lunarg.com/doc/view/1.2.162.0/windows/1.2-extensions/vkspec.html#VUID-vkCmdDrawIndexed-primitiveTopology-03420)
+
+            TL;DR: pipeline created with VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, so this can only be another triangle class
+            (_LIST, _STRIP, _FAN, _LIST_WITH_ADJACENCY, _STRIP_WITH_ADJACENCY)
+        */
+
+        // set topology
+        VULKAN_HPP_DEFAULT_DISPATCHER.vkCmdSetPrimitiveTopologyEXT(commandBuffer, m_DrawMeshes[i].topology);
+
+        // draw, all prim lists of the mesh share its state
+        // VK_TODO: use vkCmdDrawMultiIndexedEXT when VK_EXT_multi_draw is available
+        const MeshOffset &mesh = m_DrawMeshes[i];
+        Assert(mesh.indexBuffer != *m_pIndexBuffer->GetVkBuffer() ||
+               mesh.firstIndex + mesh.indexCount <= m_pIndexBuffer->GetBufferSize() / (mesh.indexType == VK_INDEX_TYPE_UINT32 ? 4 : 2));
+        for (int j = mesh.firstRange; j < mesh.firstRange + mesh.rangeCount; j++)
+        {
+            const DrawRange &range = m_DrawRanges[j];
+            Assert(range.firstIndex + range.indexCount <= mesh.indexCount);
+            vkCmdDrawIndexed(commandBuffer, range.indexCount, mesh.instanceCount, mesh.firstIndex + range.firstIndex, mesh.vertexOffset,
+                             mesh.firstInstance);
+        }
+    }
+
+    vkCmdEndRenderPass(commandBuffer);
+
+    // Sampled render targets get their mips refreshed after every pass writing them
+    if (pColor && pColor->HasAutoMipmaps())
+    {
+        pColor->GenerateMipmaps(commandBuffer);
+    }
 }
 
 void CViewportVk::Present()
@@ -773,6 +1570,9 @@ void CViewportVk::Present()
 
     vkWaitForFences(g_pShaderDevice->GetVkDevice(), 1, &m_InFlightFences[m_iCurrentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
 
+    // All viewports submit to the same queue, so anything destroyed before this frame's submit is now unused
+    g_pShaderDevice->GetDeletionQueue().OnCompleted(m_InFlightSerials[m_iCurrentFrame]);
+
     VkResult result = vkAcquireNextImageKHR(g_pShaderDevice->GetVkDevice(), m_Swapchain, std::numeric_limits<uint64_t>::max(),
                                             m_ImageAvailableSemaphores[m_iCurrentFrame], VK_NULL_HANDLE, &imageIndex);
     if (result == VK_ERROR_OUT_OF_DATE_KHR)
@@ -788,6 +1588,9 @@ void CViewportVk::Present()
 #pragma pop_macro("max")
 
     UpdateUniformBuffer(imageIndex);
+    UpdateShaderConstantBuffer(imageIndex);
+    UpdateBonePaletteBuffer(imageIndex);
+    UpdateInstanceBuffer(imageIndex);
 
     UpdateCommandBuffer(imageIndex);
 
@@ -809,6 +1612,7 @@ void CViewportVk::Present()
 
     vkResetFences(g_pShaderDevice->GetVkDevice(), 1, &m_InFlightFences[m_iCurrentFrame]);
 
+    m_InFlightSerials[m_iCurrentFrame] = g_pShaderDevice->GetDeletionQueue().OnSubmit();
     vkCheck(vkQueueSubmit(g_pShaderDevice->GetGraphicsQueue(), 1, &submitInfo, m_InFlightFences[m_iCurrentFrame]),
             "failed to submit queue");
 
@@ -883,15 +1687,18 @@ void CViewportVk::GetBackBufferDimensions(int &width, int &height)
 
 void CViewportVk::CleanupSwapchain()
 {
-    for (size_t i = 0; i < m_SwapchainFramebuffers.size(); i++)
-    {
-        vkDestroyFramebuffer(g_pShaderDevice->GetVkDevice(), m_SwapchainFramebuffers[i], g_pAllocCallbacks);
-    }
+    m_DepthBuffer.Shutdown();
 
-    for (size_t i = 0; i < m_SwapchainImages.size(); i++)
+    for (size_t i = 0; i < GetBufferSetCount(); i++)
     {
         vkDestroyBuffer(g_pShaderDevice->GetVkDevice(), m_UniformBuffers[i], g_pAllocCallbacks);
         vkFreeMemory(g_pShaderDevice->GetVkDevice(), m_UniformBuffersMemory[i], g_pAllocCallbacks);
+        vkDestroyBuffer(g_pShaderDevice->GetVkDevice(), m_ConstantBuffers[i], g_pAllocCallbacks);
+        vkFreeMemory(g_pShaderDevice->GetVkDevice(), m_ConstantBuffersMemory[i], g_pAllocCallbacks);
+        vkDestroyBuffer(g_pShaderDevice->GetVkDevice(), m_BoneBuffers[i], g_pAllocCallbacks);
+        vkFreeMemory(g_pShaderDevice->GetVkDevice(), m_BoneBuffersMemory[i], g_pAllocCallbacks);
+        vkDestroyBuffer(g_pShaderDevice->GetVkDevice(), m_InstanceBuffers[i], g_pAllocCallbacks);
+        vkFreeMemory(g_pShaderDevice->GetVkDevice(), m_InstanceBuffersMemory[i], g_pAllocCallbacks);
     }
 
     vkDestroyDescriptorPool(g_pShaderDevice->GetVkDevice(), m_DescriptorPool, g_pAllocCallbacks);
@@ -899,12 +1706,26 @@ void CViewportVk::CleanupSwapchain()
     vkFreeCommandBuffers(g_pShaderDevice->GetVkDevice(), m_CommandPool, static_cast<uint32_t>(m_CommandBuffers.size()),
                          m_CommandBuffers.data());
 
-    vkDestroyPipeline(g_pShaderDevice->GetVkDevice(), m_GraphicsPipeline, g_pAllocCallbacks);
+    // Pipelines are built against the layout, so they go with it
+    CDeletionQueueVk &deletionQueue = g_pShaderDevice->GetDeletionQueue();
+    for (const auto &entry : m_GraphicsPipelines)
+    {
+        deletionQueue.DestroyPipeline(entry.second);
+    }
+    m_GraphicsPipelines.clear();
+    if (m_VertShaderModule != VK_NULL_HANDLE)
+    {
+        deletionQueue.DestroyShaderModule(m_FragShaderModule);
+        deletionQueue.DestroyShaderModule(m_VertShaderModule);
+        m_VertShaderModule = VK_NULL_HANDLE;
+        m_FragShaderModule = VK_NULL_HANDLE;
+    }
     vkDestroyPipelineLayout(g_pShaderDevice->GetVkDevice(), m_PipelineLayout, g_pAllocCallbacks);
-    vkDestroyRenderPass(g_pShaderDevice->GetVkDevice(), m_RenderPass, g_pAllocCallbacks);
 
+    // Render passes are owned by the cache, framebuffers using the views are not
     for (size_t i = 0; i < m_SwapchainImageViews.size(); i++)
     {
+        g_pShaderDevice->GetRenderPassCache().ReleaseFramebuffers(m_SwapchainImageViews[i]);
         vkDestroyImageView(g_pShaderDevice->GetVkDevice(), m_SwapchainImageViews[i], g_pAllocCallbacks);
     }
 
@@ -925,6 +1746,8 @@ void CViewportVk::ShutdownDevice()
 
     delete m_pVertexBuffer;
     delete m_pIndexBuffer;
+    delete m_pDefaultVertexBuffer;
+    m_pDefaultVertexBuffer = nullptr;
 
     vkDestroyDescriptorSetLayout(g_pShaderDevice->GetVkDevice(), m_DescriptorSetLayout, nullptr);
 
@@ -940,47 +1763,321 @@ void CViewportVk::ShutdownDevice()
     DestroyVkSurface();
 }
 
-void CViewportVk::DrawMesh(CBaseMeshVk *pMesh)
+void CViewportVk::DrawMesh(CBaseMeshVk *pMesh, int nBaseVertex, int nFirstVertex, int nVertexCount, const CPrimList *pPrims, int nPrims)
 {
     CVertexBufferVk *vertexBuffer = pMesh->GetVertexBuffer();
     CIndexBufferVk *indexBuffer = pMesh->GetIndexBuffer();
 
-    int vertexCount = pMesh->VertexCount();
-    int indexCount = pMesh->IndexCount();
-    VkDeviceSize vertexRegionSize = vertexCount * vertexBuffer->VertexSize();
-    VkDeviceSize indexRegionSize = indexCount * indexBuffer->IndexSize();
+    // Only the span of indices the prim lists reference gets copied
+    int spanFirst = INT_MAX;
+    int spanEnd = 0;
+    for (int i = 0; i < nPrims; i++)
+    {
+        if (pPrims[i].m_NumIndices == 0)
+            continue;
 
-    // Copy mesh buffers to optimal destination buffers
-    Assert(m_pVertexBuffer->GetBufferSize() >= m_VertexBufferOffset + vertexRegionSize);
-    CopyBuffer(*vertexBuffer->GetVkBuffer(), *m_pVertexBuffer->GetVkBuffer(), 0, m_VertexBufferOffset, vertexRegionSize);
-    Assert(m_pIndexBuffer->GetBufferSize() >= m_IndexBufferOffset + indexRegionSize);
-    CopyBuffer(*indexBuffer->GetVkBuffer(), *m_pIndexBuffer->GetVkBuffer(), 0, m_IndexBufferOffset, indexRegionSize);
+        spanFirst = MIN(spanFirst, pPrims[i].m_FirstIndex);
+        spanEnd = MAX(spanEnd, pPrims[i].m_FirstIndex + pPrims[i].m_NumIndices);
+    }
+    if (spanEnd == 0)
+        return;
 
-    // Store current byte offsets for copying into buffers
-    m_VertexBufferOffset += vertexRegionSize;
-    m_IndexBufferOffset += indexRegionSize;
+    Assert(spanEnd <= indexBuffer->IndexCount());
 
-    // Get vertex and index offsets for this mesh
-    int firstVertex = 0;
-    int firstIndex = 0;
-    if (!m_DrawMeshes.empty())
-    {
-        auto back = m_DrawMeshes.back();
-        firstVertex += back.firstVertex + back.vertexCount;
-        firstIndex += back.firstIndex + back.indexCount;
-    }
+    // Dynamic meshes append batches to a shared buffer, only the range written for this draw is copied
+    Assert(nBaseVertex + nFirstVertex + nVertexCount <= vertexBuffer->VertexCount());
+    int vertexCount = nVertexCount;
+    int indexCount = spanEnd - spanFirst;
+    VkDeviceSize indexRegionSize = indexCount * indexBuffer->IndexSize();
 
     MeshOffset m;
     m.vertexCount = vertexCount;
     m.indexCount = indexCount;
-    m.firstVertex = firstVertex;
-    m.firstIndex = firstIndex;
+    m.vertexOffset = -nFirstVertex;
+    m.indexSource = indexBuffer;
+    m.sourceFirstIndex = spanFirst;
+
+    // Static data that's copied again can be instanced, dynamic buffers only when their contents repeat
+    bool bDynamic = indexBuffer->IsDynamic();
+
+    // Each stream reads from its own buffer in its own format
+    unsigned int vertexDecl = g_pShaderAPI->GetVertexDecl();
+    for (int i = VERTEX_STREAM_BASE; i < VERTEX_STREAM_DEFAULTS; i++)
+    {
+        m.vertexDecl.m_Formats[i] = VERTEX_FORMAT_UNKNOWN;
+        m.streamBuffers[i] = VK_NULL_HANDLE;
+        m.streamOffsets[i] = 0;
+        m.sources[i] = nullptr;
+        m.sourceFirstVertex[i] = 0;
+
+        int nStreamFirstVertex = 0;
+        VertexFormat_t streamFormat = pMesh->GetVertexFormat();
+        CVertexBufferVk *pStreamBuffer = vertexBuffer;
+        if (i != VERTEX_STREAM_BASE)
+        {
+            unsigned int nFlag = i == VERTEX_STREAM_COLOR ? VERTEX_DECL_COLOR_STREAM : VERTEX_DECL_FLEX_STREAM;
+            if (!(vertexDecl & nFlag))
+                continue;
+
+            pStreamBuffer = pMesh->GetStreamVertexBuffer((VertexStreamVk_t)i, streamFormat, nStreamFirstVertex);
+            if (!pStreamBuffer)
+                continue;
+        }
+
+        if (streamFormat == VERTEX_FORMAT_UNKNOWN)
+            continue;
+
+        Assert(pStreamBuffer->VertexSize() == g_pMeshMgr->VertexFormatSize(streamFormat));
+        Assert(nStreamFirstVertex + nBaseVertex + nFirstVertex + vertexCount <= pStreamBuffer->VertexCount());
+        m.vertexDecl.m_Formats[i] = streamFormat;
+        m.sources[i] = pStreamBuffer;
+        m.sourceFirstVertex[i] = nStreamFirstVertex + nBaseVertex + nFirstVertex;
+        bDynamic |= pStreamBuffer->IsDynamic();
+    }
+
     m.topology = ComputeMode(pMesh->GetPrimitiveType());
     m.ubo = GetUniformBufferObject();
+    m.textures = g_pShaderAPI->GetBindlessTextures();
+    m.vertexShader = g_pShaderManager->GetVertexStage();
+    m.pixelShader = g_pShaderManager->GetPixelStage();
+    m.geometryShader = (VkShaderModule)g_pShaderManager->GetCurrentGeometryShader();
+
+    // Picking keeps the bound vertex shader so skinned and flexed meshes are hit where they're drawn,
+    // and writes the selection id instead of shading. Nothing drawn outside of a selection name can be hit.
+    bool bPick = g_pShaderAPI->IsPicking();
+    if (bPick)
+    {
+        m.ubo.selectionId = g_pShaderAPI->GetSelectionId();
+        if (m.ubo.selectionId == 0)
+            return;
+
+        m.pixelShader = {};
+    }
+
+    // The fallback shader reads the instance stream, see CreateGraphicsPipeline
+    bool bFallback = m.vertexShader.m_Module == VK_NULL_HANDLE || (!bPick && m.pixelShader.m_Module == VK_NULL_HANDLE);
+    m.instanced = bFallback || m.vertexShader.m_bInstanced;
+    m.dynamic = bDynamic;
+    if (m.instanced && bDynamic)
+    {
+        m.instanced = GetDynamicData(m, m_DynamicData);
+    }
+
+    // Another viewport consumed the changes our constant blocks and bone palette are missing
+    if (s_pConstantViewport != this)
+    {
+        for (int i = 0; i < SHADER_CONSTANTS_STAGE_COUNT; i++)
+        {
+            m_nConstantBlock[i] = -1;
+        }
+        m_nBonePalette = -1;
+        s_pConstantViewport = this;
+    }
+    CommitShaderConstants(m);
+    CommitBonePalette(m);
+
+    if (AddInstance(m, pPrims, nPrims))
+        return;
+
+    // Every stream is copied in its own format to its own region, the draw binds each region as its stream.
+    // Arena blocks are bound in place, compaction and rewrites leave the bytes this frame reads alone.
+    for (int i = VERTEX_STREAM_BASE; i < VERTEX_STREAM_DEFAULTS; i++)
+    {
+        CVertexBufferVk *pStreamBuffer = m.sources[i];
+        if (!pStreamBuffer)
+            continue;
+
+        if (pStreamBuffer->IsInArena())
+        {
+            m.streamBuffers[i] = *pStreamBuffer->GetVkBuffer();
+            m.streamOffsets[i] = pStreamBuffer->GetBufferOffset() + m.sourceFirstVertex[i] * pStreamBuffer->VertexSize();
+            continue;
+        }
+
+        VkDeviceSize regionSize = vertexCount * pStreamBuffer->VertexSize();
+        VkDeviceSize regionOffset = AlignValue(m_VertexBufferOffset, VERTEX_STREAM_ALIGNMENT);
+        Assert(m_pVertexBuffer->GetBufferSize() >= regionOffset + regionSize);
+        CopyBuffer(*pStreamBuffer->GetVkBuffer(), *m_pVertexBuffer->GetVkBuffer(),
+                   pStreamBuffer->GetBufferOffset() + m.sourceFirstVertex[i] * pStreamBuffer->VertexSize(), regionOffset, regionSize);
+
+        m.streamBuffers[i] = *m_pVertexBuffer->GetVkBuffer();
+        m.streamOffsets[i] = regionOffset;
+        m_VertexBufferOffset = regionOffset + regionSize;
+    }
+
+    // Indices keep their source format, the region is aligned so firstIndex can count in that format.
+    // Arena ranges are aligned the same way.
+    if (indexBuffer->IsInArena())
+    {
+        m.indexBuffer = *indexBuffer->GetVkBuffer();
+        m.firstIndex = (int)(indexBuffer->GetBufferOffset() / indexBuffer->IndexSize()) + spanFirst;
+    }
+    else
+    {
+        VkDeviceSize indexRegionOffset = AlignValue(m_IndexBufferOffset, indexBuffer->IndexSize());
+        Assert(m_pIndexBuffer->GetBufferSize() >= indexRegionOffset + indexRegionSize);
+        CopyBuffer(*indexBuffer->GetVkBuffer(), *m_pIndexBuffer->GetVkBuffer(),
+                   indexBuffer->GetBufferOffset() + spanFirst * indexBuffer->IndexSize(), indexRegionOffset, indexRegionSize);
+
+        // Store current byte offset for copying into the index buffer
+        m_IndexBufferOffset = indexRegionOffset + indexRegionSize;
+
+        m.indexBuffer = *m_pIndexBuffer->GetVkBuffer();
+        m.firstIndex = (int)(indexRegionOffset / indexBuffer->IndexSize());
+    }
+    m.indexType = indexBuffer->IndexSize() == sizeof(uint32_t) ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+    m.firstRange = (int)m_DrawRanges.size();
+    m.rangeCount = 0;
+    for (int i = 0; i < nPrims; i++)
+    {
+        if (pPrims[i].m_NumIndices == 0)
+            continue;
+
+        DrawRange range;
+        range.firstIndex = pPrims[i].m_FirstIndex - spanFirst;
+        range.indexCount = pPrims[i].m_NumIndices;
+        m_DrawRanges.push_back(range);
+        m.rangeCount++;
+    }
+
+    // The image's instance buffer follows at present if this grows the data
+    m.firstInstance = (int)m_InstanceData.size();
+    m.instanceCount = 1;
+    InstanceDataVk_t instance;
+    GetInstanceData(m.ubo, instance);
+    m_InstanceData.push_back(instance);
+
+    // Later draws compare their dynamic contents with ours
+    if (m.instanced && m.dynamic)
+    {
+        m_LastDynamicData.swap(m_DynamicData);
+        m_nLastDynamicMesh = (int)m_DrawMeshes.size();
+    }
+
+    if (m_RenderPasses.empty() || !IsCurrentPass(m_RenderPasses.back()))
+    {
+        RenderPassInfo pass = {};
+        pass.colorTarget = m_ColorTarget;
+        pass.depthTarget = m_DepthTarget;
+        pass.clearColorValue = m_ClearColor;
+        pass.firstMesh = (int)m_DrawMeshes.size();
+        if (bPick)
+        {
+            // Cleared to no id and the far plane
+            pass.colorTarget = SHADER_RENDERTARGET_NONE;
+            pass.depthTarget = SHADER_RENDERTARGET_NONE;
+            pass.clearColor = true;
+            pass.clearDepth = true;
+            pass.clearColorValue = {};
+            pass.pick = true;
+        }
+        m_RenderPasses.push_back(pass);
+    }
+    m_RenderPasses.back().meshCount++;
 
     m_DrawMeshes.push_back(m);
 }
 
+void CViewportVk::SetRenderTarget(ShaderAPITextureHandle_t colorTarget, ShaderAPITextureHandle_t depthTarget)
+{
+    m_ColorTarget = colorTarget;
+    m_DepthTarget = depthTarget;
+}
+
+void CViewportVk::ClearBuffers(bool bClearColor, bool bClearDepth)
+{
+    // The pick pass clears itself, clearing in between would drop hits
+    if (g_pShaderAPI->IsPicking())
+        return;
+
+    // Clears become load ops, so clearing after drawing starts a new pass on the same target
+    // VK_TODO: use vkCmdClearAttachments for partial clears instead of splitting the pass
+    if (m_RenderPasses.empty() || !IsCurrentPass(m_RenderPasses.back()) || m_RenderPasses.back().meshCount > 0)
+    {
+        RenderPassInfo pass = {};
+        pass.colorTarget = m_ColorTarget;
+        pass.depthTarget = m_DepthTarget;
+        pass.firstMesh = (int)m_DrawMeshes.size();
+        m_RenderPasses.push_back(pass);
+    }
+
+    RenderPassInfo &pass = m_RenderPasses.back();
+    pass.clearColor |= bClearColor;
+    pass.clearDepth |= bClearDepth;
+    pass.clearColorValue = m_ClearColor;
+}
+
+bool CViewportVk::IsCurrentPass(const RenderPassInfo &pass) const
+{
+    if (g_pShaderAPI->IsPicking())
+        return pass.pick;
+
+    return !pass.pick && pass.colorTarget == m_ColorTarget && pass.depthTarget == m_DepthTarget;
+}
+
+//-----------------------------------------------------------------------------
+// Picking only starts a pass once and nothing but picking is drawn until it's resolved,
+// so the pick pass is always the last one. It's submitted on its own with the readback
+// using the pick buffer set, which only the previous pick used and that was waited on,
+// so frames in flight keep going and only the pick itself is waited for.
+//-----------------------------------------------------------------------------
+void CViewportVk::ResolvePick(CUtlVector<PickHitVk_t> &hits)
+{
+    if (m_RenderPasses.empty() || !m_RenderPasses.back().pick)
+        return;
+
+    size_t iPass = m_RenderPasses.size() - 1;
+    const RenderPassInfo &pass = m_RenderPasses[iPass];
+    CPickBufferVk &pickBuffer = g_pShaderDevice->GetPickBuffer();
+    uint32_t pickSet = GetPickBufferSet();
+
+    // Present uploads everything again for the frame
+    UpdateUniformBuffer(pickSet);
+    UpdateShaderConstantBuffer(pickSet);
+    UpdateBonePaletteBuffer(pickSet);
+    UpdateInstanceBuffer(pickSet);
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = m_CommandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    vkCheck(vkAllocateCommandBuffers(g_pShaderDevice->GetVkDevice(), &allocInfo, &commandBuffer), "failed to allocate command buffer");
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkCheck(vkBeginCommandBuffer(commandBuffer, &beginInfo), "failed to begin command buffer");
+
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(commandBuffer, VERTEX_STREAM_DEFAULTS, 1, m_pDefaultVertexBuffer->GetVkBuffer(), &offset);
+    vkCmdBindVertexBuffers(commandBuffer, VERTEX_STREAM_INSTANCE, 1, &m_InstanceBuffers[pickSet], &offset);
+    RecordRenderPass(commandBuffer, pickSet, iPass);
+    pickBuffer.RecordReadback(commandBuffer);
+
+    vkCheck(vkEndCommandBuffer(commandBuffer), "failed to end command buffer");
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    vkCheck(vkQueueSubmit(g_pShaderDevice->GetGraphicsQueue(), 1, &submitInfo, pickBuffer.GetFence()), "failed to submit queue");
+
+    // Nothing of the pick pass ends up in the frame
+    const MeshOffset &first = m_DrawMeshes[pass.firstMesh];
+    m_DrawRanges.resize(first.firstRange);
+    m_InstanceData.resize(MIN(m_InstanceData.size(), (size_t)first.firstInstance));
+    m_DrawMeshes.resize(pass.firstMesh);
+    m_nLastDynamicMesh = -1;
+    m_RenderPasses.pop_back();
+
+    // Waits on the pick fence, the selection API hands back this pass's hits
+    pickBuffer.Resolve(hits);
+    vkFreeCommandBuffers(g_pShaderDevice->GetVkDevice(), m_CommandPool, 1, &commandBuffer);
+}
+
 void CViewportVk::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize srcOffset, VkDeviceSize dstOffset, VkDeviceSize size)
 {
     VkCommandBufferAllocateInfo allocInfo{};
@@ -1014,4 +2111,6 @@ void CViewportVk::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSiz
     vkQueueSubmit(g_pShaderDevice->GetGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
     vkQueueWaitIdle(g_pShaderDevice->GetGraphicsQueue());
     vkFreeCommandBuffers(g_pShaderDevice->GetVkDevice(), m_CommandPool, 1, &commandBuffer);
+
+    g_pShaderDevice->GetDeletionQueue().OnIdle();
 }
@@ -7,8 +7,13 @@
 #pragma once
 #endif
 
+#include <unordered_map>
+#include "bindlessvk.h"
 #include "indexbuffervk.h"
 #include "meshvk.h"
+#include "pickbuffervk.h"
+#include "texturevk.h"
+#include "tier1/checksum_crc.h"
 #include "vertexbuffervk.h"
 
 struct SwapchainSupportDetails
@@ -23,14 +28,94 @@ class CViewportVk
     ImageFormat _backBufferFormat;
     int _backBufferSize[2];
 
+    // A prim list of a mesh, firstIndex is relative to the mesh's first index
+    struct DrawRange
+    {
+        int firstIndex;
+        int indexCount;
+    };
+
     struct MeshOffset
     {
         int vertexCount;
         int indexCount;
-        int firstVertex;
-        int firstIndex;
+        int firstIndex; // In units of indexType, the index buffer is bound at offset 0 with either type
+        VkIndexType indexType;
+        VkBuffer indexBuffer; // m_pIndexBuffer, or the arena block of a static index buffer
+        int vertexOffset; // Added to the indices, minus the first index value used
+        int firstInstance; // In m_InstanceData, every draw has at least its own
+        int instanceCount;
+        VertexDeclKeyVk_t vertexDecl;
+        VkBuffer streamBuffers[VERTEX_STREAM_DEFAULTS]; // m_pVertexBuffer, or the arena block of a static vertex buffer
+        VkDeviceSize streamOffsets[VERTEX_STREAM_DEFAULTS]; // Where each stream's vertices start in its buffer
+        int firstRange;
+        int rangeCount;
         VkPrimitiveTopology topology;
         UniformBufferObject ubo;
+        BindlessPushConstants_t textures;
+        ShaderStageState_t vertexShader;
+        ShaderStageState_t pixelShader;
+        VkShaderModule geometryShader; // VK_NULL_HANDLE when no geometry shader is bound
+        uint32_t constantOffsets[SHADER_CONSTANTS_STAGE_COUNT];
+        ShaderConstantPush_t constants;
+        uint32_t bonePaletteOffset;
+
+        // What was copied, repeats of the same static data become instances instead
+        CVertexBufferVk *sources[VERTEX_STREAM_DEFAULTS];
+        int sourceFirstVertex[VERTEX_STREAM_DEFAULTS];
+        CIndexBufferVk *indexSource;
+        int sourceFirstIndex;
+        bool instanced;
+        bool dynamic; // Repeats only if the contents read from the dynamic buffers repeat too
+    };
+
+    // A bone palette already written this frame
+    struct BonePalette
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    // A run of meshes drawn into the same render target
+    struct RenderPassInfo
+    {
+        ShaderAPITextureHandle_t colorTarget;
+        ShaderAPITextureHandle_t depthTarget;
+        bool clearColor;
+        bool clearDepth;
+        VkClearValue clearColorValue;
+        int firstMesh;
+        int meshCount;
+        bool pick; // Into the pick buffer instead of the targets, see CPickBufferVk
+    };
+
+    // Pipelines only need a compatible render pass, which comes down to the attachment formats,
+    // and one pipeline per set of shaders and specialization.
+    // Pipelines are dropped along with any of their modules, see ReleasePipelines.
+    struct PipelineKey
+    {
+        VkFormat colorFormat;
+        VkFormat depthFormat;
+        ShaderStageState_t vertexShader;
+        ShaderStageState_t pixelShader;
+        VkShaderModule geometryShader;
+        VertexDeclKeyVk_t vertexDecl;
+
+        bool operator==(const PipelineKey &other) const
+        {
+            return colorFormat == other.colorFormat && depthFormat == other.depthFormat && vertexShader == other.vertexShader &&
+                   pixelShader == other.pixelShader && geometryShader == other.geometryShader && vertexDecl == other.vertexDecl;
+        }
+        bool UsesModule(VkShaderModule shaderModule) const
+        {
+            return vertexShader.m_Module == shaderModule || pixelShader.m_Module == shaderModule || geometryShader == shaderModule;
+        }
+    };
+
+    // Hashes what operator== compares, padding left out
+    struct PipelineKeyHash
+    {
+        size_t operator()(const PipelineKey &key) const;
     };
 
   public:
@@ -47,14 +132,20 @@ class CViewportVk
     void RecreateSwapchain();
     void CreateSwapchain();
     void CreateImageViews();
-    void CreateRenderPass();
+    void CreateDepthBuffer();
     void CreateDescriptorSetlayout();
     void CreateDescriptorSets();
+    void WriteDescriptorSet(size_t image);
     void CreateDescriptorPool();
-    void CreateGraphicsPipeline();
-    void CreateFramebuffers();
+    void CreatePipelineLayout();
+    VkPipeline CreateGraphicsPipeline(VkRenderPass renderPass, bool bColor, bool bDepth, bool bPick, const ShaderStageState_t &vertexShader,
+                                      const ShaderStageState_t &pixelShader, VkShaderModule geometryShader,
+                                      const VertexDeclKeyVk_t &vertexDecl);
+    VkPipeline GetGraphicsPipeline(VkRenderPass renderPass, VkFormat colorFormat, VkFormat depthFormat, const MeshOffset &mesh);
     void CreateCommandPool();
+    void CreateDefaultVertexBuffer();
     void CreateUniformBuffers();
+    void ReplaceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer &buffer, VkDeviceMemory &memory);
     void CreateCommandBuffers();
     void Present();
     void CreateSyncObjects();
@@ -70,11 +161,36 @@ class CViewportVk
     void GetMatrices(VMatrix *view, VMatrix *proj, VMatrix *model);
     UniformBufferObject GetUniformBufferObject();
     void UpdateUniformBuffer(uint32_t currentImage);
+    void UpdateShaderConstantBuffer(uint32_t currentImage);
+
+    // Snapshots the shader constants for a draw, small changes are pushed instead of written as a new block
+    void CommitShaderConstants(MeshOffset &mesh);
+
+    // Skinned draws point at their bone palette, identical palettes are shared within the frame
+    void CommitBonePalette(MeshOffset &mesh);
+    void UpdateBonePaletteBuffer(uint32_t currentImage);
+    void UpdateInstanceBuffer(uint32_t currentImage);
+    bool AddInstance(const MeshOffset &mesh, const CPrimList *pPrims, int nPrims);
+    bool GetDynamicData(const MeshOffset &mesh, std::vector<uint8_t> &data) const;
 
     // Update command buffer with all meshes that want to be drawn
     void UpdateCommandBuffer(uint32_t currentImage);
+    void RecordRenderPass(VkCommandBuffer commandBuffer, uint32_t currentImage, size_t iPass);
+
+    // Copies the vertices [nBaseVertex + nFirstVertex, +nVertexCount) and the indices of the prim lists once,
+    // then draws each non-empty prim list from the copy. Index values are relative to nBaseVertex.
+    void DrawMesh(CBaseMeshVk *pMesh, int nBaseVertex, int nFirstVertex, int nVertexCount, const CPrimList *pPrims, int nPrims);
+
+    // SHADER_RENDERTARGET_BACKBUFFER and SHADER_RENDERTARGET_DEPTHBUFFER select the swapchain image and our own depth buffer
+    void SetRenderTarget(ShaderAPITextureHandle_t colorTarget, ShaderAPITextureHandle_t depthTarget);
+    void ClearBuffers(bool bClearColor, bool bClearDepth);
+
+    // Renders and reads back the draws made while picking, they are dropped from the frame.
+    // Adds the depth range of every selection id found in the pick buffer to hits.
+    void ResolvePick(CUtlVector<PickHitVk_t> &hits);
 
-    void DrawMesh(CBaseMeshVk *pMesh);
+    // The module is about to be destroyed, its handle may come back for a different module
+    void ReleasePipelines(VkShaderModule shaderModule);
 
     void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize srcOffset, VkDeviceSize dstOffset, VkDeviceSize size);
 
@@ -85,6 +201,13 @@ class CViewportVk
     bool IsResizing() { return m_bIsResizing; }
 
   private:
+    // Draws go to the pick buffer while picking, to the bound render targets otherwise
+    bool IsCurrentPass(const RenderPassInfo &pass) const;
+
+    // Every swapchain image has its own set of buffers and descriptor set, the last set belongs to the pick submit
+    size_t GetBufferSetCount() const { return m_SwapchainImages.size() + 1; }
+    uint32_t GetPickBufferSet() const { return (uint32_t)m_SwapchainImages.size(); }
+
     VkSurfaceKHR m_hSurface;
 
     VkSwapchainKHR m_Swapchain;
@@ -93,36 +216,77 @@ class CViewportVk
     std::vector<VkImageView> m_SwapchainImageViews;
     VkExtent2D m_SwapchainExtent;
 
+    // Fallback for draws without a vertex and pixel shader bound through the shader manager
     VkShaderModule m_VertShaderModule;
     VkShaderModule m_FragShaderModule;
 
-    VkRenderPass m_RenderPass;
+    // Only ever needed inside the frame, never stored
+    CTextureVk m_DepthBuffer;
+
     VkDescriptorSetLayout m_DescriptorSetLayout;
     VkDescriptorPool m_DescriptorPool;
     std::vector<VkDescriptorSet> m_DescriptorSets;
     VkPipelineLayout m_PipelineLayout;
-    VkPipeline m_GraphicsPipeline;
+    std::unordered_map<PipelineKey, VkPipeline, PipelineKeyHash> m_GraphicsPipelines;
 
-    std::vector<VkFramebuffer> m_SwapchainFramebuffers;
     std::vector<VkBuffer> m_UniformBuffers;
     std::vector<VkDeviceMemory> m_UniformBuffersMemory;
 
+    // Shader constant blocks are linearly allocated for the frame and copied to the image's buffer at present
+    std::vector<VkBuffer> m_ConstantBuffers;
+    std::vector<VkDeviceMemory> m_ConstantBuffersMemory;
+    std::vector<VkDeviceSize> m_ConstantBufferSizes; // Images catch up with the data when it grows
+    std::vector<uint8_t> m_ShaderConstantData;
+    VkDeviceSize m_nShaderConstantSize;
+    int m_nConstantBlock[SHADER_CONSTANTS_STAGE_COUNT];      // Offset of each stage's last block this frame, -1 if none
+    int m_nConstantDeltaFirst[SHADER_CONSTANTS_STAGE_COUNT]; // Registers changed since that block was written
+    int m_nConstantDeltaLast[SHADER_CONSTANTS_STAGE_COUNT];
+
+    // Bone palettes of skinned draws, set 0 binding 3 as a dynamic storage buffer
+    std::vector<VkBuffer> m_BoneBuffers;
+    std::vector<VkDeviceMemory> m_BoneBuffersMemory;
+    std::vector<VkDeviceSize> m_BoneBufferSizes;
+    std::vector<uint8_t> m_BonePaletteData;
+    VkDeviceSize m_nBonePaletteSize;
+    int m_nBonePalette; // Offset of the palette last loaded, -1 if none this frame
+    std::unordered_map<CRC32_t, BonePalette> m_BonePalettes;
+
+    // The model matrix of every draw as the instance stream, copied to the image's buffer at present
+    std::vector<VkBuffer> m_InstanceBuffers;
+    std::vector<VkDeviceMemory> m_InstanceBuffersMemory;
+    std::vector<VkDeviceSize> m_InstanceBufferSizes;
+    std::vector<InstanceDataVk_t> m_InstanceData;
+
+    // What the last draw read from dynamic buffers, a draw reading the same can be its instance
+    std::vector<uint8_t> m_LastDynamicData;
+    std::vector<uint8_t> m_DynamicData;
+    int m_nLastDynamicMesh; // Index of that draw in m_DrawMeshes, -1 if none
+
     VkCommandPool m_CommandPool;
     std::vector<VkCommandBuffer> m_CommandBuffers;
 
     std::vector<VkSemaphore> m_ImageAvailableSemaphores;
     std::vector<VkSemaphore> m_RenderFinishedSemaphores;
     std::vector<VkFence> m_InFlightFences;
+    std::vector<uint64_t> m_InFlightSerials; // Deletion queue serial completed by each fence
     size_t m_iCurrentFrame;
 
+    // Vertices of every stream in their own formats, each draw binds its streams at their offsets
     CVertexBufferVk *m_pVertexBuffer;
     CIndexBufferVk *m_pIndexBuffer;
+
+    // One VertexDefaultsVk_t for the inputs a draw's streams don't provide
+    CVertexBufferVk *m_pDefaultVertexBuffer;
     VkDeviceSize m_VertexBufferOffset;
     VkDeviceSize m_IndexBufferOffset;
 
     VkClearValue m_ClearColor = {0.0f, 0.0f, 0.0f, 1.0f};
 
     std::vector<MeshOffset> m_DrawMeshes;
+    std::vector<DrawRange> m_DrawRanges;
+    std::vector<RenderPassInfo> m_RenderPasses;
+    ShaderAPITextureHandle_t m_ColorTarget;
+    ShaderAPITextureHandle_t m_DepthTarget;
 
     // VK_TODO: detect window resize and modify this
     bool m_bFrameBufferResized = false;
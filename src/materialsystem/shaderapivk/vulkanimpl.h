@@ -53,28 +53,29 @@ inline ImageFormat vkfmt2imgfmt(VkFormat format)
 
 inline VkFormat imgfmt2vkfmt(ImageFormat format)
 {
+    // Indexed by ImageFormat, IMAGE_FORMAT_UNKNOWN is handled below
     static VkFormat conversions[] = {
-        VK_FORMAT_UNDEFINED,
-        VK_FORMAT_R8G8B8A8_UNORM,
-        VK_FORMAT_UNDEFINED, // non existent
-        VK_FORMAT_R8G8B8_UNORM,
-        VK_FORMAT_B8G8R8_UNORM,
-        VK_FORMAT_R5G6B5_UNORM_PACK16,
-        VK_FORMAT_R8_UNORM,
-        VK_FORMAT_R8G8_UNORM,
-        VK_FORMAT_R8_UNORM,
-        VK_FORMAT_R8_UNORM,
-        VK_FORMAT_R8G8B8A8_UNORM,
-        VK_FORMAT_B8G8R8_UNORM,
-        VK_FORMAT_R8G8B8A8_UNORM,
-        VK_FORMAT_UNDEFINED,
-        VK_FORMAT_UNDEFINED,
-        VK_FORMAT_UNDEFINED,
+        VK_FORMAT_R8G8B8A8_UNORM,      // RGBA8888
+        VK_FORMAT_UNDEFINED,           // ABGR8888, non existent
+        VK_FORMAT_R8G8B8_UNORM,        // RGB888
+        VK_FORMAT_B8G8R8_UNORM,        // BGR888
+        VK_FORMAT_R5G6B5_UNORM_PACK16, // RGB565
+        VK_FORMAT_R8_UNORM,            // I8
+        VK_FORMAT_R8G8_UNORM,          // IA88
+        VK_FORMAT_R8_UNORM,            // P8
+        VK_FORMAT_R8_UNORM,            // A8
+        VK_FORMAT_R8G8B8_UNORM,        // RGB888_BLUESCREEN
+        VK_FORMAT_B8G8R8_UNORM,        // BGR888_BLUESCREEN
+        VK_FORMAT_UNDEFINED,           // ARGB8888, non existent
+        VK_FORMAT_B8G8R8A8_UNORM,      // BGRA8888
+        VK_FORMAT_BC1_RGB_UNORM_BLOCK, // DXT1
+        VK_FORMAT_BC2_UNORM_BLOCK,     // DXT3
+        VK_FORMAT_BC3_UNORM_BLOCK,     // DXT5
         VK_FORMAT_B8G8R8A8_UNORM,
         VK_FORMAT_B5G6R5_UNORM_PACK16,
         VK_FORMAT_B5G5R5A1_UNORM_PACK16,
         VK_FORMAT_B4G4R4A4_UNORM_PACK16,
-        VK_FORMAT_UNDEFINED,
+        VK_FORMAT_BC1_RGBA_UNORM_BLOCK, // DXT1_ONEBITALPHA
         VK_FORMAT_B5G5R5A1_UNORM_PACK16,
         VK_FORMAT_UNDEFINED,
         VK_FORMAT_UNDEFINED,
@@ -87,10 +88,16 @@ inline VkFormat imgfmt2vkfmt(ImageFormat format)
 
         // todo: depth formats
     };
+    COMPILE_TIME_ASSERT(ARRAYSIZE(conversions) == IMAGE_FORMAT_RGBA32323232F + 1);
+
+    if (format < 0 || format >= ARRAYSIZE(conversions))
+        return VK_FORMAT_UNDEFINED;
 
     return conversions[(size_t)format];
 }
 
+inline bool IsBlockCompressed(VkFormat format) { return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK; }
+
 inline VkPrimitiveTopology ComputeMode(MaterialPrimitiveType_t type)
 {
     switch (type)